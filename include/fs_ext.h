@@ -0,0 +1,1122 @@
+#ifndef FS_EXT_H
+#define FS_EXT_H
+
+/**
+ * the features added on top of the file system of filesys.h: shared dblocks and snapshots,
+ * compression, deduplication, checksums, tail packing, the log-structured mode, lookup
+ * caches, directory indexes, links, and vectored and parallel I/O. their state is kept in
+ * the `fs_ext_t` of the file system, see `fs_ext`, where it is null or zero while a feature
+ * is off.
+ */
+
+#include "filesys.h"
+
+/**
+ * returned by a read that finds a data block that does not match its checksum. the codes of
+ * filesys.h are fixed, so this one comes after them and has no entry in
+ * `fs_retcode_string_table`: report codes that can be it with REPORT_RETCODE_EXT.
+ */
+#define CHECKSUM_MISMATCH ((fs_retcode_t) FS_RETCODE_TOTAL)
+
+#define REPORT_RETCODE_EXT(retcode) \
+do { \
+    fprintf(stdout, "Error: %s\n", fs_retcode_message(retcode)); \
+} while (0)
+
+// no dblock has this index. dblock 0 starts out as the root directory's but can be released
+// and claimed again like any other, so it cannot stand for "none"
+#define DBLOCK_NONE ((dblock_index_t) UINT32_MAX)
+
+/**
+ * set in `file_perms` of a data file whose data is stored in compressed clusters of
+ * COMPRESSED_CLUSTER_SIZE bytes. it is kept in the inode so it travels with clones and
+ * snapshots of the file.
+ */
+#define INODE_COMPRESSED 0x100u
+
+/**
+ * set in `file_perms` of a data file whose last, partial block is packed into a tail dblock
+ * shared with the tails of other files. the map entry of that block is the tail dblock and
+ * the tail starts INODE_TAIL_OFFSET(file_perms) bytes into it. only files whose map fits in
+ * the direct entries are packed, and a tail is never shared between inodes.
+ */
+#define INODE_TAIL_PACKED 0x200u
+#define INODE_TAIL_SHIFT 16
+#define INODE_TAIL_OFFSET_MASK (0xFFu << INODE_TAIL_SHIFT)
+#define INODE_TAIL_OFFSET(perms) (((perms) & INODE_TAIL_OFFSET_MASK) >> INODE_TAIL_SHIFT)
+#define INODE_LAYOUT_MASK (INODE_COMPRESSED | INODE_TAIL_PACKED | INODE_TAIL_OFFSET_MASK)
+
+/**
+ * the number of directory entries referring to a data file besides its first, kept in
+ * `file_perms` so it is saved with the image. a file that was never linked has none, so
+ * images from before links load as they are. the data is released with the last name.
+ */
+#define INODE_LINKS_SHIFT 24
+#define INODE_LINKS_MASK (0x7Fu << INODE_LINKS_SHIFT)
+#define INODE_EXTRA_LINKS(perms) (((perms) & INODE_LINKS_MASK) >> INODE_LINKS_SHIFT)
+#define INODE_MAX_LINKS (INODE_EXTRA_LINKS(INODE_LINKS_MASK) + 1)
+#define INODE_PERMISSION_MASK (FS_READ | FS_WRITE | FS_EXECUTE)
+#define INODE_PERMISSIONS(perms) ((permission_t) ((perms) & INODE_PERMISSION_MASK))
+#define COMPRESSED_CLUSTER_SIZE (DATA_BLOCK_SIZE * (DATA_BLOCK_SIZE / sizeof(dblock_index_t) - 1))
+
+/**
+ * returns `file_perms` of an inode with the flags above. the flags are kept in the
+ * permission_t field of the base inode, which C++ may not load as the enum, so C++ code
+ * reads them through this.
+ */
+uint32_t inode_file_perms(const inode_t *inode);
+
+/**
+ * a named, frozen copy of the inode table. the dblocks it points to are shared with the
+ * live file system through the dblock reference counts and copied when either side writes.
+ */
+typedef struct fs_snapshot
+{
+    char name[MAX_FILE_NAME_LEN + 1];
+    inode_index_t available_inode;
+    inode_t *inodes;
+} fs_snapshot_t;
+
+/**
+ * in-memory index from the content of full data blocks to the dblocks holding it, used to
+ * share identical blocks between data files. each dblock is in at most one hash chain,
+ * so the per-dblock arrays double as the chain links.
+ */
+typedef struct dedup_index
+{
+    size_t bucket_count;        // a power of two
+    dblock_index_t *buckets;    // first dblock of each chain, DBLOCK_NONE if empty
+    dblock_index_t *next;       // next dblock in the same chain, DBLOCK_NONE at the end, per dblock
+    uint32_t *hashes;           // CRC32C of the content, per dblock
+    byte *indexed;              // bitmask of the dblocks in the index
+    size_t saved;               // dblocks shared instead of claimed
+} dedup_index_t;
+
+#define TAIL_POOL_HINTS 16
+
+/**
+ * in-memory allocator for the tails packed into tail dblocks. which bytes of a tail dblock
+ * are taken is kept in a bitmask; it is rebuilt from the inodes when an image is loaded.
+ * every tail holds one reference on its tail dblock.
+ */
+typedef struct tail_pool
+{
+    byte *used;                             // DATA_BLOCK_SIZE bits per dblock, set for bytes holding a tail
+    dblock_index_t hints[TAIL_POOL_HINTS];  // tail dblocks that had room recently, DBLOCK_NONE if unused
+    size_t next_hint;                       // hint replaced next
+    size_t tails;                           // tails in the pool
+    size_t dblocks;                         // tail dblocks in use
+    int packing;                            // pack the tails of files as they are written
+} tail_pool_t;
+
+#define LOG_SEGMENT_DBLOCKS 64
+#define LOG_CLEAN_RESERVE 4
+
+/**
+ * state of the log-structured write mode. the dblocks are split into segments of
+ * LOG_SEGMENT_DBLOCKS dblocks and new dblocks are claimed in order from the segment at the
+ * head of the log. data blocks are copied to the head instead of being written in place,
+ * and the cleaner empties segments that are at most half live by moving what is left of them.
+ */
+typedef struct fs_log
+{
+    uint16_t *live;         // claimed dblocks per segment
+    size_t segment_count;
+    size_t free_segments;   // segments without a claimed dblock
+    size_t head;            // next dblock to try at the head of the log
+    size_t head_end;        // end of the segment at the head
+    byte *cleaning;         // segments being emptied, skipped by the head. null unless the cleaner runs
+    size_t cleaned;         // segments emptied by the cleaner
+    size_t moved;           // dblocks moved by the cleaner
+} fs_log_t;
+
+#define DENTRY_CACHE_CAPACITY 4096
+#define DENTRY_NONE UINT32_MAX
+
+/**
+ * a cached directory lookup: `name` in the directory `parent` refers to `child`
+ */
+typedef struct dentry
+{
+    char name[MAX_FILE_NAME_LEN];
+    inode_index_t parent;
+    inode_index_t child;
+    uint32_t hash_next;     // next entry in the same chain or on the free list, DENTRY_NONE at the end
+    uint32_t lru_prev;      // more recently used entry, DENTRY_NONE for the first
+    uint32_t lru_next;      // less recently used entry, DENTRY_NONE for the last
+} dentry_t;
+
+/**
+ * in-memory cache of the names path resolution found, so walking the same path again does
+ * not scan the directories on the way. only names that exist are cached. when the cache is
+ * full the least recently used entry is evicted.
+ */
+typedef struct dentry_cache
+{
+    dentry_t entries[DENTRY_CACHE_CAPACITY];
+    uint32_t buckets[DENTRY_CACHE_CAPACITY];   // first entry of each chain, DENTRY_NONE if empty
+    uint32_t free_first;                       // first unused entry, DENTRY_NONE if the cache is full
+    uint32_t lru_first;                        // most recently used entry
+    uint32_t lru_last;                         // least recently used entry, evicted next
+    size_t count;                              // entries in use
+    size_t hits;
+    size_t misses;
+} dentry_cache_t;
+
+#define DIR_FREE_SLOTS 6
+
+/**
+ * in-memory record of where a directory has room, so adding an entry does not scan for a
+ * tombstone. every entry below `scanned` is live or listed in `free`. the record is only a
+ * hint: a listed slot is checked before it is reused.
+ */
+typedef struct dir_slots
+{
+    uint32_t scanned;
+    uint32_t free[DIR_FREE_SLOTS];  // tombstones below `scanned`
+    uint8_t free_count;
+    uint8_t known;                  // zero until the directory is first added to
+} dir_slots_t;
+
+/**
+ * the path of the last working directory asked for, kept so the terminal prompt is not
+ * rebuilt from the tree each time. change_directory follows it along, and it is dropped
+ * whenever a directory leaves the tree
+ */
+typedef struct path_cache
+{
+    inode_t *dir;           // the directory the path is for, null if none
+    char *path;
+    size_t len;
+    size_t capacity;
+} path_cache_t;
+
+#define DIR_TOTAL_NONE UINT32_MAX
+
+/**
+ * in-memory totals of a subtree, one per inode, kept up to date as data files are written
+ * and entries are added and removed so `du` does not walk the tree. every change is added
+ * to the totals of the directories on the way up to the root through `parent`. a data file
+ * with several names is counted, entry and bytes, under each of them as `du` does when it
+ * walks the tree; `parent` holds the directory of one of them and `links` the others.
+ */
+typedef struct dir_total
+{
+    size_t bytes;           // the size of a data file, or of every data file under a directory
+    size_t descendants;     // entries under a directory, "." and ".." aside
+    uint32_t parent;        // the directory holding the entry of the inode, DIR_TOTAL_NONE if none does
+    uint32_t link_count;    // the directories in `links`
+    uint32_t *links;        // the directories of the other names of a data file, room for
+                            // INODE_MAX_LINKS - 1 of them, NULL until it is first linked
+} dir_total_t;
+
+#define FREE_DBLOCK_COUNT_UNKNOWN ((size_t) -1)
+
+/**
+ * the state of the added features of one file system. the layout of `filesystem_t` is fixed
+ * by filesys.h, so the state is kept beside it and found from its dblocks with `fs_ext`,
+ * which lets copies of a `filesystem_t` share it. every feature starts out off.
+ */
+typedef struct fs_ext
+{
+    size_t free_dblock_count;   // cached number of available dblocks, FREE_DBLOCK_COUNT_UNKNOWN until counted
+    uint32_t *dblock_refs;      // extra references per dblock shared by cloned files, null until first shared
+    fs_snapshot_t *snapshots;   // in the order they were taken
+    size_t snapshot_count;
+    dedup_index_t *dedup;       // content index for deduplication, null unless enabled
+    uint32_t *dblock_crcs;      // CRC32C per dblock, null unless checksums are on
+    int verify_reads;           // check the checksum of every dblock a read returns data from
+    tail_pool_t *tails;         // allocator for packed tails, null until tail packing is first on
+    fs_log_t *log;              // log-structured write mode, null unless on
+    dentry_cache_t *dentries;   // cache of directory lookups, null until the first lookup
+    dir_slots_t *dir_slots;     // free entry hints per inode, null until a directory is first added to
+    path_cache_t *path_cache;   // path of the working directory, null until one is asked for
+    dir_total_t *dir_totals;    // subtree totals per inode, null unless directory totals are on
+} fs_ext_t;
+
+/*----------------------------------------------*
+ |  PART 0 ADDITIONS: DBLOCK SHARING & CACHES   |
+ *----------------------------------------------*/
+
+/**
+ * releases many claimed data blocks at once
+ * 
+ * `indices` is sorted in place so that the bits of neighbouring dblocks are cleared
+ * with one update per bitmask byte, and the available dblock count is updated once.
+ * indices of dblocks that are already available are ignored.
+ * 
+ * @param fs the file system to release the data blocks in
+ * @param indices the indices of the data blocks to release
+ * @param count the number of indices
+ * @return SUCCESS if the data blocks are successfully released.
+ *         INVALID_INPUT if `fs` is null, or `indices` is null and `count` is not 0.
+ *         INVALID_INPUT if an index is out of range. nothing is released in that case.
+ */
+fs_retcode_t release_dblocks(filesystem_t *fs, dblock_index_t *indices, size_t count);
+
+/**
+ * takes another reference on a claimed data block so it can be shared by several inodes.
+ * 
+ * a dblock starts out with one reference when it is claimed. the reference table is
+ * allocated the first time a dblock is shared.
+ * 
+ * @param fs the file system the data block is in
+ * @param index the index of the data block
+ * @return SUCCESS if the reference is taken.
+ *         INVALID_INPUT if `fs` is null or `index` is out of range.
+ *         SYSTEM_ERROR if the reference table cannot be allocated.
+ */
+fs_retcode_t ref_dblock(filesystem_t *fs, dblock_index_t index);
+
+/**
+ * drops one reference on a data block. the data block itself is not released.
+ * 
+ * @param fs the file system the data block is in
+ * @param index the index of the data block
+ * @return 1 if that was the last reference and the caller should release the dblock, 0 otherwise
+ */
+int unref_dblock(filesystem_t *fs, dblock_index_t index);
+
+/**
+ * @param fs the file system the data block is in
+ * @param index the index of the data block
+ * @return the number of references on a claimed data block
+ */
+size_t dblock_ref_count(filesystem_t *fs, dblock_index_t index);
+
+/**
+ * @param fs the file system to count in
+ * @return the number of data blocks referenced more than once
+ */
+size_t shared_dblocks(filesystem_t *fs);
+
+/**
+ * turns on deduplication: from now on, a full data block written to a data file that has
+ * the same content as a block already in the index is shared instead of claimed.
+ * the index starts empty, see `fs_dedup` to fill it from the blocks already written.
+ * 
+ * @param fs the file system to deduplicate
+ * @return SUCCESS if deduplication is on
+ *         INVALID_INPUT if `fs` is null
+ *         SYSTEM_ERROR if the index cannot be allocated
+ */
+fs_retcode_t dedup_enable(filesystem_t *fs);
+
+/**
+ * turns off deduplication and frees the index. blocks already shared stay shared.
+ */
+void dedup_disable(filesystem_t *fs);
+
+/**
+ * @param fs the file system to search in
+ * @param data the DATA_BLOCK_SIZE bytes to look for
+ * @param hash the CRC32C of `data`
+ * @return a dblock in the index holding exactly `data`, or DBLOCK_NONE if there is none
+ */
+dblock_index_t dedup_find(filesystem_t *fs, const byte *data, uint32_t hash);
+
+/**
+ * adds a full data block of a data file to the index. a dblock already in the index is
+ * left as it is.
+ */
+void dedup_insert(filesystem_t *fs, dblock_index_t index, uint32_t hash);
+
+/**
+ * removes a dblock from the index. called whenever a dblock is released or written in place.
+ */
+void dedup_forget(filesystem_t *fs, dblock_index_t index);
+
+/**
+ * turns on per-dblock checksums: a CRC32C of every dblock, kept up to date as dblocks are
+ * claimed and written and stored with the image by `save_filesystem_ext`.
+ * 
+ * @param fs the file system to checksum
+ * @param verify_reads nonzero to also check every data block an inode read returns data from
+ * @return SUCCESS if checksums are on
+ *         INVALID_INPUT if `fs` is null
+ *         SYSTEM_ERROR if the checksum table cannot be allocated
+ */
+fs_retcode_t checksum_enable(filesystem_t *fs, int verify_reads);
+
+/**
+ * turns off checksums and frees the checksum table
+ */
+void checksum_disable(filesystem_t *fs);
+
+/**
+ * recomputes the checksum of a dblock after it was written. does nothing if checksums are off.
+ */
+void checksum_update(filesystem_t *fs, dblock_index_t index);
+
+/**
+ * @return 1 if a dblock matches its checksum or checksums are off, 0 otherwise
+ */
+int checksum_verify(filesystem_t *fs, dblock_index_t index);
+
+/**
+ * checks every claimed dblock against its checksum, splitting the dblocks between
+ * `threads` threads.
+ * 
+ * @param fs the file system to scrub
+ * @param threads the number of threads to use, at least 1
+ * @param bad set to a malloc'd array of the dblocks that do not match, in increasing order,
+ * or null if there are none. the caller frees it.
+ * @param bad_count set to the number of dblocks that do not match
+ * @return SUCCESS if every claimed dblock was checked
+ *         INVALID_INPUT if fs, bad or bad_count is null, or checksums are off
+ *         SYSTEM_ERROR if a thread or memory cannot be allocated
+ */
+fs_retcode_t fs_scrub(filesystem_t *fs, size_t threads, dblock_index_t **bad, size_t *bad_count);
+
+/**
+ * turns on tail packing: from now on, the last partial block of a small data file is moved
+ * into a tail dblock shared with the tails of other files whenever the file is written.
+ * 
+ * @param fs the file system to pack
+ * @return SUCCESS if tail packing is on
+ *         INVALID_INPUT if `fs` is null
+ *         SYSTEM_ERROR if the tail pool cannot be allocated
+ */
+fs_retcode_t tail_packing_enable(filesystem_t *fs);
+
+/**
+ * stops packing new tails. tails already packed stay where they are.
+ */
+void tail_packing_disable(filesystem_t *fs);
+
+/**
+ * claims `len` bytes for a tail, in a tail dblock with room or in a newly claimed one.
+ * 
+ * @param fs the file system to claim in, with a tail pool
+ * @param len the length of the tail, 1 to DATA_BLOCK_SIZE - 1
+ * @param dblock set to the tail dblock
+ * @param offset set to where the tail starts in it
+ * @return SUCCESS if the bytes are claimed
+ *         INVALID_INPUT if `fs` has no tail pool or `len` is out of range
+ *         DBLOCK_UNAVAILABLE if no tail dblock has room and no dblock is available
+ */
+fs_retcode_t tail_claim(filesystem_t *fs, size_t len, dblock_index_t *dblock, size_t *offset);
+
+/**
+ * gives back the bytes of a tail past its first `new_len`. once `new_len` is 0 the tail
+ * drops its reference on the tail dblock, which is released with the last tail in it.
+ */
+void tail_shrink(filesystem_t *fs, dblock_index_t dblock, size_t offset, size_t old_len, size_t new_len);
+
+/**
+ * turns on the log-structured write mode: from now on `claim_available_dblock` hands out
+ * dblocks in order from the segment at the head of the log, and writes to a data block
+ * copy it to the head instead of updating it in place. the dblocks claimed so far stay
+ * where they are.
+ * 
+ * @param fs the file system to switch
+ * @return SUCCESS if the mode is on
+ *         INVALID_INPUT if `fs` is null
+ *         SYSTEM_ERROR if the segment table cannot be allocated
+ */
+fs_retcode_t log_enable(filesystem_t *fs);
+
+/**
+ * goes back to claiming the first available dblock and writing data blocks in place
+ */
+void log_disable(filesystem_t *fs);
+
+/**
+ * empties the segments that are at most half live, fewest live dblocks first, by moving
+ * their dblocks to the head of the log and pointing every block map of the live file
+ * system and of the snapshots at the new copies. a segment is only taken if the dblocks
+ * outside the chosen segments can hold everything moved. dblocks that no block map
+ * refers to are left where they are.
+ * 
+ * @param fs the file system to clean
+ * @param cleaned set to the number of segments emptied
+ * @return SUCCESS if the pass completed
+ *         INVALID_INPUT if fs or cleaned is null, or the log-structured mode is off
+ *         SYSTEM_ERROR if memory cannot be allocated
+ */
+fs_retcode_t fs_log_clean(filesystem_t *fs, size_t *cleaned);
+
+/**
+ * runs `fs_log_clean` if fewer than LOG_CLEAN_RESERVE segments are free. the inode write
+ * functions call it once they are done, so a dblock is never moved in the middle of a write.
+ */
+void log_clean_if_low(filesystem_t *fs);
+
+/**
+ * looks up `name` in the directory with inode index `parent` in the dentry cache
+ * 
+ * @return 1 and sets `child` if the name is cached, 0 otherwise
+ */
+int dentry_lookup(filesystem_t *fs, inode_index_t parent, const char *name, inode_index_t *child);
+
+/**
+ * caches that `name` in the directory `parent` refers to `child`, evicting the least
+ * recently used entry if the cache is full
+ */
+void dentry_insert(filesystem_t *fs, inode_index_t parent, const char *name, inode_index_t child);
+
+/**
+ * drops the cached lookup of `name` in the directory `parent`. called whenever a directory
+ * entry is added or removed.
+ */
+void dentry_invalidate(filesystem_t *fs, inode_index_t parent, const char *name);
+
+/**
+ * drops every cached lookup in or of the directory `dir`, before its inode is released
+ */
+void dentry_invalidate_dir(filesystem_t *fs, inode_index_t dir);
+
+/**
+ * drops every cached lookup, keeping the hit and miss counts. called when the whole
+ * inode table changes, such as on a snapshot rollback.
+ */
+void dentry_invalidate_all(filesystem_t *fs);
+
+/**
+ * turns on directory totals: the size of the data files and the number of entries under
+ * every directory are counted once from the tree and from then on kept up to date as it
+ * changes. turning them on again counts them afresh.
+ * 
+ * @param fs the file system to count
+ * @return SUCCESS if directory totals are on
+ *         INVALID_INPUT if `fs` is null
+ *         SYSTEM_ERROR if the totals cannot be allocated
+ */
+fs_retcode_t dir_totals_enable(filesystem_t *fs);
+
+/**
+ * turns off directory totals and frees them
+ */
+void dir_totals_disable(filesystem_t *fs);
+
+/**
+ * adds the change in size of a data file since it was last counted to the directories
+ * above each of its names. the inode write functions call it once they are done. does
+ * nothing if directory totals are off or `inode` is not a data file of the inode table.
+ */
+void dir_totals_update(filesystem_t *fs, inode_t *inode);
+
+/**
+ * makes room to note another name of the data file `child`, so that the dir_totals_link
+ * giving it one cannot fail. the room is kept until the totals are freed.
+ *
+ * @return SUCCESS if there is room or directory totals are off
+ *         SYSTEM_ERROR if it cannot be allocated
+ */
+fs_retcode_t dir_totals_reserve(filesystem_t *fs, inode_index_t child);
+
+/**
+ * notes that the directory `parent` gained an entry for `child`, adding the totals of
+ * `child` to it and the directories above it. a data file already counted elsewhere adds
+ * its size and the entry again, once per name, and needs a dir_totals_reserve first.
+ */
+void dir_totals_link(filesystem_t *fs, inode_index_t parent, inode_index_t child);
+
+/**
+ * notes that the entry for `child` was removed from the directory `parent`, taking the
+ * totals of `child` off it and the directories above it. removing the name whose directory
+ * a linked file keeps in `parent` moves one of its `links` there.
+ */
+void dir_totals_unlink(filesystem_t *fs, inode_index_t parent, inode_index_t child);
+
+/*----------------------------------------------*
+ |  PART 1 ADDITIONS: INODE DATA LAYOUT & I/O   |
+ *----------------------------------------------*/
+
+/**
+ * one buffer of a scatter/gather request
+ */
+typedef struct fs_iovec
+{
+    void *base;
+    size_t len;
+} fs_iovec_t;
+
+/**
+ * vectored version of `inode_write_data`. the iovecs are appended to the inode in order
+ * as if they were one contiguous buffer.
+ * 
+ * the dblocks needed for the whole vector are checked once up front and the block map
+ * is walked once, so either every iovec is written or the file system is not modified.
+ * 
+ * @param fs the file system the inode is in
+ * @param inode the inode to write data in
+ * @param iov the buffers to write to the inode
+ * @param iovcnt the number of buffers in `iov`
+ * @return SUCCESS if the data is successfully written
+ *         INVALID_INPUT if fs or inode is null, or an iovec has a null base and nonzero length
+ *         INSUFFICIENT_DBLOCKS if there is not enough available data blocks
+ */
+fs_retcode_t inode_write_datav(filesystem_t *fs, inode_t *inode, const fs_iovec_t *iov, size_t iovcnt);
+
+/**
+ * vectored version of `inode_read_data`. the data starting at `offset` is scattered into
+ * the iovecs in order. `bytes_read` holds the total number of bytes read.
+ * 
+ * @param fs the file system the inode is in
+ * @param inode the inode to read data from
+ * @param offset the offset into the data to read from
+ * @param iov the buffers to store the data into
+ * @param iovcnt the number of buffers in `iov`
+ * @param bytes_read the address to store the number of bytes actually read
+ * @return SUCCESS if the data is successfully read 
+ *         INVALID_INPUT if fs or inode or bytes_read is null, or an iovec is invalid
+ */
+fs_retcode_t inode_read_datav(filesystem_t *fs, inode_t *inode, size_t offset, const fs_iovec_t *iov, size_t iovcnt, size_t *bytes_read);
+
+/**
+ * walks the data of an inode one data block at a time. a pass over the file follows the
+ * index chain once, and the blocks of a plain inode are handed out in place instead of
+ * being copied. the inode must not be written while it is walked.
+ */
+typedef struct inode_block_iter
+{
+    filesystem_t *fs;
+    inode_t *inode;
+    size_t offset;                  // file offset of the next block
+    int chained;                    // whether index_dblock is set
+    dblock_index_t index_dblock;    // index dblock holding the map entry of the last block handed out
+    byte buffer[DATA_BLOCK_SIZE];   // the current block of a compressed inode, decompressed
+} inode_block_iter_t;
+
+/**
+ * starts walking the data of an inode from the data block holding `offset`
+ */
+void inode_block_iter_init(inode_block_iter_t *iter, filesystem_t *fs, inode_t *inode, size_t offset);
+
+/**
+ * steps to the next data block of the inode being walked
+ * 
+ * @param iter the walk started with `inode_block_iter_init`
+ * @param data set to the bytes of the block, valid until the next call or a write
+ * @param len set to the number of bytes of the block, DATA_BLOCK_SIZE except for the last
+ * block, and 0 once the end of the data is reached
+ * @return SUCCESS if the block is read or the end is reached
+ *         INVALID_INPUT if iter, data or len is null
+ *         CHECKSUM_MISMATCH if reads are verified and the block does not match its checksum
+ */
+fs_retcode_t inode_block_iter_next(inode_block_iter_t *iter, const byte **data, size_t *len);
+
+/**
+ * vectored version of `inode_modify_data`. the iovecs overwrite the data starting at
+ * `offset` and anything past the end of the file is appended.
+ * 
+ * if there is not enough data blocks for the appended part, then the file system
+ * is NOT modified.
+ * 
+ * @param fs the file system the inode is in
+ * @param inode the inode to modify the data
+ * @param offset the offset into the data to modify the data
+ * @param iov the new data to be stored in the inode
+ * @param iovcnt the number of buffers in `iov`
+ * @return SUCCESS if the data is successfully modified
+ *         INVALID_INPUT if the fs or inode is null, or an iovec is invalid
+ *         INVALID_INPUT if the offset exceeds the size of the file
+ *         INSUFFICIENT_DBLOCKS if there is not enough available data blocks
+ */
+fs_retcode_t inode_modify_datav(filesystem_t *fs, inode_t *inode, size_t offset, const fs_iovec_t *iov, size_t iovcnt);
+
+/**
+ * makes an empty inode share the data of another inode without copying it.
+ * 
+ * the dblocks are reference counted and copied lazily: a write to either inode copies
+ * only the dblocks it touches, so the other inode keeps seeing the old data. sharing
+ * takes a reference on at most five dblocks (the direct blocks and the first index dblock)
+ * regardless of the file size.
+ * 
+ * @param fs the file system the inodes are in
+ * @param dst the empty inode to share the data with
+ * @param src the inode whose data is shared
+ * @return SUCCESS if the data is shared
+ *         INVALID_INPUT if fs, dst or src is null, dst is src, or dst is not empty
+ *         SYSTEM_ERROR if the reference table cannot be allocated
+ */
+fs_retcode_t inode_share_data(filesystem_t *fs, inode_t *dst, inode_t *src);
+
+/**
+ * switches a data file between plain dblocks and compressed clusters (INODE_COMPRESSED).
+ * 
+ * a compressed file stores its data in clusters of COMPRESSED_CLUSTER_SIZE bytes. each
+ * entry of the block map is the header dblock of a cluster, listing the dblocks that
+ * hold the cluster compressed (or raw, when compressing saves nothing). reads decompress
+ * the clusters they touch and writes compress them again into new dblocks.
+ * 
+ * the data is rewritten in the new layout before the old dblocks are released, so the
+ * file is unchanged if there are not enough dblocks for both at once.
+ * 
+ * @param fs the file system the inode is in
+ * @param inode the inode to convert
+ * @param compressed nonzero to compress the file, zero to store it plainly
+ * @return SUCCESS if the file is in the requested layout
+ *         INVALID_INPUT if fs or inode is null
+ *         INVALID_FILE_TYPE if the inode is not a data file
+ *         INSUFFICIENT_DBLOCKS if there is not enough available data blocks
+ *         SYSTEM_ERROR if the data cannot be buffered
+ */
+fs_retcode_t inode_set_compressed(filesystem_t *fs, inode_t *inode, int compressed);
+
+/**
+ * deduplicates every plain data file: each full data block that has the same content as
+ * another dblock is replaced by a reference to it, and dblocks nobody refers to anymore
+ * are released. deduplication is turned on if it was off, and stays on.
+ * 
+ * compressed files are left as they are, and so are the blocks behind index dblocks that
+ * are already shared with a clone or a snapshot.
+ * 
+ * @param fs the file system to deduplicate
+ * @param saved set to the number of dblocks released
+ * @return SUCCESS if the pass completed
+ *         INVALID_INPUT if fs or saved is null
+ *         SYSTEM_ERROR if the index cannot be allocated
+ */
+fs_retcode_t fs_dedup(filesystem_t *fs, size_t *saved);
+
+/*----------------------------------------------*
+ |  PART 2 ADDITIONS: VECTORED & POSITIONED IO  |
+ *----------------------------------------------*/
+
+/**
+ * reads the content of a file into several buffers, filling each in order
+ * 
+ * @param file the file handler returned by `fs_open`
+ * @param iov the buffers to store the data in
+ * @param iovcnt the number of buffers in `iov`
+ * @return the total number of bytes read. if `file` is null, return 0.
+ */
+size_t fs_readv(fs_file_t file, const fs_iovec_t *iov, size_t iovcnt);
+
+/**
+ * writes the content of several buffers to a file as one write
+ * 
+ * either all of the buffers are written or none of them are.
+ * 
+ * @param file the file handler returned by `fs_open`
+ * @param iov the buffers to write the data from
+ * @param iovcnt the number of buffers in `iov`
+ * @return the total number of bytes written. if `file` is null or any error, return 0.
+ */
+size_t fs_writev(fs_file_t file, const fs_iovec_t *iov, size_t iovcnt);
+
+/**
+ * reads the content of a file starting at `offset` without using or updating the
+ * offset stored in the file handler, so several readers can share one handler.
+ * 
+ * @param file the file handler returned by `fs_open`
+ * @param buffer the buffer to store the data in
+ * @param n the number of bytes to read from the file
+ * @param offset the offset into the file to read from
+ * @return the number of bytes read. if `file` is null or any error, return 0.
+ */
+size_t fs_pread(fs_file_t file, void *buffer, size_t n, size_t offset);
+
+/**
+ * writes the content of a buffer to a file starting at `offset` without using or
+ * updating the offset stored in the file handler. bytes past the end of the file
+ * are appended. `offset` may not be past the end of the file.
+ * 
+ * @param file the file handler returned by `fs_open`
+ * @param buffer the buffer to write the data from
+ * @param n the number of bytes to write to the file
+ * @param offset the offset into the file to write at
+ * @return the number of bytes written. if `file` is null or any error, return 0.
+ */
+size_t fs_pwrite(fs_file_t file, void *buffer, size_t n, size_t offset);
+
+/*----------------------------------------------*
+ |  PART 3 ADDITIONS: DIRECTORIES & FILES       |
+ *----------------------------------------------*/
+
+/**
+ * returns the path of the working directory without copying it. the path is cached by the
+ * file system, so asking again for the same directory takes constant time
+ * 
+ * @param context the context contianing information about the file system and the current
+ * working directory
+ * @return the path, valid until the file system is changed or freed
+ */
+const char *working_directory_path(terminal_context_t *context);
+
+/**
+ * creates a new file that shares the data of an existing file (a reflink). the data
+ * blocks are copied lazily when either file is written, so the clone is cheap
+ * regardless of the file size.
+ * 
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param src_path the path to the file to clone
+ * @param dst_path the path to the new file
+ * @return 0 if successful, -1 on any failure.
+ */
+int fs_clone_file(terminal_context_t *context, char *src_path, char *dst_path);
+
+/**
+ * gives an existing data file another name (a hard link). both names refer to the same
+ * inode, so a write through either is seen through the other, and `remove_file` only
+ * releases the data once the last name is removed. the inode keeps the name it was
+ * created or last renamed with. a file has at most INODE_MAX_LINKS names.
+ * 
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param existing_path the path to the data file to link
+ * @param new_path the path of the new name
+ * @return 0 if successful, -1 on any failure.
+ */
+int fs_link(terminal_context_t *context, char *existing_path, char *new_path);
+
+/**
+ * moves a file or directory to a new path, which can be in another directory. only the
+ * directory entries change, so the cost does not depend on the size of the file. a moved
+ * directory has its ".." entry pointed at its new parent, and the inode takes the new name.
+ * an existing file at `new_path` is replaced, as is an empty directory if a directory is
+ * moved, in one step: the new name never goes missing. nothing changes on failure.
+ * 
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param old_path the path to the file or directory to move
+ * @param new_path the path it moves to
+ * @return 0 if successful, -1 on any failure.
+ */
+int fs_rename(terminal_context_t *context, char *old_path, char *new_path);
+
+/**
+ * turns compression of a file on or off, see `inode_set_compressed`.
+ * 
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param path the path to the file
+ * @param compressed nonzero to compress the file, zero to store it plainly
+ * @return 0 if successful, -1 on any failure.
+ */
+int fs_compress_file(terminal_context_t *context, char *path, int compressed);
+
+#define FS_INDEX_NONE 0
+#define FS_INDEX_HASHED 1
+#define FS_INDEX_ORDERED 2
+
+/**
+ * adds, changes or removes the index of a directory. the index is stored in an inode of
+ * its own that is in no directory, so name lookups, inserts and removals read a few index
+ * slots or nodes instead of every entry. directories without an index are scanned linearly
+ * as before.
+ * 
+ * FS_INDEX_HASHED keeps an open addressing table from name hash to entry number.
+ * FS_INDEX_ORDERED keeps a B+ tree keyed by name, so lookups take O(log n) node reads and
+ * `list` and `fs_readdir_prefix` give the entries in name order.
+ *
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param path the path to the directory
+ * @param indexed the kind of index to keep, FS_INDEX_NONE to drop the index
+ * @return 0 if successful, -1 on any failure.
+ */
+int fs_index_directory(terminal_context_t *context, char *path, int indexed);
+
+/**
+ * an entry of a directory, see `fs_readdir` and `fs_readdir_prefix`
+ */
+typedef struct fs_dirent
+{
+    char name[MAX_FILE_NAME_LEN + 1];
+    inode_index_t inode;
+    file_type_t type;   // the type of the inode
+    size_t size;        // the file size of the inode
+} fs_dirent_t;
+
+/**
+ * finds the entries of a directory whose name starts with `prefix`, in name order. a
+ * directory with an ordered index reads only the range of its tree holding them, others
+ * are scanned whole.
+ * 
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param path the path to the directory
+ * @param prefix the start of the names to find, empty for every entry
+ * @param entries filled with the first `max_entries` matching entries
+ * @param max_entries the size of `entries`
+ * @return the number of matching entries, which can be more than `max_entries`,
+ * or -1 if the directory cannot be found or the matches of an unordered directory
+ * cannot be sorted.
+ */
+int fs_readdir_prefix(terminal_context_t *context, char *path, char *prefix, fs_dirent_t *entries, size_t max_entries);
+
+typedef struct fs_dir *fs_dir_t;
+
+/**
+ * opens a directory to read its entries with `fs_readdir`. the entries are given in name
+ * order if the directory has an ordered index, and in entry order otherwise, "." and ".."
+ * included. entries added or removed while it is open may or may not be given.
+ * 
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param path the path to the directory
+ * @return the open directory, or NULL if the directory cannot be found or opened
+ */
+fs_dir_t fs_opendir(terminal_context_t *context, char *path);
+
+/**
+ * reads the next entries of an open directory into a buffer of the caller, allocating
+ * nothing
+ * 
+ * @param dir the open directory
+ * @param entries filled with up to `max_entries` entries
+ * @param max_entries the size of `entries`
+ * @return the number of entries read, 0 once every entry has been read
+ */
+size_t fs_readdir(fs_dir_t dir, fs_dirent_t *entries, size_t max_entries);
+
+/**
+ * closes a directory opened with `fs_opendir`
+ * 
+ * @param dir the directory to close
+ */
+void fs_closedir(fs_dir_t dir);
+
+/**
+ * an entry visited by `fs_walk`
+ */
+typedef struct fs_walk_entry
+{
+    const fs_dirent_t *entry;   // the walked path itself is named after its inode
+    const char *path;           // the walked path, followed by the names down to the entry
+    size_t depth;               // 0 for the walked path itself
+} fs_walk_entry_t;
+
+typedef void (*fs_walk_visit_t)(const fs_walk_entry_t *entry, void *arg);
+
+/**
+ * visits a file or every entry of a directory tree but "." and "..", each directory
+ * before its entries and the entries in `fs_readdir` order. the directories are read by
+ * `threads` threads, each taking subdirectories from a queue of its own and from the
+ * others' once it runs out, then visited in order on the calling thread. the tree must not
+ * be changed during the walk.
+ * 
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param path the path to walk
+ * @param threads the number of threads to read directories with, at least 1
+ * @param visit called for every entry
+ * @param arg passed to `visit`
+ * @return 0 if successful, -1 if the path cannot be found or memory cannot be allocated,
+ * in which case the visits stop
+ */
+int fs_walk(terminal_context_t *context, char *path, size_t threads, fs_walk_visit_t visit, void *arg);
+
+/**
+ * `tree` read by `threads` threads, see `fs_walk`
+ */
+int fs_tree(terminal_context_t *context, char *path, size_t threads);
+
+/**
+ * adds up the sizes of the data files in a tree, read by `threads` threads, see `fs_walk`.
+ * a data file with several names in the tree is added once per name. with directory totals
+ * on, the total is looked up instead and nothing is read.
+ * 
+ * @param bytes set to the total size
+ * @return 0 if successful, -1 on any failure
+ */
+int fs_du(terminal_context_t *context, char *path, size_t threads, size_t *bytes);
+
+/**
+ * what `fs_find` looks for. an entry is found if it passes every predicate that is set
+ */
+typedef struct fs_find_query
+{
+    const char *name;   // a glob the name must match, see fnmatch(3), or null for any name
+    char type;          // 'f' for data files, 'd' for directories, or 0 for either
+    char size_op;       // '+' for a size above `size`, '-' below it, '=' equal to it, 0 for any
+    size_t size;
+    long max_depth;     // how many levels below the path to look in, negative for all
+} fs_find_query_t;
+
+/**
+ * prints the path of every entry of a tree that `query` finds, read by `threads` threads,
+ * see `fs_walk`. the predicates are tested against the type and size kept in the inode
+ * table, and directories below `max_depth` are never read
+ * 
+ * @param context the context containing information about the file system
+ * and the current working directory
+ * @param path the path to search under, which is printed in front of every entry found
+ * @param query the predicates
+ * @param threads the number of threads to read directories with
+ * @return 0 if successful, -1 on any failure
+ */
+int fs_find(terminal_context_t *context, char *path, const fs_find_query_t *query, size_t threads);
+
+/*----------------------------------------------*
+ |  SNAPSHOTS                                   |
+ |  implemented in src/snapshot.c               |
+ *----------------------------------------------*/
+
+/**
+ * freezes the current inode table under `name`. no data is copied: the snapshot takes a
+ * reference on the dblocks of every file, and later writes copy the dblocks they touch.
+ * the cost is one pass over the inode table regardless of how much data is stored.
+ * 
+ * @param fs the file system to snapshot
+ * @param name the name of the snapshot, at most MAX_FILE_NAME_LEN characters
+ * @return SUCCESS if the snapshot is created
+ *         INVALID_INPUT if fs or name is null, the name is empty, too long or already used
+ *         SYSTEM_ERROR if memory cannot be allocated
+ */
+fs_retcode_t fs_snapshot_create(filesystem_t *fs, const char *name);
+
+/**
+ * deletes a snapshot, releasing the dblocks only it still refers to
+ * 
+ * @param fs the file system the snapshot is in
+ * @param name the name of the snapshot
+ * @return SUCCESS if the snapshot is deleted
+ *         INVALID_INPUT if fs or name is null
+ *         NOT_FOUND if there is no snapshot with that name
+ */
+fs_retcode_t fs_snapshot_delete(filesystem_t *fs, const char *name);
+
+/**
+ * restores the file system to a snapshot. the data written since the snapshot is released
+ * and the snapshot is kept, so the file system can be rolled back to it again.
+ * 
+ * terminal contexts may refer to directories that no longer exist afterwards and should
+ * be reset with `new_terminal`.
+ * 
+ * @param fs the file system the snapshot is in
+ * @param name the name of the snapshot
+ * @return SUCCESS if the file system is rolled back
+ *         INVALID_INPUT if fs or name is null
+ *         NOT_FOUND if there is no snapshot with that name
+ */
+fs_retcode_t fs_snapshot_rollback(filesystem_t *fs, const char *name);
+
+/**
+ * prints the inodes that changed since a snapshot, one per line: `+` for an inode created
+ * since, `-` for one removed since and `M` for one whose attributes or data changed.
+ * 
+ * only the root dblock pointers of each inode are compared, since any write to data
+ * shared with the snapshot copies at least one of them.
+ * 
+ * @param fs the file system the snapshot is in
+ * @param name the name of the snapshot
+ * @return SUCCESS if the differences are printed
+ *         INVALID_INPUT if fs or name is null
+ *         NOT_FOUND if there is no snapshot with that name
+ */
+fs_retcode_t fs_snapshot_diff(filesystem_t *fs, const char *name);
+
+/**
+ * stores a snapshot to an output file as a standalone file system image, which can be
+ * loaded with `load_filesystem_ext`. the live file system can keep changing between saves
+ * without affecting what is written.
+ * 
+ * @param fs the file system the snapshot is in
+ * @param name the name of the snapshot
+ * @param file the output file to write the snapshot to
+ * @return SUCCESS if the snapshot is saved
+ *         INVALID_INPUT if fs, name or file is null
+ *         NOT_FOUND if there is no snapshot with that name
+ *         SYSTEM_ERROR if memory cannot be allocated
+ */
+fs_retcode_t fs_snapshot_save(filesystem_t *fs, const char *name, FILE *file);
+
+/*----------------------------------------------*
+ |  UTILITY ADDITIONS                           |
+ |  implemented in src/fs_ext.c, except         |
+ |  `restore_tail_pool` in src/filesys.c        |
+ *----------------------------------------------*/
+
+/**
+ * finds the state of the added features of a file system, creating it with every feature
+ * off the first time. lookups take no lock, so the threads of a parallel walk may call it
+ * at the same time, but `fs_ext_drop` must not run alongside any other call.
+ * 
+ * @return the state, or NULL if `fs` is null or has no dblocks, or the state cannot be
+ *         allocated. every feature is off for a file system without state.
+ */
+fs_ext_t *fs_ext(const filesystem_t *fs);
+
+/**
+ * forgets the state of the added features of a file system. what the state points to is
+ * not freed, see `free_filesystem`.
+ */
+void fs_ext_drop(const filesystem_t *fs);
+
+/**
+ * number of entries in the block map of an inode holding `file_size` bytes. an entry is a
+ * data dblock, or the header dblock of a cluster if the inode is compressed.
+ */
+size_t calculate_map_entries(inode_t *inode, size_t file_size);
+
+/**
+ * number of index dblocks needed for `map_entries` entries in a block map
+ */
+size_t calculate_map_index_dblock_amount(size_t map_entries);
+
+#define CLUSTER_STORED_RAW 0x1
+
+/**
+ * header dblock of a compressed cluster. the stored bytes, compressed unless
+ * CLUSTER_STORED_RAW is set, fill the payload dblocks in order.
+ */
+typedef struct cluster_header
+{
+    uint16_t stored_len;
+    uint8_t flags;
+    uint8_t reserved;
+    dblock_index_t payload[COMPRESSED_CLUSTER_SIZE / DATA_BLOCK_SIZE];
+} cluster_header_t;
+
+/**
+ * reads the header of a compressed cluster
+ * 
+ * @return the number of payload dblocks
+ */
+size_t read_cluster_header(filesystem_t *fs, dblock_index_t header_dblock, cluster_header_t *header);
+
+/**
+ * @return the message of a return code, including the codes added in this file
+ */
+const char *fs_retcode_message(fs_retcode_t retcode);
+
+/**
+ * CRC32C (Castagnoli) of `n` bytes, continuing from `crc` (0 to start)
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t n);
+
+/**
+ * rebuilds the tail pool of a loaded image from the packed inodes of the live inode table
+ * and every snapshot. does nothing if no inode has a packed tail.
+ */
+fs_retcode_t restore_tail_pool(filesystem_t *fs);
+
+/**
+ * writes the state in `ext` of the added features in use after the dblocks of the image of
+ * `fs` that `save_filesystem` just wrote. nothing is written for a feature that is off, so
+ * images of file systems that never used any stay byte for byte what `save_filesystem` writes.
+ */
+void save_optional_sections(FILE *file, filesystem_t *fs, const fs_ext_t *ext);
+
+/**
+ * saves a file system with `save_filesystem`, followed by the state of its added features
+ * 
+ * @return what `save_filesystem` returns
+ */
+fs_retcode_t save_filesystem_ext(FILE *file, filesystem_t *fs);
+
+/**
+ * loads a file system with `load_filesystem`, then reads the state of its added features
+ * written by `save_filesystem_ext` up to the end of the file and rebuilds the state that
+ * is not saved. unknown sections are skipped.
+ * 
+ * @return SUCCESS if the image and every section are read
+ *         what `load_filesystem` returns if the image cannot be read
+ *         INVALID_BINARY_FORMAT if a section is malformed or cut short
+ *         SYSTEM_ERROR if memory cannot be allocated
+ */
+fs_retcode_t load_filesystem_ext(FILE *file, filesystem_t *fs);
+
+/**
+ * displays the file system like `display_filesystem`, with a line for each added feature
+ * in use after the file system structure. the inode list follows the block maps of
+ * compressed files and shows packed tails and link counts.
+ */
+void display_filesystem_ext(filesystem_t *fs, fs_display_flag_t flag);
+
+#endif
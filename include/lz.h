@@ -0,0 +1,33 @@
+#ifndef LZ_H
+#define LZ_H
+
+/**
+ * a small LZ77 codec in the style of LZ4, used for compressed inodes.
+ * 
+ * the stream is a list of sequences. each sequence is a token byte whose high nibble is
+ * the literal length and low nibble the match length minus LZ_MIN_MATCH (15 in either
+ * nibble means more length bytes follow, each adding up to 255), the literals, and a
+ * two byte little endian match offset. the last sequence only has literals.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ_MIN_MATCH 4
+
+/**
+ * compresses `n` bytes from `src` into `dst`
+ * 
+ * @return the compressed length, or 0 if it does not fit in `capacity` bytes
+ */
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t capacity);
+
+/**
+ * decompresses `n` bytes from `src` into `dst`
+ * 
+ * @return the decompressed length, or 0 if the stream is malformed or does not fit
+ * in `capacity` bytes
+ */
+size_t lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t capacity);
+
+#endif
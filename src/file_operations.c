@@ -1,224 +1,1449 @@
 #include "filesys.h"
+#include "fs_ext.h"
 #include "debug.h"
 #include "utility.h"
 
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define DIRECTORY_ENTRY_SIZE (sizeof(inode_index_t) + MAX_FILE_NAME_LEN)
 #define DIRECTORY_ENTRIES_PER_DATABLOCK (DATA_BLOCK_SIZE / DIRECTORY_ENTRY_SIZE)
+
+// a directory may keep a hashed index of its entries in an inode of its own, which is in
+// no directory. the index inode is stored in the last bytes of the name of the "." entry,
+// past its terminator, so directories without an index are unchanged and scanned linearly.
+#define DIR_INDEX_LINK_OFFSET (DIRECTORY_ENTRY_SIZE - sizeof(inode_index_t))
+#define DIR_INDEX_MAGIC "DIDX"
+#define DIR_INDEX_MIN_CAPACITY 16
+#define DIR_INDEX_EMPTY 0
+#define DIR_INDEX_DELETED 0xFFFFFFFFu
+#define DIR_INDEX_ENTRY_MASK 0xFFFFFFu
+
+// the data of an index inode: this header followed by `capacity` slots, a power of two.
+// a used slot holds the top 8 bits of the name hash and the entry number + 1 in the low
+// 24 bits, so most mismatches are rejected without reading the directory entry.
+typedef struct dir_index_header {
+    char magic[4];
+    uint32_t capacity;
+    uint32_t used;
+    uint32_t deleted;
+} dir_index_header_t;
+
+// a directory can instead keep an ordered index, a B+ tree keyed by name in the same kind
+// of inode. the leaves hold the name, inode and entry number of every entry and are chained
+// in name order. an internal node holds its children, each with the smallest name under
+// it, and the first of those names is never compared. removals leave nodes underfull, and
+// the tree is rebuilt once its leaves are mostly empty.
+#define DIR_TREE_MAGIC "DBTR"
+#define DIR_TREE_FANOUT 25
+#define DIR_TREE_FILL 19        // records per node of a rebuilt tree, leaving room to insert
+#define DIR_TREE_MAX_DEPTH 16
+#define DIR_TREE_NONE 0xFFFFFFFFu
+
+// the data of an ordered index: this header followed by `nodes` nodes
+typedef struct dir_tree_header {
+    char magic[4];
+    uint32_t root;
+    uint32_t nodes;
+    uint32_t leaves;
+    uint32_t live;
+} dir_tree_header_t;
+
+typedef struct dir_tree_record {
+    char name[MAX_FILE_NAME_LEN];   // zero padded, so names compare with memcmp
+    inode_index_t inode;            // the inode of the entry, in leaves
+    uint32_t value;                 // the entry number in leaves, the child node otherwise
+} dir_tree_record_t;
+
+typedef struct dir_tree_node {
+    uint16_t leaf;
+    uint16_t count;
+    uint32_t next;                  // the next leaf in name order
+    dir_tree_record_t records[DIR_TREE_FANOUT];
+} dir_tree_node_t;
+
 //Helpers//
-static int resolve_parent(terminal_context_t *context, const char *path,
-                          inode_t **parent, char *base_name_out) {
-    char *dup = strdup(path);
-    if (!dup)
-        return -1;
-    char *last_slash = strrchr(dup, '/');
-    if (last_slash) {
-        *last_slash = '\0';
-        if (strlen(dup) == 0) {
-            *parent = context->working_directory;
-        } else {
-            inode_t *curr = context->working_directory;
-            char *token = strtok(dup, "/");
-            while (token) {
-                size_t entries = curr->internal.file_size / DIRECTORY_ENTRY_SIZE;
-                int found = 0;
-                for (size_t i = 0; i < entries; i++) {
-                    size_t offset = i * DIRECTORY_ENTRY_SIZE;
-                    byte buf[DIRECTORY_ENTRY_SIZE];
-                    size_t br;
-                    if (inode_read_data(context->fs, curr, offset, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
-                        continue;
-                    inode_index_t idx;
-                    memcpy(&idx, buf, sizeof(inode_index_t));
-                    if (idx == 0)
-                        continue;
-                    char entry_name[MAX_FILE_NAME_LEN + 1] = {0};
-                    memcpy(entry_name, buf + sizeof(inode_index_t), MAX_FILE_NAME_LEN);
-                    if (strcmp(token, entry_name) == 0) {
-                        inode_t *child = &context->fs->inodes[idx];
-                        if (child->internal.file_type != DIRECTORY) {
-                            free(dup);
-                            return -1;
-                        }
-                        curr = child;
-                        found = 1;
-                        break;
-                    }
-                }
-                if (!found) {
-                    free(dup);
-                    return -1;
-                }
-                token = strtok(NULL, "/");
-            }
-            *parent = curr;
+static uint32_t dir_name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < MAX_FILE_NAME_LEN && name[i]; i++) {
+        hash ^= (byte) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t dir_index_slot_offset(size_t slot) {
+    return sizeof(dir_index_header_t) + slot * sizeof(uint32_t);
+}
+
+static uint32_t dir_index_slot_value(uint32_t hash, size_t entry) {
+    return (hash & ~DIR_INDEX_ENTRY_MASK) | (uint32_t) (entry + 1);
+}
+
+// a removed entry is all zeros. entries can refer to the root inode, so only the name
+// tells a tombstone apart
+static int is_tombstone(const byte *entry) {
+    return entry[sizeof(inode_index_t)] == '\0';
+}
+
+// a name being looked up, laid out as the directory entry it would be stored in. only the
+// name and its terminator have to match: the bytes past it can hold the index link
+typedef struct dir_name_key {
+    byte entry[DIRECTORY_ENTRY_SIZE];
+    size_t checked;     // bytes of the name field compared
+    uint32_t mask;      // the compared bytes of the entry, one bit each
+} dir_name_key_t;
+
+// fails for names no entry can have: empty ones, which only tombstones match, and names
+// too long to be stored
+static int dir_name_key_init(dir_name_key_t *key, const char *name) {
+    size_t len = strnlen(name, MAX_FILE_NAME_LEN + 1);
+    if (len == 0 || len > MAX_FILE_NAME_LEN)
+        return -1;
+    memset(key->entry, 0, DIRECTORY_ENTRY_SIZE);
+    memcpy(key->entry + sizeof(inode_index_t), name, len);
+    key->checked = len < MAX_FILE_NAME_LEN ? len + 1 : len;
+    key->mask = ((1u << key->checked) - 1) << sizeof(inode_index_t);
+    return 0;
+}
+
+// the first of `count` consecutive entries with the name of `key`, or `count` if none has
+// it. tombstones never match since the first name byte of a key is not zero
+static size_t dir_name_match(const byte *entries, size_t count, const dir_name_key_t *key) {
+#if defined(__SSE2__)
+    // a compare of all 16 bytes of an entry and a mask of the bytes that count
+    __m128i target = _mm_loadu_si128((const __m128i*) key->entry);
+    for (size_t i = 0; i < count; i++) {
+        __m128i entry = _mm_loadu_si128((const __m128i*) (entries + i * DIRECTORY_ENTRY_SIZE));
+        uint32_t equal = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(entry, target));
+        if ((equal & key->mask) == key->mask)
+            return i;
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        if (memcmp(entries + i * DIRECTORY_ENTRY_SIZE + sizeof(inode_index_t),
+                   key->entry + sizeof(inode_index_t), key->checked) == 0)
+            return i;
+    }
+#endif
+    return count;
+}
+
+// walks the entries of a directory a data block at a time. entries never straddle data
+// blocks, so each one is handed out in place
+typedef struct dir_iter {
+    inode_block_iter_t blocks;
+    const byte *data;
+    size_t len;
+    size_t pos;
+    size_t entry;
+} dir_iter_t;
+
+static void dir_iter_init(dir_iter_t *it, filesystem_t *fs, inode_t *dir, size_t first_entry) {
+    inode_block_iter_init(&it->blocks, fs, dir, first_entry * DIRECTORY_ENTRY_SIZE);
+    it->data = NULL;
+    it->len = 0;
+    it->pos = first_entry * DIRECTORY_ENTRY_SIZE % DATA_BLOCK_SIZE;
+    it->entry = first_entry;
+}
+
+// the next entry, tombstones included, or NULL at the end of the directory or on a bad
+// read. `entry` is set to its entry number
+static const byte *dir_iter_next(dir_iter_t *it, size_t *entry) {
+    if (it->pos >= it->len) {
+        size_t skip = it->data ? 0 : it->pos;
+        if (inode_block_iter_next(&it->blocks, &it->data, &it->len) != SUCCESS || it->len <= skip)
+            return NULL;
+        it->pos = skip;
+    }
+    const byte *current = it->data + it->pos;
+    it->pos += DIRECTORY_ENTRY_SIZE;
+    *entry = it->entry++;
+    return current;
+}
+
+// the inode the index link of a directory refers to, of either kind
+static inode_t *dir_index_inode(filesystem_t *fs, inode_t *dir) {
+    if (dir->internal.file_type != DIRECTORY || dir->internal.file_size < DIRECTORY_ENTRY_SIZE)
+        return NULL;
+    byte buf[DIRECTORY_ENTRY_SIZE];
+    size_t br;
+    if (inode_read_data(fs, dir, 0, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
+        return NULL;
+    if (strcmp((char*)(buf + sizeof(inode_index_t)), ".") != 0)
+        return NULL;
+    inode_index_t index_idx;
+    memcpy(&index_idx, buf + DIR_INDEX_LINK_OFFSET, sizeof(inode_index_t));
+    if (index_idx == 0 || index_idx >= fs->inode_count)
+        return NULL;
+    inode_t *index = &fs->inodes[index_idx];
+    if (index->internal.file_type != DATA_FILE)
+        return NULL;
+    return index;
+}
+
+// the hashed index inode of a directory and its header, or NULL if the directory has none
+static inode_t *dir_index_open(filesystem_t *fs, inode_t *dir, dir_index_header_t *header) {
+    inode_t *index = dir_index_inode(fs, dir);
+    size_t br;
+    if (!index
+        || inode_read_data(fs, index, 0, header, sizeof(*header), &br) != SUCCESS || br != sizeof(*header)
+        || memcmp(header->magic, DIR_INDEX_MAGIC, sizeof(header->magic)) != 0
+        || header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0)
+        return NULL;
+    return index;
+}
+
+// looks the name of `key` up through the index of `dir`
+static int dir_index_find(filesystem_t *fs, inode_t *dir, inode_t *index, const dir_index_header_t *header,
+                          const dir_name_key_t *key, size_t *entry, inode_index_t *child_idx) {
+    uint32_t hash = dir_name_hash((const char*) key->entry + sizeof(inode_index_t));
+    size_t mask = header->capacity - 1;
+    size_t slot = hash & mask;
+    for (size_t i = 0; i < header->capacity; i++, slot = (slot + 1) & mask) {
+        uint32_t value;
+        size_t br;
+        if (inode_read_data(fs, index, dir_index_slot_offset(slot), &value, sizeof(value), &br) != SUCCESS)
+            return -1;
+        if (value == DIR_INDEX_EMPTY)
+            return -1;
+        if (value == DIR_INDEX_DELETED || (value & ~DIR_INDEX_ENTRY_MASK) != (hash & ~DIR_INDEX_ENTRY_MASK))
+            continue;
+        size_t candidate = (value & DIR_INDEX_ENTRY_MASK) - 1;
+        byte buf[DIRECTORY_ENTRY_SIZE];
+        if (inode_read_data(fs, dir, candidate * DIRECTORY_ENTRY_SIZE, buf, DIRECTORY_ENTRY_SIZE, &br) == SUCCESS
+            && br == DIRECTORY_ENTRY_SIZE && dir_name_match(buf, 1, key) == 0) {
+            *entry = candidate;
+            memcpy(child_idx, buf, sizeof(inode_index_t));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// rewrites the index of `dir` from its entries with room for as many again
+static int dir_index_build(filesystem_t *fs, inode_t *dir, inode_t *index) {
+    size_t entries = dir->internal.file_size / DIRECTORY_ENTRY_SIZE;
+    dir_iter_t it;
+    const byte *entry;
+    size_t i;
+    size_t live = 0;
+    dir_iter_init(&it, fs, dir, 0);
+    while ((entry = dir_iter_next(&it, &i))) {
+        if (!is_tombstone(entry))
+            live++;
+    }
+    if (it.entry != entries)
+        return -1;
+    size_t capacity = DIR_INDEX_MIN_CAPACITY;
+    while (capacity < 2 * (live + 1))
+        capacity *= 2;
+    byte *table = calloc(1, dir_index_slot_offset(capacity));
+    if (!table)
+        return -1;
+    dir_index_header_t header = { DIR_INDEX_MAGIC, (uint32_t) capacity, (uint32_t) live, 0 };
+    memcpy(table, &header, sizeof(header));
+    uint32_t *slots = (uint32_t*)(table + sizeof(header));
+    dir_iter_init(&it, fs, dir, 0);
+    while ((entry = dir_iter_next(&it, &i))) {
+        if (is_tombstone(entry))
+            continue;
+        char entry_name[MAX_FILE_NAME_LEN + 1];
+        memcpy(entry_name, entry + sizeof(inode_index_t), MAX_FILE_NAME_LEN);
+        entry_name[MAX_FILE_NAME_LEN] = '\0';
+        uint32_t hash = dir_name_hash(entry_name);
+        size_t slot = hash & (capacity - 1);
+        while (slots[slot] != DIR_INDEX_EMPTY)
+            slot = (slot + 1) & (capacity - 1);
+        slots[slot] = dir_index_slot_value(hash, i);
+    }
+    if (it.entry != entries) {
+        free(table);
+        return -1;
+    }
+    int ret = -1;
+    if (inode_shrink_data(fs, index, 0) == SUCCESS
+        && inode_write_data(fs, index, table, dir_index_slot_offset(capacity)) == SUCCESS)
+        ret = 0;
+    free(table);
+    return ret;
+}
+
+static size_t dir_tree_node_offset(uint32_t node) {
+    return sizeof(dir_tree_header_t) + (size_t) node * sizeof(dir_tree_node_t);
+}
+
+// the ordered index inode of a directory and its header, or NULL if the directory has none
+static inode_t *dir_tree_open(filesystem_t *fs, inode_t *dir, dir_tree_header_t *header) {
+    inode_t *index = dir_index_inode(fs, dir);
+    size_t br;
+    if (!index
+        || inode_read_data(fs, index, 0, header, sizeof(*header), &br) != SUCCESS || br != sizeof(*header)
+        || memcmp(header->magic, DIR_TREE_MAGIC, sizeof(header->magic)) != 0
+        || header->root >= header->nodes)
+        return NULL;
+    return index;
+}
+
+static int dir_tree_read(filesystem_t *fs, inode_t *index, const dir_tree_header_t *header, uint32_t node, dir_tree_node_t *out) {
+    size_t br;
+    if (node >= header->nodes
+        || inode_read_data(fs, index, dir_tree_node_offset(node), out, sizeof(*out), &br) != SUCCESS
+        || br != sizeof(*out) || out->count > DIR_TREE_FANOUT)
+        return -1;
+    return 0;
+}
+
+static int dir_tree_write(filesystem_t *fs, inode_t *index, uint32_t node, dir_tree_node_t *in) {
+    return inode_modify_data(fs, index, dir_tree_node_offset(node), in, sizeof(*in)) == SUCCESS ? 0 : -1;
+}
+
+// the child of an internal node whose names can include `name`
+static size_t dir_tree_child(const dir_tree_node_t *node, const char *name) {
+    size_t lo = 1, hi = node->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (memcmp(node->records[mid].name, name, MAX_FILE_NAME_LEN) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+// the first record of a leaf whose name is not below `name`
+static size_t dir_tree_lower_bound(const dir_tree_node_t *leaf, const char *name) {
+    size_t lo = 0, hi = leaf->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (memcmp(leaf->records[mid].name, name, MAX_FILE_NAME_LEN) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// reads the leaf `name` belongs in. `path` and `slots` are set to the nodes passed on the
+// way and the children taken from them, the leaf last; `depth` to the index of the leaf
+static int dir_tree_descend(filesystem_t *fs, inode_t *index, const dir_tree_header_t *header, const char *name,
+                            dir_tree_node_t *leaf, uint32_t *path, size_t *slots, size_t *depth) {
+    uint32_t node = header->root;
+    for (size_t d = 0; d < DIR_TREE_MAX_DEPTH; d++) {
+        if (dir_tree_read(fs, index, header, node, leaf) != 0)
+            return -1;
+        if (path)
+            path[d] = node;
+        if (leaf->leaf) {
+            if (depth)
+                *depth = d;
+            return 0;
+        }
+        if (leaf->count == 0)
+            return -1;
+        size_t child = dir_tree_child(leaf, name);
+        if (slots)
+            slots[d] = child;
+        node = leaf->records[child].value;
+    }
+    return -1;
+}
+
+// a name as it is kept in the tree
+static void dir_tree_name(char *out, const char *name) {
+    size_t len = strnlen(name, MAX_FILE_NAME_LEN);
+    memset(out, 0, MAX_FILE_NAME_LEN);
+    memcpy(out, name, len);
+}
+
+// looks the name of `key` up through the ordered index of `dir`
+static int dir_tree_find(filesystem_t *fs, inode_t *index, const dir_tree_header_t *header,
+                         const dir_name_key_t *key, size_t *entry, inode_index_t *child_idx) {
+    const char *name = (const char*) key->entry + sizeof(inode_index_t);
+    dir_tree_node_t leaf;
+    if (dir_tree_descend(fs, index, header, name, &leaf, NULL, NULL, NULL) != 0)
+        return -1;
+    size_t pos = dir_tree_lower_bound(&leaf, name);
+    if (pos >= leaf.count || memcmp(leaf.records[pos].name, name, MAX_FILE_NAME_LEN) != 0)
+        return -1;
+    *entry = leaf.records[pos].value;
+    *child_idx = leaf.records[pos].inode;
+    return 0;
+}
+
+// adds directory entry number `entry` to the ordered index, splitting the full nodes on
+// the way back up. a new node always goes at the end of the index inode
+static int dir_tree_insert(filesystem_t *fs, inode_t *index, dir_tree_header_t *header,
+                           const char *name, inode_index_t child_idx, size_t entry) {
+    dir_tree_record_t record = { { 0 }, child_idx, (uint32_t) entry };
+    dir_tree_name(record.name, name);
+    dir_tree_node_t node;
+    uint32_t path[DIR_TREE_MAX_DEPTH];
+    size_t slots[DIR_TREE_MAX_DEPTH];
+    size_t depth;
+    if (dir_tree_descend(fs, index, header, record.name, &node, path, slots, &depth) != 0)
+        return -1;
+    size_t pos = dir_tree_lower_bound(&node, record.name);
+    if (pos < node.count && memcmp(node.records[pos].name, record.name, MAX_FILE_NAME_LEN) == 0) {
+        node.records[pos] = record;
+        return dir_tree_write(fs, index, path[depth], &node);
+    }
+    header->live++;
+    while (node.count == DIR_TREE_FANOUT) {
+        dir_tree_record_t all[DIR_TREE_FANOUT + 1];
+        memcpy(all, node.records, pos * sizeof(dir_tree_record_t));
+        all[pos] = record;
+        memcpy(all + pos + 1, node.records + pos, (DIR_TREE_FANOUT - pos) * sizeof(dir_tree_record_t));
+        size_t left = (DIR_TREE_FANOUT + 1) / 2;
+        dir_tree_node_t right = { node.leaf, (uint16_t) (DIR_TREE_FANOUT + 1 - left), DIR_TREE_NONE, { { { 0 }, 0, 0 } } };
+        memcpy(right.records, all + left, right.count * sizeof(dir_tree_record_t));
+        uint32_t right_node = header->nodes++;
+        node.count = (uint16_t) left;
+        memcpy(node.records, all, left * sizeof(dir_tree_record_t));
+        if (node.leaf) {
+            right.next = node.next;
+            node.next = right_node;
+            header->leaves++;
+        }
+        if (dir_tree_write(fs, index, right_node, &right) != 0 || dir_tree_write(fs, index, path[depth], &node) != 0)
+            return -1;
+        record = (dir_tree_record_t) { { 0 }, 0, right_node };
+        memcpy(record.name, right.records[0].name, MAX_FILE_NAME_LEN);
+        if (depth == 0) {
+            // the root split, the tree grows a level
+            dir_tree_node_t root = { 0, 2, DIR_TREE_NONE, { { { 0 }, 0, path[0] }, record } };
+            memcpy(root.records[0].name, node.records[0].name, MAX_FILE_NAME_LEN);
+            header->root = header->nodes++;
+            if (dir_tree_write(fs, index, header->root, &root) != 0)
+                return -1;
+            return inode_modify_data(fs, index, 0, header, sizeof(*header)) == SUCCESS ? 0 : -1;
+        }
+        depth--;
+        if (dir_tree_read(fs, index, header, path[depth], &node) != 0)
+            return -1;
+        pos = slots[depth] + 1;
+    }
+    memmove(node.records + pos + 1, node.records + pos, (node.count - pos) * sizeof(dir_tree_record_t));
+    node.records[pos] = record;
+    node.count++;
+    if (dir_tree_write(fs, index, path[depth], &node) != 0)
+        return -1;
+    return inode_modify_data(fs, index, 0, header, sizeof(*header)) == SUCCESS ? 0 : -1;
+}
+
+// removes directory entry number `entry` from the ordered index. only the leaf changes
+static int dir_tree_remove(filesystem_t *fs, inode_t *index, dir_tree_header_t *header, const char *name, size_t entry) {
+    char tree_name[MAX_FILE_NAME_LEN];
+    dir_tree_name(tree_name, name);
+    dir_tree_node_t leaf;
+    uint32_t path[DIR_TREE_MAX_DEPTH];
+    size_t depth;
+    if (dir_tree_descend(fs, index, header, tree_name, &leaf, path, NULL, &depth) != 0)
+        return -1;
+    size_t pos = dir_tree_lower_bound(&leaf, tree_name);
+    if (pos >= leaf.count || memcmp(leaf.records[pos].name, tree_name, MAX_FILE_NAME_LEN) != 0
+        || leaf.records[pos].value != entry)
+        return -1;
+    memmove(leaf.records + pos, leaf.records + pos + 1, (leaf.count - pos - 1) * sizeof(dir_tree_record_t));
+    leaf.count--;
+    header->live--;
+    if (dir_tree_write(fs, index, path[depth], &leaf) != 0)
+        return -1;
+    return inode_modify_data(fs, index, 0, header, sizeof(*header)) == SUCCESS ? 0 : -1;
+}
+
+static int dir_tree_record_compare(const void *a, const void *b) {
+    return memcmp(((const dir_tree_record_t*) a)->name, ((const dir_tree_record_t*) b)->name, MAX_FILE_NAME_LEN);
+}
+
+// rewrites the ordered index of `dir` from its entries, filling the nodes bottom up
+static int dir_tree_build(filesystem_t *fs, inode_t *dir, inode_t *index) {
+    size_t entries = dir->internal.file_size / DIRECTORY_ENTRY_SIZE;
+    dir_iter_t it;
+    const byte *entry;
+    size_t i;
+    size_t live = 0;
+    dir_iter_init(&it, fs, dir, 0);
+    while ((entry = dir_iter_next(&it, &i))) {
+        if (!is_tombstone(entry))
+            live++;
+    }
+    if (it.entry != entries)
+        return -1;
+    // a level of n records takes at most n / DIR_TREE_FILL + 1 nodes
+    size_t max_nodes = 1;
+    for (size_t n = live; n > 1; n = n / DIR_TREE_FILL + 1)
+        max_nodes += n / DIR_TREE_FILL + 1;
+    dir_tree_record_t *records = malloc((live + 1) * sizeof(dir_tree_record_t));
+    byte *data = calloc(1, dir_tree_node_offset((uint32_t) max_nodes));
+    if (!records || !data) {
+        free(records);
+        free(data);
+        return -1;
+    }
+    size_t count = 0;
+    dir_iter_init(&it, fs, dir, 0);
+    while ((entry = dir_iter_next(&it, &i)) && count < live) {
+        if (is_tombstone(entry))
+            continue;
+        dir_tree_record_t *record = &records[count++];
+        dir_tree_name(record->name, (const char*) entry + sizeof(inode_index_t));
+        memcpy(&record->inode, entry, sizeof(inode_index_t));
+        record->value = (uint32_t) i;
+    }
+    qsort(records, count, sizeof(dir_tree_record_t), dir_tree_record_compare);
+
+    // each level is cut into nodes, and the first names of the nodes make up the next one
+    dir_tree_node_t *nodes = (dir_tree_node_t*) (data + sizeof(dir_tree_header_t));
+    dir_tree_header_t header = { DIR_TREE_MAGIC, 0, 0, 0, (uint32_t) count };
+    int leaf = 1;
+    do {
+        size_t first = header.nodes;
+        for (size_t start = 0; start < count || start == 0; start += DIR_TREE_FILL) {
+            dir_tree_node_t *node = &nodes[header.nodes++];
+            node->leaf = (uint16_t) leaf;
+            node->count = (uint16_t) (count - start < DIR_TREE_FILL ? count - start : DIR_TREE_FILL);
+            node->next = DIR_TREE_NONE;
+            memcpy(node->records, records + start, node->count * sizeof(dir_tree_record_t));
+            if (leaf && start > 0)
+                nodes[header.nodes - 2].next = header.nodes - 1;
+            if (count == 0)
+                break;
+        }
+        if (leaf)
+            header.leaves = header.nodes;
+        count = header.nodes - first;
+        for (size_t n = 0; n < count; n++) {
+            records[n] = nodes[first + n].records[0];
+            records[n].inode = 0;
+            records[n].value = (uint32_t) (first + n);
         }
-        strncpy(base_name_out, last_slash + 1, MAX_FILE_NAME_LEN);
-        base_name_out[MAX_FILE_NAME_LEN] = '\0';
+        leaf = 0;
+    } while (count > 1);
+    header.root = header.nodes - 1;
+    memcpy(data, &header, sizeof(header));
+    free(records);
+    int ret = -1;
+    if (inode_shrink_data(fs, index, 0) == SUCCESS
+        && inode_write_data(fs, index, data, dir_tree_node_offset(header.nodes)) == SUCCESS)
+        ret = 0;
+    free(data);
+    return ret;
+}
+
+// walks the records of the leaves of an ordered index in name order
+typedef struct dir_tree_iter {
+    filesystem_t *fs;
+    inode_t *index;
+    dir_tree_header_t header;
+    dir_tree_node_t leaf;
+    size_t pos;
+} dir_tree_iter_t;
+
+// starts at the first name not below `name`
+static int dir_tree_iter_init(dir_tree_iter_t *it, filesystem_t *fs, inode_t *index, const dir_tree_header_t *header,
+                              const char *name) {
+    char tree_name[MAX_FILE_NAME_LEN];
+    dir_tree_name(tree_name, name);
+    it->fs = fs;
+    it->index = index;
+    it->header = *header;
+    if (dir_tree_descend(fs, index, header, tree_name, &it->leaf, NULL, NULL, NULL) != 0)
+        return -1;
+    it->pos = dir_tree_lower_bound(&it->leaf, tree_name);
+    return 0;
+}
+
+// the next record, or NULL past the last leaf. removals can leave leaves empty
+static const dir_tree_record_t *dir_tree_iter_next(dir_tree_iter_t *it) {
+    while (it->pos >= it->leaf.count) {
+        if (it->leaf.next == DIR_TREE_NONE
+            || dir_tree_read(it->fs, it->index, &it->header, it->leaf.next, &it->leaf) != 0 || !it->leaf.leaf)
+            return NULL;
+        it->pos = 0;
+    }
+    return &it->leaf.records[it->pos++];
+}
+
+// the index inode of `dir` and its kind, FS_INDEX_NONE if it has no index
+static inode_t *dir_index_kind(filesystem_t *fs, inode_t *dir, int *kind) {
+    dir_index_header_t header;
+    dir_tree_header_t tree;
+    inode_t *index;
+    if ((index = dir_index_open(fs, dir, &header)))
+        *kind = FS_INDEX_HASHED;
+    else if ((index = dir_tree_open(fs, dir, &tree)))
+        *kind = FS_INDEX_ORDERED;
+    else
+        *kind = FS_INDEX_NONE;
+    return index;
+}
+
+// removes the index of `dir`, which is then scanned linearly. the index data is released
+// first so that unlinking it can never run out of dblocks.
+static void dir_index_drop(filesystem_t *fs, inode_t *dir, inode_t *index) {
+    inode_index_t none = 0;
+    inode_release_data(fs, index);
+    inode_modify_data(fs, dir, DIR_INDEX_LINK_OFFSET, &none, sizeof(none));
+    release_inode(fs, index);
+}
+
+// points the index record of directory entry number `entry` at `child_idx`. only the
+// ordered index keeps inodes, and inserting a name it holds overwrites the record
+static void dir_index_repoint(filesystem_t *fs, inode_t *dir, size_t entry, const char *name, inode_index_t child_idx) {
+    dir_tree_header_t tree;
+    inode_t *index = dir_tree_open(fs, dir, &tree);
+    if (index && dir_tree_insert(fs, index, &tree, name, child_idx, entry) != 0)
+        dir_index_drop(fs, dir, index);
+}
+
+// records directory entry number `entry` in the index of `dir`, if it has one
+static void dir_index_insert(filesystem_t *fs, inode_t *dir, size_t entry, const char *name, inode_index_t child_idx) {
+    dir_tree_header_t tree;
+    inode_t *index = dir_tree_open(fs, dir, &tree);
+    if (index) {
+        if (dir_tree_insert(fs, index, &tree, name, child_idx, entry) != 0)
+            dir_index_drop(fs, dir, index);
+        return;
+    }
+    dir_index_header_t header;
+    index = dir_index_open(fs, dir, &header);
+    if (!index)
+        return;
+    if ((header.used + header.deleted + 1) * 4 > header.capacity * 3) {
+        // the entry is already in the directory, so a rebuild picks it up
+        if (dir_index_build(fs, dir, index) != 0)
+            dir_index_drop(fs, dir, index);
+        return;
+    }
+    uint32_t hash = dir_name_hash(name);
+    size_t mask = header.capacity - 1;
+    size_t slot = hash & mask;
+    for (size_t i = 0; i < header.capacity; i++, slot = (slot + 1) & mask) {
+        uint32_t value;
+        size_t br;
+        if (inode_read_data(fs, index, dir_index_slot_offset(slot), &value, sizeof(value), &br) != SUCCESS)
+            break;
+        if (value != DIR_INDEX_EMPTY && value != DIR_INDEX_DELETED)
+            continue;
+        if (value == DIR_INDEX_DELETED)
+            header.deleted--;
+        header.used++;
+        value = dir_index_slot_value(hash, entry);
+        if (inode_modify_data(fs, index, dir_index_slot_offset(slot), &value, sizeof(value)) != SUCCESS
+            || inode_modify_data(fs, index, 0, &header, sizeof(header)) != SUCCESS)
+            break;
+        return;
+    }
+    dir_index_drop(fs, dir, index);
+}
+
+// turns the slot of directory entry number `entry` in the index of `dir` into a tombstone
+static void dir_index_remove(filesystem_t *fs, inode_t *dir, size_t entry, const char *name) {
+    dir_tree_header_t tree;
+    inode_t *index = dir_tree_open(fs, dir, &tree);
+    if (index) {
+        // rebuilt once three quarters of the leaf records are gone
+        if (dir_tree_remove(fs, index, &tree, name, entry) != 0
+            || (tree.leaves > 1 && (size_t) tree.live * 4 < (size_t) tree.leaves * DIR_TREE_FANOUT
+                && dir_tree_build(fs, dir, index) != 0))
+            dir_index_drop(fs, dir, index);
+        return;
+    }
+    dir_index_header_t header;
+    index = dir_index_open(fs, dir, &header);
+    if (!index)
+        return;
+    uint32_t hash = dir_name_hash(name);
+    uint32_t target = dir_index_slot_value(hash, entry);
+    size_t mask = header.capacity - 1;
+    size_t slot = hash & mask;
+    for (size_t i = 0; i < header.capacity; i++, slot = (slot + 1) & mask) {
+        uint32_t value;
+        size_t br;
+        if (inode_read_data(fs, index, dir_index_slot_offset(slot), &value, sizeof(value), &br) != SUCCESS)
+            break;
+        if (value == DIR_INDEX_EMPTY)
+            break;
+        if (value != target)
+            continue;
+        header.used--;
+        header.deleted++;
+        value = DIR_INDEX_DELETED;
+        if (inode_modify_data(fs, index, dir_index_slot_offset(slot), &value, sizeof(value)) != SUCCESS
+            || inode_modify_data(fs, index, 0, &header, sizeof(header)) != SUCCESS)
+            break;
+        return;
+    }
+    dir_index_drop(fs, dir, index);
+}
+
+static int find_directory_entry(filesystem_t *fs, inode_t *dir, const char *name, size_t *entry_offset, inode_index_t *child_idx) {
+    dir_name_key_t key;
+    if (dir_name_key_init(&key, name) != 0)
+        return -1;
+    dir_index_header_t header;
+    dir_tree_header_t tree;
+    inode_t *index;
+    size_t entry = 0;
+    inode_index_t idx;
+    if ((index = dir_index_open(fs, dir, &header))) {
+        if (dir_index_find(fs, dir, index, &header, &key, &entry, &idx) != 0)
+            return -1;
+    } else if ((index = dir_tree_open(fs, dir, &tree))) {
+        if (dir_tree_find(fs, index, &tree, &key, &entry, &idx) != 0)
+            return -1;
     } else {
-        *parent = context->working_directory;
-        strncpy(base_name_out, dup, MAX_FILE_NAME_LEN);
-        base_name_out[MAX_FILE_NAME_LEN] = '\0';
+        // whole data blocks of entries are matched at once
+        inode_block_iter_t blocks;
+        const byte *data;
+        size_t len;
+        inode_block_iter_init(&blocks, fs, dir, 0);
+        while (1) {
+            if (inode_block_iter_next(&blocks, &data, &len) != SUCCESS || len == 0)
+                return -1;
+            size_t count = len / DIRECTORY_ENTRY_SIZE;
+            size_t match = dir_name_match(data, count, &key);
+            if (match < count) {
+                entry += match;
+                memcpy(&idx, data + match * DIRECTORY_ENTRY_SIZE, sizeof(inode_index_t));
+                break;
+            }
+            entry += count;
+        }
     }
-    free(dup);
+    if (entry_offset)
+        *entry_offset = entry * DIRECTORY_ENTRY_SIZE;
+    if (child_idx)
+        *child_idx = idx;
     return 0;
 }
 
-static int resolve_path(terminal_context_t *context, const char *path, inode_t **result) {
-    char *dup = strdup(path);
-    if (!dup)
+// looks up a path component of the directory `dir`, going through the dentry cache. every
+// child found is cached, whatever its type. an entry only changes which inode it names
+// through add_directory_entry, remove_directory_entry and repoint_directory_entry, which
+// drop the cached name, and a released directory drops all of its own, so a cached child
+// is the one the directory holds
+static int lookup_entry(filesystem_t *fs, inode_t *dir, const char *name, inode_index_t *child_idx) {
+    inode_index_t parent_idx = dir - fs->inodes;
+    if (dentry_lookup(fs, parent_idx, name, child_idx))
+        return 0;
+    if (find_directory_entry(fs, dir, name, NULL, child_idx) != 0)
+        return -1;
+    dentry_insert(fs, parent_idx, name, *child_idx);
+    return 0;
+}
+
+// the next component of a path from `*pos` up to `end`, skipping repeated slashes, or NULL
+// if there is none. `*pos` is moved past it and `len` set to its length. the path is only
+// read, so walks need no copy of it and keep no state of their own.
+static const char *path_next(const char **pos, const char *end, size_t *len) {
+    const char *start = *pos;
+    while (start < end && *start == '/')
+        start++;
+    if (start == end)
+        return NULL;
+    const char *stop = start;
+    while (stop < end && *stop != '/')
+        stop++;
+    *pos = stop;
+    *len = stop - start;
+    return start;
+}
+
+// steps from the directory `*curr` into the component `name` of `len` bytes. "." stays
+// put, ".." is looked up like any name, so it fails at the root, which has no parent
+static int path_step(filesystem_t *fs, inode_t **curr, const char *name, size_t len) {
+    if ((*curr)->internal.file_type != DIRECTORY)
+        return -1;
+    if (len == 1 && name[0] == '.')
+        return 0;
+    if (len > MAX_FILE_NAME_LEN)
+        return -1;
+    char component[MAX_FILE_NAME_LEN + 1];
+    memcpy(component, name, len);
+    component[len] = '\0';
+    inode_index_t idx;
+    if (lookup_entry(fs, *curr, component, &idx) != 0)
+        return -1;
+    *curr = &fs->inodes[idx];
+    return 0;
+}
+
+// walks every component of the path from `path` up to `end`
+static int path_walk(filesystem_t *fs, inode_t **curr, const char *path, const char *end) {
+    const char *name;
+    size_t len;
+    while ((name = path_next(&path, end, &len))) {
+        if (path_step(fs, curr, name, len) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// the last component of a path, ignoring trailing slashes. NULL if the path has none
+static const char *path_base(const char *path, size_t *len) {
+    const char *end = path + strlen(path);
+    while (end > path && end[-1] == '/')
+        end--;
+    const char *base = end;
+    while (base > path && base[-1] != '/')
+        base--;
+    *len = end - base;
+    return base == end ? NULL : base;
+}
+
+static int resolve_parent(terminal_context_t *context, const char *path,
+                          inode_t **parent, char *base_name_out) {
+    size_t len;
+    const char *base = path_base(path, &len);
+    if (!base)
         return -1;
     inode_t *curr = context->working_directory;
-    char *token = strtok(dup, "/");
-    while (token) {
-        size_t entries = curr->internal.file_size / DIRECTORY_ENTRY_SIZE;
-        int found = 0;
-        for (size_t i = 0; i < entries; i++) {
-            size_t offset = i * DIRECTORY_ENTRY_SIZE;
+    if (path_walk(context->fs, &curr, path, base) != 0 || curr->internal.file_type != DIRECTORY)
+        return -1;
+    *parent = curr;
+    if (len > MAX_FILE_NAME_LEN)
+        len = MAX_FILE_NAME_LEN;
+    memcpy(base_name_out, base, len);
+    base_name_out[len] = '\0';
+    return 0;
+}
+
+static int resolve_path(terminal_context_t *context, const char *path, inode_t **result) {
+    inode_t *curr = context->working_directory;
+    if (path_walk(context->fs, &curr, path, path + strlen(path)) != 0)
+        return -1;
+    *result = curr;
+    return 0;
+}
+
+// the free entry hints of a directory, allocated for every inode on first use. null if
+// they cannot be allocated, in which case the directory is scanned
+static dir_slots_t *dir_slots(filesystem_t *fs, inode_t *dir) {
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext)
+        return NULL;
+    if (!ext->dir_slots) {
+        ext->dir_slots = calloc(fs->inode_count, sizeof(dir_slots_t));
+        if (!ext->dir_slots)
+            return NULL;
+    }
+    dir_slots_t *slots = &ext->dir_slots[dir - fs->inodes];
+    if (!slots->known) {
+        slots->scanned = 0;
+        slots->free_count = 0;
+        slots->known = 1;
+    }
+    return slots;
+}
+
+// notes that entry number `entry` of `dir` became a tombstone
+static void dir_slots_freed(filesystem_t *fs, inode_t *dir, size_t entry) {
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dir_slots)
+        return;
+    dir_slots_t *slots = &ext->dir_slots[dir - fs->inodes];
+    if (!slots->known || entry >= slots->scanned)
+        return;
+    if (slots->free_count < DIR_FREE_SLOTS)
+        slots->free[slots->free_count++] = (uint32_t) entry;
+    else
+        slots->scanned = (uint32_t) entry;
+}
+
+// finds the entry number a new entry of `parent` goes to: a tombstone if there is one,
+// otherwise the end of the directory. listed slots are checked since the hints can be stale
+static size_t free_directory_entry(filesystem_t *fs, inode_t *parent) {
+    size_t entries = parent->internal.file_size / DIRECTORY_ENTRY_SIZE;
+    dir_slots_t *slots = dir_slots(fs, parent);
+    size_t first = 0;
+    if (slots) {
+        while (slots->free_count > 0) {
+            size_t candidate = slots->free[--slots->free_count];
             byte buf[DIRECTORY_ENTRY_SIZE];
             size_t br;
-            if (inode_read_data(context->fs, curr, offset, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
-                continue;
-            inode_index_t idx;
-            memcpy(&idx, buf, sizeof(inode_index_t));
-            if (idx == 0)
-                continue;
-            char entry_name[MAX_FILE_NAME_LEN + 1];
-            memcpy(entry_name, buf + sizeof(inode_index_t), MAX_FILE_NAME_LEN);
-            entry_name[MAX_FILE_NAME_LEN] = '\0';
-            if (strcmp(token, entry_name) == 0) {
-                curr = &context->fs->inodes[idx];
-                found = 1;
+            if (candidate < entries
+                && inode_read_data(fs, parent, candidate * DIRECTORY_ENTRY_SIZE, buf, DIRECTORY_ENTRY_SIZE, &br) == SUCCESS
+                && is_tombstone(buf))
+                return candidate;
+        }
+        first = slots->scanned;
+    }
+    dir_iter_t it;
+    const byte *buf;
+    size_t i;
+    dir_iter_init(&it, fs, parent, first < entries ? first : entries);
+    while ((buf = dir_iter_next(&it, &i))) {
+        if (is_tombstone(buf)) {
+            if (slots)
+                slots->scanned = (uint32_t) (i + 1);
+            return i;
+        }
+    }
+    // the entry appended next is live
+    if (slots)
+        slots->scanned = (uint32_t) (entries + 1);
+    return entries;
+}
+
+static int add_directory_entry(filesystem_t *fs, inode_t *parent, inode_index_t child_idx, const char *name) {
+    byte new_entry[DIRECTORY_ENTRY_SIZE];
+    memset(new_entry, 0, DIRECTORY_ENTRY_SIZE);
+    memcpy(new_entry, &child_idx, sizeof(inode_index_t));
+    strncpy((char*)(new_entry + sizeof(inode_index_t)), name, MAX_FILE_NAME_LEN);
+    dentry_invalidate(fs, parent - fs->inodes, name);
+    size_t entries = parent->internal.file_size / DIRECTORY_ENTRY_SIZE;
+    size_t entry = free_directory_entry(fs, parent);
+    if (entry < entries) {
+        if (inode_modify_data(fs, parent, entry * DIRECTORY_ENTRY_SIZE, new_entry, DIRECTORY_ENTRY_SIZE) != SUCCESS)
+            return -1;
+    } else if (inode_write_data(fs, parent, new_entry, DIRECTORY_ENTRY_SIZE) != SUCCESS) {
+        return -1;
+    }
+    dir_index_insert(fs, parent, entry, name, child_idx);
+    dir_totals_link(fs, parent - fs->inodes, child_idx);
+    return 0;
+}
+
+static int remove_directory_entry(filesystem_t *fs, inode_t *parent, const char *name) {
+    size_t offset;
+    inode_index_t child_idx;
+    if (find_directory_entry(fs, parent, name, &offset, &child_idx) != 0)
+        return -1;
+    byte tomb[DIRECTORY_ENTRY_SIZE];
+    memset(tomb, 0, DIRECTORY_ENTRY_SIZE);
+    if (inode_modify_data(fs, parent, offset, tomb, DIRECTORY_ENTRY_SIZE) != SUCCESS)
+        return -1;
+    dentry_invalidate(fs, parent - fs->inodes, name);
+    dir_index_remove(fs, parent, offset / DIRECTORY_ENTRY_SIZE, name);
+    dir_slots_freed(fs, parent, offset / DIRECTORY_ENTRY_SIZE);
+    dir_totals_unlink(fs, parent - fs->inodes, child_idx);
+    while (parent->internal.file_size >= DIRECTORY_ENTRY_SIZE) {
+        size_t last_offset = parent->internal.file_size - DIRECTORY_ENTRY_SIZE;
+        byte buf[DIRECTORY_ENTRY_SIZE];
+        size_t br;
+        if (inode_read_data(fs, parent, last_offset, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
+            break;
+        int is_tomb = 1;
+        for (size_t i = 0; i < DIRECTORY_ENTRY_SIZE; i++) {
+            if (buf[i] != 0) {
+                is_tomb = 0;
                 break;
             }
         }
-        if (!found) {
-            free(dup);
-            return -1;
+        if (is_tomb)
+            inode_shrink_data(fs, parent, last_offset);
+        else
+            break;
+    }
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->dir_slots) {
+        dir_slots_t *slots = &ext->dir_slots[parent - fs->inodes];
+        size_t entries = parent->internal.file_size / DIRECTORY_ENTRY_SIZE;
+        if (slots->scanned > entries)
+            slots->scanned = (uint32_t) entries;
+    }
+    return 0;
+}
+
+// points the existing entry `name` of `parent` at `child_idx` in place, so the name never
+// goes missing. the inode it pointed at is stored in `old_idx`
+static int repoint_directory_entry(filesystem_t *fs, inode_t *parent, const char *name,
+                                   inode_index_t child_idx, inode_index_t *old_idx) {
+    size_t offset;
+    if (find_directory_entry(fs, parent, name, &offset, old_idx) != 0)
+        return -1;
+    if (inode_modify_data(fs, parent, offset, &child_idx, sizeof(inode_index_t)) != SUCCESS)
+        return -1;
+    dentry_invalidate(fs, parent - fs->inodes, name);
+    dir_index_repoint(fs, parent, offset / DIRECTORY_ENTRY_SIZE, name, child_idx);
+    return 0;
+}
+
+// fills in a directory entry from its raw name and inode
+static void dirent_fill(filesystem_t *fs, fs_dirent_t *entry, const void *name, inode_index_t idx) {
+    memcpy(entry->name, name, MAX_FILE_NAME_LEN);
+    entry->name[MAX_FILE_NAME_LEN] = '\0';
+    entry->inode = idx;
+    entry->type = fs->inodes[idx].internal.file_type;
+    entry->size = fs->inodes[idx].internal.file_size;
+}
+
+// an open directory walks either the ordered index or the entries themselves
+struct fs_dir {
+    filesystem_t *fs;
+    int ordered;
+    dir_tree_iter_t tree;
+    dir_iter_t entries;
+};
+
+static void dir_init(fs_dir_t open_dir, filesystem_t *fs, inode_t *dir) {
+    open_dir->fs = fs;
+    dir_tree_header_t header;
+    inode_t *index = dir_tree_open(fs, dir, &header);
+    open_dir->ordered = index && dir_tree_iter_init(&open_dir->tree, fs, index, &header, "") == 0;
+    if (!open_dir->ordered)
+        dir_iter_init(&open_dir->entries, fs, dir, 0);
+}
+
+static fs_dir_t dir_open(filesystem_t *fs, inode_t *dir) {
+    fs_dir_t open_dir = malloc(sizeof(struct fs_dir));
+    if (open_dir)
+        dir_init(open_dir, fs, dir);
+    return open_dir;
+}
+
+static size_t dir_read(fs_dir_t dir, fs_dirent_t *entries, size_t max_entries) {
+    size_t count = 0;
+    while (count < max_entries) {
+        if (dir->ordered) {
+            const dir_tree_record_t *record = dir_tree_iter_next(&dir->tree);
+            if (!record)
+                break;
+            dirent_fill(dir->fs, &entries[count++], record->name, record->inode);
+            continue;
         }
-        token = strtok(NULL, "/");
+        const byte *buf;
+        size_t i;
+        if (!(buf = dir_iter_next(&dir->entries, &i)))
+            break;
+        if (is_tombstone(buf))
+            continue;
+        inode_index_t idx;
+        memcpy(&idx, buf, sizeof(inode_index_t));
+        dirent_fill(dir->fs, &entries[count++], buf + sizeof(inode_index_t), idx);
     }
-    free(dup);
-    *result = curr;
+    return count;
+}
+
+// entries read at a time by `list` and `tree`
+#define DIR_READ_BATCH 16
+
+// prints a line of `list` for a directory entry
+static void list_entry(filesystem_t *fs, const fs_dirent_t *entry) {
+    inode_t *child = &fs->inodes[entry->inode];
+    char type = (entry->type == DIRECTORY) ? 'd' :
+                (entry->type == DATA_FILE) ? 'f' : 'E';
+    char perm[4] = {
+        (child->internal.file_perms & FS_READ) ? 'r' : '-',
+        (child->internal.file_perms & FS_WRITE) ? 'w' : '-',
+        (child->internal.file_perms & FS_EXECUTE) ? 'x' : '-',
+        '\0'
+    };
+    if (strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0) {
+        printf("%c%s\t%lu\t%s -> %s\n", type, perm, (unsigned long) entry->size, entry->name, child->internal.file_name);
+    } else {
+        printf("%c%s\t%lu\t%s\n", type, perm, (unsigned long) entry->size, entry->name);
+    }
+}
+
+// sets the number of names of a data file besides its first
+static void set_extra_links(inode_t *inode, size_t links) {
+    inode->internal.file_perms &= ~INODE_LINKS_MASK;
+    inode->internal.file_perms |= (uint32_t) links << INODE_LINKS_SHIFT;
+}
+
+// drops a name of a data file whose directory entry is already gone, releasing the data
+// with the last one
+static int release_file(filesystem_t *fs, inode_t *child) {
+    size_t links = INODE_EXTRA_LINKS(child->internal.file_perms);
+    if (links > 0) {
+        // the data stays with the other names
+        set_extra_links(child, links - 1);
+        return 0;
+    }
+    if (inode_release_data(fs, child) != SUCCESS)
+        return -1;
+    if (release_inode(fs, child) != SUCCESS)
+        return -1;
+    return 0;
+}
+
+// releases an empty directory whose directory entry is already gone, with its index
+static int release_directory(filesystem_t *fs, inode_t *child) {
+    int kind;
+    inode_t *index = dir_index_kind(fs, child, &kind);
+    if (index) {
+        inode_release_data(fs, index);
+        release_inode(fs, index);
+    }
+    dentry_invalidate_dir(fs, child - fs->inodes);
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->path_cache)
+        ext->path_cache->dir = NULL;
+    if (inode_release_data(fs, child) != SUCCESS)
+        return -1;
+    if (release_inode(fs, child) != SUCCESS)
+        return -1;
+    return 0;
+}
+
+// ----------------------- CORE FUNCTION ----------------------- //
+int new_file(terminal_context_t *context, char *path, permission_t perms) {
+    if (!context || !path)
+        return 0;
+    filesystem_t *fs = context->fs;
+    inode_t *parent;
+    char base_name[MAX_FILE_NAME_LEN + 1];
+    if (resolve_parent(context, path, &parent, base_name) != 0) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    size_t dummy;
+    inode_index_t exist;
+    if (find_directory_entry(fs, parent, base_name, &dummy, &exist) == 0) {
+        REPORT_RETCODE(FILE_EXIST);
+        return -1;
+    }
+    inode_index_t new_idx;
+    if (claim_available_inode(fs, &new_idx) != SUCCESS) {
+        REPORT_RETCODE(INODE_UNAVAILABLE);
+        return -1;
+    }
+    inode_t *new_inode = &fs->inodes[new_idx];
+    new_inode->internal.file_type = DATA_FILE;
+    new_inode->internal.file_perms = perms;
+    new_inode->internal.file_size = 0;
+    strncpy(new_inode->internal.file_name, base_name, MAX_FILE_NAME_LEN);
+    if (strlen(base_name) < MAX_FILE_NAME_LEN)
+        new_inode->internal.file_name[strlen(base_name)] = '\0';
+    if (add_directory_entry(fs, parent, new_idx, base_name) != 0) {
+        release_inode(fs, new_inode);
+        return -1;
+    }
+    return 0;
+}
+
+int new_directory(terminal_context_t *context, char *path) {
+    if (!context || !path)
+        return 0;
+    filesystem_t *fs = context->fs;
+    inode_t *parent;
+    char base_name[MAX_FILE_NAME_LEN + 1];
+    if (resolve_parent(context, path, &parent, base_name) != 0) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    size_t dummy;
+    inode_index_t exist;
+    if (find_directory_entry(fs, parent, base_name, &dummy, &exist) == 0) {
+        REPORT_RETCODE(DIRECTORY_EXIST);
+        return -1;
+    }
+    inode_index_t new_idx;
+    if (claim_available_inode(fs, &new_idx) != SUCCESS) {
+        REPORT_RETCODE(INODE_UNAVAILABLE);
+        return -1;
+    }
+    inode_t *new_inode = &fs->inodes[new_idx];
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->dir_slots)
+        ext->dir_slots[new_idx].known = 0;
+    new_inode->internal.file_type = DIRECTORY;
+    new_inode->internal.file_perms = 0;
+    strncpy(new_inode->internal.file_name, base_name, MAX_FILE_NAME_LEN);
+    if (strlen(base_name) < MAX_FILE_NAME_LEN)
+        new_inode->internal.file_name[strlen(base_name)] = '\0';
+    dblock_index_t dblock;
+    if (claim_available_dblock(fs, &dblock) != SUCCESS) {
+        release_inode(fs, new_inode);
+        REPORT_RETCODE(INSUFFICIENT_DBLOCKS);
+        return -1;
+    }
+    new_inode->internal.direct_data[0] = dblock;
+    byte entry[DIRECTORY_ENTRY_SIZE];
+    memset(entry, 0, DIRECTORY_ENTRY_SIZE);
+    memcpy(entry, &new_idx, sizeof(inode_index_t));
+    strncpy((char*)(entry + sizeof(inode_index_t)), ".", MAX_FILE_NAME_LEN);
+    if (inode_write_data(fs, new_inode, entry, DIRECTORY_ENTRY_SIZE) != SUCCESS) {
+        release_dblock(fs, fs->dblocks + dblock * DATA_BLOCK_SIZE);
+        release_inode(fs, new_inode);
+        return -1;
+    }
+    memset(entry, 0, DIRECTORY_ENTRY_SIZE);
+    inode_index_t parent_idx = parent - fs->inodes;
+    memcpy(entry, &parent_idx, sizeof(inode_index_t));
+    strncpy((char*)(entry + sizeof(inode_index_t)), "..", MAX_FILE_NAME_LEN);
+    if (inode_write_data(fs, new_inode, entry, DIRECTORY_ENTRY_SIZE) != SUCCESS) {
+        inode_shrink_data(fs, new_inode, 0);
+        release_dblock(fs, fs->dblocks + dblock * DATA_BLOCK_SIZE);
+        release_inode(fs, new_inode);
+        return -1;
+    }
+    if (add_directory_entry(fs, parent, new_idx, base_name) != 0) {
+        inode_release_data(fs, new_inode);
+        release_inode(fs, new_inode);
+        return -1;
+    }
+    return 0;
+}
+
+int remove_file(terminal_context_t *context, char *path) {
+    if (!context || !path)
+        return 0;
+    filesystem_t *fs = context->fs;
+    inode_t *parent;
+    char base_name[MAX_FILE_NAME_LEN + 1];
+    if (resolve_parent(context, path, &parent, base_name) != 0) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    size_t offset;
+    inode_index_t child_idx;
+    if (find_directory_entry(fs, parent, base_name, &offset, &child_idx) != 0) {
+        REPORT_RETCODE(FILE_NOT_FOUND);
+        return -1;
+    }
+    inode_t *child = &fs->inodes[child_idx];
+    if (child->internal.file_type != DATA_FILE) {
+        REPORT_RETCODE(FILE_NOT_FOUND);
+        return -1;
+    }
+    if (remove_directory_entry(fs, parent, base_name) != 0)
+        return -1;
+    return release_file(fs, child);
+}
+
+// we can only delete a directory if it is empty!!
+int remove_directory(terminal_context_t *context, char *path) {
+    if (!context || !path)
+        return 0;
+    filesystem_t *fs = context->fs;
+    inode_t *parent;
+    char base_name[MAX_FILE_NAME_LEN + 1];
+    if (resolve_parent(context, path, &parent, base_name) != 0) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    if (strcmp(base_name, ".") == 0 || strcmp(base_name, "..") == 0) {
+        REPORT_RETCODE(INVALID_FILENAME);
+        return -1;
+    }
+    size_t offset;
+    inode_index_t child_idx;
+    if (find_directory_entry(fs, parent, base_name, &offset, &child_idx) != 0) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    inode_t *child = &fs->inodes[child_idx];
+    if (child->internal.file_type != DIRECTORY) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    if (child->internal.file_size > 2 * DIRECTORY_ENTRY_SIZE) {
+        REPORT_RETCODE(DIR_NOT_EMPTY);
+        return -1;
+    }
+    if (child == context->working_directory) {
+        REPORT_RETCODE(ATTEMPT_DELETE_CWD);
+        return -1;
+    }
+    if (remove_directory_entry(fs, parent, base_name) != 0)
+        return -1;
+    return release_directory(fs, child);
+}
+
+// the parent of a directory through its ".." entry, or NULL at the root or if it has none
+static inode_t *path_parent(filesystem_t *fs, inode_t *dir) {
+    inode_index_t idx;
+    if (dir == &fs->inodes[0] || lookup_entry(fs, dir, "..", &idx) != 0)
+        return NULL;
+    return &fs->inodes[idx];
+}
+
+// the path cache of a file system, allocated on first use. null if it cannot be
+static path_cache_t *path_cache(filesystem_t *fs) {
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext)
+        return NULL;
+    if (!ext->path_cache)
+        ext->path_cache = calloc(1, sizeof(path_cache_t));
+    return ext->path_cache;
+}
+
+// grows the cached path to hold `len` bytes and a terminator
+static int path_reserve(path_cache_t *cache, size_t len) {
+    if (len < cache->capacity)
+        return 0;
+    size_t capacity = cache->capacity ? cache->capacity : 64;
+    while (capacity <= len)
+        capacity *= 2;
+    char *path = realloc(cache->path, capacity);
+    if (!path)
+        return -1;
+    cache->path = path;
+    cache->capacity = capacity;
     return 0;
 }
 
-static int find_directory_entry(filesystem_t *fs, inode_t *dir, const char *name, size_t *entry_offset, inode_index_t *child_idx) {
-    size_t entries = dir->internal.file_size / DIRECTORY_ENTRY_SIZE;
-    for (size_t i = 0; i < entries; i++) {
-        size_t offset = i * DIRECTORY_ENTRY_SIZE;
-        byte buf[DIRECTORY_ENTRY_SIZE];
-        size_t br;
-        if (inode_read_data(fs, dir, offset, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
-            continue;
-        inode_index_t idx;
-        memcpy(&idx, buf, sizeof(inode_index_t));
-        if (idx == 0)
-            continue;
-        char entry_name[MAX_FILE_NAME_LEN + 1];
-        memcpy(entry_name, buf + sizeof(inode_index_t), MAX_FILE_NAME_LEN);
-        entry_name[MAX_FILE_NAME_LEN] = '\0';
-        if (strcmp(entry_name, name) == 0) {
-            if (entry_offset)
-                *entry_offset = offset;
-            if (child_idx)
-                *child_idx = idx;
-            return 0;
-        }
+// rebuilds the cached path of `dir` by walking ".." up to the root: once to measure it,
+// then again to fill it in from the end. the walk gives up after as many steps as there
+// are inodes
+static int path_rebuild(filesystem_t *fs, path_cache_t *cache, inode_t *dir) {
+    inode_t *root = &fs->inodes[0];
+    size_t len = strnlen(root->internal.file_name, MAX_FILE_NAME_LEN);
+    size_t depth = 0;
+    for (inode_t *curr = dir; curr && depth < fs->inode_count; curr = path_parent(fs, curr), depth++) {
+        if (curr != root)
+            len += 1 + strnlen(curr->internal.file_name, MAX_FILE_NAME_LEN);
     }
-    return -1;
+    cache->dir = NULL;
+    if (path_reserve(cache, len) != 0)
+        return -1;
+    size_t end = len;
+    inode_t *curr = dir;
+    for (size_t step = 0; curr && curr != root && step < depth; curr = path_parent(fs, curr), step++) {
+        size_t name_len = strnlen(curr->internal.file_name, MAX_FILE_NAME_LEN);
+        end -= name_len;
+        memcpy(cache->path + end, curr->internal.file_name, name_len);
+        cache->path[--end] = '/';
+    }
+    memcpy(cache->path, root->internal.file_name, end);
+    cache->path[len] = '\0';
+    cache->len = len;
+    cache->dir = dir;
+    return 0;
 }
 
-static int add_directory_entry(filesystem_t *fs, inode_t *parent, inode_index_t child_idx, const char *name) {
-    byte new_entry[DIRECTORY_ENTRY_SIZE];
-    memset(new_entry, 0, DIRECTORY_ENTRY_SIZE);
-    memcpy(new_entry, &child_idx, sizeof(inode_index_t));
-    strncpy((char*)(new_entry + sizeof(inode_index_t)), name, MAX_FILE_NAME_LEN);
-    size_t entries = parent->internal.file_size / DIRECTORY_ENTRY_SIZE;
-    for (size_t i = 0; i < entries; i++) {
-        size_t offset = i * DIRECTORY_ENTRY_SIZE;
-        byte buf[DIRECTORY_ENTRY_SIZE];
-        size_t br;
-        if (inode_read_data(fs, parent, offset, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
-            continue;
-        inode_index_t idx;
-        memcpy(&idx, buf, sizeof(inode_index_t));
-        if (idx == 0) {
-            if (inode_modify_data(fs, parent, offset, new_entry, DIRECTORY_ENTRY_SIZE) != SUCCESS)
-                return -1;
-            return 0;
-        }
+// follows a step of change_directory into `dir` in the cached path: ".." drops the last
+// name, and any other name is appended as the directory stepped into calls itself
+static int path_follow(path_cache_t *cache, inode_t *dir, const char *name, size_t len) {
+    if (len == 1 && name[0] == '.')
+        return 0;
+    if (len == 2 && name[0] == '.' && name[1] == '.') {
+        size_t slash = cache->len;
+        while (slash > 0 && cache->path[slash - 1] != '/')
+            slash--;
+        if (slash == 0)
+            return -1;
+        cache->len = slash - 1;
+        cache->path[cache->len] = '\0';
+        return 0;
     }
-    if (inode_write_data(fs, parent, new_entry, DIRECTORY_ENTRY_SIZE) != SUCCESS)
+    size_t name_len = strnlen(dir->internal.file_name, MAX_FILE_NAME_LEN);
+    if (path_reserve(cache, cache->len + 1 + name_len) != 0)
         return -1;
+    cache->path[cache->len++] = '/';
+    memcpy(cache->path + cache->len, dir->internal.file_name, name_len);
+    cache->len += name_len;
+    cache->path[cache->len] = '\0';
     return 0;
 }
 
-static int remove_directory_entry(filesystem_t *fs, inode_t *parent, const char *name) {
-    size_t offset;
-    inode_index_t child_idx;
-    if (find_directory_entry(fs, parent, name, &offset, &child_idx) != 0)
+int change_directory(terminal_context_t *context, char *path) {
+    if (!context || !path)
+        return 0;
+    inode_t *target;
+    if (resolve_path(context, path, &target) != 0) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
         return -1;
-    byte tomb[DIRECTORY_ENTRY_SIZE];
-    memset(tomb, 0, DIRECTORY_ENTRY_SIZE);
-    if (inode_modify_data(fs, parent, offset, tomb, DIRECTORY_ENTRY_SIZE) != SUCCESS)
+    }
+    if (target->internal.file_type != DIRECTORY) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
         return -1;
-    while (parent->internal.file_size >= DIRECTORY_ENTRY_SIZE) {
-        size_t last_offset = parent->internal.file_size - DIRECTORY_ENTRY_SIZE;
-        byte buf[DIRECTORY_ENTRY_SIZE];
-        size_t br;
-        if (inode_read_data(fs, parent, last_offset, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
-            break;
-        int is_tomb = 1;
-        for (size_t i = 0; i < DIRECTORY_ENTRY_SIZE; i++) {
-            if (buf[i] != 0) {
-                is_tomb = 0;
+    }
+    // the walk is done again to follow it in the cached path, which is otherwise rebuilt
+    // from the tree the next time it is asked for
+    filesystem_t *fs = context->fs;
+    fs_ext_t *ext = fs_ext(fs);
+    path_cache_t *cache = ext ? ext->path_cache : NULL;
+    if (cache && cache->dir && cache->dir == context->working_directory) {
+        inode_t *curr = context->working_directory;
+        const char *pos = path, *end = path + strlen(path), *name;
+        size_t len;
+        while ((name = path_next(&pos, end, &len))) {
+            if (path_step(fs, &curr, name, len) != 0 || path_follow(cache, curr, name, len) != 0) {
+                cache->dir = NULL;
                 break;
             }
         }
-        if (is_tomb)
-            inode_shrink_data(fs, parent, last_offset);
-        else
-            break;
+        if (cache->dir)
+            cache->dir = target;
     }
+    context->working_directory = target;
     return 0;
 }
 
-static void tree_helper(filesystem_t *fs, inode_t *node, int depth) {
-    for (int i = 0; i < depth; i++)
-        printf("   ");
-    printf("%s\n", node->internal.file_name);
-    if (node->internal.file_type == DIRECTORY) {
-        size_t entries = node->internal.file_size / DIRECTORY_ENTRY_SIZE;
-        for (size_t i = 0; i < entries; i++) {
-            size_t offset = i * DIRECTORY_ENTRY_SIZE;
-            byte buf[DIRECTORY_ENTRY_SIZE];
-            size_t br;
-            if (inode_read_data(fs, node, offset, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
-                continue;
-            inode_index_t idx;
-            memcpy(&idx, buf, sizeof(inode_index_t));
-            if (idx == 0)
-                continue;
-            char entry_name[MAX_FILE_NAME_LEN + 1];
-            memcpy(entry_name, buf + sizeof(inode_index_t), MAX_FILE_NAME_LEN);
-            entry_name[MAX_FILE_NAME_LEN] = '\0';
-            if (strcmp(entry_name, ".") == 0 || strcmp(entry_name, "..") == 0)
-                continue;
-            inode_t *child = &fs->inodes[idx];
-            tree_helper(fs, child, depth + 1);
+int list(terminal_context_t *context, char *path) {
+    if (!context || !path)
+        return 0;
+    filesystem_t *fs = context->fs;
+    inode_t *target;
+    if (resolve_path(context, path, &target) != 0) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    if (target->internal.file_type == DATA_FILE) {
+        char perm[4] = {
+            (target->internal.file_perms & FS_READ) ? 'r' : '-',
+            (target->internal.file_perms & FS_WRITE) ? 'w' : '-',
+            (target->internal.file_perms & FS_EXECUTE) ? 'x' : '-',
+            '\0'
+        };
+        printf("f%s\t%lu\t%s\n", perm, (unsigned long) target->internal.file_size, target->internal.file_name);
+    } else if (target->internal.file_type == DIRECTORY) {
+        // an ordered directory is listed in name order, others in entry order
+        fs_dir_t dir = dir_open(fs, target);
+        if (!dir) {
+            REPORT_RETCODE(SYSTEM_ERROR);
+            return -1;
         }
+        fs_dirent_t entries[DIR_READ_BATCH];
+        size_t count;
+        while ((count = dir_read(dir, entries, DIR_READ_BATCH))) {
+            for (size_t i = 0; i < count; i++)
+                list_entry(fs, &entries[i]);
+        }
+        free(dir);
+    } else {
+        return -1;
     }
+    return 0;
 }
-// ----------------------- CORE FUNCTION ----------------------- //
-int new_file(terminal_context_t *context, char *path, permission_t perms) {
+
+char *get_path_string(terminal_context_t *context) {
+    return strdup(working_directory_path(context));
+}
+
+const char *working_directory_path(terminal_context_t *context) {
+    if (!context)
+        return "";
+    filesystem_t *fs = context->fs;
+    path_cache_t *cache = path_cache(fs);
+    if (!cache)
+        return "";
+    if (cache->dir != context->working_directory
+        && path_rebuild(fs, cache, context->working_directory) != 0)
+        return "";
+    return cache->path;
+}
+
+
+int tree(terminal_context_t *context, char *path) {
     if (!context || !path)
         return 0;
+    return fs_tree(context, path, 1);
+}
+
+int fs_clone_file(terminal_context_t *context, char *src_path, char *dst_path) {
+    if (!context || !src_path || !dst_path)
+        return 0;
     filesystem_t *fs = context->fs;
+    inode_t *source;
+    if (resolve_path(context, src_path, &source) != 0 || source->internal.file_type != DATA_FILE) {
+        REPORT_RETCODE(FILE_NOT_FOUND);
+        return -1;
+    }
     inode_t *parent;
     char base_name[MAX_FILE_NAME_LEN + 1];
-    if (resolve_parent(context, path, &parent, base_name) != 0) {
+    if (resolve_parent(context, dst_path, &parent, base_name) != 0) {
         REPORT_RETCODE(DIR_NOT_FOUND);
         return -1;
     }
@@ -235,270 +1460,890 @@ int new_file(terminal_context_t *context, char *path, permission_t perms) {
     }
     inode_t *new_inode = &fs->inodes[new_idx];
     new_inode->internal.file_type = DATA_FILE;
-    new_inode->internal.file_perms = perms;
+    new_inode->internal.file_perms = source->internal.file_perms & ~INODE_LINKS_MASK;
     new_inode->internal.file_size = 0;
     strncpy(new_inode->internal.file_name, base_name, MAX_FILE_NAME_LEN);
     if (strlen(base_name) < MAX_FILE_NAME_LEN)
         new_inode->internal.file_name[strlen(base_name)] = '\0';
+    fs_retcode_t ret = inode_share_data(fs, new_inode, source);
+    if (ret != SUCCESS) {
+        REPORT_RETCODE_EXT(ret);
+        release_inode(fs, new_inode);
+        return -1;
+    }
     if (add_directory_entry(fs, parent, new_idx, base_name) != 0) {
+        inode_release_data(fs, new_inode);
         release_inode(fs, new_inode);
         return -1;
     }
     return 0;
 }
 
-int new_directory(terminal_context_t *context, char *path) {
-    if (!context || !path)
+int fs_link(terminal_context_t *context, char *existing_path, char *new_path) {
+    if (!context || !existing_path || !new_path)
         return 0;
     filesystem_t *fs = context->fs;
+    inode_t *target;
+    if (resolve_path(context, existing_path, &target) != 0 || target->internal.file_type != DATA_FILE) {
+        REPORT_RETCODE(FILE_NOT_FOUND);
+        return -1;
+    }
+    size_t links = INODE_EXTRA_LINKS(target->internal.file_perms);
+    if (links + 1 >= INODE_MAX_LINKS) {
+        REPORT_RETCODE(INVALID_INPUT);
+        return -1;
+    }
     inode_t *parent;
     char base_name[MAX_FILE_NAME_LEN + 1];
-    if (resolve_parent(context, path, &parent, base_name) != 0) {
+    if (resolve_parent(context, new_path, &parent, base_name) != 0) {
         REPORT_RETCODE(DIR_NOT_FOUND);
         return -1;
     }
     size_t dummy;
     inode_index_t exist;
     if (find_directory_entry(fs, parent, base_name, &dummy, &exist) == 0) {
-        REPORT_RETCODE(DIRECTORY_EXIST);
+        REPORT_RETCODE(FILE_EXIST);
         return -1;
     }
-    inode_index_t new_idx;
-    if (claim_available_inode(fs, &new_idx) != SUCCESS) {
+    if (dir_totals_reserve(fs, target - fs->inodes) != SUCCESS) {
+        REPORT_RETCODE(SYSTEM_ERROR);
+        return -1;
+    }
+    // the new name is one directory entry; the inode and its data are not touched
+    if (add_directory_entry(fs, parent, target - fs->inodes, base_name) != 0)
+        return -1;
+    set_extra_links(target, links + 1);
+    return 0;
+}
+
+// checks that `dir` is not `parent` or one of its ancestors, walking ".." up to the root
+static int is_ancestor(filesystem_t *fs, inode_t *dir, inode_t *parent) {
+    size_t depth = 0;
+    for (inode_t *curr = parent; curr && depth < fs->inode_count; curr = path_parent(fs, curr), depth++) {
+        if (curr == dir)
+            return 1;
+    }
+    return 0;
+}
+
+int fs_rename(terminal_context_t *context, char *old_path, char *new_path) {
+    if (!context || !old_path || !new_path)
+        return 0;
+    filesystem_t *fs = context->fs;
+    inode_t *old_parent, *new_parent;
+    char old_name[MAX_FILE_NAME_LEN + 1], new_name[MAX_FILE_NAME_LEN + 1];
+    if (resolve_parent(context, old_path, &old_parent, old_name) != 0
+        || resolve_parent(context, new_path, &new_parent, new_name) != 0) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    if (strcmp(old_name, ".") == 0 || strcmp(old_name, "..") == 0
+        || strcmp(new_name, ".") == 0 || strcmp(new_name, "..") == 0) {
+        REPORT_RETCODE(INVALID_FILENAME);
+        return -1;
+    }
+    inode_index_t child_idx;
+    if (find_directory_entry(fs, old_parent, old_name, NULL, &child_idx) != 0) {
+        REPORT_RETCODE(FILE_NOT_FOUND);
+        return -1;
+    }
+    inode_t *child = &fs->inodes[child_idx];
+    int is_directory = child->internal.file_type == DIRECTORY;
+    if (is_directory && is_ancestor(fs, child, new_parent)) {
+        REPORT_RETCODE(INVALID_INPUT);
+        return -1;
+    }
+    // an existing name is taken over, the way it would be by removing it first
+    inode_index_t target_idx;
+    inode_t *target = NULL;
+    if (find_directory_entry(fs, new_parent, new_name, NULL, &target_idx) == 0) {
+        if (target_idx == child_idx)
+            return 0;
+        target = &fs->inodes[target_idx];
+        if (target->internal.file_type != child->internal.file_type) {
+            REPORT_RETCODE(INVALID_FILE_TYPE);
+            return -1;
+        }
+        if (is_directory && target->internal.file_size > 2 * DIRECTORY_ENTRY_SIZE) {
+            REPORT_RETCODE(DIR_NOT_EMPTY);
+            return -1;
+        }
+        if (target == context->working_directory) {
+            REPORT_RETCODE(ATTEMPT_DELETE_CWD);
+            return -1;
+        }
+    }
+    // only directory entries change, so the cost does not depend on the size of the file.
+    // each step is undone if a later one fails
+    inode_index_t old_parent_idx = old_parent - fs->inodes;
+    inode_index_t new_parent_idx = new_parent - fs->inodes;
+    inode_index_t previous;
+    int moves_directory = is_directory && old_parent != new_parent;
+    if (moves_directory && repoint_directory_entry(fs, child, "..", new_parent_idx, &previous) != 0)
+        return -1;
+    if (remove_directory_entry(fs, old_parent, old_name) != 0) {
+        if (moves_directory)
+            repoint_directory_entry(fs, child, "..", old_parent_idx, &previous);
+        return -1;
+    }
+    int ret = target ? repoint_directory_entry(fs, new_parent, new_name, child_idx, &previous)
+                     : add_directory_entry(fs, new_parent, child_idx, new_name);
+    if (ret != 0) {
+        add_directory_entry(fs, old_parent, child_idx, old_name);
+        if (moves_directory)
+            repoint_directory_entry(fs, child, "..", old_parent_idx, &previous);
+        return -1;
+    }
+    if (target) {
+        dir_totals_unlink(fs, new_parent_idx, target_idx);
+        dir_totals_link(fs, new_parent_idx, child_idx);
+    }
+    strncpy(child->internal.file_name, new_name, MAX_FILE_NAME_LEN);
+    if (strlen(new_name) < MAX_FILE_NAME_LEN)
+        child->internal.file_name[strlen(new_name)] = '\0';
+    fs_ext_t *ext = fs_ext(fs);
+    if (is_directory && ext && ext->path_cache)
+        ext->path_cache->dir = NULL;
+    if (target)
+        return is_directory ? release_directory(fs, target) : release_file(fs, target);
+    return 0;
+}
+
+int fs_compress_file(terminal_context_t *context, char *path, int compressed) {
+    if (!context || !path)
+        return 0;
+    inode_t *target;
+    if (resolve_path(context, path, &target) != 0 || target->internal.file_type != DATA_FILE) {
+        REPORT_RETCODE(FILE_NOT_FOUND);
+        return -1;
+    }
+    fs_retcode_t ret = inode_set_compressed(context->fs, target, compressed);
+    if (ret != SUCCESS) {
+        REPORT_RETCODE_EXT(ret);
+        return -1;
+    }
+    return 0;
+}
+
+int fs_index_directory(terminal_context_t *context, char *path, int indexed) {
+    if (!context || !path)
+        return 0;
+    filesystem_t *fs = context->fs;
+    inode_t *dir;
+    if (resolve_path(context, path, &dir) != 0 || dir->internal.file_type != DIRECTORY) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return -1;
+    }
+    int kind;
+    inode_t *index = dir_index_kind(fs, dir, &kind);
+    if (indexed != FS_INDEX_NONE && indexed != FS_INDEX_ORDERED)
+        indexed = FS_INDEX_HASHED;
+    if (kind == indexed)
+        return 0;
+    if (index)
+        dir_index_drop(fs, dir, index);
+    if (indexed == FS_INDEX_NONE)
+        return 0;
+    inode_index_t index_idx;
+    if (claim_available_inode(fs, &index_idx) != SUCCESS) {
         REPORT_RETCODE(INODE_UNAVAILABLE);
         return -1;
     }
-    inode_t *new_inode = &fs->inodes[new_idx];
-    new_inode->internal.file_type = DIRECTORY;
-    new_inode->internal.file_perms = 0;
-    strncpy(new_inode->internal.file_name, base_name, MAX_FILE_NAME_LEN);
-    if (strlen(base_name) < MAX_FILE_NAME_LEN)
-        new_inode->internal.file_name[strlen(base_name)] = '\0';
-    dblock_index_t dblock;
-    if (claim_available_dblock(fs, &dblock) != SUCCESS) {
-        release_inode(fs, new_inode);
+    index = &fs->inodes[index_idx];
+    index->internal.file_type = DATA_FILE;
+    index->internal.file_perms = 0;
+    index->internal.file_size = 0;
+    strncpy(index->internal.file_name, ".index", MAX_FILE_NAME_LEN);
+    if ((indexed == FS_INDEX_ORDERED ? dir_tree_build(fs, dir, index) : dir_index_build(fs, dir, index)) != 0) {
+        inode_release_data(fs, index);
+        release_inode(fs, index);
         REPORT_RETCODE(INSUFFICIENT_DBLOCKS);
         return -1;
     }
-    new_inode->internal.direct_data[0] = dblock;
-    byte entry[DIRECTORY_ENTRY_SIZE];
-    memset(entry, 0, DIRECTORY_ENTRY_SIZE);
-    memcpy(entry, &new_idx, sizeof(inode_index_t));
-    strncpy((char*)(entry + sizeof(inode_index_t)), ".", MAX_FILE_NAME_LEN);
-    if (inode_write_data(fs, new_inode, entry, DIRECTORY_ENTRY_SIZE) != SUCCESS) {
-        release_dblock(fs, fs->dblocks + dblock * DATA_BLOCK_SIZE);
-        release_inode(fs, new_inode);
+    if (inode_modify_data(fs, dir, DIR_INDEX_LINK_OFFSET, &index_idx, sizeof(index_idx)) != SUCCESS) {
+        inode_release_data(fs, index);
+        release_inode(fs, index);
+        REPORT_RETCODE(INSUFFICIENT_DBLOCKS);
         return -1;
     }
-    memset(entry, 0, DIRECTORY_ENTRY_SIZE);
-    inode_index_t parent_idx = parent - fs->inodes;
-    memcpy(entry, &parent_idx, sizeof(inode_index_t));
-    strncpy((char*)(entry + sizeof(inode_index_t)), "..", MAX_FILE_NAME_LEN);
-    if (inode_write_data(fs, new_inode, entry, DIRECTORY_ENTRY_SIZE) != SUCCESS) {
-        inode_shrink_data(fs, new_inode, 0);
-        release_dblock(fs, fs->dblocks + dblock * DATA_BLOCK_SIZE);
-        release_inode(fs, new_inode);
+    return 0;
+}
+
+static int dirent_compare(const void *a, const void *b) {
+    return strcmp(((const fs_dirent_t*) a)->name, ((const fs_dirent_t*) b)->name);
+}
+
+int fs_readdir_prefix(terminal_context_t *context, char *path, char *prefix, fs_dirent_t *entries, size_t max_entries) {
+    if (!context || !path || !prefix)
+        return 0;
+    filesystem_t *fs = context->fs;
+    inode_t *dir;
+    if (resolve_path(context, path, &dir) != 0 || dir->internal.file_type != DIRECTORY) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
         return -1;
     }
-    if (add_directory_entry(fs, parent, new_idx, base_name) != 0) {
-        inode_release_data(fs, new_inode);
-        release_inode(fs, new_inode);
-        return -1;
+    size_t prefix_len = strlen(prefix);
+    if (prefix_len > MAX_FILE_NAME_LEN)
+        return 0;
+    size_t found = 0;
+    dir_tree_header_t tree;
+    dir_tree_iter_t tree_it;
+    inode_t *index = dir_tree_open(fs, dir, &tree);
+    if (index && dir_tree_iter_init(&tree_it, fs, index, &tree, prefix) == 0) {
+        // the matches are the records from the prefix on, up to the first that differs
+        const dir_tree_record_t *record;
+        while ((record = dir_tree_iter_next(&tree_it)) && memcmp(record->name, prefix, prefix_len) == 0) {
+            if (found < max_entries)
+                dirent_fill(fs, &entries[found], record->name, record->inode);
+            found++;
+        }
+        return (int) found;
+    }
+    // otherwise every match is gathered and sorted
+    fs_dirent_t *matches = NULL;
+    size_t capacity = 0;
+    dir_iter_t it;
+    const byte *buf;
+    size_t i;
+    dir_iter_init(&it, fs, dir, 0);
+    while ((buf = dir_iter_next(&it, &i))) {
+        if (is_tombstone(buf) || strncmp((const char*) buf + sizeof(inode_index_t), prefix, prefix_len) != 0)
+            continue;
+        if (found == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            fs_dirent_t *grown = realloc(matches, capacity * sizeof(fs_dirent_t));
+            if (!grown) {
+                free(matches);
+                REPORT_RETCODE(SYSTEM_ERROR);
+                return -1;
+            }
+            matches = grown;
+        }
+        inode_index_t idx;
+        memcpy(&idx, buf, sizeof(inode_index_t));
+        dirent_fill(fs, &matches[found++], buf + sizeof(inode_index_t), idx);
+    }
+    if (found > 0) {
+        qsort(matches, found, sizeof(fs_dirent_t), dirent_compare);
+        memcpy(entries, matches, (found < max_entries ? found : max_entries) * sizeof(fs_dirent_t));
+    }
+    free(matches);
+    return (int) found;
+}
+
+fs_dir_t fs_opendir(terminal_context_t *context, char *path) {
+    if (!context || !path)
+        return NULL;
+    inode_t *dir;
+    if (resolve_path(context, path, &dir) != 0 || dir->internal.file_type != DIRECTORY) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return NULL;
+    }
+    fs_dir_t open_dir = dir_open(context->fs, dir);
+    if (!open_dir)
+        REPORT_RETCODE(SYSTEM_ERROR);
+    return open_dir;
+}
+
+size_t fs_readdir(fs_dir_t dir, fs_dirent_t *entries, size_t max_entries) {
+    if (!dir || !entries)
+        return 0;
+    return dir_read(dir, entries, max_entries);
+}
+
+void fs_closedir(fs_dir_t dir) {
+    free(dir);
+}
+
+// a walk first reads the whole tree into nodes, a directory at a time across the workers,
+// then visits the nodes in order on the calling thread, so the order never depends on
+// which worker read what
+typedef struct walk_node {
+    fs_dirent_t entry;
+    struct walk_node *children;     // the entries of a directory but "." and "..", once read
+    size_t child_count;
+    size_t depth;
+    int kept;                       // visited, rather than only read through
+} walk_node_t;
+
+// what a walk reads and visits
+typedef struct walk_options {
+    size_t threads;
+    size_t max_depth;               // directories this deep are not read
+    int (*keep)(const fs_dirent_t *entry, void *arg);    // null to visit every entry
+    fs_walk_visit_t visit;
+    void *arg;                      // passed to keep and visit
+} walk_options_t;
+
+static int walk_keeps(const walk_options_t *options, const fs_dirent_t *entry) {
+    return !options->keep || options->keep(entry, options->arg);
+}
+
+// nodes are handed out from chunks each worker keeps to itself, which are freed together
+// once the walk is over
+#define WALK_CHUNK_NODES 1024
+
+typedef struct walk_chunk {
+    struct walk_chunk *next;
+    size_t used;
+    size_t capacity;
+    walk_node_t nodes[];
+} walk_chunk_t;
+
+// the directories a worker has left to read. the worker takes from the back, and others
+// steal from the front, where the larger subtrees tend to be
+typedef struct walk_deque {
+    pthread_mutex_t lock;
+    walk_node_t **nodes;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} walk_deque_t;
+
+typedef struct walk_shared {
+    filesystem_t *fs;
+    const walk_options_t *options;
+    walk_deque_t *deques;
+    size_t threads;
+    atomic_size_t pending;          // directories pushed but not read yet
+    atomic_int failed;
+} walk_shared_t;
+
+typedef struct walk_worker {
+    walk_shared_t *shared;
+    size_t id;
+    walk_chunk_t *chunks;
+    fs_dirent_t *scratch;           // the entries of the directory being read
+    size_t scratch_capacity;
+} walk_worker_t;
+
+static walk_node_t *walk_alloc(walk_worker_t *worker, size_t count) {
+    walk_chunk_t *chunk = worker->chunks;
+    if (!chunk || chunk->capacity - chunk->used < count) {
+        size_t capacity = count > WALK_CHUNK_NODES ? count : WALK_CHUNK_NODES;
+        chunk = malloc(sizeof(walk_chunk_t) + capacity * sizeof(walk_node_t));
+        if (!chunk)
+            return NULL;
+        chunk->next = worker->chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        worker->chunks = chunk;
+    }
+    walk_node_t *nodes = chunk->nodes + chunk->used;
+    chunk->used += count;
+    return nodes;
+}
+
+static int walk_push(walk_deque_t *deque, walk_node_t *node) {
+    int ret = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head == deque->tail)
+        deque->head = deque->tail = 0;
+    if (deque->tail == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        walk_node_t **nodes = realloc(deque->nodes, capacity * sizeof(walk_node_t*));
+        if (nodes) {
+            deque->nodes = nodes;
+            deque->capacity = capacity;
+        }
+        else ret = -1;
     }
-    return 0;
+    if (ret == 0)
+        deque->nodes[deque->tail++] = node;
+    pthread_mutex_unlock(&deque->lock);
+    return ret;
 }
 
-int remove_file(terminal_context_t *context, char *path) {
-    if (!context || !path)
-        return 0;
-    filesystem_t *fs = context->fs;
-    inode_t *parent;
-    char base_name[MAX_FILE_NAME_LEN + 1];
-    if (resolve_parent(context, path, &parent, base_name) != 0) {
-        REPORT_RETCODE(DIR_NOT_FOUND);
+static walk_node_t *walk_pop(walk_deque_t *deque, int steal) {
+    walk_node_t *node = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail)
+        node = steal ? deque->nodes[deque->head++] : deque->nodes[--deque->tail];
+    pthread_mutex_unlock(&deque->lock);
+    return node;
+}
+
+// reads the entries of a directory node and queues its subdirectories for the worker
+static int walk_expand(walk_worker_t *worker, walk_node_t *node) {
+    walk_shared_t *shared = worker->shared;
+    const walk_options_t *options = shared->options;
+    filesystem_t *fs = shared->fs;
+    size_t depth = node->depth + 1;
+    fs_dir_t dir = dir_open(fs, &fs->inodes[node->entry.inode]);
+    if (!dir)
         return -1;
-    }
-    size_t offset;
-    inode_index_t child_idx;
-    if (find_directory_entry(fs, parent, base_name, &offset, &child_idx) != 0) {
-        REPORT_RETCODE(FILE_NOT_FOUND);
+    size_t found = 0;
+    size_t count;
+    do {
+        if (worker->scratch_capacity - found < DIR_READ_BATCH) {
+            size_t capacity = worker->scratch_capacity ? worker->scratch_capacity * 2 : 4 * DIR_READ_BATCH;
+            fs_dirent_t *scratch = realloc(worker->scratch, capacity * sizeof(fs_dirent_t));
+            if (!scratch) {
+                free(dir);
+                return -1;
+            }
+            worker->scratch = scratch;
+            worker->scratch_capacity = capacity;
+        }
+        count = dir_read(dir, worker->scratch + found, DIR_READ_BATCH);
+        size_t end = found + count;
+        for (size_t i = found; i < end; i++) {
+            // entries that are not visited are only kept to be read through
+            const fs_dirent_t *entry = &worker->scratch[i];
+            if (strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0)
+                continue;
+            if (walk_keeps(options, entry) || (entry->type == DIRECTORY && depth < options->max_depth))
+                worker->scratch[found++] = *entry;
+        }
+    } while (count);
+    free(dir);
+    if (found == 0)
+        return 0;
+    node->children = walk_alloc(worker, found);
+    if (!node->children)
         return -1;
+    node->child_count = found;
+    for (size_t i = 0; i < found; i++) {
+        walk_node_t *child = &node->children[i];
+        child->entry = worker->scratch[i];
+        child->children = NULL;
+        child->child_count = 0;
+        child->depth = depth;
+        child->kept = walk_keeps(options, &child->entry);
     }
-    inode_t *child = &fs->inodes[child_idx];
-    if (child->internal.file_type != DATA_FILE) {
-        REPORT_RETCODE(FILE_NOT_FOUND);
-        return -1;
+    for (size_t i = 0; i < found; i++) {
+        if (node->children[i].entry.type != DIRECTORY || depth >= options->max_depth)
+            continue;
+        atomic_fetch_add(&shared->pending, 1);
+        if (walk_push(&shared->deques[worker->id], &node->children[i]) != 0) {
+            atomic_fetch_sub(&shared->pending, 1);
+            return -1;
+        }
     }
-    if (remove_directory_entry(fs, parent, base_name) != 0)
-        return -1;
-    if (inode_release_data(fs, child) != SUCCESS)
-        return -1;
-    if (release_inode(fs, child) != SUCCESS)
-        return -1;
     return 0;
 }
 
-// we can only delete a directory if it is empty!!
-int remove_directory(terminal_context_t *context, char *path) {
-    if (!context || !path)
-        return 0;
-    filesystem_t *fs = context->fs;
-    inode_t *parent;
-    char base_name[MAX_FILE_NAME_LEN + 1];
-    if (resolve_parent(context, path, &parent, base_name) != 0) {
-        REPORT_RETCODE(DIR_NOT_FOUND);
-        return -1;
+static void *walk_worker(void *arg) {
+    walk_worker_t *worker = arg;
+    walk_shared_t *shared = worker->shared;
+    while (!atomic_load(&shared->failed)) {
+        walk_node_t *node = walk_pop(&shared->deques[worker->id], 0);
+        for (size_t i = 1; !node && i < shared->threads; i++)
+            node = walk_pop(&shared->deques[(worker->id + i) % shared->threads], 1);
+        if (!node) {
+            // the others may still queue more, until every pushed directory is read
+            if (atomic_load(&shared->pending) == 0)
+                break;
+            sched_yield();
+            continue;
+        }
+        if (walk_expand(worker, node) != 0)
+            atomic_store(&shared->failed, 1);
+        atomic_fetch_sub(&shared->pending, 1);
     }
-    if (strcmp(base_name, ".") == 0 || strcmp(base_name, "..") == 0) {
-        REPORT_RETCODE(INVALID_FILENAME);
-        return -1;
+    return NULL;
+}
+
+// reads the tree under `root` with `threads` workers, the calling thread being one of them.
+// `chunks` is set to the nodes read, which the caller frees with walk_free
+static fs_retcode_t walk_read(filesystem_t *fs, walk_node_t *root, const walk_options_t *options, walk_chunk_t **chunks) {
+    *chunks = NULL;
+    size_t threads = options->threads;
+    walk_shared_t shared;
+    shared.fs = fs;
+    shared.options = options;
+    shared.threads = threads;
+    atomic_init(&shared.pending, 1);
+    atomic_init(&shared.failed, 0);
+    shared.deques = calloc(threads, sizeof(walk_deque_t));
+    walk_worker_t *workers = calloc(threads, sizeof(walk_worker_t));
+    pthread_t *handles = calloc(threads, sizeof(pthread_t));
+    if (!shared.deques || !workers || !handles) {
+        free(shared.deques);
+        free(workers);
+        free(handles);
+        return SYSTEM_ERROR;
     }
-    size_t offset;
-    inode_index_t child_idx;
-    if (find_directory_entry(fs, parent, base_name, &offset, &child_idx) != 0) {
-        REPORT_RETCODE(DIR_NOT_FOUND);
-        return -1;
+    for (size_t i = 0; i < threads; i++) {
+        pthread_mutex_init(&shared.deques[i].lock, NULL);
+        workers[i].shared = &shared;
+        workers[i].id = i;
     }
-    inode_t *child = &fs->inodes[child_idx];
-    if (child->internal.file_type != DIRECTORY) {
-        REPORT_RETCODE(DIR_NOT_FOUND);
-        return -1;
+    fs_retcode_t ret = SUCCESS;
+    if (walk_push(&shared.deques[threads - 1], root) != 0)
+        ret = SYSTEM_ERROR;
+    size_t started = 0;
+    for (; ret == SUCCESS && started + 1 < threads; started++) {
+        // the workers started so far finish the walk without the others
+        if (pthread_create(&handles[started], NULL, walk_worker, &workers[started]) != 0)
+            break;
     }
-    if (child->internal.file_size > 2 * DIRECTORY_ENTRY_SIZE) {
-        REPORT_RETCODE(DIR_NOT_EMPTY);
-        return -1;
+    if (ret == SUCCESS)
+        walk_worker(&workers[threads - 1]);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(handles[i], NULL);
+    if (atomic_load(&shared.failed))
+        ret = SYSTEM_ERROR;
+    for (size_t i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&shared.deques[i].lock);
+        free(shared.deques[i].nodes);
+        free(workers[i].scratch);
+        while (workers[i].chunks) {
+            walk_chunk_t *chunk = workers[i].chunks;
+            workers[i].chunks = chunk->next;
+            chunk->next = *chunks;
+            *chunks = chunk;
+        }
     }
-    if (child == context->working_directory) {
-        REPORT_RETCODE(ATTEMPT_DELETE_CWD);
-        return -1;
+    free(shared.deques);
+    free(workers);
+    free(handles);
+    return ret;
+}
+
+static void walk_free(walk_chunk_t *chunks) {
+    while (chunks) {
+        walk_chunk_t *next = chunks->next;
+        free(chunks);
+        chunks = next;
     }
-    if (remove_directory_entry(fs, parent, base_name) != 0)
-        return -1;
-    if (inode_release_data(fs, child) != SUCCESS)
-        return -1;
-    if (release_inode(fs, child) != SUCCESS)
+}
+
+// the path of the entry being visited, grown as needed
+typedef struct walk_path {
+    char *buffer;
+    size_t len;
+    size_t capacity;
+} walk_path_t;
+
+// starts at the walked path, dropping trailing slashes so the names are joined with one
+static int walk_path_init(walk_path_t *path, const char *root) {
+    path->len = strlen(root);
+    while (path->len > 1 && root[path->len - 1] == '/')
+        path->len--;
+    path->capacity = path->len + 1 > 64 ? path->len + 1 : 64;
+    if (!(path->buffer = malloc(path->capacity)))
         return -1;
+    memcpy(path->buffer, root, path->len);
+    path->buffer[path->len] = '\0';
     return 0;
 }
 
-int change_directory(terminal_context_t *context, char *path) {
-    if (!context || !path)
-        return 0;
-    inode_t *target;
-    if (resolve_path(context, path, &target) != 0) {
-        REPORT_RETCODE(DIR_NOT_FOUND);
-        return -1;
-    }
-    if (target->internal.file_type != DIRECTORY) {
-        REPORT_RETCODE(DIR_NOT_FOUND);
-        return -1;
+// sets the path to its first `prefix_len` bytes followed by `/name`
+static int walk_path_join(walk_path_t *path, size_t prefix_len, const char *name) {
+    size_t name_len = strlen(name);
+    size_t len = prefix_len + 1 + name_len;
+    if (len + 1 > path->capacity) {
+        size_t capacity = path->capacity * 2 > len + 1 ? path->capacity * 2 : len + 1;
+        char *grown = realloc(path->buffer, capacity);
+        if (!grown)
+            return -1;
+        path->buffer = grown;
+        path->capacity = capacity;
     }
-    context->working_directory = target;
+    path->buffer[prefix_len] = '/';
+    memcpy(path->buffer + prefix_len + 1, name, name_len + 1);
+    path->len = len;
     return 0;
 }
 
-int list(terminal_context_t *context, char *path) {
-    if (!context || !path)
-        return 0;
+static void walk_path_visit(const walk_options_t *options, const fs_dirent_t *entry, const walk_path_t *path,
+                            size_t depth) {
+    fs_walk_entry_t visited = { entry, path->buffer, depth };
+    options->visit(&visited, options->arg);
+}
+
+typedef struct walk_frame {
+    walk_node_t *nodes;
+    size_t count;
+    size_t next;
+    size_t path_len;
+} walk_frame_t;
+
+// visits the nodes read under `root` in order, with an explicit stack so deep trees do not
+// overflow the call stack
+static fs_retcode_t walk_visit(walk_node_t *root, walk_path_t *path, const walk_options_t *options) {
+    if (root->kept)
+        walk_path_visit(options, &root->entry, path, 0);
+    fs_retcode_t ret = SUCCESS;
+    walk_frame_t *stack = NULL;
+    size_t depth = 0, capacity = 0;
+    walk_node_t *node = root;
+    for (;;) {
+        if (node->children) {
+            if (depth == capacity) {
+                size_t grown_capacity = capacity ? capacity * 2 : 16;
+                walk_frame_t *grown = realloc(stack, grown_capacity * sizeof(walk_frame_t));
+                if (!grown) {
+                    ret = SYSTEM_ERROR;
+                    break;
+                }
+                stack = grown;
+                capacity = grown_capacity;
+            }
+            stack[depth++] = (walk_frame_t) { node->children, node->child_count, 0, path->len };
+        }
+        while (depth > 0 && stack[depth - 1].next == stack[depth - 1].count)
+            depth--;
+        if (depth == 0)
+            break;
+        walk_frame_t *frame = &stack[depth - 1];
+        node = &frame->nodes[frame->next++];
+        if (walk_path_join(path, frame->path_len, node->entry.name) != 0) {
+            ret = SYSTEM_ERROR;
+            break;
+        }
+        if (node->kept)
+            walk_path_visit(options, &node->entry, path, depth);
+    }
+    free(stack);
+    return ret;
+}
+
+// a directory a streaming walk is in the middle of, with the entries it read last
+typedef struct walk_stream_frame {
+    struct fs_dir dir;
+    fs_dirent_t entries[DIR_READ_BATCH];
+    size_t count;
+    size_t next;
+    size_t path_len;
+} walk_stream_frame_t;
+
+// visits the tree on the calling thread as it is read, a directory at a time. the frames
+// of the directories being read are kept on an explicit stack, one allocation a level, and
+// never move, since a directory iterator can point into itself
+static fs_retcode_t walk_stream(filesystem_t *fs, const fs_dirent_t *root, walk_path_t *path,
+                                const walk_options_t *options) {
+    if (walk_keeps(options, root))
+        walk_path_visit(options, root, path, 0);
+    fs_retcode_t ret = SUCCESS;
+    walk_stream_frame_t **stack = NULL;
+    size_t depth = 0, allocated = 0, capacity = 0;
+    const fs_dirent_t *next_dir = root->type == DIRECTORY && options->max_depth > 0 ? root : NULL;
+    while (next_dir || depth > 0) {
+        if (next_dir) {
+            if (depth == allocated) {
+                if (allocated == capacity) {
+                    size_t grown_capacity = capacity ? capacity * 2 : 16;
+                    walk_stream_frame_t **grown = realloc(stack, grown_capacity * sizeof(walk_stream_frame_t*));
+                    if (!grown) {
+                        ret = SYSTEM_ERROR;
+                        break;
+                    }
+                    stack = grown;
+                    capacity = grown_capacity;
+                }
+                if (!(stack[allocated] = malloc(sizeof(walk_stream_frame_t)))) {
+                    ret = SYSTEM_ERROR;
+                    break;
+                }
+                allocated++;
+            }
+            walk_stream_frame_t *frame = stack[depth++];
+            dir_init(&frame->dir, fs, &fs->inodes[next_dir->inode]);
+            frame->count = frame->next = 0;
+            frame->path_len = path->len;
+            next_dir = NULL;
+        }
+        walk_stream_frame_t *frame = stack[depth - 1];
+        if (frame->next == frame->count) {
+            frame->count = dir_read(&frame->dir, frame->entries, DIR_READ_BATCH);
+            frame->next = 0;
+            if (frame->count == 0)
+                depth--;
+            continue;
+        }
+        const fs_dirent_t *entry = &frame->entries[frame->next++];
+        if (strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0)
+            continue;
+        if (walk_path_join(path, frame->path_len, entry->name) != 0) {
+            ret = SYSTEM_ERROR;
+            break;
+        }
+        if (walk_keeps(options, entry))
+            walk_path_visit(options, entry, path, depth);
+        if (entry->type == DIRECTORY && depth < options->max_depth)
+            next_dir = entry;
+    }
+    for (size_t i = 0; i < allocated; i++)
+        free(stack[i]);
+    free(stack);
+    return ret;
+}
+
+// walks the tree at `path`: streamed on the calling thread with one thread, otherwise read
+// whole by the workers then visited
+static int walk_run(terminal_context_t *context, char *path, const walk_options_t *options) {
     filesystem_t *fs = context->fs;
     inode_t *target;
     if (resolve_path(context, path, &target) != 0) {
         REPORT_RETCODE(DIR_NOT_FOUND);
         return -1;
     }
-    if (target->internal.file_type == DATA_FILE) {
-        char perm[4] = {
-            (target->internal.file_perms & FS_READ) ? 'r' : '-',
-            (target->internal.file_perms & FS_WRITE) ? 'w' : '-',
-            (target->internal.file_perms & FS_EXECUTE) ? 'x' : '-',
-            '\0'
-        };
-        printf("f%s\t%lu\t%s\n", perm, (unsigned long) target->internal.file_size, target->internal.file_name);
-    } else if (target->internal.file_type == DIRECTORY) {
-        size_t entries = target->internal.file_size / DIRECTORY_ENTRY_SIZE;
-        for (size_t i = 0; i < entries; i++) {
-            size_t offset = i * DIRECTORY_ENTRY_SIZE;
-            byte buf[DIRECTORY_ENTRY_SIZE];
-            size_t br;
-            if (inode_read_data(fs, target, offset, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
-                continue;
-            inode_index_t idx;
-            memcpy(&idx, buf, sizeof(inode_index_t));
-            if (idx == 0)
-                continue;
-            char entry_name[MAX_FILE_NAME_LEN + 1];
-            memcpy(entry_name, buf + sizeof(inode_index_t), MAX_FILE_NAME_LEN);
-            entry_name[MAX_FILE_NAME_LEN] = '\0';
-            inode_t *child = &fs->inodes[idx];
-            char type = (child->internal.file_type == DIRECTORY) ? 'd' :
-                        (child->internal.file_type == DATA_FILE) ? 'f' : 'E';
-            char perm[4] = {
-                (child->internal.file_perms & FS_READ) ? 'r' : '-',
-                (child->internal.file_perms & FS_WRITE) ? 'w' : '-',
-                (child->internal.file_perms & FS_EXECUTE) ? 'x' : '-',
-                '\0'
-            };
-            if (strcmp(entry_name, ".") == 0 || strcmp(entry_name, "..") == 0) {
-                printf("%c%s\t%lu\t%s -> %s\n", type, perm, (unsigned long) child->internal.file_size, entry_name, child->internal.file_name);
-            } else {
-                printf("%c%s\t%lu\t%s\n", type, perm, (unsigned long) child->internal.file_size, entry_name);
-            }
-        }
+    walk_node_t root;
+    dirent_fill(fs, &root.entry, target->internal.file_name, target - fs->inodes);
+    root.children = NULL;
+    root.child_count = 0;
+    root.depth = 0;
+    root.kept = walk_keeps(options, &root.entry);
+    walk_path_t walked;
+    if (walk_path_init(&walked, path) != 0) {
+        REPORT_RETCODE(SYSTEM_ERROR);
+        return -1;
+    }
+    fs_retcode_t ret = SUCCESS;
+    if (options->threads <= 1) {
+        ret = walk_stream(fs, &root.entry, &walked, options);
     } else {
+        walk_chunk_t *chunks = NULL;
+        if (root.entry.type == DIRECTORY && options->max_depth > 0)
+            ret = walk_read(fs, &root, options, &chunks);
+        if (ret == SUCCESS)
+            ret = walk_visit(&root, &walked, options);
+        walk_free(chunks);
+    }
+    free(walked.buffer);
+    if (ret != SUCCESS) {
+        REPORT_RETCODE_EXT(ret);
         return -1;
     }
     return 0;
 }
 
-char *get_path_string(terminal_context_t *context) {
-    if (!context)
-        return strdup("");
-    filesystem_t *fs = context->fs;
-    char *names[256];
-    int count = 0;
-    inode_t *curr = context->working_directory;
-    while (curr != &fs->inodes[0] && count < 256) {
-        names[count++] = strdup(curr->internal.file_name);
-        byte buf[DIRECTORY_ENTRY_SIZE];
-        size_t br;
-        if (inode_read_data(fs, curr, DIRECTORY_ENTRY_SIZE, buf, DIRECTORY_ENTRY_SIZE, &br) != SUCCESS)
-            break;
-        inode_index_t parent_idx;
-        memcpy(&parent_idx, buf, sizeof(inode_index_t));
-        curr = &fs->inodes[parent_idx];
-    }
-    names[count++] = strdup(fs->inodes[0].internal.file_name);
-    size_t total_length = 0;
-    for (int i = 0; i < count; i++) {
-        total_length += strlen(names[i]) + 1;
-    }
-    char *path_str = malloc(total_length + 1);
-    if (!path_str) {
-        for (int i = 0; i < count; i++)
-            free(names[i]);
-        return strdup("");
-    }
-    path_str[0] = '\0';
-    for (int i = count - 1; i >= 0; i--) {
-        strcat(path_str, names[i]);
-        if (i > 0)
-            strcat(path_str, "/");
-        free(names[i]);
+int fs_walk(terminal_context_t *context, char *path, size_t threads, fs_walk_visit_t visit, void *arg) {
+    if (!context || !path || !visit)
+        return 0;
+    walk_options_t options = { threads, SIZE_MAX, NULL, visit, arg };
+    return walk_run(context, path, &options);
+}
+
+// `tree` and `find` format their lines in a buffer of this size and write it out whenever
+// it fills
+#define LINE_OUTPUT_SIZE (64 * 1024)
+
+typedef struct line_output {
+    size_t len;
+    char buffer[LINE_OUTPUT_SIZE];
+} line_output_t;
+
+static void line_flush(line_output_t *out) {
+    fwrite(out->buffer, 1, out->len, stdout);
+    out->len = 0;
+}
+
+// adds `len` bytes of `fill`, or of `text` if it is not null
+static void line_put(line_output_t *out, const char *text, char fill, size_t len) {
+    while (len > 0) {
+        if (out->len == LINE_OUTPUT_SIZE)
+            line_flush(out);
+        size_t chunk = LINE_OUTPUT_SIZE - out->len;
+        if (chunk > len)
+            chunk = len;
+        if (text) {
+            memcpy(out->buffer + out->len, text, chunk);
+            text += chunk;
+        }
+        else memset(out->buffer + out->len, fill, chunk);
+        out->len += chunk;
+        len -= chunk;
     }
-    return path_str;
 }
 
+// adds a line of `indent` spaces followed by the text
+static void line_add(line_output_t *out, size_t indent, const char *text) {
+    line_put(out, NULL, ' ', indent);
+    line_put(out, text, 0, strlen(text));
+    line_put(out, NULL, '\n', 1);
+}
 
-int tree(terminal_context_t *context, char *path) {
+static line_output_t *line_output_new(void) {
+    line_output_t *out = malloc(sizeof(line_output_t));
+    if (out)
+        out->len = 0;
+    else
+        REPORT_RETCODE(SYSTEM_ERROR);
+    return out;
+}
+
+static void line_output_free(line_output_t *out) {
+    line_flush(out);
+    free(out);
+}
+
+typedef struct find_state {
+    const fs_find_query_t *query;
+    line_output_t *out;
+} find_state_t;
+
+// every level of `tree` is indented by three spaces
+static void tree_visit(const fs_walk_entry_t *visited, void *arg) {
+    line_add(arg, 3 * visited->depth, visited->entry->name);
+}
+
+int fs_tree(terminal_context_t *context, char *path, size_t threads) {
     if (!context || !path)
         return 0;
-    inode_t *target;
-    if (resolve_path(context, path, &target) != 0) {
-        REPORT_RETCODE(DIR_NOT_FOUND);
+    line_output_t *out = line_output_new();
+    if (!out)
         return -1;
+    walk_options_t options = { threads, SIZE_MAX, NULL, tree_visit, out };
+    int ret = walk_run(context, path, &options);
+    line_output_free(out);
+    return ret;
+}
+
+static void du_visit(const fs_walk_entry_t *visited, void *arg) {
+    if (visited->entry->type == DATA_FILE)
+        *(size_t*) arg += visited->entry->size;
+}
+
+int fs_du(terminal_context_t *context, char *path, size_t threads, size_t *bytes) {
+    if (!bytes)
+        return 0;
+    *bytes = 0;
+    fs_ext_t *ext = context ? fs_ext(context->fs) : NULL;
+    if (path && ext && ext->dir_totals) {
+        inode_t *target;
+        if (resolve_path(context, path, &target) != 0) {
+            REPORT_RETCODE(DIR_NOT_FOUND);
+            return -1;
+        }
+        *bytes = ext->dir_totals[target - context->fs->inodes].bytes;
+        return 0;
     }
-    tree_helper(context->fs, target, 0);
-    return 0;
+    return fs_walk(context, path, threads, du_visit, bytes);
+}
+
+// the predicates of `find` only look at the entry, whose type and size come from the inode
+// table, so no data is read to test them
+static int find_keep(const fs_dirent_t *entry, void *arg) {
+    const fs_find_query_t *query = ((const find_state_t*) arg)->query;
+    if (query->type == 'f' && entry->type != DATA_FILE)
+        return 0;
+    if (query->type == 'd' && entry->type != DIRECTORY)
+        return 0;
+    if ((query->size_op == '+' && entry->size <= query->size)
+        || (query->size_op == '-' && entry->size >= query->size)
+        || (query->size_op == '=' && entry->size != query->size))
+        return 0;
+    return !query->name || fnmatch(query->name, entry->name, 0) == 0;
+}
+
+static void find_visit(const fs_walk_entry_t *visited, void *arg) {
+    line_add(((find_state_t*) arg)->out, 0, visited->path);
+}
+
+int fs_find(terminal_context_t *context, char *path, const fs_find_query_t *query, size_t threads) {
+    if (!context || !path || !query)
+        return 0;
+    find_state_t state = { query, line_output_new() };
+    if (!state.out)
+        return -1;
+    size_t max_depth = query->max_depth < 0 ? SIZE_MAX : (size_t) query->max_depth;
+    walk_options_t options = { threads, max_depth, find_keep, find_visit, &state };
+    int ret = walk_run(context, path, &options);
+    line_output_free(state.out);
+    return ret;
 }
 
 //Part 2
@@ -513,88 +2358,29 @@ fs_file_t fs_open(terminal_context_t *context, char *path)
 {
     if (!context || !path) return NULL;
     filesystem_t *fs = context->fs;
-    inode_t *cwd = context->working_directory;
-
-    char *pcopy = strdup(path);
-    if (!pcopy) return NULL;
-
-    char *token = strtok(pcopy, "/");
-    inode_t *dir = cwd;
-    char *next;
-    while (token) {
-        next = strtok(NULL, "/");
-        if (!next) break;
-        size_t dir_size = dir->internal.file_size;
-        size_t entries = dir_size / DIRECTORY_ENTRY_SIZE;
-        int found = 0;
-        for (size_t i = 0; i < entries; i++) {
-            size_t offset = i * DIRECTORY_ENTRY_SIZE;
-            byte buf[DIRECTORY_ENTRY_SIZE];
-            size_t br;
-            inode_read_data(fs, dir, offset, buf, DIRECTORY_ENTRY_SIZE, &br);
-            inode_index_t idx;
-            memcpy(&idx, buf, sizeof(idx));
-            char name[MAX_FILE_NAME_LEN+1];
-            memcpy(name, buf + sizeof(idx), MAX_FILE_NAME_LEN);
-            name[MAX_FILE_NAME_LEN] = '\0';
-            if (strcmp(name, token)==0) {
-                if (fs->inodes[idx].internal.file_type != DIRECTORY) {
-                    REPORT_RETCODE(DIR_NOT_FOUND);
-                    free(pcopy);
-                    return NULL;
-                }
-                dir = &fs->inodes[idx];
-                found = 1;
-                break;
-            }
-        }
-        if (!found) {
-            REPORT_RETCODE(DIR_NOT_FOUND);
-            free(pcopy);
-            return NULL;
-        }
-        token = next;
-    }
+    inode_t *dir = context->working_directory;
 
-    char *basename = token;
-    size_t dir_size = dir->internal.file_size;
-    size_t entries = dir_size / DIRECTORY_ENTRY_SIZE;
-    inode_t *file_inode = NULL;
-    for (size_t i = 0; i < entries; i++) {
-        size_t offset = i * DIRECTORY_ENTRY_SIZE;
-        byte buf[DIRECTORY_ENTRY_SIZE];
-        size_t br;
-        inode_read_data(fs, dir, offset, buf, DIRECTORY_ENTRY_SIZE, &br);
-        inode_index_t idx;
-        memcpy(&idx, buf, sizeof(idx));
-        char name[MAX_FILE_NAME_LEN+1];
-        memcpy(name, buf + sizeof(idx), MAX_FILE_NAME_LEN);
-        name[MAX_FILE_NAME_LEN] = '\0';
-        if (strcmp(name, basename)==0) {
-            file_inode = &fs->inodes[idx];
-            break;
-        }
+    size_t len;
+    const char *basename = path_base(path, &len);
+    if (basename && (path_walk(fs, &dir, path, basename) != 0 || dir->internal.file_type != DIRECTORY)) {
+        REPORT_RETCODE(DIR_NOT_FOUND);
+        return NULL;
     }
-    if (!file_inode) {
+    inode_t *file_inode = dir;
+    if (!basename || path_step(fs, &file_inode, basename, len) != 0) {
         REPORT_RETCODE(FILE_NOT_FOUND);
-        free(pcopy);
         return NULL;
     }
     if (file_inode->internal.file_type != DATA_FILE) {
         REPORT_RETCODE(INVALID_FILE_TYPE);
-        free(pcopy);
         return NULL;
     }
 
     fs_file_t f = malloc(sizeof(*f));
-    if (!f) {
-        free(pcopy);
-        return NULL;
-    }
+    if (!f) return NULL;
     f->fs = fs;
     f->inode = file_inode;
     f->offset = 0;
-    free(pcopy);
     return f;
 }
 
@@ -608,7 +2394,7 @@ size_t fs_read(fs_file_t file, void *buffer, size_t n)
     if (!file || !buffer) return 0;
     size_t bytes_read = 0;
     fs_retcode_t ret = inode_read_data(file->fs, file->inode, file->offset, buffer, n, &bytes_read);
-    if (ret != SUCCESS) REPORT_RETCODE(ret);
+    if (ret != SUCCESS) REPORT_RETCODE_EXT(ret);
     file->offset += bytes_read;
     return bytes_read;
 }
@@ -624,7 +2410,7 @@ size_t fs_write(fs_file_t file, void *buffer, size_t n)
         size_t to_over = (off + n <= sz) ? n : (sz - off);
         fs_retcode_t ret = inode_modify_data(file->fs, file->inode, off, buffer, to_over);
         if (ret != SUCCESS) {
-            REPORT_RETCODE(ret);
+            REPORT_RETCODE_EXT(ret);
             return 0;
         }
         written += to_over;
@@ -634,7 +2420,7 @@ size_t fs_write(fs_file_t file, void *buffer, size_t n)
         size_t to_app = off + n - sz;
         fs_retcode_t ret = inode_write_data(file->fs, file->inode, (byte*)buffer + written, to_app);
         if (ret != SUCCESS) {
-            REPORT_RETCODE(ret);
+            REPORT_RETCODE_EXT(ret);
             return written;
         }
         written += to_app;
@@ -644,6 +2430,56 @@ size_t fs_write(fs_file_t file, void *buffer, size_t n)
     return n;
 }
 
+size_t fs_readv(fs_file_t file, const fs_iovec_t *iov, size_t iovcnt)
+{
+    if (!file) return 0;
+    size_t bytes_read = 0;
+    fs_retcode_t ret = inode_read_datav(file->fs, file->inode, file->offset, iov, iovcnt, &bytes_read);
+    if (ret != SUCCESS) {
+        REPORT_RETCODE_EXT(ret);
+        return 0;
+    }
+    file->offset += bytes_read;
+    return bytes_read;
+}
+
+size_t fs_writev(fs_file_t file, const fs_iovec_t *iov, size_t iovcnt)
+{
+    if (!file) return 0;
+    fs_retcode_t ret = inode_modify_datav(file->fs, file->inode, file->offset, iov, iovcnt);
+    if (ret != SUCCESS) {
+        REPORT_RETCODE_EXT(ret);
+        return 0;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < iovcnt; i++) n += iov[i].len;
+    file->offset += n;
+    return n;
+}
+
+size_t fs_pread(fs_file_t file, void *buffer, size_t n, size_t offset)
+{
+    if (!file || !buffer) return 0;
+    size_t bytes_read = 0;
+    fs_retcode_t ret = inode_read_data(file->fs, file->inode, offset, buffer, n, &bytes_read);
+    if (ret != SUCCESS) {
+        REPORT_RETCODE_EXT(ret);
+        return 0;
+    }
+    return bytes_read;
+}
+
+size_t fs_pwrite(fs_file_t file, void *buffer, size_t n, size_t offset)
+{
+    if (!file || !buffer) return 0;
+    fs_retcode_t ret = inode_modify_data(file->fs, file->inode, offset, buffer, n);
+    if (ret != SUCCESS) {
+        REPORT_RETCODE_EXT(ret);
+        return 0;
+    }
+    return n;
+}
+
 int fs_seek(fs_file_t file, seek_mode_t mode, int offset) {
     if (file == NULL)
         return -1;
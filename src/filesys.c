@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "filesys.h"
+#include "fs_ext.h"
 #include "debug.h"
 #include "utility.h"
 
@@ -27,6 +29,97 @@ static void mark_dblock_as_unused(byte *dblock_bitmask, size_t n)
     dblock_bitmask[n / 8] |= 1 << (7 - n % 8);
 }
 
+static int dblock_is_available(byte *dblock_bitmask, size_t n)
+{
+    return (dblock_bitmask[n / 8] >> (7 - n % 8)) & 1;
+}
+
+// ----------------------- LOG-STRUCTURED ALLOCATION ----------------------- //
+
+// the state of the log-structured mode, null unless it is on
+static fs_log_t *log_of(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    return ext ? ext->log : NULL;
+}
+
+static size_t log_segment_size(filesystem_t *fs, size_t segment)
+{
+    size_t first = segment * LOG_SEGMENT_DBLOCKS;
+    return (fs->dblock_count - first < LOG_SEGMENT_DBLOCKS) ? fs->dblock_count - first : LOG_SEGMENT_DBLOCKS;
+}
+
+static void log_note_claim(filesystem_t *fs, size_t n)
+{
+    fs_log_t *log = log_of(fs);
+    if (!log) return;
+    if (log->live[n / LOG_SEGMENT_DBLOCKS]++ == 0) --log->free_segments;
+}
+
+static void log_note_release(filesystem_t *fs, size_t n)
+{
+    fs_log_t *log = log_of(fs);
+    if (!log) return;
+    if (--log->live[n / LOG_SEGMENT_DBLOCKS] == 0) ++log->free_segments;
+}
+
+// marks an available dblock as claimed
+static void claim_dblock(filesystem_t *fs, size_t n)
+{
+    mark_dblock_as_used(fs->dblock_bitmask, n);
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->free_dblock_count != FREE_DBLOCK_COUNT_UNKNOWN) --ext->free_dblock_count;
+    log_note_claim(fs, n);
+    // a claimed dblock that is never written still matches its checksum
+    checksum_update(fs, n);
+}
+
+// moves the head of the log to the next free segment after the current one, or to the
+// segment with the most room if none is free
+static int log_next_segment(filesystem_t *fs)
+{
+    fs_log_t *log = log_of(fs);
+    size_t start = log->head_end / LOG_SEGMENT_DBLOCKS;
+    size_t best = log->segment_count;
+    size_t best_room = 0;
+    for (size_t i = 0; i < log->segment_count; ++i)
+    {
+        size_t segment = (start + i) % log->segment_count;
+        if (log->cleaning && log->cleaning[segment]) continue;
+        size_t room = log_segment_size(fs, segment) - log->live[segment];
+        if (log->live[segment] == 0)
+        {
+            best = segment;
+            break;
+        }
+        if (room > best_room)
+        {
+            best = segment;
+            best_room = room;
+        }
+    }
+    if (best == log->segment_count) return 0;
+    log->head = best * LOG_SEGMENT_DBLOCKS;
+    log->head_end = log->head + log_segment_size(fs, best);
+    return 1;
+}
+
+static fs_retcode_t log_claim(filesystem_t *fs, dblock_index_t *index)
+{
+    fs_log_t *log = log_of(fs);
+    for (;;)
+    {
+        for (; log->head < log->head_end; ++log->head)
+        {
+            if (!dblock_is_available(fs->dblock_bitmask, log->head)) continue;
+            *index = log->head++;
+            claim_dblock(fs, *index);
+            return SUCCESS;
+        }
+        if (!log_next_segment(fs)) return DBLOCK_UNAVAILABLE;
+    }
+}
+
 // ----------------------- CORE FUNCTION ----------------------- //
 
 fs_retcode_t new_filesystem(filesystem_t *fs, size_t inode_total, size_t dblock_total)
@@ -76,6 +169,11 @@ fs_retcode_t new_filesystem(filesystem_t *fs, size_t inode_total, size_t dblock_
     fs->dblock_bitmask = dblock_bitmask;
     fs->dblocks = dblocks;
     fs->dblock_count = dblock_total;
+    // a state left behind by a file system whose dblocks were freed without free_filesystem
+    // would be found again if the new dblocks landed at the same address
+    fs_ext_drop(fs);
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext) ext->free_dblock_count = dblock_total - 1;
 
     return SUCCESS;
 }
@@ -85,6 +183,25 @@ void free_filesystem(filesystem_t *fs)
     if (!fs) return;
     free(fs->inodes);
     free(fs->dblock_bitmask);
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext)
+    {
+        free(ext->dblock_refs);
+        for (size_t i = 0; i < ext->snapshot_count; ++i) free(ext->snapshots[i].inodes);
+        free(ext->snapshots);
+        if (ext->tails) free(ext->tails->used);
+        free(ext->tails);
+        free(ext->dentries);
+        free(ext->dir_slots);
+        if (ext->path_cache) free(ext->path_cache->path);
+        free(ext->path_cache);
+    }
+    dedup_disable(fs);
+    checksum_disable(fs);
+    log_disable(fs);
+    dir_totals_disable(fs);
+    fs_ext_drop(fs);
+    // the dblocks go last, the state of the added features is found by them
     free(fs->dblocks);
 }
 
@@ -104,6 +221,8 @@ size_t available_inodes(filesystem_t *fs)
 size_t available_dblocks(filesystem_t *fs)
 {
     if (!fs) return 0;
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->free_dblock_count != FREE_DBLOCK_COUNT_UNKNOWN) return ext->free_dblock_count;
     size_t count = 0;
     for (size_t i = 0; i < fs->dblock_count; ++i)
     {
@@ -111,6 +230,7 @@ size_t available_dblocks(filesystem_t *fs)
         size_t bit_idx = i % 8;
         if (fs->dblock_bitmask[block_idx] & (1 << (7 - bit_idx))) ++count;
     }
+    if (ext) ext->free_dblock_count = count;
     return count;
 }
 
@@ -128,6 +248,7 @@ fs_retcode_t claim_available_inode(filesystem_t *fs, inode_index_t *index)
 fs_retcode_t claim_available_dblock(filesystem_t *fs, dblock_index_t *index)
 {
     if (!fs || !index) return INVALID_INPUT;
+    if (log_of(fs)) return log_claim(fs, index);
 
     for (size_t i = 0; i < fs->dblock_count; ++i)
     {
@@ -138,7 +259,7 @@ fs_retcode_t claim_available_dblock(filesystem_t *fs, dblock_index_t *index)
         {
             // claim the data block
             *index = i;
-            mark_dblock_as_used(fs->dblock_bitmask, i);
+            claim_dblock(fs, i);
             return SUCCESS;
         }
     }
@@ -172,7 +293,923 @@ fs_retcode_t release_dblock(filesystem_t *fs, byte *dblock)
     // if (dblock_idx < 0 || dblock_idx >= (long) fs->dblock_count) return INVALID_INPUT;
 
     // enable bit in the bitmask marking availablity
+    if (!dblock_is_available(fs->dblock_bitmask, dblock_idx))
+    {
+        fs_ext_t *ext = fs_ext(fs);
+        if (ext && ext->free_dblock_count != FREE_DBLOCK_COUNT_UNKNOWN) ++ext->free_dblock_count;
+        log_note_release(fs, dblock_idx);
+    }
     mark_dblock_as_unused(fs->dblock_bitmask, dblock_idx);
+    dedup_forget(fs, dblock_idx);
+
+    return SUCCESS;
+}
+
+static int compare_dblock_index(const void *a, const void *b)
+{
+    dblock_index_t lhs = *(const dblock_index_t *) a;
+    dblock_index_t rhs = *(const dblock_index_t *) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+fs_retcode_t release_dblocks(filesystem_t *fs, dblock_index_t *indices, size_t count)
+{
+    if (!fs || (!indices && count)) return INVALID_INPUT;
+    if (count == 0) return SUCCESS;
+
+    qsort(indices, count, sizeof(dblock_index_t), compare_dblock_index);
+    if (indices[count - 1] >= fs->dblock_count) return INVALID_INPUT;
+
+    // build the mask for one bitmask byte at a time and apply it once
+    size_t freed = 0;
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t byte_idx = indices[i] / 8;
+        byte mask = 0;
+        for (; i < count && indices[i] / 8 == byte_idx; ++i)
+            mask |= 1 << (7 - indices[i] % 8);
+        byte newly_freed = mask & ~fs->dblock_bitmask[byte_idx];
+        fs->dblock_bitmask[byte_idx] |= mask;
+        for (size_t bit = 0; bit < 8; ++bit)
+            if (newly_freed & (1 << (7 - bit))) log_note_release(fs, byte_idx * 8 + bit);
+        for (; newly_freed; newly_freed &= newly_freed - 1) ++freed;
+    }
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->free_dblock_count != FREE_DBLOCK_COUNT_UNKNOWN) ext->free_dblock_count += freed;
+    if (ext && ext->dedup)
+        for (i = 0; i < count; ++i) dedup_forget(fs, indices[i]);
+
+    return SUCCESS;
+}
+
+fs_retcode_t ref_dblock(filesystem_t *fs, dblock_index_t index)
+{
+    if (!fs || index >= fs->dblock_count) return INVALID_INPUT;
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    // the table stores references beyond the first, so it stays zeroed until a dblock is shared
+    if (!ext->dblock_refs)
+    {
+        ext->dblock_refs = calloc(fs->dblock_count, sizeof(uint32_t));
+        if (!ext->dblock_refs) return SYSTEM_ERROR;
+    }
+    ++ext->dblock_refs[index];
+    return SUCCESS;
+}
+
+int unref_dblock(filesystem_t *fs, dblock_index_t index)
+{
+    if (!fs || index >= fs->dblock_count) return 0;
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dblock_refs || ext->dblock_refs[index] == 0) return 1;
+    --ext->dblock_refs[index];
+    return 0;
+}
+
+size_t dblock_ref_count(filesystem_t *fs, dblock_index_t index)
+{
+    if (!fs || index >= fs->dblock_count) return 0;
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dblock_refs) return 1;
+    return (size_t) ext->dblock_refs[index] + 1;
+}
+
+size_t shared_dblocks(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dblock_refs) return 0;
+    size_t count = 0;
+    for (size_t i = 0; i < fs->dblock_count; ++i)
+        if (ext->dblock_refs[i]) ++count;
+    return count;
+}
+
+// ----------------------- DEDUPLICATION ----------------------- //
+
+static int dedup_is_indexed(dedup_index_t *dedup, dblock_index_t index)
+{
+    return (dedup->indexed[index / 8] >> (index % 8)) & 1;
+}
+
+fs_retcode_t dedup_enable(filesystem_t *fs)
+{
+    if (!fs) return INVALID_INPUT;
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    if (ext->dedup) return SUCCESS;
+    dedup_index_t *dedup = calloc(1, sizeof(dedup_index_t));
+    if (!dedup) return SYSTEM_ERROR;
+    // about two dblocks per chain when every dblock is indexed
+    dedup->bucket_count = 1;
+    while (dedup->bucket_count * 2 < fs->dblock_count) dedup->bucket_count *= 2;
+    dedup->buckets = malloc(dedup->bucket_count * sizeof(dblock_index_t));
+    dedup->next = calloc(fs->dblock_count, sizeof(dblock_index_t));
+    dedup->hashes = calloc(fs->dblock_count, sizeof(uint32_t));
+    dedup->indexed = calloc(DBLOCK_MASK_SIZE(fs->dblock_count), sizeof(byte));
+    ext->dedup = dedup;
+    if (!dedup->buckets || !dedup->next || !dedup->hashes || !dedup->indexed)
+    {
+        dedup_disable(fs);
+        return SYSTEM_ERROR;
+    }
+    for (size_t i = 0; i < dedup->bucket_count; ++i) dedup->buckets[i] = DBLOCK_NONE;
+    return SUCCESS;
+}
+
+void dedup_disable(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dedup) return;
+    free(ext->dedup->buckets);
+    free(ext->dedup->next);
+    free(ext->dedup->hashes);
+    free(ext->dedup->indexed);
+    free(ext->dedup);
+    ext->dedup = NULL;
+}
+
+dblock_index_t dedup_find(filesystem_t *fs, const byte *data, uint32_t hash)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dedup || !data) return DBLOCK_NONE;
+    dedup_index_t *dedup = ext->dedup;
+    dblock_index_t iter = dedup->buckets[hash & (dedup->bucket_count - 1)];
+    for (; iter != DBLOCK_NONE; iter = dedup->next[iter])
+        if (dedup->hashes[iter] == hash && memcmp(fs->dblocks + iter * DATA_BLOCK_SIZE, data, DATA_BLOCK_SIZE) == 0)
+            return iter;
+    return DBLOCK_NONE;
+}
+
+void dedup_insert(filesystem_t *fs, dblock_index_t index, uint32_t hash)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dedup || index >= fs->dblock_count) return;
+    dedup_index_t *dedup = ext->dedup;
+    if (dedup_is_indexed(dedup, index)) return;
+    dblock_index_t *bucket = &dedup->buckets[hash & (dedup->bucket_count - 1)];
+    dedup->hashes[index] = hash;
+    dedup->next[index] = *bucket;
+    *bucket = index;
+    dedup->indexed[index / 8] |= 1 << (index % 8);
+}
+
+void dedup_forget(filesystem_t *fs, dblock_index_t index)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dedup || index >= fs->dblock_count) return;
+    dedup_index_t *dedup = ext->dedup;
+    if (!dedup_is_indexed(dedup, index)) return;
+    dblock_index_t *link = &dedup->buckets[dedup->hashes[index] & (dedup->bucket_count - 1)];
+    while (*link != index) link = &dedup->next[*link];
+    *link = dedup->next[index];
+    dedup->indexed[index / 8] &= ~(1 << (index % 8));
+}
+
+// ----------------------- CHECKSUMS ----------------------- //
+
+fs_retcode_t checksum_enable(filesystem_t *fs, int verify_reads)
+{
+    if (!fs) return INVALID_INPUT;
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    if (!ext->dblock_crcs)
+    {
+        ext->dblock_crcs = malloc(fs->dblock_count * sizeof(uint32_t));
+        if (!ext->dblock_crcs) return SYSTEM_ERROR;
+        for (size_t i = 0; i < fs->dblock_count; ++i) checksum_update(fs, i);
+    }
+    ext->verify_reads = verify_reads;
+    return SUCCESS;
+}
+
+void checksum_disable(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return;
+    free(ext->dblock_crcs);
+    ext->dblock_crcs = NULL;
+    ext->verify_reads = 0;
+}
+
+void checksum_update(filesystem_t *fs, dblock_index_t index)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dblock_crcs || index >= fs->dblock_count) return;
+    ext->dblock_crcs[index] = crc32c(0, fs->dblocks + index * DATA_BLOCK_SIZE, DATA_BLOCK_SIZE);
+}
+
+int checksum_verify(filesystem_t *fs, dblock_index_t index)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dblock_crcs || index >= fs->dblock_count) return 1;
+    return ext->dblock_crcs[index] == crc32c(0, fs->dblocks + index * DATA_BLOCK_SIZE, DATA_BLOCK_SIZE);
+}
+
+typedef struct scrub_range
+{
+    filesystem_t *fs;
+    size_t first;
+    size_t end;
+    dblock_index_t *bad;    // room for end - first entries
+    size_t bad_count;
+} scrub_range_t;
+
+static void *scrub_worker(void *arg)
+{
+    scrub_range_t *range = arg;
+    filesystem_t *fs = range->fs;
+    for (size_t i = range->first; i < range->end; ++i)
+        if (!dblock_is_available(fs->dblock_bitmask, i) && !checksum_verify(fs, i))
+            range->bad[range->bad_count++] = i;
+    return NULL;
+}
+
+fs_retcode_t fs_scrub(filesystem_t *fs, size_t threads, dblock_index_t **bad, size_t *bad_count)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !bad || !bad_count || !ext->dblock_crcs) return INVALID_INPUT;
+    *bad = NULL;
+    *bad_count = 0;
+    if (threads == 0) threads = 1;
+    if (threads > fs->dblock_count) threads = fs->dblock_count;
+
+    // each thread checks a contiguous run of dblocks, so the results come out sorted
+    scrub_range_t *ranges = calloc(threads, sizeof(scrub_range_t));
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    dblock_index_t *found = malloc(fs->dblock_count * sizeof(dblock_index_t));
+    if (!ranges || !workers || !found)
+    {
+        free(ranges);
+        free(workers);
+        free(found);
+        return SYSTEM_ERROR;
+    }
+    fs_retcode_t ret = SUCCESS;
+    size_t started = 0;
+    for (; started < threads; ++started)
+    {
+        scrub_range_t *range = &ranges[started];
+        range->fs = fs;
+        range->first = fs->dblock_count * started / threads;
+        range->end = fs->dblock_count * (started + 1) / threads;
+        range->bad = found + range->first;
+        // the calling thread takes the last range itself
+        if (started + 1 == threads) scrub_worker(range);
+        else if (pthread_create(&workers[started], NULL, scrub_worker, range) != 0)
+        {
+            ret = SYSTEM_ERROR;
+            break;
+        }
+    }
+    for (size_t i = 0; i < started && i + 1 < threads; ++i) pthread_join(workers[i], NULL);
+
+    if (ret == SUCCESS)
+    {
+        for (size_t i = 0; i < threads; ++i)
+        {
+            memmove(found + *bad_count, ranges[i].bad, ranges[i].bad_count * sizeof(dblock_index_t));
+            *bad_count += ranges[i].bad_count;
+        }
+    }
+    if (ret == SUCCESS && *bad_count) *bad = found;
+    else free(found);
+    free(ranges);
+    free(workers);
+    return ret;
+}
+
+// ----------------------- TAIL PACKING ----------------------- //
+
+#define TAIL_MASK_BYTES ((DATA_BLOCK_SIZE + 7) / 8)
+
+_Static_assert(DATA_BLOCK_SIZE <= INODE_TAIL_OFFSET_MASK >> INODE_TAIL_SHIFT, "tail offsets must fit in file_perms");
+
+static byte *tail_mask(tail_pool_t *pool, dblock_index_t dblock)
+{
+    return pool->used + (size_t) dblock * TAIL_MASK_BYTES;
+}
+
+static int tail_byte_used(byte *mask, size_t n)
+{
+    return (mask[n / 8] >> (n % 8)) & 1;
+}
+
+static void mark_tail_bytes(byte *mask, size_t offset, size_t len, int used)
+{
+    for (size_t i = offset; i < offset + len; ++i)
+    {
+        if (used) mask[i / 8] |= 1 << (i % 8);
+        else mask[i / 8] &= ~(1 << (i % 8));
+    }
+}
+
+static int tail_mask_empty(byte *mask)
+{
+    for (size_t i = 0; i < TAIL_MASK_BYTES; ++i)
+        if (mask[i]) return 0;
+    return 1;
+}
+
+// start of the first run of `len` free bytes in a tail dblock, DATA_BLOCK_SIZE if there is none
+static size_t tail_find_room(byte *mask, size_t len)
+{
+    size_t run = 0;
+    for (size_t i = 0; i < DATA_BLOCK_SIZE; ++i)
+    {
+        run = tail_byte_used(mask, i) ? 0 : run + 1;
+        if (run == len) return i + 1 - len;
+    }
+    return DATA_BLOCK_SIZE;
+}
+
+// remembers a tail dblock with room, replacing the oldest hint
+static void tail_hint(tail_pool_t *pool, dblock_index_t dblock)
+{
+    for (size_t i = 0; i < TAIL_POOL_HINTS; ++i)
+        if (pool->hints[i] == dblock) return;
+    pool->hints[pool->next_hint] = dblock;
+    pool->next_hint = (pool->next_hint + 1) % TAIL_POOL_HINTS;
+}
+
+static fs_retcode_t new_tail_pool(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    if (ext->tails) return SUCCESS;
+    tail_pool_t *pool = calloc(1, sizeof(tail_pool_t));
+    if (!pool) return SYSTEM_ERROR;
+    pool->used = calloc(fs->dblock_count, TAIL_MASK_BYTES);
+    if (!pool->used)
+    {
+        free(pool);
+        return SYSTEM_ERROR;
+    }
+    for (size_t i = 0; i < TAIL_POOL_HINTS; ++i) pool->hints[i] = DBLOCK_NONE;
+    ext->tails = pool;
+    return SUCCESS;
+}
+
+fs_retcode_t tail_packing_enable(filesystem_t *fs)
+{
+    if (!fs) return INVALID_INPUT;
+    fs_retcode_t ret = new_tail_pool(fs);
+    if (ret != SUCCESS) return ret;
+    fs_ext(fs)->tails->packing = 1;
+    return SUCCESS;
+}
 
+void tail_packing_disable(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->tails) ext->tails->packing = 0;
+}
+
+fs_retcode_t tail_claim(filesystem_t *fs, size_t len, dblock_index_t *dblock, size_t *offset)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->tails || !dblock || !offset || len == 0 || len >= DATA_BLOCK_SIZE) return INVALID_INPUT;
+    tail_pool_t *pool = ext->tails;
+    for (size_t i = 0; i < TAIL_POOL_HINTS; ++i)
+    {
+        dblock_index_t hint = pool->hints[i];
+        if (hint == DBLOCK_NONE) continue;
+        size_t at = tail_find_room(tail_mask(pool, hint), len);
+        if (at == DATA_BLOCK_SIZE) continue;
+        fs_retcode_t ret = ref_dblock(fs, hint);
+        if (ret != SUCCESS) return ret;
+        mark_tail_bytes(tail_mask(pool, hint), at, len, 1);
+        ++pool->tails;
+        *dblock = hint;
+        *offset = at;
+        return SUCCESS;
+    }
+
+    dblock_index_t fresh;
+    fs_retcode_t ret = claim_available_dblock(fs, &fresh);
+    if (ret != SUCCESS) return ret;
+    mark_tail_bytes(tail_mask(pool, fresh), 0, len, 1);
+    ++pool->tails;
+    ++pool->dblocks;
+    tail_hint(pool, fresh);
+    *dblock = fresh;
+    *offset = 0;
+    return SUCCESS;
+}
+
+void tail_shrink(filesystem_t *fs, dblock_index_t dblock, size_t offset, size_t old_len, size_t new_len)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->tails || dblock >= fs->dblock_count || new_len >= old_len) return;
+    tail_pool_t *pool = ext->tails;
+    mark_tail_bytes(tail_mask(pool, dblock), offset + new_len, old_len - new_len, 0);
+    if (new_len > 0)
+    {
+        tail_hint(pool, dblock);
+        return;
+    }
+    --pool->tails;
+    if (!unref_dblock(fs, dblock))
+    {
+        tail_hint(pool, dblock);
+        return;
+    }
+    release_dblock(fs, fs->dblocks + dblock * DATA_BLOCK_SIZE);
+    --pool->dblocks;
+    for (size_t i = 0; i < TAIL_POOL_HINTS; ++i)
+        if (pool->hints[i] == dblock) pool->hints[i] = DBLOCK_NONE;
+}
+
+// marks the tail of every packed inode in use in an inode table
+static fs_retcode_t mark_table_tails(filesystem_t *fs, inode_t *inodes, inode_index_t available_inode)
+{
+    tail_pool_t *pool = fs_ext(fs)->tails;
+    byte *is_free = calloc(fs->inode_count, sizeof(byte));
+    if (!is_free) return SYSTEM_ERROR;
+    for (inode_index_t iter = available_inode; iter != 0; iter = inodes[iter].next_free_inode)
+        is_free[iter] = 1;
+    fs_retcode_t ret = SUCCESS;
+    for (size_t i = 0; i < fs->inode_count && ret == SUCCESS; ++i)
+    {
+        inode_t *inode = &inodes[i];
+        if (is_free[i] || !(inode->internal.file_perms & INODE_TAIL_PACKED)) continue;
+        size_t block = inode->internal.file_size / DATA_BLOCK_SIZE;
+        size_t len = inode->internal.file_size % DATA_BLOCK_SIZE;
+        size_t offset = INODE_TAIL_OFFSET(inode->internal.file_perms);
+        dblock_index_t dblock = block < INODE_DIRECT_BLOCK_COUNT ? inode->internal.direct_data[block] : 0;
+        if (block >= INODE_DIRECT_BLOCK_COUNT || len == 0 || offset + len > DATA_BLOCK_SIZE || dblock >= fs->dblock_count)
+        {
+            ret = INVALID_BINARY_FORMAT;
+            break;
+        }
+        byte *mask = tail_mask(pool, dblock);
+        if (tail_mask_empty(mask))
+        {
+            ++pool->dblocks;
+            tail_hint(pool, dblock);
+        }
+        mark_tail_bytes(mask, offset, len, 1);
+        ++pool->tails;
+    }
+    free(is_free);
+    return ret;
+}
+
+fs_retcode_t restore_tail_pool(filesystem_t *fs)
+{
+    if (!fs) return INVALID_INPUT;
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    fs_retcode_t ret = new_tail_pool(fs);
+    if (ret == SUCCESS) ret = mark_table_tails(fs, fs->inodes, fs->available_inode);
+    for (size_t i = 0; i < ext->snapshot_count && ret == SUCCESS; ++i)
+        ret = mark_table_tails(fs, ext->snapshots[i].inodes, ext->snapshots[i].available_inode);
+    if (ret == SUCCESS && ext->tails->tails > 0)
+    {
+        ext->tails->packing = 1;
+        return SUCCESS;
+    }
+    if (ext->tails) free(ext->tails->used);
+    free(ext->tails);
+    ext->tails = NULL;
+    return ret;
+}
+
+// ----------------------- LOG-STRUCTURED MODE ----------------------- //
+
+fs_retcode_t log_enable(filesystem_t *fs)
+{
+    if (!fs) return INVALID_INPUT;
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    if (ext->log) return SUCCESS;
+    fs_log_t *log = calloc(1, sizeof(fs_log_t));
+    if (!log) return SYSTEM_ERROR;
+    log->segment_count = (fs->dblock_count + LOG_SEGMENT_DBLOCKS - 1) / LOG_SEGMENT_DBLOCKS;
+    log->live = calloc(log->segment_count, sizeof(uint16_t));
+    if (!log->live)
+    {
+        free(log);
+        return SYSTEM_ERROR;
+    }
+    for (size_t i = 0; i < fs->dblock_count; ++i)
+        if (!dblock_is_available(fs->dblock_bitmask, i)) ++log->live[i / LOG_SEGMENT_DBLOCKS];
+    for (size_t i = 0; i < log->segment_count; ++i)
+        if (log->live[i] == 0) ++log->free_segments;
+    ext->log = log;
     return SUCCESS;
 }
+
+void log_disable(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->log) return;
+    free(ext->log->live);
+    free(ext->log);
+    ext->log = NULL;
+}
+
+typedef struct log_cleaner
+{
+    dblock_index_t *moved_to;   // new home of each moved dblock, DBLOCK_NONE if not moved
+    dblock_index_t *moved;      // the dblocks moved, released once every map points past them
+    size_t moved_count;
+    byte *is_free;              // scratch space for the free inodes of a table
+} log_cleaner_t;
+
+// moves the dblock a map slot points to out of a segment being cleaned, the first time it
+// is reached, and points the slot at the copy. the copy takes over the references,
+// checksum, dedup entry and packed tails of the original
+static void log_move(filesystem_t *fs, log_cleaner_t *cleaner, dblock_index_t *slot)
+{
+    dblock_index_t old = *slot;
+    if (old >= fs->dblock_count || !log_of(fs)->cleaning[old / LOG_SEGMENT_DBLOCKS]) return;
+    if (cleaner->moved_to[old] != DBLOCK_NONE)
+    {
+        *slot = cleaner->moved_to[old];
+        return;
+    }
+    dblock_index_t copy;
+    if (dblock_is_available(fs->dblock_bitmask, old) || log_claim(fs, &copy) != SUCCESS) return;
+    memcpy(fs->dblocks + copy * DATA_BLOCK_SIZE, fs->dblocks + old * DATA_BLOCK_SIZE, DATA_BLOCK_SIZE);
+    checksum_update(fs, copy);
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->dblock_refs)
+    {
+        ext->dblock_refs[copy] = ext->dblock_refs[old];
+        ext->dblock_refs[old] = 0;
+    }
+    if (ext && ext->dedup && dedup_is_indexed(ext->dedup, old))
+    {
+        uint32_t hash = ext->dedup->hashes[old];
+        dedup_forget(fs, old);
+        dedup_insert(fs, copy, hash);
+    }
+    if (ext && ext->tails && !tail_mask_empty(tail_mask(ext->tails, old)))
+    {
+        memcpy(tail_mask(ext->tails, copy), tail_mask(ext->tails, old), TAIL_MASK_BYTES);
+        memset(tail_mask(ext->tails, old), 0, TAIL_MASK_BYTES);
+        for (size_t i = 0; i < TAIL_POOL_HINTS; ++i)
+            if (ext->tails->hints[i] == old) ext->tails->hints[i] = copy;
+    }
+    cleaner->moved_to[old] = copy;
+    cleaner->moved[cleaner->moved_count++] = old;
+    *slot = copy;
+}
+
+// moves a map entry, and the payload of the cluster behind it if the inode is compressed
+static void log_move_entry(filesystem_t *fs, log_cleaner_t *cleaner, dblock_index_t *slot, int compressed)
+{
+    log_move(fs, cleaner, slot);
+    if (!compressed) return;
+    cluster_header_t header;
+    size_t payload = read_cluster_header(fs, *slot, &header);
+    for (size_t i = 0; i < payload; ++i) log_move(fs, cleaner, &header.payload[i]);
+    memcpy(fs->dblocks + *slot * DATA_BLOCK_SIZE, &header, sizeof(header));
+    checksum_update(fs, *slot);
+}
+
+// moves every dblock the live maps of an inode table reach. an index dblock shared between
+// inodes is walked once per inode, which is harmless since a moved entry is never moved again
+static void log_move_table(filesystem_t *fs, log_cleaner_t *cleaner, inode_t *inodes, inode_index_t available_inode)
+{
+    byte *is_free = cleaner->is_free;
+    memset(is_free, 0, fs->inode_count);
+    for (inode_index_t iter = available_inode; iter != 0; iter = inodes[iter].next_free_inode)
+        is_free[iter] = 1;
+    for (size_t i = 0; i < fs->inode_count; ++i)
+    {
+        if (is_free[i]) continue;
+        inode_t *inode = &inodes[i];
+        int compressed = (inode->internal.file_perms & INODE_COMPRESSED) != 0;
+        size_t entries = calculate_map_entries(inode, inode->internal.file_size);
+        size_t index_count = calculate_map_index_dblock_amount(entries);
+        for (size_t b = 0; b < entries && b < INODE_DIRECT_BLOCK_COUNT; ++b)
+            log_move_entry(fs, cleaner, &inode->internal.direct_data[b], compressed);
+        dblock_index_t *link = &inode->internal.indirect_dblock;
+        dblock_index_t holder = DBLOCK_NONE;
+        for (size_t position = 0; position < index_count; ++position)
+        {
+            log_move(fs, cleaner, link);
+            if (holder != DBLOCK_NONE) checksum_update(fs, holder);
+            holder = *link;
+            dblock_index_t *index_arr = cast_dblock_ptr(fs->dblocks + holder * DATA_BLOCK_SIZE);
+            size_t first = INODE_DIRECT_BLOCK_COUNT + position * INDIRECT_DBLOCK_INDEX_COUNT;
+            for (size_t k = 0; k < INDIRECT_DBLOCK_INDEX_COUNT && first + k < entries; ++k)
+                log_move_entry(fs, cleaner, &index_arr[k], compressed);
+            checksum_update(fs, holder);
+            link = &index_arr[INDIRECT_DBLOCK_INDEX_COUNT];
+        }
+    }
+}
+
+fs_retcode_t fs_log_clean(filesystem_t *fs, size_t *cleaned)
+{
+    fs_log_t *log = log_of(fs);
+    if (!log || !cleaned) return INVALID_INPUT;
+    *cleaned = 0;
+
+    // the candidates are the segments at most half live apart from the one at the head,
+    // gathered by live count so the emptiest come first
+    size_t *candidates = malloc(log->segment_count * sizeof(size_t));
+    if (!candidates) return SYSTEM_ERROR;
+    size_t candidate_count = 0;
+    size_t head_segment = (log->head_end > 0) ? (log->head_end - 1) / LOG_SEGMENT_DBLOCKS : log->segment_count;
+    for (size_t live = 1; live <= LOG_SEGMENT_DBLOCKS / 2; ++live)
+        for (size_t i = 0; i < log->segment_count; ++i)
+            if (i != head_segment && log->live[i] == live && live * 2 <= log_segment_size(fs, i))
+                candidates[candidate_count++] = i;
+
+    // take the emptiest first while the rest of the file system has room for what they hold
+    size_t room = available_dblocks(fs);
+    size_t to_move = 0;
+    size_t chosen = 0;
+    for (; chosen < candidate_count; ++chosen)
+    {
+        size_t segment = candidates[chosen];
+        size_t live = log->live[segment];
+        size_t free_in_segment = log_segment_size(fs, segment) - live;
+        if (room < free_in_segment || room - free_in_segment < to_move + live) break;
+        room -= free_in_segment;
+        to_move += live;
+    }
+    if (chosen == 0)
+    {
+        free(candidates);
+        return SUCCESS;
+    }
+
+    log_cleaner_t cleaner;
+    log->cleaning = calloc(log->segment_count, sizeof(byte));
+    cleaner.moved_to = malloc(fs->dblock_count * sizeof(dblock_index_t));
+    cleaner.moved = malloc(to_move * sizeof(dblock_index_t));
+    cleaner.moved_count = 0;
+    cleaner.is_free = malloc(fs->inode_count);
+    fs_retcode_t ret = (log->cleaning && cleaner.moved_to && cleaner.moved && cleaner.is_free) ? SUCCESS : SYSTEM_ERROR;
+    if (ret == SUCCESS)
+    {
+        for (size_t i = 0; i < fs->dblock_count; ++i) cleaner.moved_to[i] = DBLOCK_NONE;
+        for (size_t i = 0; i < chosen; ++i) log->cleaning[candidates[i]] = 1;
+        log_move_table(fs, &cleaner, fs->inodes, fs->available_inode);
+        fs_ext_t *ext = fs_ext(fs);
+        for (size_t i = 0; i < ext->snapshot_count; ++i)
+            log_move_table(fs, &cleaner, ext->snapshots[i].inodes, ext->snapshots[i].available_inode);
+        release_dblocks(fs, cleaner.moved, cleaner.moved_count);
+        for (size_t i = 0; i < chosen; ++i)
+            if (log->live[candidates[i]] == 0) ++*cleaned;
+        log->cleaned += *cleaned;
+        log->moved += cleaner.moved_count;
+    }
+    free(log->cleaning);
+    log->cleaning = NULL;
+    free(cleaner.moved_to);
+    free(cleaner.moved);
+    free(cleaner.is_free);
+    free(candidates);
+    return ret;
+}
+
+void log_clean_if_low(filesystem_t *fs)
+{
+    fs_log_t *log = log_of(fs);
+    if (!log || log->free_segments >= LOG_CLEAN_RESERVE) return;
+    size_t cleaned;
+    fs_log_clean(fs, &cleaned);
+}
+
+// ----------------------- DENTRY CACHE ----------------------- //
+
+static uint32_t dentry_hash(inode_index_t parent, const char *name)
+{
+    uint32_t hash = (2166136261u ^ parent) * 16777619u;
+    for (size_t i = 0; i < MAX_FILE_NAME_LEN && name[i]; ++i)
+    {
+        hash ^= (byte) name[i];
+        hash *= 16777619u;
+    }
+    return hash & (DENTRY_CACHE_CAPACITY - 1);
+}
+
+// empties the cache and puts every entry on the free list
+static void dentry_reset(dentry_cache_t *cache)
+{
+    for (uint32_t i = 0; i < DENTRY_CACHE_CAPACITY; ++i)
+    {
+        cache->buckets[i] = DENTRY_NONE;
+        cache->entries[i].hash_next = i + 1 < DENTRY_CACHE_CAPACITY ? i + 1 : DENTRY_NONE;
+    }
+    cache->free_first = 0;
+    cache->lru_first = DENTRY_NONE;
+    cache->lru_last = DENTRY_NONE;
+    cache->count = 0;
+}
+
+// the cache of a file system, allocated on first use. null if it cannot be allocated
+static dentry_cache_t *dentry_cache(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return NULL;
+    if (ext->dentries) return ext->dentries;
+    dentry_cache_t *cache = malloc(sizeof(dentry_cache_t));
+    if (!cache) return NULL;
+    dentry_reset(cache);
+    cache->hits = 0;
+    cache->misses = 0;
+    ext->dentries = cache;
+    return cache;
+}
+
+// the link pointing at the entry for `name` in `parent`, or at DENTRY_NONE if it is not cached
+static uint32_t *dentry_link(dentry_cache_t *cache, inode_index_t parent, const char *name)
+{
+    uint32_t *link = &cache->buckets[dentry_hash(parent, name)];
+    while (*link != DENTRY_NONE)
+    {
+        dentry_t *entry = &cache->entries[*link];
+        if (entry->parent == parent && strncmp(entry->name, name, MAX_FILE_NAME_LEN) == 0) break;
+        link = &entry->hash_next;
+    }
+    return link;
+}
+
+static void dentry_lru_unlink(dentry_cache_t *cache, uint32_t index)
+{
+    dentry_t *entry = &cache->entries[index];
+    if (entry->lru_prev != DENTRY_NONE) cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+    else cache->lru_first = entry->lru_next;
+    if (entry->lru_next != DENTRY_NONE) cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else cache->lru_last = entry->lru_prev;
+}
+
+static void dentry_lru_push(dentry_cache_t *cache, uint32_t index)
+{
+    dentry_t *entry = &cache->entries[index];
+    entry->lru_prev = DENTRY_NONE;
+    entry->lru_next = cache->lru_first;
+    if (cache->lru_first != DENTRY_NONE) cache->entries[cache->lru_first].lru_prev = index;
+    else cache->lru_last = index;
+    cache->lru_first = index;
+}
+
+// removes the entry `*link` points at and puts it on the free list
+static void dentry_remove(dentry_cache_t *cache, uint32_t *link)
+{
+    uint32_t index = *link;
+    *link = cache->entries[index].hash_next;
+    dentry_lru_unlink(cache, index);
+    cache->entries[index].hash_next = cache->free_first;
+    cache->free_first = index;
+    --cache->count;
+}
+
+// names longer than a directory entry can hold are never found, so they are not cached
+static int dentry_name_fits(const char *name)
+{
+    return name && strnlen(name, MAX_FILE_NAME_LEN + 1) <= MAX_FILE_NAME_LEN;
+}
+
+int dentry_lookup(filesystem_t *fs, inode_index_t parent, const char *name, inode_index_t *child)
+{
+    if (!fs || !child || !dentry_name_fits(name)) return 0;
+    dentry_cache_t *cache = dentry_cache(fs);
+    if (!cache) return 0;
+    uint32_t index = *dentry_link(cache, parent, name);
+    if (index == DENTRY_NONE)
+    {
+        ++cache->misses;
+        return 0;
+    }
+    ++cache->hits;
+    dentry_lru_unlink(cache, index);
+    dentry_lru_push(cache, index);
+    *child = cache->entries[index].child;
+    return 1;
+}
+
+void dentry_insert(filesystem_t *fs, inode_index_t parent, const char *name, inode_index_t child)
+{
+    if (!fs || !dentry_name_fits(name)) return;
+    dentry_cache_t *cache = dentry_cache(fs);
+    if (!cache) return;
+    uint32_t *link = dentry_link(cache, parent, name);
+    if (*link != DENTRY_NONE) dentry_remove(cache, link);
+    if (cache->free_first == DENTRY_NONE)
+    {
+        dentry_t *victim = &cache->entries[cache->lru_last];
+        dentry_remove(cache, dentry_link(cache, victim->parent, victim->name));
+    }
+    uint32_t index = cache->free_first;
+    dentry_t *entry = &cache->entries[index];
+    cache->free_first = entry->hash_next;
+    strncpy(entry->name, name, MAX_FILE_NAME_LEN);
+    entry->parent = parent;
+    entry->child = child;
+    uint32_t *bucket = &cache->buckets[dentry_hash(parent, name)];
+    entry->hash_next = *bucket;
+    *bucket = index;
+    dentry_lru_push(cache, index);
+    ++cache->count;
+}
+
+void dentry_invalidate(filesystem_t *fs, inode_index_t parent, const char *name)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dentries || !dentry_name_fits(name)) return;
+    uint32_t *link = dentry_link(ext->dentries, parent, name);
+    if (*link != DENTRY_NONE) dentry_remove(ext->dentries, link);
+}
+
+void dentry_invalidate_dir(filesystem_t *fs, inode_index_t dir)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dentries) return;
+    dentry_cache_t *cache = ext->dentries;
+    for (size_t bucket = 0; bucket < DENTRY_CACHE_CAPACITY; ++bucket)
+    {
+        uint32_t *link = &cache->buckets[bucket];
+        while (*link != DENTRY_NONE)
+        {
+            dentry_t *entry = &cache->entries[*link];
+            if (entry->parent == dir || entry->child == dir) dentry_remove(cache, link);
+            else link = &entry->hash_next;
+        }
+    }
+}
+
+void dentry_invalidate_all(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dentries) return;
+    dentry_reset(ext->dentries);
+}
+
+// ----------------------- DIRECTORY TOTALS ----------------------- //
+
+// adds `bytes` and `descendants` to `dir` and every directory above it. taking away is
+// adding the negated amounts, which wrap around in size_t
+static void dir_totals_add(dir_total_t *totals, uint32_t dir, size_t bytes, size_t descendants)
+{
+    while (dir != DIR_TOTAL_NONE)
+    {
+        totals[dir].bytes += bytes;
+        totals[dir].descendants += descendants;
+        dir = totals[dir].parent;
+    }
+}
+
+void dir_totals_disable(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dir_totals) return;
+    for (size_t i = 0; i < fs->inode_count; i++) free(ext->dir_totals[i].links);
+    free(ext->dir_totals);
+    ext->dir_totals = NULL;
+}
+
+fs_retcode_t dir_totals_reserve(filesystem_t *fs, inode_index_t child)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dir_totals || ext->dir_totals[child].links) return SUCCESS;
+    // room for every name a file can have besides the one in `parent`, kept until the totals
+    // are freed so a rename never needs more
+    ext->dir_totals[child].links = malloc((INODE_MAX_LINKS - 1) * sizeof(uint32_t));
+    return ext->dir_totals[child].links ? SUCCESS : SYSTEM_ERROR;
+}
+
+void dir_totals_link(filesystem_t *fs, inode_index_t parent, inode_index_t child)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dir_totals) return;
+    dir_total_t *total = &ext->dir_totals[child];
+    if (total->parent != DIR_TOTAL_NONE)
+    {
+        if (!total->links || total->link_count >= INODE_MAX_LINKS - 1) return;
+        total->links[total->link_count++] = parent;
+        dir_totals_add(ext->dir_totals, parent, total->bytes, 1);
+        return;
+    }
+    if (fs->inodes[child].internal.file_type == DATA_FILE) total->bytes = fs->inodes[child].internal.file_size;
+    total->parent = parent;
+    dir_totals_add(ext->dir_totals, parent, total->bytes, total->descendants + 1);
+}
+
+void dir_totals_unlink(filesystem_t *fs, inode_index_t parent, inode_index_t child)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dir_totals) return;
+    dir_total_t *total = &ext->dir_totals[child];
+    if (total->parent != parent)
+    {
+        for (uint32_t i = 0; i < total->link_count; i++)
+        {
+            if (total->links[i] != parent) continue;
+            total->links[i] = total->links[--total->link_count];
+            dir_totals_add(ext->dir_totals, parent, -total->bytes, -1);
+            return;
+        }
+        return;
+    }
+    // another name of a linked file takes over, already counted in its own directory
+    total->parent = total->link_count > 0 ? total->links[--total->link_count] : DIR_TOTAL_NONE;
+    dir_totals_add(ext->dir_totals, parent, -total->bytes, -(total->descendants + 1));
+}
@@ -0,0 +1,451 @@
+#include "filesys.h"
+#include "fs_ext.h"
+#include "utility.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define INDIRECT_DBLOCK_INDEX_COUNT (DATA_BLOCK_SIZE / sizeof(dblock_index_t) - 1)
+#define NEXT_INDIRECT_INDEX_OFFSET (DATA_BLOCK_SIZE - sizeof(dblock_index_t))
+
+// optional sections stored after the dblocks. each one is a 4 byte tag, the payload length
+// and the payload. a section is only written when its feature is in use, so images of file
+// systems that never used it stay byte for byte the same. unknown sections are skipped on load
+#define SECTION_TAG_SIZE 4
+#define SECTION_REFS "REFS"
+#define SECTION_SNAPSHOT "SNAP"
+#define SECTION_CHECKSUMS "CSUM"
+
+// -------------------------------- HELPER FUNCTIONS -------------------------------- //
+
+const char *fs_retcode_message(fs_retcode_t retcode)
+{
+    if (retcode == CHECKSUM_MISMATCH) return "Checksum mismatch";
+    if ((size_t) retcode < FS_RETCODE_TOTAL) return fs_retcode_string_table[retcode];
+    return "Unknown error";
+}
+
+uint32_t inode_file_perms(const inode_t *inode)
+{
+    return (uint32_t) inode->internal.file_perms;
+}
+
+size_t calculate_map_entries(inode_t *inode, size_t file_size)
+{
+    size_t unit = (inode->internal.file_perms & INODE_COMPRESSED) ? COMPRESSED_CLUSTER_SIZE : DATA_BLOCK_SIZE;
+    return (file_size + unit - 1) / unit;
+}
+
+size_t calculate_map_index_dblock_amount(size_t map_entries)
+{
+    if (map_entries <= INODE_DIRECT_BLOCK_COUNT) return 0;
+    return (map_entries - INODE_DIRECT_BLOCK_COUNT + INDIRECT_DBLOCK_INDEX_COUNT - 1) / INDIRECT_DBLOCK_INDEX_COUNT;
+}
+
+size_t read_cluster_header(filesystem_t *fs, dblock_index_t header_dblock, cluster_header_t *header)
+{
+    memcpy(header, fs->dblocks + header_dblock * DATA_BLOCK_SIZE, sizeof(cluster_header_t));
+    return (header->stored_len + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
+}
+
+// CRC32C (Castagnoli) with the SSE4.2 crc32 instruction when the CPU has it, and
+// slice-by-8 tables otherwise
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_init_table(void)
+{
+    for (uint32_t n = 0; n < 256; ++n)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        crc32c_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; ++n)
+        for (int t = 1; t < 8; ++t)
+            crc32c_table[t][n] = (crc32c_table[t - 1][n] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][n] & 0xFF];
+}
+
+static uint32_t crc32c_slice8(uint32_t crc, const byte *p, size_t n)
+{
+    for (; n >= 8; p += 8, n -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xFF] ^ crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^ crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^ crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^ crc32c_table[0][word >> 56];
+    }
+    for (; n > 0; ++p, --n) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const byte *p, size_t n)
+{
+    uint64_t crc64 = crc;
+    for (; n >= 8; p += 8, n -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; n > 0; ++p, --n) crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t n)
+{
+    static uint32_t (*impl)(uint32_t, const byte *, size_t) = NULL;
+    if (!impl)
+    {
+#if defined(__x86_64__) && defined(__GNUC__)
+        if (__builtin_cpu_supports("sse4.2")) impl = crc32c_sse42;
+#endif
+        if (!impl)
+        {
+            crc32c_init_table();
+            impl = crc32c_slice8;
+        }
+    }
+    return ~impl(~crc, data, n);
+}
+
+// -------------------------------- EXTENSION STATE -------------------------------- //
+
+// the state of every file system, keyed by its dblocks. entries are only added at the head,
+// under the lock, so lookups can walk the list without it
+typedef struct fs_ext_entry
+{
+    const byte *dblocks;
+    fs_ext_t ext;
+    struct fs_ext_entry *next;
+} fs_ext_entry_t;
+
+static fs_ext_entry_t *fs_ext_entries = NULL;
+static pthread_mutex_t fs_ext_lock = PTHREAD_MUTEX_INITIALIZER;
+
+fs_ext_t *fs_ext(const filesystem_t *fs)
+{
+    if (!fs || !fs->dblocks) return NULL;
+    fs_ext_entry_t *entry = __atomic_load_n(&fs_ext_entries, __ATOMIC_ACQUIRE);
+    for (; entry; entry = entry->next)
+        if (entry->dblocks == fs->dblocks) return &entry->ext;
+
+    // look again under the lock, another thread may have just added it
+    pthread_mutex_lock(&fs_ext_lock);
+    for (entry = fs_ext_entries; entry && entry->dblocks != fs->dblocks; entry = entry->next);
+    if (!entry && (entry = calloc(1, sizeof(fs_ext_entry_t))))
+    {
+        entry->dblocks = fs->dblocks;
+        entry->ext.free_dblock_count = FREE_DBLOCK_COUNT_UNKNOWN; // counted on first use
+        entry->next = fs_ext_entries;
+        __atomic_store_n(&fs_ext_entries, entry, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&fs_ext_lock);
+    return entry ? &entry->ext : NULL;
+}
+
+void fs_ext_drop(const filesystem_t *fs)
+{
+    if (!fs || !fs->dblocks) return;
+    pthread_mutex_lock(&fs_ext_lock);
+    fs_ext_entry_t **link = &fs_ext_entries;
+    while (*link && (*link)->dblocks != fs->dblocks) link = &(*link)->next;
+    fs_ext_entry_t *entry = *link;
+    if (entry) __atomic_store_n(link, entry->next, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&fs_ext_lock);
+    free(entry);
+}
+
+// -------------------------------- OPTIONAL STATE -------------------------------- //
+
+void save_optional_sections(FILE *file, filesystem_t *fs, const fs_ext_t *ext)
+{
+    // the extra references of shared dblocks as (index, extra references) pairs
+    uint64_t shared = 0;
+    if (ext && ext->dblock_refs)
+        for (size_t i = 0; i < fs->dblock_count; ++i)
+            if (ext->dblock_refs[i]) ++shared;
+    if (shared)
+    {
+        uint64_t length = shared * 2 * sizeof(uint32_t);
+        fwrite(SECTION_REFS, 1, SECTION_TAG_SIZE, file);
+        fwrite(&length, sizeof(length), 1, file);
+        for (uint32_t i = 0; i < fs->dblock_count; ++i)
+        {
+            if (!ext->dblock_refs[i]) continue;
+            fwrite(&i, sizeof(i), 1, file);
+            fwrite(&ext->dblock_refs[i], sizeof(uint32_t), 1, file);
+        }
+    }
+
+    // the checksum of every dblock, claimed or not
+    if (ext && ext->dblock_crcs)
+    {
+        uint64_t length = fs->dblock_count * sizeof(uint32_t);
+        fwrite(SECTION_CHECKSUMS, 1, SECTION_TAG_SIZE, file);
+        fwrite(&length, sizeof(length), 1, file);
+        fwrite(ext->dblock_crcs, sizeof(uint32_t), fs->dblock_count, file);
+    }
+
+    // one section per snapshot: the name, the next available inode and the inode table
+    for (size_t i = 0; ext && i < ext->snapshot_count; ++i)
+    {
+        fs_snapshot_t *snapshot = &ext->snapshots[i];
+        uint64_t length = MAX_FILE_NAME_LEN + sizeof(inode_index_t) + fs->inode_count * sizeof(inode_t);
+        fwrite(SECTION_SNAPSHOT, 1, SECTION_TAG_SIZE, file);
+        fwrite(&length, sizeof(length), 1, file);
+        fwrite(snapshot->name, 1, MAX_FILE_NAME_LEN, file);
+        fwrite(&snapshot->available_inode, sizeof(inode_index_t), 1, file);
+        fwrite(snapshot->inodes, sizeof(inode_t), fs->inode_count, file);
+    }
+}
+
+static fs_retcode_t load_refs_section(FILE *file, filesystem_t *fs, fs_ext_t *ext, uint64_t length)
+{
+    if (length % (2 * sizeof(uint32_t))) return INVALID_BINARY_FORMAT;
+    if (!ext->dblock_refs) ext->dblock_refs = calloc(fs->dblock_count, sizeof(uint32_t));
+    if (!ext->dblock_refs) return SYSTEM_ERROR;
+    for (uint64_t i = 0; i < length / (2 * sizeof(uint32_t)); ++i)
+    {
+        uint32_t pair[2];
+        if (fread(pair, sizeof(uint32_t), 2, file) != 2) return INVALID_BINARY_FORMAT;
+        if (pair[0] >= fs->dblock_count) return INVALID_BINARY_FORMAT;
+        ext->dblock_refs[pair[0]] = pair[1];
+    }
+    return SUCCESS;
+}
+
+static fs_retcode_t load_snapshot_section(FILE *file, filesystem_t *fs, fs_ext_t *ext, uint64_t length)
+{
+    if (length != MAX_FILE_NAME_LEN + sizeof(inode_index_t) + fs->inode_count * sizeof(inode_t))
+        return INVALID_BINARY_FORMAT;
+    fs_snapshot_t *snapshots = realloc(ext->snapshots, (ext->snapshot_count + 1) * sizeof(fs_snapshot_t));
+    if (!snapshots) return SYSTEM_ERROR;
+    ext->snapshots = snapshots;
+    fs_snapshot_t *snapshot = &ext->snapshots[ext->snapshot_count];
+    memset(snapshot->name, 0, sizeof(snapshot->name));
+    snapshot->inodes = malloc(fs->inode_count * sizeof(inode_t));
+    if (!snapshot->inodes) return SYSTEM_ERROR;
+    if (fread(snapshot->name, 1, MAX_FILE_NAME_LEN, file) != MAX_FILE_NAME_LEN ||
+        fread(&snapshot->available_inode, sizeof(inode_index_t), 1, file) != 1 ||
+        fread(snapshot->inodes, sizeof(inode_t), fs->inode_count, file) != fs->inode_count)
+    {
+        free(snapshot->inodes);
+        return INVALID_BINARY_FORMAT;
+    }
+    ++ext->snapshot_count;
+    return SUCCESS;
+}
+
+static fs_retcode_t load_checksum_section(FILE *file, filesystem_t *fs, fs_ext_t *ext, uint64_t length)
+{
+    if (length != fs->dblock_count * sizeof(uint32_t)) return INVALID_BINARY_FORMAT;
+    free(ext->dblock_crcs);
+    ext->dblock_crcs = malloc(length);
+    if (!ext->dblock_crcs) return SYSTEM_ERROR;
+    if (fread(ext->dblock_crcs, sizeof(uint32_t), fs->dblock_count, file) != fs->dblock_count) return INVALID_BINARY_FORMAT;
+    return SUCCESS;
+}
+
+static fs_retcode_t load_optional_sections(FILE *file, filesystem_t *fs, fs_ext_t *ext)
+{
+    char tag[SECTION_TAG_SIZE];
+    while (fread(tag, 1, SECTION_TAG_SIZE, file) == SECTION_TAG_SIZE)
+    {
+        uint64_t length;
+        if (fread(&length, sizeof(length), 1, file) != 1) return INVALID_BINARY_FORMAT;
+        fs_retcode_t ret = SUCCESS;
+        if (!memcmp(tag, SECTION_REFS, SECTION_TAG_SIZE)) ret = load_refs_section(file, fs, ext, length);
+        else if (!memcmp(tag, SECTION_SNAPSHOT, SECTION_TAG_SIZE)) ret = load_snapshot_section(file, fs, ext, length);
+        else if (!memcmp(tag, SECTION_CHECKSUMS, SECTION_TAG_SIZE)) ret = load_checksum_section(file, fs, ext, length);
+        else if (fseek(file, (long) length, SEEK_CUR)) ret = INVALID_BINARY_FORMAT;
+        if (ret != SUCCESS) return ret;
+    }
+
+    return restore_tail_pool(fs);
+}
+
+fs_retcode_t save_filesystem_ext(FILE *file, filesystem_t *fs)
+{
+    fs_retcode_t ret = save_filesystem(file, fs);
+    if (ret != SUCCESS) return ret;
+    save_optional_sections(file, fs, fs_ext(fs));
+    return SUCCESS;
+}
+
+fs_retcode_t load_filesystem_ext(FILE *file, filesystem_t *fs)
+{
+    fs_retcode_t ret = load_filesystem(file, fs);
+    if (ret != SUCCESS) return ret;
+    // the dblocks were just allocated, so a state found by them was left behind by a file
+    // system freed without free_filesystem
+    fs_ext_drop(fs);
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    return load_optional_sections(file, fs, ext);
+}
+
+// -------------------------------- DISPLAY -------------------------------- //
+
+static const char *filetype_str_table[] = {
+    STR(DATA_FILE),
+    STR(DIRECTORY)
+};
+
+static void extract_filename(inode_t *inode, char *buffer)
+{
+    size_t i = 0;
+    for (; i <= MAX_FILE_NAME_LEN; ++i)
+    {
+        if (inode->internal.file_name[i])
+        {
+            buffer[i] = inode->internal.file_name[i];
+        }
+        else break;
+    }
+    buffer[i] = '\0';
+}
+
+static void set_inode_mask(filesystem_t *fs, byte *mask)
+{
+    inode_index_t iter = fs->available_inode;
+    while (iter != 0)
+    {
+        mask[iter / 8] |= 1 << (iter % 8);
+        iter = fs->inodes[iter].next_free_inode;
+    }
+}
+
+// the block map is walked by its entries rather than by the file size, since the entries
+// of a compressed inode are cluster header dblocks
+static void display_direct_map_entries(inode_t *node, size_t map_entries)
+{
+    size_t direct_entries = map_entries < INODE_DIRECT_BLOCK_COUNT ? map_entries : INODE_DIRECT_BLOCK_COUNT;
+
+    for (size_t i = 0; i < direct_entries; ++i)
+    {
+        printf("%u ", node->internal.direct_data[i]);
+    }
+}
+
+static void display_indirect_map_entries(filesystem_t *fs, inode_t *node, size_t map_entries, int index_blocks)
+{
+    // only called if we know there must be indirect map entries
+    size_t indirect_entries = map_entries - INODE_DIRECT_BLOCK_COUNT;
+
+    dblock_index_t index_blk_idx = node->internal.indirect_dblock;
+    for (size_t i = 0; i < indirect_entries; i += index_blocks ? INDIRECT_DBLOCK_INDEX_COUNT : 1)
+    {
+        size_t indirect_idx_offset = i % INDIRECT_DBLOCK_INDEX_COUNT;
+        if (i != 0 && indirect_idx_offset == 0)
+        {
+            index_blk_idx = *cast_dblock_ptr(&fs->dblocks[ index_blk_idx * DATA_BLOCK_SIZE + NEXT_INDIRECT_INDEX_OFFSET ]);
+        }
+
+        if (index_blocks) printf("%u ", index_blk_idx);
+        else printf("%u ", *cast_dblock_ptr(&fs->dblocks[ index_blk_idx * DATA_BLOCK_SIZE + indirect_idx_offset * sizeof(dblock_index_t) ]));
+    }
+}
+
+static void display_inodes(filesystem_t *fs)
+{
+    byte *inode_mask = calloc((fs->inode_count + 7) / 8, sizeof(byte));
+    if (!inode_mask) return;
+    set_inode_mask(fs, inode_mask);
+    puts("I-Node List:");
+    for (size_t i = 0; i < fs->inode_count; ++i)
+    {
+        if (inode_mask[i / 8] & (1 << (i % 8))) continue;
+
+        inode_t *inode = &fs->inodes[i];
+        char filename[MAX_FILE_NAME_LEN + 1] = { 0 };
+        extract_filename(inode, filename);
+
+        permission_t perms = INODE_PERMISSIONS(inode->internal.file_perms);
+        if (perms)
+        {
+            printf("\tinode index %lu [.type = %s .perm = %s%s%s .name = \"%s\" .size = %lu]\n", 
+                i, filetype_str_table[inode->internal.file_type],
+                perms & FS_READ ? "READ " : "", perms & FS_WRITE ? "WRITE " : "", perms & FS_EXECUTE ? "EXECUTE " : "",
+                filename, inode->internal.file_size
+            );
+        }
+        else
+        {
+            printf("\tinode index %lu [.type = %s .name = \"%s\" .size = %lu]\n", 
+                i, filetype_str_table[inode->internal.file_type],
+                filename, inode->internal.file_size
+            );
+        }
+
+        if (INODE_EXTRA_LINKS(inode->internal.file_perms) > 0)
+            printf("\t\tLinks: %u\n", (unsigned) INODE_EXTRA_LINKS(inode->internal.file_perms) + 1);
+
+        size_t file_size = inode->internal.file_size;
+        if (file_size == 0) continue;
+
+        size_t map_entries = calculate_map_entries(inode, file_size);
+        // the block map of a compressed inode holds cluster header dblocks
+        const char *entry_str = (inode->internal.file_perms & INODE_COMPRESSED) ? "Cluster" : "Data";
+
+        printf("\t\tDirect %s Blocks: ", entry_str);
+        display_direct_map_entries(inode, map_entries);
+        puts("");
+
+        if (inode->internal.file_perms & INODE_TAIL_PACKED)
+            printf("\t\tPacked Tail: dblock %u offset %u length %lu\n",
+                inode->internal.direct_data[map_entries - 1],
+                (unsigned) INODE_TAIL_OFFSET(inode->internal.file_perms), file_size % DATA_BLOCK_SIZE);
+
+        if (map_entries > INODE_DIRECT_BLOCK_COUNT)
+        {
+            printf("\t\tIndirect %s Blocks: ", entry_str);
+            display_indirect_map_entries(fs, inode, map_entries, 0);
+            puts("");
+
+            printf("\t\tIndirect Index Blocks: ");
+            display_indirect_map_entries(fs, inode, map_entries, 1);
+            puts("");
+        }
+    }
+
+    free(inode_mask);
+}
+
+static void display_optional_state(filesystem_t *fs)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (ext && ext->dblock_refs) printf("\tshared dblock: %lu\n", shared_dblocks(fs));
+    for (size_t i = 0; ext && i < ext->snapshot_count; ++i) printf("\tsnapshot: %s\n", ext->snapshots[i].name);
+    if (ext && ext->dedup) printf("\tdeduplicated dblock: %lu\n", ext->dedup->saved);
+    if (ext && ext->dblock_crcs) printf("\tchecksums: %s\n", ext->verify_reads ? "verified on read" : "on");
+    if (ext && ext->tails) printf("\tpacked tails: %lu in %lu dblocks\n", ext->tails->tails, ext->tails->dblocks);
+    if (ext && ext->log) printf("\tlog segments: %lu free of %lu, %lu cleaned, %lu dblocks moved\n", ext->log->free_segments, ext->log->segment_count, ext->log->cleaned, ext->log->moved);
+}
+
+void display_filesystem_ext(filesystem_t *fs, fs_display_flag_t flag)
+{
+    if (!fs)
+    {
+        puts("No file system specified.");
+        return;
+    }
+
+    // the base listing walks block maps by the file size, which does not hold for
+    // compressed inodes, so the inodes are listed here
+    display_filesystem(fs, (fs_display_flag_t) (flag & DISPLAY_FS_FORMAT));
+    if (flag & DISPLAY_FS_FORMAT) display_optional_state(fs);
+    if (flag & DISPLAY_INODES) display_inodes(fs);
+    display_filesystem(fs, (fs_display_flag_t) (flag & DISPLAY_DBLOCKS));
+}
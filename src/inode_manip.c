@@ -1,269 +1,1262 @@
 #include "filesys.h"
+#include "fs_ext.h"
 #include "utility.h"
 #include "debug.h"
+#include "lz.h"
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 
 #define INDIRECT_DBLOCK_INDEX_COUNT (DATA_BLOCK_SIZE / sizeof(dblock_index_t) - 1)
 #define NEXT_INDIRECT_INDEX_OFFSET (DATA_BLOCK_SIZE - sizeof(dblock_index_t))
+#define DIRECTORY_ENTRY_SIZE (sizeof(inode_index_t) + MAX_FILE_NAME_LEN)
 
-static fs_retcode_t get_or_allocate_indirect_data_block(filesystem_t *fs, inode_t *inode, size_t indirect_index, dblock_index_t *result) {
-    fs_retcode_t ret;
-    if (inode->internal.indirect_dblock == 0) {
-        dblock_index_t new_index;
-        ret = claim_available_dblock(fs, &new_index);
+// ----------------------- BLOCK CURSOR ----------------------- //
+
+// walks the block map of an inode one logical block at a time. stepping to the next
+// block is O(1) since the cursor remembers which index dblock it is in, so a single
+// pass over a file costs one walk of the index chain instead of one walk per block.
+//
+// only the index dblocks needed for the file size are live. shrinking leaves the old
+// pointers to released index dblocks in place, so links past the live ones are ignored.
+//
+// a cursor opened for writing makes every index dblock it passes through private to the
+// inode, copying the ones that are shared with another inode (see `inode_share_data`).
+//
+// the entries of a compressed inode's map are cluster header dblocks instead of data
+// dblocks, so a block number is a cluster number there.
+typedef struct block_cursor
+{
+    filesystem_t *fs;
+    inode_t *inode;
+    size_t block;                   // logical block the cursor points at
+    size_t live_index;              // number of live index dblocks in the chain
+    size_t live_blocks;             // number of live entries in the map
+    int writable;                   // copy shared index dblocks on the way
+    dblock_index_t index_dblock;    // index dblock holding `block` (DBLOCK_NONE if direct or not yet allocated)
+    dblock_index_t prev_index;      // index dblock before `index_dblock` (DBLOCK_NONE if none)
+} block_cursor_t;
+
+static int is_compressed(inode_t *inode) {
+    return (inode->internal.file_perms & INODE_COMPRESSED) != 0;
+}
+
+static int is_tail_packed(inode_t *inode) {
+    return (inode->internal.file_perms & INODE_TAIL_PACKED) != 0;
+}
+
+// whether the file system is in the log-structured mode
+static int log_on(filesystem_t *fs) {
+    fs_ext_t *ext = fs_ext(fs);
+    return ext && ext->log;
+}
+
+// whether reads check every data block they return data from against its checksum
+static int reads_verified(filesystem_t *fs) {
+    fs_ext_t *ext = fs_ext(fs);
+    return ext && ext->verify_reads;
+}
+
+// number of live entries in the block map of an inode
+static size_t live_map_entries(inode_t *inode) {
+    return calculate_map_entries(inode, inode->internal.file_size);
+}
+
+// number of index dblocks that hold live entries for an inode
+static size_t live_index_dblocks(inode_t *inode) {
+    return calculate_map_index_dblock_amount(live_map_entries(inode));
+}
+
+// position in the index chain of the index dblock that holds `block`
+static size_t index_position(size_t block) {
+    return (block - INODE_DIRECT_BLOCK_COUNT) / INDIRECT_DBLOCK_INDEX_COUNT;
+}
+
+static dblock_index_t *index_entries(filesystem_t *fs, dblock_index_t index_dblock) {
+    return cast_dblock_ptr(fs->dblocks + index_dblock * DATA_BLOCK_SIZE);
+}
+
+static dblock_index_t next_index_dblock(filesystem_t *fs, dblock_index_t index_dblock) {
+    return index_entries(fs, index_dblock)[INDIRECT_DBLOCK_INDEX_COUNT];
+}
+
+// link to the index dblock at chain position `position`, given the one before it
+static dblock_index_t *index_link(block_cursor_t *cur, size_t position) {
+    if (position == 0) return &cur->inode->internal.indirect_dblock;
+    return &index_entries(cur->fs, cur->prev_index)[INDIRECT_DBLOCK_INDEX_COUNT];
+}
+
+// keeps the checksum of the index dblock holding the link at `position` up to date
+static void link_written(block_cursor_t *cur, size_t position) {
+    if (position > 0) checksum_update(cur->fs, cur->prev_index);
+}
+
+// makes the index dblock at chain position `position` referenced from `link` private.
+// a shared index dblock is copied, and the copy takes a reference on everything the
+// original points to: the live data entries and the next live index dblock.
+static fs_retcode_t unshare_index_dblock(block_cursor_t *cur, dblock_index_t *link, size_t position) {
+    filesystem_t *fs = cur->fs;
+    dblock_index_t shared = *link;
+    if (dblock_ref_count(fs, shared) <= 1) return SUCCESS;
+    dblock_index_t copy;
+    fs_retcode_t ret = claim_available_dblock(fs, &copy);
+    if (ret != SUCCESS) return ret;
+    memcpy(fs->dblocks + copy * DATA_BLOCK_SIZE, fs->dblocks + shared * DATA_BLOCK_SIZE, DATA_BLOCK_SIZE);
+    checksum_update(fs, copy);
+    dblock_index_t *entries = index_entries(fs, copy);
+    size_t first_block = INODE_DIRECT_BLOCK_COUNT + position * INDIRECT_DBLOCK_INDEX_COUNT;
+    for (size_t i = 0; i < INDIRECT_DBLOCK_INDEX_COUNT && first_block + i < cur->live_blocks; i++) {
+        ret = ref_dblock(fs, entries[i]);
         if (ret != SUCCESS) return ret;
-        inode->internal.indirect_dblock = new_index;
-        memset(fs->dblocks + new_index * DATA_BLOCK_SIZE, 0, DATA_BLOCK_SIZE);
-    }
-    size_t rem = indirect_index;
-    dblock_index_t current = inode->internal.indirect_dblock;
-    while (rem >= INDIRECT_DBLOCK_INDEX_COUNT) {
-        dblock_index_t *index_arr = cast_dblock_ptr(fs->dblocks + current * DATA_BLOCK_SIZE);
-        if (index_arr[INDIRECT_DBLOCK_INDEX_COUNT] == 0) {
-            dblock_index_t new_index;
-            ret = claim_available_dblock(fs, &new_index);
-            if (ret != SUCCESS) return ret;
-            index_arr[INDIRECT_DBLOCK_INDEX_COUNT] = new_index;
-            memset(fs->dblocks + new_index * DATA_BLOCK_SIZE, 0, DATA_BLOCK_SIZE);
-        }
-        current = cast_dblock_ptr(fs->dblocks + current * DATA_BLOCK_SIZE)[INDIRECT_DBLOCK_INDEX_COUNT];
-        rem -= INDIRECT_DBLOCK_INDEX_COUNT;
     }
-    dblock_index_t *index_arr = cast_dblock_ptr(fs->dblocks + current * DATA_BLOCK_SIZE);
-    if (index_arr[rem] == 0) {
-        dblock_index_t new_data;
-        ret = claim_available_dblock(fs, &new_data);
+    if (position + 1 < cur->live_index) {
+        ret = ref_dblock(fs, entries[INDIRECT_DBLOCK_INDEX_COUNT]);
         if (ret != SUCCESS) return ret;
-        index_arr[rem] = new_data;
     }
-    *result = index_arr[rem];
+    unref_dblock(fs, shared);
+    *link = copy;
+    link_written(cur, position);
     return SUCCESS;
 }
 
-static fs_retcode_t get_data_block(filesystem_t *fs, inode_t *inode, size_t block_index, dblock_index_t *result) {
-    if (block_index < INODE_DIRECT_BLOCK_COUNT) {
-        *result = inode->internal.direct_data[block_index];
+
+// steps into the index dblock at chain position `position`, with `prev_index` already set
+static fs_retcode_t cursor_enter_index(block_cursor_t *cur, size_t position) {
+    if (position >= cur->live_index) {
+        cur->index_dblock = DBLOCK_NONE;
         return SUCCESS;
-    } else {
-        size_t indirect_index = block_index - INODE_DIRECT_BLOCK_COUNT;
-        if (inode->internal.indirect_dblock == 0) return INVALID_INPUT;
-        dblock_index_t current = inode->internal.indirect_dblock;
-        while (indirect_index >= INDIRECT_DBLOCK_INDEX_COUNT) {
-            dblock_index_t *index_arr = cast_dblock_ptr(fs->dblocks + current * DATA_BLOCK_SIZE);
-            if (index_arr[INDIRECT_DBLOCK_INDEX_COUNT] == 0) return INVALID_INPUT;
-            current = index_arr[INDIRECT_DBLOCK_INDEX_COUNT];
-            indirect_index -= INDIRECT_DBLOCK_INDEX_COUNT;
+    }
+    dblock_index_t *link = index_link(cur, position);
+    if (cur->writable) {
+        fs_retcode_t ret = unshare_index_dblock(cur, link, position);
+        if (ret != SUCCESS) return ret;
+    }
+    cur->index_dblock = *link;
+    return SUCCESS;
+}
+
+// positions the cursor at `block`. the index chain must reach the index dblock before the
+// one holding `block`; the index dblock holding `block` itself may still be unallocated.
+static fs_retcode_t cursor_open(block_cursor_t *cur, filesystem_t *fs, inode_t *inode, size_t block, int writable) {
+    cur->fs = fs;
+    cur->inode = inode;
+    cur->block = block;
+    cur->live_index = live_index_dblocks(inode);
+    cur->live_blocks = live_map_entries(inode);
+    cur->writable = writable;
+    cur->index_dblock = DBLOCK_NONE;
+    cur->prev_index = DBLOCK_NONE;
+    if (block < INODE_DIRECT_BLOCK_COUNT) return SUCCESS;
+    size_t hops = index_position(block);
+    if (hops > cur->live_index) return INVALID_INPUT;
+    for (size_t i = 0; i < hops; i++) {
+        fs_retcode_t ret = cursor_enter_index(cur, i);
+        if (ret != SUCCESS) return ret;
+        cur->prev_index = cur->index_dblock;
+    }
+    return cursor_enter_index(cur, hops);
+}
+
+static fs_retcode_t cursor_seek(block_cursor_t *cur, filesystem_t *fs, inode_t *inode, size_t block) {
+    return cursor_open(cur, fs, inode, block, 0);
+}
+
+static fs_retcode_t cursor_seek_writable(block_cursor_t *cur, filesystem_t *fs, inode_t *inode, size_t block) {
+    return cursor_open(cur, fs, inode, block, 1);
+}
+
+static fs_retcode_t cursor_next(block_cursor_t *cur) {
+    cur->block++;
+    if (cur->block < INODE_DIRECT_BLOCK_COUNT) return SUCCESS;
+    if ((cur->block - INODE_DIRECT_BLOCK_COUNT) % INDIRECT_DBLOCK_INDEX_COUNT != 0) return SUCCESS;
+    cur->prev_index = cur->index_dblock;
+    return cursor_enter_index(cur, index_position(cur->block));
+}
+
+// address of the map slot holding the dblock index of the current block
+static dblock_index_t *cursor_slot(block_cursor_t *cur) {
+    if (cur->block < INODE_DIRECT_BLOCK_COUNT)
+        return &cur->inode->internal.direct_data[cur->block];
+    if (cur->index_dblock == DBLOCK_NONE) return NULL;
+    dblock_index_t *index_arr = index_entries(cur->fs, cur->index_dblock);
+    return &index_arr[(cur->block - INODE_DIRECT_BLOCK_COUNT) % INDIRECT_DBLOCK_INDEX_COUNT];
+}
+
+// keeps the checksum of the index dblock holding the current slot up to date
+static void cursor_slot_written(block_cursor_t *cur) {
+    if (cur->block >= INODE_DIRECT_BLOCK_COUNT) checksum_update(cur->fs, cur->index_dblock);
+}
+
+static fs_retcode_t cursor_lookup(block_cursor_t *cur, dblock_index_t *result) {
+    dblock_index_t *slot = cursor_slot(cur);
+    if (!slot) return INVALID_INPUT;
+    *result = *slot;
+    return SUCCESS;
+}
+
+// looks up the current block for writing, copying its data block first if it is shared.
+// in the log-structured mode every data block is copied to the head of the log, and the
+// old one is released unless another inode still refers to it
+static fs_retcode_t cursor_lookup_writable(block_cursor_t *cur, dblock_index_t *result) {
+    filesystem_t *fs = cur->fs;
+    dblock_index_t *slot = cursor_slot(cur);
+    if (!slot) return INVALID_INPUT;
+    if (log_on(fs) || dblock_ref_count(fs, *slot) > 1) {
+        dblock_index_t copy;
+        fs_retcode_t ret = claim_available_dblock(fs, &copy);
+        if (ret != SUCCESS) return ret;
+        memcpy(fs->dblocks + copy * DATA_BLOCK_SIZE, fs->dblocks + *slot * DATA_BLOCK_SIZE, DATA_BLOCK_SIZE);
+        if (unref_dblock(fs, *slot)) release_dblock(fs, fs->dblocks + *slot * DATA_BLOCK_SIZE);
+        *slot = copy;
+        cursor_slot_written(cur);
+    }
+    *result = *slot;
+    return SUCCESS;
+}
+
+// claims and links a new index dblock if the current block starts one
+static fs_retcode_t cursor_extend(block_cursor_t *cur) {
+    filesystem_t *fs = cur->fs;
+    if (cur->block < INODE_DIRECT_BLOCK_COUNT || cur->index_dblock != DBLOCK_NONE) return SUCCESS;
+    dblock_index_t new_index;
+    fs_retcode_t ret = claim_available_dblock(fs, &new_index);
+    if (ret != SUCCESS) return ret;
+    memset(fs->dblocks + new_index * DATA_BLOCK_SIZE, 0, DATA_BLOCK_SIZE);
+    checksum_update(fs, new_index);
+    *index_link(cur, index_position(cur->block)) = new_index;
+    link_written(cur, index_position(cur->block));
+    cur->index_dblock = new_index;
+    cur->live_index++;
+    return SUCCESS;
+}
+
+// claims a new data block for the current block, claiming and linking a new index dblock
+// first if the current block starts one
+static fs_retcode_t cursor_allocate(block_cursor_t *cur, dblock_index_t *result) {
+    fs_retcode_t ret = cursor_extend(cur);
+    if (ret != SUCCESS) return ret;
+    dblock_index_t new_data;
+    ret = claim_available_dblock(cur->fs, &new_data);
+    if (ret != SUCCESS) return ret;
+    *cursor_slot(cur) = new_data;
+    cursor_slot_written(cur);
+    cur->live_blocks = cur->block + 1;
+    *result = new_data;
+    return SUCCESS;
+}
+
+// makes the current block a new reference to an existing data block
+static fs_retcode_t cursor_append_shared(block_cursor_t *cur, dblock_index_t dblock) {
+    fs_retcode_t ret = cursor_extend(cur);
+    if (ret == SUCCESS) ret = ref_dblock(cur->fs, dblock);
+    if (ret != SUCCESS) return ret;
+    *cursor_slot(cur) = dblock;
+    cursor_slot_written(cur);
+    cur->live_blocks = cur->block + 1;
+    return SUCCESS;
+}
+
+// number of dblocks a writable cursor claims to copy shared dblocks when it makes the first
+// `index_positions` index dblocks and the data blocks in [data_first, data_end) private.
+// once one index dblock in the chain is copied, everything it points to becomes shared
+// as well, so every index dblock and data block after it is copied too. in the
+// log-structured mode a private data block is copied and released one at a time, so
+// those need one dblock between them.
+static size_t unshare_dblock_cost(filesystem_t *fs, inode_t *inode, size_t index_positions, size_t data_first, size_t data_end) {
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || (!ext->dblock_refs && !ext->log)) return 0;
+    size_t cost = 0;
+    size_t live_index = live_index_dblocks(inode);
+    if (index_positions > live_index) index_positions = live_index;
+    size_t copied_from = SIZE_MAX;
+    dblock_index_t current = inode->internal.indirect_dblock;
+    for (size_t position = 0; position < index_positions; position++) {
+        if (position > 0) current = next_index_dblock(fs, current);
+        if (copied_from == SIZE_MAX && dblock_ref_count(fs, current) > 1) copied_from = position;
+        if (copied_from != SIZE_MAX) cost++;
+    }
+    if (data_first >= data_end) return cost;
+    block_cursor_t cur;
+    if (cursor_seek(&cur, fs, inode, data_first) != SUCCESS) return cost;
+    int relocated = 0;
+    for (size_t block = data_first; block < data_end; block++) {
+        dblock_index_t dblock;
+        if (cursor_lookup(&cur, &dblock) != SUCCESS) break;
+        int inherited = block >= INODE_DIRECT_BLOCK_COUNT && copied_from != SIZE_MAX && index_position(block) >= copied_from;
+        if (inherited || dblock_ref_count(fs, dblock) > 1) cost++;
+        else if (ext->log) relocated = 1;
+        cursor_next(&cur);
+    }
+    return cost + relocated;
+}
+
+// ----------------------- IOVEC HELPERS ----------------------- //
+
+typedef struct iov_iter
+{
+    const fs_iovec_t *iov;
+    size_t iovcnt;
+    size_t index;   // current iovec
+    size_t offset;  // offset into the current iovec
+} iov_iter_t;
+
+static int iov_valid(const fs_iovec_t *iov, size_t iovcnt) {
+    if (iovcnt > 0 && !iov) return 0;
+    for (size_t i = 0; i < iovcnt; i++)
+        if (!iov[i].base && iov[i].len > 0) return 0;
+    return 1;
+}
+
+static size_t iov_total(const fs_iovec_t *iov, size_t iovcnt) {
+    size_t total = 0;
+    for (size_t i = 0; i < iovcnt; i++) total += iov[i].len;
+    return total;
+}
+
+// gathers `n` bytes from the iovecs into `dst`
+static void iov_gather(iov_iter_t *it, byte *dst, size_t n) {
+    while (n > 0) {
+        const fs_iovec_t *v = &it->iov[it->index];
+        size_t avail = v->len - it->offset;
+        size_t chunk = (n < avail) ? n : avail;
+        // an empty iovec may have a null base, which memcpy does not accept even for 0 bytes
+        if (chunk > 0) memcpy(dst, (byte *)v->base + it->offset, chunk);
+        dst += chunk;
+        n -= chunk;
+        it->offset += chunk;
+        if (it->offset == v->len) {
+            it->index++;
+            it->offset = 0;
         }
-        dblock_index_t *index_arr = cast_dblock_ptr(fs->dblocks + current * DATA_BLOCK_SIZE);
-        *result = index_arr[indirect_index];
+    }
+}
+
+// scatters `n` bytes from `src` into the iovecs
+static void iov_scatter(iov_iter_t *it, const byte *src, size_t n) {
+    while (n > 0) {
+        const fs_iovec_t *v = &it->iov[it->index];
+        size_t avail = v->len - it->offset;
+        size_t chunk = (n < avail) ? n : avail;
+        if (chunk > 0) memcpy((byte *)v->base + it->offset, src, chunk);
+        src += chunk;
+        n -= chunk;
+        it->offset += chunk;
+        if (it->offset == v->len) {
+            it->index++;
+            it->offset = 0;
+        }
+    }
+}
+
+// ----------------------- DEDUPLICATION ----------------------- //
+
+// only the full data blocks of plain data files go in the dedup index. the payload of a
+// compressed cluster is not reference counted, so it must never be shared
+static int dedup_applies(filesystem_t *fs, inode_t *inode) {
+    fs_ext_t *ext = fs_ext(fs);
+    return ext && ext->dedup && inode->internal.file_type == DATA_FILE && !is_compressed(inode);
+}
+
+// keeps the dedup index in step with a data block that was just written in place
+static void dedup_rewritten(filesystem_t *fs, inode_t *inode, dblock_index_t dblock, int full) {
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dedup) return;
+    dedup_forget(fs, dblock);
+    if (full && dedup_applies(fs, inode))
+        dedup_insert(fs, dblock, crc32c(0, fs->dblocks + dblock * DATA_BLOCK_SIZE, DATA_BLOCK_SIZE));
+}
+
+// appends one full block of `data`, sharing an identical dblock from the index if there is one
+static fs_retcode_t cursor_append_dedup(block_cursor_t *cur, const byte *data) {
+    filesystem_t *fs = cur->fs;
+    uint32_t hash = crc32c(0, data, DATA_BLOCK_SIZE);
+    dblock_index_t dblock = dedup_find(fs, data, hash);
+    if (dblock != DBLOCK_NONE) {
+        fs_retcode_t ret = cursor_append_shared(cur, dblock);
+        if (ret == SUCCESS) fs_ext(fs)->dedup->saved++;
+        return ret;
+    }
+    fs_retcode_t ret = cursor_allocate(cur, &dblock);
+    if (ret != SUCCESS) return ret;
+    memcpy(fs->dblocks + dblock * DATA_BLOCK_SIZE, data, DATA_BLOCK_SIZE);
+    checksum_update(fs, dblock);
+    dedup_insert(fs, dblock, hash);
+    return SUCCESS;
+}
+
+// overwrites the current block with one full block of `data`. if an identical dblock is in
+// the index the map points at it instead, dropping the old dblock
+static fs_retcode_t cursor_overwrite_dedup(block_cursor_t *cur, const byte *data) {
+    filesystem_t *fs = cur->fs;
+    uint32_t hash = crc32c(0, data, DATA_BLOCK_SIZE);
+    dblock_index_t *slot = cursor_slot(cur);
+    if (!slot) return INVALID_INPUT;
+    dblock_index_t match = dedup_find(fs, data, hash);
+    if (match == *slot) return SUCCESS;
+    if (match != DBLOCK_NONE) {
+        fs_retcode_t ret = ref_dblock(fs, match);
+        if (ret != SUCCESS) return ret;
+        if (unref_dblock(fs, *slot)) release_dblock(fs, fs->dblocks + *slot * DATA_BLOCK_SIZE);
+        *slot = match;
+        cursor_slot_written(cur);
+        fs_ext(fs)->dedup->saved++;
         return SUCCESS;
     }
+    dblock_index_t dblock;
+    fs_retcode_t ret = cursor_lookup_writable(cur, &dblock);
+    if (ret != SUCCESS) return ret;
+    memcpy(fs->dblocks + dblock * DATA_BLOCK_SIZE, data, DATA_BLOCK_SIZE);
+    checksum_update(fs, dblock);
+    dedup_forget(fs, dblock);
+    dedup_insert(fs, dblock, hash);
+    return SUCCESS;
 }
 
-fs_retcode_t inode_write_data(filesystem_t *fs, inode_t *inode, void *data, size_t n) {
-    if (!fs || !inode || !data) return INVALID_INPUT;
+// ----------------------- TAIL PACKING ----------------------- //
+
+// the last block of a packed file lives in a tail dblock shared with other files, at the
+// offset kept in its `file_perms`. the tail is private to the inode, so it is never copied
+// on write; instead it is moved back into a block of its own before the file is written
+// and packed again afterwards.
+
+// map slot of the last block of a file whose map fits in the direct entries, or null
+static dblock_index_t *tail_slot(inode_t *inode) {
+    size_t blocks = live_map_entries(inode);
+    if (blocks == 0 || blocks > INODE_DIRECT_BLOCK_COUNT) return NULL;
+    return &inode->internal.direct_data[blocks - 1];
+}
+
+static void set_tail(inode_t *inode, int packed, size_t offset) {
+    inode->internal.file_perms &= ~(INODE_TAIL_PACKED | INODE_TAIL_OFFSET_MASK);
+    if (packed) inode->internal.file_perms |= INODE_TAIL_PACKED | (offset << INODE_TAIL_SHIFT);
+}
+
+// moves the partial last block of a small plain data file into a tail dblock. packing is
+// best effort: a file whose last block is shared, or for which there is no room, is left as is
+static void pack_tail(filesystem_t *fs, inode_t *inode) {
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->tails || !ext->tails->packing || inode->internal.file_type != DATA_FILE) return;
+    if (is_compressed(inode) || is_tail_packed(inode)) return;
+    size_t len = inode->internal.file_size % DATA_BLOCK_SIZE;
+    dblock_index_t *slot = tail_slot(inode);
+    if (len == 0 || !slot || dblock_ref_count(fs, *slot) > 1) return;
+    dblock_index_t tail;
+    size_t offset;
+    if (tail_claim(fs, len, &tail, &offset) != SUCCESS) return;
+    memcpy(fs->dblocks + tail * DATA_BLOCK_SIZE + offset, fs->dblocks + *slot * DATA_BLOCK_SIZE, len);
+    checksum_update(fs, tail);
+    release_dblock(fs, fs->dblocks + *slot * DATA_BLOCK_SIZE);
+    *slot = tail;
+    set_tail(inode, 1, offset);
+}
+
+// moves a packed tail back into a dblock of its own
+static fs_retcode_t unpack_tail(filesystem_t *fs, inode_t *inode) {
+    if (!is_tail_packed(inode)) return SUCCESS;
+    dblock_index_t *slot = tail_slot(inode);
+    size_t len = inode->internal.file_size % DATA_BLOCK_SIZE;
+    size_t offset = INODE_TAIL_OFFSET(inode->internal.file_perms);
+    dblock_index_t dblock;
+    if (claim_available_dblock(fs, &dblock) != SUCCESS) return INSUFFICIENT_DBLOCKS;
+    memcpy(fs->dblocks + dblock * DATA_BLOCK_SIZE, fs->dblocks + *slot * DATA_BLOCK_SIZE + offset, len);
+    checksum_update(fs, dblock);
+    tail_shrink(fs, *slot, offset, len, 0);
+    *slot = dblock;
+    set_tail(inode, 0, 0);
+    return SUCCESS;
+}
+
+// ----------------------- DATA PATHS ----------------------- //
+
+// number of dblocks (data and index) an append of `n` bytes needs on top of what the inode
+// holds. this includes copies of shared dblocks that the append has to write into.
+static size_t append_dblock_cost(filesystem_t *fs, inode_t *inode, size_t n) {
     size_t current_size = inode->internal.file_size;
     size_t new_size = current_size + n;
     size_t blocks_required = (new_size + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
-    size_t current_blocks = (current_size == 0) ? 0 : ((current_size - 1) / DATA_BLOCK_SIZE + 1);
+    size_t current_blocks = (current_size + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
     size_t additional_blocks = (blocks_required > current_blocks) ? (blocks_required - current_blocks) : 0;
     size_t required_index_blocks = 0;
     if (blocks_required > INODE_DIRECT_BLOCK_COUNT) {
         size_t req = blocks_required - INODE_DIRECT_BLOCK_COUNT;
         required_index_blocks = (req + INDIRECT_DBLOCK_INDEX_COUNT - 1) / INDIRECT_DBLOCK_INDEX_COUNT;
     }
-    size_t current_index_blocks = 0;
-    if (inode->internal.indirect_dblock != 0) {
-        dblock_index_t curr = inode->internal.indirect_dblock;
-        while (curr != 0) {
-            current_index_blocks++;
-            dblock_index_t *arr = cast_dblock_ptr(fs->dblocks + curr * DATA_BLOCK_SIZE);
-            if (arr[INDIRECT_DBLOCK_INDEX_COUNT] == 0) break;
-            curr = arr[INDIRECT_DBLOCK_INDEX_COUNT];
-        }
-    }
+    size_t current_index_blocks = live_index_dblocks(inode);
     size_t additional_index_blocks = (required_index_blocks > current_index_blocks) ? (required_index_blocks - current_index_blocks) : 0;
-    size_t total_additional = additional_blocks + additional_index_blocks;
-    if (total_additional > available_dblocks(fs)) return INSUFFICIENT_DBLOCKS;
-    size_t original_size = current_size;
-    byte *data_ptr = (byte *)data;
-    size_t bytes_remaining = n;
+    // the append walks the index chain up to the block it starts in and writes into the
+    // partially used last block, copying whatever of that is shared
+    size_t first = (current_size % DATA_BLOCK_SIZE != 0) ? current_blocks - 1 : current_blocks;
+    size_t positions = (first >= INODE_DIRECT_BLOCK_COUNT) ? index_position(first) + 1 : 0;
+    size_t unshare = (n > 0) ? unshare_dblock_cost(fs, inode, positions, first, current_blocks) : 0;
+    return additional_blocks + additional_index_blocks + unshare;
+}
+
+// appends `n` bytes gathered from `it`. the caller has already checked that enough dblocks
+// are available, so the block claims below cannot fail part way through.
+static fs_retcode_t append_from_iov(filesystem_t *fs, inode_t *inode, iov_iter_t *it, size_t n) {
+    if (n == 0) return SUCCESS;
+    size_t current_size = inode->internal.file_size;
     size_t offset_in_block = current_size % DATA_BLOCK_SIZE;
-    size_t block_index = current_blocks;
-    if (offset_in_block != 0 && current_blocks > 0) {
-        dblock_index_t dblock_id;
-        if (current_blocks <= INODE_DIRECT_BLOCK_COUNT)
-            dblock_id = inode->internal.direct_data[current_blocks - 1];
-        else {
-            if (get_data_block(fs, inode, current_blocks - 1, &dblock_id) != SUCCESS)
-                return INVALID_INPUT;
-        }
+    size_t current_blocks = (current_size + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
+    block_cursor_t cur;
+    fs_retcode_t ret;
+    size_t remaining = n;
+    if (offset_in_block != 0) {
+        // fill the partially used last block first
+        ret = cursor_seek_writable(&cur, fs, inode, current_blocks - 1);
+        if (ret != SUCCESS) return ret;
+        dblock_index_t dblock;
+        ret = cursor_lookup_writable(&cur, &dblock);
+        if (ret != SUCCESS) return ret;
         size_t space_in_block = DATA_BLOCK_SIZE - offset_in_block;
-        size_t to_copy = (bytes_remaining < space_in_block) ? bytes_remaining : space_in_block;
-        memcpy(fs->dblocks + dblock_id * DATA_BLOCK_SIZE + offset_in_block, data_ptr, to_copy);
-        data_ptr += to_copy;
-        bytes_remaining -= to_copy;
-        current_size += to_copy;
-    }
-    while (bytes_remaining > 0) {
-        if (block_index < INODE_DIRECT_BLOCK_COUNT) {
-            dblock_index_t new_dblock;
-            if (claim_available_dblock(fs, &new_dblock) != SUCCESS) {
-                inode->internal.file_size = original_size;
-                return INSUFFICIENT_DBLOCKS;
-            }
-            inode->internal.direct_data[block_index] = new_dblock;
+        size_t to_copy = (remaining < space_in_block) ? remaining : space_in_block;
+        iov_gather(it, fs->dblocks + dblock * DATA_BLOCK_SIZE + offset_in_block, to_copy);
+        checksum_update(fs, dblock);
+        dedup_rewritten(fs, inode, dblock, to_copy == space_in_block);
+        remaining -= to_copy;
+        ret = cursor_next(&cur);
+    } else {
+        ret = cursor_seek_writable(&cur, fs, inode, current_blocks);
+    }
+    if (ret != SUCCESS) return ret;
+    int dedup = dedup_applies(fs, inode);
+    while (remaining > 0) {
+        size_t to_copy = (remaining < DATA_BLOCK_SIZE) ? remaining : DATA_BLOCK_SIZE;
+        if (dedup && to_copy == DATA_BLOCK_SIZE) {
+            byte data[DATA_BLOCK_SIZE];
+            iov_gather(it, data, DATA_BLOCK_SIZE);
+            ret = cursor_append_dedup(&cur, data);
+            if (ret != SUCCESS) return ret;
         } else {
-            dblock_index_t new_dblock;
-            if (get_or_allocate_indirect_data_block(fs, inode, block_index - INODE_DIRECT_BLOCK_COUNT, &new_dblock) != SUCCESS) {
-                inode->internal.file_size = original_size;
-                return INSUFFICIENT_DBLOCKS;
-            }
+            dblock_index_t dblock;
+            ret = cursor_allocate(&cur, &dblock);
+            if (ret != SUCCESS) return ret;
+            iov_gather(it, fs->dblocks + dblock * DATA_BLOCK_SIZE, to_copy);
+            checksum_update(fs, dblock);
         }
-        size_t to_copy = (bytes_remaining < DATA_BLOCK_SIZE) ? bytes_remaining : DATA_BLOCK_SIZE;
-        dblock_index_t current_dblock;
-        if (block_index < INODE_DIRECT_BLOCK_COUNT)
-            current_dblock = inode->internal.direct_data[block_index];
-        else {
-            if (get_data_block(fs, inode, block_index, &current_dblock) != SUCCESS) {
-                inode->internal.file_size = original_size;
-                return INVALID_INPUT;
-            }
+        remaining -= to_copy;
+        ret = cursor_next(&cur);
+        if (ret != SUCCESS) return ret;
+    }
+    inode->internal.file_size = current_size + n;
+    return SUCCESS;
+}
+
+// ----------------------- COMPRESSED CLUSTERS ----------------------- //
+
+#define CLUSTER_PAYLOAD_COUNT (COMPRESSED_CLUSTER_SIZE / DATA_BLOCK_SIZE)
+
+// a cluster encoded in memory, ready to be stored
+typedef struct encoded_cluster
+{
+    byte data[COMPRESSED_CLUSTER_SIZE];
+    uint16_t len;
+    uint8_t flags;
+} encoded_cluster_t;
+
+static size_t dblocks_for(size_t n) {
+    return (n + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
+}
+
+// drops the inode's reference on a map entry, queueing it for release if it was the last
+// one. the payload of a cluster is only referenced through its header, so it goes with it
+static void drop_map_entry(filesystem_t *fs, inode_t *inode, dblock_index_t entry, dblock_index_t *freed, size_t *count) {
+    if (!unref_dblock(fs, entry)) return;
+    freed[(*count)++] = entry;
+    if (!is_compressed(inode)) return;
+    cluster_header_t header;
+    size_t payload = read_cluster_header(fs, entry, &header);
+    for (size_t i = 0; i < payload; i++) freed[(*count)++] = header.payload[i];
+}
+
+// decompresses a cluster into `plain`, which holds COMPRESSED_CLUSTER_SIZE bytes
+static fs_retcode_t load_cluster(filesystem_t *fs, dblock_index_t header_dblock, byte *plain) {
+    int verify = reads_verified(fs);
+    if (verify && !checksum_verify(fs, header_dblock)) return CHECKSUM_MISMATCH;
+    cluster_header_t header;
+    size_t payload = read_cluster_header(fs, header_dblock, &header);
+    if (header.stored_len > COMPRESSED_CLUSTER_SIZE) return INVALID_BINARY_FORMAT;
+    byte stored[COMPRESSED_CLUSTER_SIZE];
+    byte *dst = (header.flags & CLUSTER_STORED_RAW) ? plain : stored;
+    for (size_t i = 0; i < payload; i++) {
+        if (verify && !checksum_verify(fs, header.payload[i])) return CHECKSUM_MISMATCH;
+        size_t chunk = header.stored_len - i * DATA_BLOCK_SIZE;
+        if (chunk > DATA_BLOCK_SIZE) chunk = DATA_BLOCK_SIZE;
+        memcpy(dst + i * DATA_BLOCK_SIZE, fs->dblocks + header.payload[i] * DATA_BLOCK_SIZE, chunk);
+    }
+    if (header.flags & CLUSTER_STORED_RAW) return SUCCESS;
+    if (lz_decompress(stored, header.stored_len, plain, COMPRESSED_CLUSTER_SIZE) == 0) return INVALID_BINARY_FORMAT;
+    return SUCCESS;
+}
+
+static void encode_cluster(const byte *plain, size_t n, encoded_cluster_t *encoded) {
+    size_t len = lz_compress(plain, n, encoded->data, COMPRESSED_CLUSTER_SIZE);
+    // keep the cluster raw unless compressing it saves a dblock
+    if (len == 0 || dblocks_for(len) >= dblocks_for(n)) {
+        memcpy(encoded->data, plain, n);
+        encoded->len = n;
+        encoded->flags = CLUSTER_STORED_RAW;
+    } else {
+        encoded->len = len;
+        encoded->flags = 0;
+    }
+}
+
+// claims the payload dblocks of an encoded cluster and writes it behind `header_dblock`
+static fs_retcode_t store_cluster(filesystem_t *fs, dblock_index_t header_dblock, const encoded_cluster_t *encoded) {
+    cluster_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.stored_len = encoded->len;
+    header.flags = encoded->flags;
+    for (size_t i = 0; i < dblocks_for(encoded->len); i++) {
+        fs_retcode_t ret = claim_available_dblock(fs, &header.payload[i]);
+        if (ret != SUCCESS) return ret;
+        size_t chunk = encoded->len - i * DATA_BLOCK_SIZE;
+        if (chunk > DATA_BLOCK_SIZE) chunk = DATA_BLOCK_SIZE;
+        memcpy(fs->dblocks + header.payload[i] * DATA_BLOCK_SIZE, encoded->data + i * DATA_BLOCK_SIZE, chunk);
+        checksum_update(fs, header.payload[i]);
+    }
+    memcpy(fs->dblocks + header_dblock * DATA_BLOCK_SIZE, &header, sizeof(header));
+    checksum_update(fs, header_dblock);
+    return SUCCESS;
+}
+
+// writes `n` bytes from `it` at `offset` of a compressed inode, appending past the end.
+// every cluster the range touches is decompressed, patched and compressed into new dblocks
+// before the old cluster is dropped. clusters are never updated in place, so a cluster
+// shared with a clone or a snapshot needs no copy.
+static fs_retcode_t compressed_write(filesystem_t *fs, inode_t *inode, size_t offset, iov_iter_t *it, size_t n) {
+    if (n == 0) return SUCCESS;
+    size_t file_size = inode->internal.file_size;
+    size_t end = offset + n;
+    size_t new_size = (end > file_size) ? end : file_size;
+    size_t first = offset / COMPRESSED_CLUSTER_SIZE;
+    size_t last = (end - 1) / COMPRESSED_CLUSTER_SIZE;
+    size_t count = last - first + 1;
+    size_t old_clusters = live_map_entries(inode);
+
+    encoded_cluster_t *encoded = malloc(count * sizeof(encoded_cluster_t));
+    dblock_index_t *freed = malloc(count * (1 + CLUSTER_PAYLOAD_COUNT) * sizeof(dblock_index_t));
+    if (!encoded || !freed) {
+        free(encoded);
+        free(freed);
+        return SYSTEM_ERROR;
+    }
+
+    // encode every cluster first so the dblocks needed are known before anything changes
+    byte plain[COMPRESSED_CLUSTER_SIZE];
+    size_t cost = 0;
+    block_cursor_t cur;
+    fs_retcode_t ret = cursor_seek(&cur, fs, inode, first);
+    for (size_t i = 0; ret == SUCCESS && i < count; i++) {
+        size_t start = (first + i) * COMPRESSED_CLUSTER_SIZE;
+        size_t plain_len = new_size - start;
+        if (plain_len > COMPRESSED_CLUSTER_SIZE) plain_len = COMPRESSED_CLUSTER_SIZE;
+        if (first + i < old_clusters) {
+            dblock_index_t header;
+            ret = cursor_lookup(&cur, &header);
+            if (ret == SUCCESS) ret = load_cluster(fs, header, plain);
+            if (ret != SUCCESS) break;
         }
-        memcpy(fs->dblocks + current_dblock * DATA_BLOCK_SIZE, data_ptr, to_copy);
-        data_ptr += to_copy;
-        bytes_remaining -= to_copy;
-        current_size += to_copy;
-        block_index++;
+        size_t lo = ((offset > start) ? offset : start) - start;
+        size_t hi = ((end < start + COMPRESSED_CLUSTER_SIZE) ? end : start + COMPRESSED_CLUSTER_SIZE) - start;
+        iov_gather(it, plain + lo, hi - lo);
+        encode_cluster(plain, plain_len, &encoded[i]);
+        cost += 1 + dblocks_for(encoded[i].len);
+        ret = cursor_next(&cur);
+    }
+    size_t new_clusters = (last + 1 > old_clusters) ? last + 1 : old_clusters;
+    cost += calculate_map_index_dblock_amount(new_clusters) - live_index_dblocks(inode);
+    size_t positions = (last >= INODE_DIRECT_BLOCK_COUNT) ? index_position(last) + 1 : 0;
+    cost += unshare_dblock_cost(fs, inode, positions, 0, 0);
+    if (ret == SUCCESS && cost > available_dblocks(fs)) ret = INSUFFICIENT_DBLOCKS;
+
+    size_t freed_count = 0;
+    if (ret == SUCCESS) ret = cursor_seek_writable(&cur, fs, inode, first);
+    for (size_t i = 0; ret == SUCCESS && i < count; i++) {
+        dblock_index_t header;
+        if (first + i < old_clusters) {
+            dblock_index_t *slot = cursor_slot(&cur);
+            ret = claim_available_dblock(fs, &header);
+            if (ret != SUCCESS) break;
+            drop_map_entry(fs, inode, *slot, freed, &freed_count);
+            *slot = header;
+            cursor_slot_written(&cur);
+        } else {
+            ret = cursor_allocate(&cur, &header);
+            if (ret != SUCCESS) break;
+        }
+        ret = store_cluster(fs, header, &encoded[i]);
+        if (ret == SUCCESS) ret = cursor_next(&cur);
+    }
+    if (ret == SUCCESS) ret = release_dblocks(fs, freed, freed_count);
+    if (ret == SUCCESS) inode->internal.file_size = new_size;
+    free(encoded);
+    free(freed);
+    return ret;
+}
+
+static fs_retcode_t compressed_read(filesystem_t *fs, inode_t *inode, size_t offset, iov_iter_t *it, size_t n) {
+    block_cursor_t cur;
+    if (cursor_seek(&cur, fs, inode, offset / COMPRESSED_CLUSTER_SIZE) != SUCCESS)
+        return INVALID_INPUT;
+    byte plain[COMPRESSED_CLUSTER_SIZE];
+    size_t cluster_offset = offset % COMPRESSED_CLUSTER_SIZE;
+    while (n > 0) {
+        dblock_index_t header;
+        if (cursor_lookup(&cur, &header) != SUCCESS)
+            return INVALID_INPUT;
+        fs_retcode_t ret = load_cluster(fs, header, plain);
+        if (ret != SUCCESS) return ret;
+        size_t chunk = COMPRESSED_CLUSTER_SIZE - cluster_offset;
+        if (chunk > n) chunk = n;
+        iov_scatter(it, plain + cluster_offset, chunk);
+        n -= chunk;
+        cluster_offset = 0;
+        cursor_next(&cur);
     }
-    inode->internal.file_size = new_size;
     return SUCCESS;
 }
 
-fs_retcode_t inode_read_data(filesystem_t *fs, inode_t *inode, size_t offset, void *buffer, size_t n, size_t *bytes_read) {
-    if (!fs || !inode || !buffer || !bytes_read) return INVALID_INPUT;
+// ----------------------- INODE DATA ----------------------- //
+
+// appends `n` bytes gathered from `it` in the layout of the inode. the log cleaner does
+// not run, so this is safe for an inode that is in no inode table yet
+static fs_retcode_t write_data(filesystem_t *fs, inode_t *inode, iov_iter_t *it, size_t n) {
+    if (is_compressed(inode)) return compressed_write(fs, inode, inode->internal.file_size, it, n);
+    if (n == 0) return SUCCESS;
+    fs_retcode_t ret = unpack_tail(fs, inode);
+    if (ret == SUCCESS && append_dblock_cost(fs, inode, n) > available_dblocks(fs)) ret = INSUFFICIENT_DBLOCKS;
+    if (ret == SUCCESS) ret = append_from_iov(fs, inode, it, n);
+    pack_tail(fs, inode);
+    return ret;
+}
+
+fs_retcode_t inode_write_datav(filesystem_t *fs, inode_t *inode, const fs_iovec_t *iov, size_t iovcnt) {
+    if (!fs || !inode || !iov_valid(iov, iovcnt)) return INVALID_INPUT;
+    iov_iter_t it = { iov, iovcnt, 0, 0 };
+    fs_retcode_t ret = write_data(fs, inode, &it, iov_total(iov, iovcnt));
+    dir_totals_update(fs, inode);
+    log_clean_if_low(fs);
+    return ret;
+}
+
+fs_retcode_t inode_write_data(filesystem_t *fs, inode_t *inode, void *data, size_t n) {
+    if (!fs || !inode || !data) return INVALID_INPUT;
+    fs_iovec_t iov = { data, n };
+    return inode_write_datav(fs, inode, &iov, 1);
+}
+
+fs_retcode_t inode_read_datav(filesystem_t *fs, inode_t *inode, size_t offset, const fs_iovec_t *iov, size_t iovcnt, size_t *bytes_read) {
+    if (!fs || !inode || !bytes_read || !iov_valid(iov, iovcnt)) return INVALID_INPUT;
     size_t file_size = inode->internal.file_size;
     if (offset > file_size) {
         *bytes_read = 0;
         return SUCCESS;
     }
+    size_t n = iov_total(iov, iovcnt);
     size_t to_read = (offset + n > file_size) ? (file_size - offset) : n;
     *bytes_read = to_read;
-    size_t start_block = offset / DATA_BLOCK_SIZE;
+    if (to_read == 0) return SUCCESS;
+    iov_iter_t it = { iov, iovcnt, 0, 0 };
+    if (is_compressed(inode)) return compressed_read(fs, inode, offset, &it, to_read);
+    block_cursor_t cur;
+    if (cursor_seek(&cur, fs, inode, offset / DATA_BLOCK_SIZE) != SUCCESS)
+        return INVALID_INPUT;
     size_t block_offset = offset % DATA_BLOCK_SIZE;
-    size_t remaining = to_read, copied = 0;
+    size_t remaining = to_read;
+    int verify = reads_verified(fs);
     while (remaining > 0) {
         dblock_index_t dblock;
-        if (get_data_block(fs, inode, start_block, &dblock) != SUCCESS)
+        if (cursor_lookup(&cur, &dblock) != SUCCESS)
             return INVALID_INPUT;
+        if (verify && !checksum_verify(fs, dblock))
+            return CHECKSUM_MISMATCH;
         size_t copy_size = DATA_BLOCK_SIZE - block_offset;
         if (copy_size > remaining) copy_size = remaining;
-        memcpy((byte *)buffer + copied, fs->dblocks + dblock * DATA_BLOCK_SIZE + block_offset, copy_size);
+        if (is_tail_packed(inode) && cur.block + 1 == cur.live_blocks)
+            block_offset += INODE_TAIL_OFFSET(inode->internal.file_perms);
+        iov_scatter(&it, fs->dblocks + dblock * DATA_BLOCK_SIZE + block_offset, copy_size);
         remaining -= copy_size;
-        copied += copy_size;
-        start_block++;
         block_offset = 0;
+        cursor_next(&cur);
     }
     return SUCCESS;
 }
 
-fs_retcode_t inode_modify_data(filesystem_t *fs, inode_t *inode, size_t offset, void *buffer, size_t n) {
-    if (!fs || !inode || !buffer) return INVALID_INPUT;
+fs_retcode_t inode_read_data(filesystem_t *fs, inode_t *inode, size_t offset, void *buffer, size_t n, size_t *bytes_read) {
+    if (!fs || !inode || !buffer || !bytes_read) return INVALID_INPUT;
+    fs_iovec_t iov = { buffer, n };
+    return inode_read_datav(fs, inode, offset, &iov, 1, bytes_read);
+}
+
+void inode_block_iter_init(inode_block_iter_t *iter, filesystem_t *fs, inode_t *inode, size_t offset) {
+    if (!iter) return;
+    iter->fs = fs;
+    iter->inode = inode;
+    iter->offset = offset - offset % DATA_BLOCK_SIZE;
+    iter->chained = 0;
+    iter->index_dblock = 0;
+}
+
+fs_retcode_t inode_block_iter_next(inode_block_iter_t *iter, const byte **data, size_t *len) {
+    if (!iter || !iter->fs || !iter->inode || !data || !len) return INVALID_INPUT;
+    filesystem_t *fs = iter->fs;
+    inode_t *inode = iter->inode;
+    size_t file_size = inode->internal.file_size;
+    *len = 0;
+    if (iter->offset >= file_size) return SUCCESS;
+    size_t n = file_size - iter->offset;
+    if (n > DATA_BLOCK_SIZE) n = DATA_BLOCK_SIZE;
+    if (is_compressed(inode)) {
+        // the cluster is decoded again for every block; directories are never compressed
+        size_t bytes_read;
+        fs_retcode_t ret = inode_read_data(fs, inode, iter->offset, iter->buffer, n, &bytes_read);
+        if (ret != SUCCESS) return ret;
+        *data = iter->buffer;
+    } else {
+        size_t block = iter->offset / DATA_BLOCK_SIZE;
+        dblock_index_t dblock;
+        if (block < INODE_DIRECT_BLOCK_COUNT) {
+            dblock = inode->internal.direct_data[block];
+        } else {
+            size_t slot = (block - INODE_DIRECT_BLOCK_COUNT) % INDIRECT_DBLOCK_INDEX_COUNT;
+            if (!iter->chained) {
+                // the first block past the direct entries walks the chain to its index dblock once
+                iter->index_dblock = inode->internal.indirect_dblock;
+                for (size_t i = (block - INODE_DIRECT_BLOCK_COUNT) / INDIRECT_DBLOCK_INDEX_COUNT; i > 0; i--)
+                    iter->index_dblock = next_index_dblock(fs, iter->index_dblock);
+                iter->chained = 1;
+            } else if (slot == 0) {
+                iter->index_dblock = next_index_dblock(fs, iter->index_dblock);
+            }
+            dblock = index_entries(fs, iter->index_dblock)[slot];
+        }
+        if (reads_verified(fs) && !checksum_verify(fs, dblock)) return CHECKSUM_MISMATCH;
+        size_t start = 0;
+        if (is_tail_packed(inode) && block + 1 == live_map_entries(inode))
+            start = INODE_TAIL_OFFSET(inode->internal.file_perms);
+        *data = fs->dblocks + dblock * DATA_BLOCK_SIZE + start;
+    }
+    iter->offset += n;
+    *len = n;
+    return SUCCESS;
+}
+
+// overwrites and appends `n` bytes at `offset` of a plain inode
+static fs_retcode_t plain_modify(filesystem_t *fs, inode_t *inode, size_t offset, const fs_iovec_t *iov, size_t iovcnt, size_t n) {
     size_t file_size = inode->internal.file_size;
-    if (offset > file_size) return INVALID_INPUT;
     size_t end_offset = offset + n;
     size_t overwrite = (end_offset <= file_size) ? n : (file_size - offset);
-    size_t appended = (end_offset > file_size) ? (end_offset - file_size) : 0;
-    size_t current = offset, remaining = overwrite, copied = 0;
-    while (remaining > 0) {
-        dblock_index_t dblock;
-        if (get_data_block(fs, inode, current / DATA_BLOCK_SIZE, &dblock) != SUCCESS)
-            return INVALID_INPUT;
-        size_t block_offset = current % DATA_BLOCK_SIZE;
-        size_t copy_size = DATA_BLOCK_SIZE - block_offset;
-        if (copy_size > remaining) copy_size = remaining;
-        memcpy(fs->dblocks + dblock * DATA_BLOCK_SIZE + block_offset, (byte *)buffer + copied, copy_size);
-        current += copy_size;
-        copied += copy_size;
-        remaining -= copy_size;
+    size_t appended = n - overwrite;
+    // check the space for copying shared dblocks and for the appended part before touching
+    // anything so a failed modify leaves the file unchanged
+    size_t cost = 0;
+    if (overwrite > 0) {
+        size_t first = offset / DATA_BLOCK_SIZE;
+        size_t last = (offset + overwrite - 1) / DATA_BLOCK_SIZE;
+        size_t positions = (last >= INODE_DIRECT_BLOCK_COUNT) ? index_position(last) + 1 : 0;
+        cost += unshare_dblock_cost(fs, inode, positions, first, last + 1);
     }
-    if (appended > 0) {
-        if (inode_write_data(fs, inode, (byte *)buffer + copied, appended) != SUCCESS)
-            return INSUFFICIENT_DBLOCKS;
+    if (appended > 0) cost += append_dblock_cost(fs, inode, appended);
+    if (cost > available_dblocks(fs))
+        return INSUFFICIENT_DBLOCKS;
+    iov_iter_t it = { iov, iovcnt, 0, 0 };
+    if (overwrite > 0) {
+        block_cursor_t cur;
+        fs_retcode_t ret = cursor_seek_writable(&cur, fs, inode, offset / DATA_BLOCK_SIZE);
+        if (ret != SUCCESS) return ret;
+        size_t block_offset = offset % DATA_BLOCK_SIZE;
+        size_t remaining = overwrite;
+        int dedup = dedup_applies(fs, inode);
+        while (remaining > 0) {
+            size_t copy_size = DATA_BLOCK_SIZE - block_offset;
+            if (copy_size > remaining) copy_size = remaining;
+            if (dedup && copy_size == DATA_BLOCK_SIZE) {
+                byte data[DATA_BLOCK_SIZE];
+                iov_gather(&it, data, DATA_BLOCK_SIZE);
+                ret = cursor_overwrite_dedup(&cur, data);
+                if (ret != SUCCESS) return ret;
+            } else {
+                dblock_index_t dblock;
+                ret = cursor_lookup_writable(&cur, &dblock);
+                if (ret != SUCCESS) return ret;
+                iov_gather(&it, fs->dblocks + dblock * DATA_BLOCK_SIZE + block_offset, copy_size);
+                checksum_update(fs, dblock);
+                size_t block_end = (cur.block + 1) * DATA_BLOCK_SIZE;
+                dedup_rewritten(fs, inode, dblock, block_end <= file_size);
+            }
+            remaining -= copy_size;
+            block_offset = 0;
+            if (remaining > 0) {
+                ret = cursor_next(&cur);
+                if (ret != SUCCESS) return ret;
+            }
+        }
     }
-    return SUCCESS;
+    return append_from_iov(fs, inode, &it, appended);
 }
 
-fs_retcode_t inode_shrink_data(filesystem_t *fs, inode_t *inode, size_t new_size) {
-    if (!fs || !inode) return INVALID_INPUT;
+fs_retcode_t inode_modify_datav(filesystem_t *fs, inode_t *inode, size_t offset, const fs_iovec_t *iov, size_t iovcnt) {
+    if (!fs || !inode || !iov_valid(iov, iovcnt)) return INVALID_INPUT;
+    if (offset > inode->internal.file_size) return INVALID_INPUT;
+    size_t n = iov_total(iov, iovcnt);
+    fs_retcode_t ret = SUCCESS;
+    if (is_compressed(inode)) {
+        iov_iter_t it = { iov, iovcnt, 0, 0 };
+        ret = compressed_write(fs, inode, offset, &it, n);
+    } else if (n > 0) {
+        ret = unpack_tail(fs, inode);
+        if (ret == SUCCESS) ret = plain_modify(fs, inode, offset, iov, iovcnt, n);
+        pack_tail(fs, inode);
+    }
+    dir_totals_update(fs, inode);
+    log_clean_if_low(fs);
+    return ret;
+}
+
+fs_retcode_t inode_modify_data(filesystem_t *fs, inode_t *inode, size_t offset, void *buffer, size_t n) {
+    if (!fs || !inode || !buffer) return INVALID_INPUT;
+    fs_iovec_t iov = { buffer, n };
+    return inode_modify_datav(fs, inode, offset, &iov, 1);
+}
+
+static fs_retcode_t shrink_data(filesystem_t *fs, inode_t *inode, size_t new_size) {
     size_t old_size = inode->internal.file_size;
     if (new_size > old_size) return INVALID_INPUT;
 
-    size_t old_blocks = (old_size + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
-    size_t new_blocks = (new_size + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
+    // a packed tail gives back the bytes past the new size. once the whole tail goes, the
+    // rest of the file is full blocks in the direct entries and shrinks as usual
+    if (is_tail_packed(inode)) {
+        size_t tail_start = old_size - old_size % DATA_BLOCK_SIZE;
+        size_t new_len = (new_size > tail_start) ? new_size - tail_start : 0;
+        tail_shrink(fs, *tail_slot(inode), INODE_TAIL_OFFSET(inode->internal.file_perms), old_size - tail_start, new_len);
+        if (new_len == 0) set_tail(inode, 0, 0);
+        inode->internal.file_size = (new_len > 0) ? new_size : tail_start;
+        if (new_len > 0) return SUCCESS;
+        old_size = tail_start;
+    }
+
+    // a compressed inode keeps its last cluster whole. the bytes past the new size are
+    // ignored and replaced when the cluster is next written
+    size_t old_blocks = live_map_entries(inode);
+    size_t new_blocks = calculate_map_entries(inode, new_size);
+    size_t keep_index = calculate_map_index_dblock_amount(new_blocks);
+    size_t chain_length = live_index_dblocks(inode);
 
-    for (size_t b = new_blocks; b < old_blocks; b++) {
-        dblock_index_t db;
-        if (get_data_block(fs, inode, b, &db) != SUCCESS) return INVALID_INPUT;
-        release_dblock(fs, fs->dblocks + db * DATA_BLOCK_SIZE);
+    // gather every dblock to free in one walk of the block map, then release them together
+    size_t per_entry = is_compressed(inode) ? 1 + CLUSTER_PAYLOAD_COUNT : 1;
+    size_t capacity = (old_blocks - new_blocks) * per_entry + chain_length;
+    if (capacity == 0) {
+        inode->internal.file_size = new_size;
+        pack_tail(fs, inode);
+        return SUCCESS;
     }
 
-    if (inode->internal.indirect_dblock != 0) {
-        size_t direct = INODE_DIRECT_BLOCK_COUNT;
-        if (new_blocks <= direct) {
-            dblock_index_t chain = inode->internal.indirect_dblock;
-            while (chain) {
-                dblock_index_t *arr = cast_dblock_ptr(fs->dblocks + chain * DATA_BLOCK_SIZE);
-                dblock_index_t next = arr[INDIRECT_DBLOCK_INDEX_COUNT];
-                release_dblock(fs, fs->dblocks + chain * DATA_BLOCK_SIZE);
-                chain = next;
-            }
-        } else {
-            size_t used_indirect = new_blocks - direct;
-            size_t keep_idx = (used_indirect + (DATA_BLOCK_SIZE/sizeof(dblock_index_t)-1) - 1)
-                              / (DATA_BLOCK_SIZE/sizeof(dblock_index_t)-1);
-            dblock_index_t curr = inode->internal.indirect_dblock;
-            for (size_t i = 1; i < keep_idx; i++) {
-                dblock_index_t *arr = cast_dblock_ptr(fs->dblocks + curr * DATA_BLOCK_SIZE);
-                curr = arr[INDIRECT_DBLOCK_INDEX_COUNT];
-                if (!curr) break;
-            }
-            dblock_index_t *arr = cast_dblock_ptr(fs->dblocks + curr * DATA_BLOCK_SIZE);
-            dblock_index_t next = arr[INDIRECT_DBLOCK_INDEX_COUNT];
-            while (next) {
-                dblock_index_t *arr2 = cast_dblock_ptr(fs->dblocks + next * DATA_BLOCK_SIZE);
-                dblock_index_t nn = arr2[INDIRECT_DBLOCK_INDEX_COUNT];
-                release_dblock(fs, fs->dblocks + next * DATA_BLOCK_SIZE);
-                next = nn;
-            }
+    // the last kept index dblock loses entries or its successor. if any index dblock up to
+    // it is shared it has to be copied first, or the other inode would lose them too
+    size_t kept_end = INODE_DIRECT_BLOCK_COUNT + keep_index * INDIRECT_DBLOCK_INDEX_COUNT;
+    int trims_kept = keep_index > 0 && (keep_index < chain_length || new_blocks < kept_end);
+    if (trims_kept && unshare_dblock_cost(fs, inode, keep_index, 0, 0) > available_dblocks(fs))
+        return INSUFFICIENT_DBLOCKS;
+
+    dblock_index_t *freed = malloc(capacity * sizeof(dblock_index_t));
+    if (!freed) return SYSTEM_ERROR;
+    size_t count = 0;
+
+    for (size_t b = new_blocks; b < old_blocks && b < INODE_DIRECT_BLOCK_COUNT; b++)
+        drop_map_entry(fs, inode, inode->internal.direct_data[b], freed, &count);
+
+    dblock_index_t chain = inode->internal.indirect_dblock;
+    if (trims_kept) {
+        block_cursor_t cur;
+        fs_retcode_t ret = cursor_seek_writable(&cur, fs, inode, kept_end - 1);
+        if (ret != SUCCESS) {
+            free(freed);
+            return ret;
         }
+        dblock_index_t *entries = index_entries(fs, cur.index_dblock);
+        for (size_t b = new_blocks; b < old_blocks && b < kept_end; b++)
+            drop_map_entry(fs, inode, entries[(b - INODE_DIRECT_BLOCK_COUNT) % INDIRECT_DBLOCK_INDEX_COUNT], freed, &count);
+        chain = entries[INDIRECT_DBLOCK_INDEX_COUNT];
+    }
+
+    // index dblocks past the ones still needed. a shared index dblock only loses this
+    // inode's reference, and everything behind it still belongs to the other inode.
+    // their links are left as is and become stale once the file size drops
+    for (size_t position = keep_index; position < chain_length; position++) {
+        if (!unref_dblock(fs, chain)) break;
+        freed[count++] = chain;
+        dblock_index_t *entries = index_entries(fs, chain);
+        size_t first_block = INODE_DIRECT_BLOCK_COUNT + position * INDIRECT_DBLOCK_INDEX_COUNT;
+        for (size_t i = 0; i < INDIRECT_DBLOCK_INDEX_COUNT && first_block + i < old_blocks; i++)
+            drop_map_entry(fs, inode, entries[i], freed, &count);
+        chain = entries[INDIRECT_DBLOCK_INDEX_COUNT];
     }
 
+    fs_retcode_t ret = release_dblocks(fs, freed, count);
+    free(freed);
+    if (ret != SUCCESS) return ret;
+
     inode->internal.file_size = new_size;
+    pack_tail(fs, inode);
     return SUCCESS;
 }
 
+fs_retcode_t inode_shrink_data(filesystem_t *fs, inode_t *inode, size_t new_size) {
+    if (!fs || !inode) return INVALID_INPUT;
+    fs_retcode_t ret = shrink_data(fs, inode, new_size);
+    dir_totals_update(fs, inode);
+    return ret;
+}
+
 fs_retcode_t inode_release_data(filesystem_t *fs, inode_t *inode) {
     if (!fs || !inode) return INVALID_INPUT;
+    return inode_shrink_data(fs, inode, 0);
+}
+
+fs_retcode_t inode_share_data(filesystem_t *fs, inode_t *dst, inode_t *src) {
+    if (!fs || !dst || !src || dst == src) return INVALID_INPUT;
+    if (dst->internal.file_size != 0) return INVALID_INPUT;
+    // the map is only meaningful in the layout of the source
+    dst->internal.file_perms = (dst->internal.file_perms & ~INODE_LAYOUT_MASK) | (src->internal.file_perms & INODE_COMPRESSED);
+    // a packed tail is copied into a tail of its own instead of shared
+    size_t blocks = live_map_entries(src);
+    size_t tail_len = is_tail_packed(src) ? src->internal.file_size % DATA_BLOCK_SIZE : 0;
+    dblock_index_t tail = 0;
+    size_t tail_offset = 0;
+    if (tail_len > 0) {
+        if (tail_claim(fs, tail_len, &tail, &tail_offset) != SUCCESS) return INSUFFICIENT_DBLOCKS;
+        memcpy(fs->dblocks + tail * DATA_BLOCK_SIZE + tail_offset,
+               fs->dblocks + src->internal.direct_data[blocks - 1] * DATA_BLOCK_SIZE + INODE_TAIL_OFFSET(src->internal.file_perms), tail_len);
+        checksum_update(fs, tail);
+        dst->internal.direct_data[--blocks] = tail;
+        set_tail(dst, 1, tail_offset);
+    }
+    // only the direct blocks and the head of the index chain gain a reference. the rest of
+    // the chain is reached through the shared head and is copied lazily on the first write
+    for (size_t b = 0; b < blocks && b < INODE_DIRECT_BLOCK_COUNT; b++) {
+        fs_retcode_t ret = ref_dblock(fs, src->internal.direct_data[b]);
+        if (ret != SUCCESS) {
+            for (size_t undo = 0; undo < b; undo++) unref_dblock(fs, src->internal.direct_data[undo]);
+            if (tail_len > 0) {
+                tail_shrink(fs, tail, tail_offset, tail_len, 0);
+                set_tail(dst, 0, 0);
+            }
+            return ret;
+        }
+        dst->internal.direct_data[b] = src->internal.direct_data[b];
+    }
+    if (live_index_dblocks(src) > 0) {
+        fs_retcode_t ret = ref_dblock(fs, src->internal.indirect_dblock);
+        if (ret != SUCCESS) {
+            for (size_t b = 0; b < blocks && b < INODE_DIRECT_BLOCK_COUNT; b++) unref_dblock(fs, src->internal.direct_data[b]);
+            return ret;
+        }
+        dst->internal.indirect_dblock = src->internal.indirect_dblock;
+    }
+    dst->internal.file_size = src->internal.file_size;
+    dir_totals_update(fs, dst);
+    return SUCCESS;
+}
+
+fs_retcode_t inode_set_compressed(filesystem_t *fs, inode_t *inode, int compressed) {
+    if (!fs || !inode) return INVALID_INPUT;
+    if (inode->internal.file_type != DATA_FILE) return INVALID_FILE_TYPE;
+    if (is_compressed(inode) == (compressed != 0)) return SUCCESS;
+    size_t file_size = inode->internal.file_size;
+    byte *data = malloc(file_size ? file_size : 1);
+    if (!data) return SYSTEM_ERROR;
+    size_t bytes_read;
+    fs_retcode_t ret = inode_read_data(fs, inode, 0, data, file_size, &bytes_read);
+    // write the data in the new layout to a scratch inode first, so running out of
+    // dblocks leaves the file as it was
+    inode_t converted;
+    memset(&converted, 0, sizeof(converted));
+    converted.internal.file_type = DATA_FILE;
+    converted.internal.file_perms = compressed ? INODE_COMPRESSED : 0;
+    fs_iovec_t iov = { data, file_size };
+    iov_iter_t it = { &iov, 1, 0, 0 };
+    if (ret == SUCCESS) ret = write_data(fs, &converted, &it, file_size);
+    free(data);
+    if (ret != SUCCESS) return ret;
+    ret = inode_release_data(fs, inode);
+    if (ret != SUCCESS) {
+        inode_release_data(fs, &converted);
+        return ret;
+    }
+    inode->internal.file_perms = (inode->internal.file_perms & ~INODE_LAYOUT_MASK) | converted.internal.file_perms;
+    memcpy(inode->internal.direct_data, converted.internal.direct_data, sizeof(converted.internal.direct_data));
+    inode->internal.indirect_dblock = converted.internal.indirect_dblock;
+    inode->internal.file_size = file_size;
+    dir_totals_update(fs, inode);
+    log_clean_if_low(fs);
+    return SUCCESS;
+}
 
-    size_t sz = inode->internal.file_size;
-    size_t blocks = (sz + DATA_BLOCK_SIZE - 1) / DATA_BLOCK_SIZE;
+// points every full data block of a plain data file that has a twin in the dedup index at
+// the twin, and adds the others to the index. an index dblock shared with another inode
+// is left alone together with everything behind it, since its blocks are shared already
+static fs_retcode_t inode_dedup_data(filesystem_t *fs, inode_t *inode, size_t *saved) {
+    size_t full_blocks = inode->internal.file_size / DATA_BLOCK_SIZE;
+    size_t live_index = live_index_dblocks(inode);
+    dblock_index_t index_dblock = 0;
+    for (size_t b = 0; b < full_blocks; b++) {
+        dblock_index_t *slot;
+        if (b < INODE_DIRECT_BLOCK_COUNT) {
+            slot = &inode->internal.direct_data[b];
+        } else {
+            size_t position = index_position(b);
+            if ((b - INODE_DIRECT_BLOCK_COUNT) % INDIRECT_DBLOCK_INDEX_COUNT == 0) {
+                if (position >= live_index) break;
+                index_dblock = (position == 0) ? inode->internal.indirect_dblock : next_index_dblock(fs, index_dblock);
+                if (dblock_ref_count(fs, index_dblock) > 1) break;
+            }
+            slot = &index_entries(fs, index_dblock)[(b - INODE_DIRECT_BLOCK_COUNT) % INDIRECT_DBLOCK_INDEX_COUNT];
+        }
+        byte *data = fs->dblocks + *slot * DATA_BLOCK_SIZE;
+        uint32_t hash = crc32c(0, data, DATA_BLOCK_SIZE);
+        dblock_index_t match = dedup_find(fs, data, hash);
+        if (match == DBLOCK_NONE) {
+            dedup_insert(fs, *slot, hash);
+            continue;
+        }
+        if (match == *slot) continue;
+        fs_retcode_t ret = ref_dblock(fs, match);
+        if (ret != SUCCESS) return ret;
+        if (unref_dblock(fs, *slot)) {
+            release_dblock(fs, data);
+            (*saved)++;
+        }
+        *slot = match;
+        if (b >= INODE_DIRECT_BLOCK_COUNT) checksum_update(fs, index_dblock);
+    }
+    return SUCCESS;
+}
 
-    for (size_t b = 0; b < blocks; b++) {
-        dblock_index_t db;
-        if (get_data_block(fs, inode, b, &db) != SUCCESS) return INVALID_INPUT;
-        release_dblock(fs, fs->dblocks + db * DATA_BLOCK_SIZE);
+fs_retcode_t fs_dedup(filesystem_t *fs, size_t *saved) {
+    if (!fs || !saved) return INVALID_INPUT;
+    *saved = 0;
+    fs_retcode_t ret = dedup_enable(fs);
+    if (ret != SUCCESS) return ret;
+    byte *is_free = calloc(fs->inode_count, sizeof(byte));
+    if (!is_free) return SYSTEM_ERROR;
+    for (inode_index_t iter = fs->available_inode; iter != 0; iter = fs->inodes[iter].next_free_inode)
+        is_free[iter] = 1;
+    for (size_t i = 0; i < fs->inode_count && ret == SUCCESS; i++) {
+        inode_t *inode = &fs->inodes[i];
+        if (!is_free[i] && dedup_applies(fs, inode)) ret = inode_dedup_data(fs, inode, saved);
     }
+    free(is_free);
+    fs_ext(fs)->dedup->saved += *saved;
+    return ret;
+}
 
-    dblock_index_t chain = inode->internal.indirect_dblock;
-    while (chain) {
-        dblock_index_t *arr = cast_dblock_ptr(fs->dblocks + chain * DATA_BLOCK_SIZE);
-        dblock_index_t next = arr[INDIRECT_DBLOCK_INDEX_COUNT];
-        release_dblock(fs, fs->dblocks + chain * DATA_BLOCK_SIZE);
-        chain = next;
+// ----------------------- DIRECTORY TOTALS ----------------------- //
+
+fs_retcode_t dir_totals_enable(filesystem_t *fs) {
+    if (!fs) return INVALID_INPUT;
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    dir_total_t *totals = malloc(fs->inode_count * sizeof(dir_total_t));
+    inode_index_t *order = malloc(fs->inode_count * sizeof(inode_index_t));
+    if (!totals || !order) {
+        free(totals);
+        free(order);
+        return SYSTEM_ERROR;
+    }
+    for (size_t i = 0; i < fs->inode_count; i++) {
+        totals[i].bytes = 0;
+        totals[i].descendants = 0;
+        totals[i].parent = DIR_TOTAL_NONE;
+        totals[i].link_count = 0;
+        totals[i].links = NULL;
     }
 
-    inode->internal.file_size = 0;
+    // find the parent of every entry, listing the directories so that each one comes after
+    // its parent. an inode already reached is not followed again: the directories of the
+    // other names of a data file go in its `links`
+    fs_retcode_t ret = SUCCESS;
+    size_t count = 0;
+    order[count++] = 0;
+    for (size_t next = 0; next < count && ret == SUCCESS; next++) {
+        inode_block_iter_t iter;
+        inode_block_iter_init(&iter, fs, &fs->inodes[order[next]], 0);
+        const byte *data;
+        size_t len;
+        while (ret == SUCCESS && inode_block_iter_next(&iter, &data, &len) == SUCCESS && len > 0) {
+            for (size_t pos = 0; pos + DIRECTORY_ENTRY_SIZE <= len; pos += DIRECTORY_ENTRY_SIZE) {
+                const char *name = (const char*) data + pos + sizeof(inode_index_t);
+                if (name[0] == '\0' || strncmp(name, ".", MAX_FILE_NAME_LEN) == 0
+                    || strncmp(name, "..", MAX_FILE_NAME_LEN) == 0) continue;
+                inode_index_t child;
+                memcpy(&child, data + pos, sizeof(inode_index_t));
+                if (child == 0 || child >= fs->inode_count) continue;
+                if (totals[child].parent != DIR_TOTAL_NONE) {
+                    dir_total_t *total = &totals[child];
+                    if (fs->inodes[child].internal.file_type != DATA_FILE || total->link_count >= INODE_MAX_LINKS - 1)
+                        continue;
+                    if (!total->links) total->links = malloc((INODE_MAX_LINKS - 1) * sizeof(uint32_t));
+                    if (!total->links) {
+                        ret = SYSTEM_ERROR;
+                        break;
+                    }
+                    total->links[total->link_count++] = order[next];
+                    continue;
+                }
+                totals[child].parent = order[next];
+                if (fs->inodes[child].internal.file_type == DIRECTORY) order[count++] = child;
+                else totals[child].bytes = fs->inodes[child].internal.file_size;
+            }
+        }
+    }
+
+    if (ret != SUCCESS) {
+        for (size_t i = 0; i < fs->inode_count; i++) free(totals[i].links);
+        free(totals);
+        free(order);
+        return ret;
+    }
+
+    // the files count towards the directory of each name, then every directory towards its
+    // parent, deepest first
+    for (size_t i = 0; i < fs->inode_count; i++) {
+        if (totals[i].parent == DIR_TOTAL_NONE || fs->inodes[i].internal.file_type == DIRECTORY) continue;
+        totals[totals[i].parent].bytes += totals[i].bytes;
+        totals[totals[i].parent].descendants++;
+        for (uint32_t link = 0; link < totals[i].link_count; link++) {
+            totals[totals[i].links[link]].bytes += totals[i].bytes;
+            totals[totals[i].links[link]].descendants++;
+        }
+    }
+    for (size_t i = count; i-- > 1;) {
+        dir_total_t *dir = &totals[order[i]];
+        totals[dir->parent].bytes += dir->bytes;
+        totals[dir->parent].descendants += dir->descendants + 1;
+    }
+    free(order);
+    dir_totals_disable(fs);
+    ext->dir_totals = totals;
     return SUCCESS;
-}
\ No newline at end of file
+}
+
+void dir_totals_update(filesystem_t *fs, inode_t *inode) {
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext || !ext->dir_totals || !inode) return;
+    if (inode < fs->inodes || inode >= fs->inodes + fs->inode_count) return;
+    if (inode->internal.file_type != DATA_FILE) return;
+    dir_total_t *totals = ext->dir_totals;
+    dir_total_t *total = &totals[inode - fs->inodes];
+    size_t change = inode->internal.file_size - total->bytes;
+    if (change == 0) return;
+
+    // once up from the directory of every name
+    total->bytes = inode->internal.file_size;
+    for (uint32_t link = 0; link <= total->link_count; link++) {
+        uint32_t dir = link < total->link_count ? total->links[link] : total->parent;
+        for (; dir != DIR_TOTAL_NONE; dir = totals[dir].parent) {
+            totals[dir].bytes += change;
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS 10
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_NO_POSITION UINT32_MAX
+
+// ----------------------- UTILITY FUNCTION ----------------------- //
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// writes the extra bytes of a length that did not fit in its nibble
+static size_t write_length(uint8_t *dst, size_t out, size_t capacity, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (out >= capacity) return 0;
+        dst[out++] = 255;
+    }
+    if (out >= capacity) return 0;
+    dst[out++] = (uint8_t) length;
+    return out;
+}
+
+// writes one sequence. a match length of 0 marks the last sequence, which has no match
+static size_t write_sequence(uint8_t *dst, size_t out, size_t capacity,
+    const uint8_t *literals, size_t literal_len, size_t match_len, size_t offset)
+{
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+    if (out >= capacity) return 0;
+    size_t token = out++;
+    dst[token] = (uint8_t) (((literal_len < 15 ? literal_len : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_len >= 15 && !(out = write_length(dst, out, capacity, literal_len - 15))) return 0;
+    if (out + literal_len > capacity) return 0;
+    memcpy(dst + out, literals, literal_len);
+    out += literal_len;
+    if (!match_len) return out;
+
+    if (out + 2 > capacity) return 0;
+    dst[out++] = (uint8_t) (offset & 0xFF);
+    dst[out++] = (uint8_t) (offset >> 8);
+    if (match_code >= 15 && !(out = write_length(dst, out, capacity, match_code - 15))) return 0;
+    return out;
+}
+
+// reads the extra bytes of a length whose nibble was 15
+static int read_length(const uint8_t *src, size_t n, size_t *in, size_t *length)
+{
+    uint8_t b;
+    do
+    {
+        if (*in >= n) return -1;
+        b = src[(*in)++];
+        *length += b;
+    } while (b == 255);
+    return 0;
+}
+
+// ----------------------- CORE FUNCTION ----------------------- //
+
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t capacity)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    size_t out = 0;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= n)
+    {
+        uint32_t v = read32(src + i);
+        uint32_t h = lz_hash(v);
+        uint32_t candidate = table[h];
+        table[h] = (uint32_t) i;
+        if (candidate == LZ_NO_POSITION || i - candidate > LZ_MAX_OFFSET || read32(src + candidate) != v)
+        {
+            ++i;
+            continue;
+        }
+
+        size_t match_len = LZ_MIN_MATCH;
+        while (i + match_len < n && src[candidate + match_len] == src[i + match_len]) ++match_len;
+        out = write_sequence(dst, out, capacity, src + anchor, i - anchor, match_len, i - candidate);
+        if (!out) return 0;
+        i += match_len;
+        anchor = i;
+    }
+    return write_sequence(dst, out, capacity, src + anchor, n - anchor, 0, 0);
+}
+
+size_t lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t capacity)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < n)
+    {
+        uint8_t token = src[in++];
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && read_length(src, n, &in, &literal_len)) return 0;
+        if (in + literal_len > n || out + literal_len > capacity) return 0;
+        memcpy(dst + out, src + in, literal_len);
+        in += literal_len;
+        out += literal_len;
+        if (in == n) break; // the last sequence has no match
+
+        if (in + 2 > n) return 0;
+        size_t offset = src[in] | (size_t) src[in + 1] << 8;
+        in += 2;
+        size_t match_len = token & 0xF;
+        if (match_len == 15 && read_length(src, n, &in, &match_len)) return 0;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || out + match_len > capacity) return 0;
+        // byte by byte since the match may overlap the bytes it produces
+        for (size_t j = 0; j < match_len; ++j, ++out) dst[out] = dst[out - offset];
+    }
+    return out;
+}
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filesys.h"
+#include "fs_ext.h"
+#include "debug.h"
+#include "utility.h"
+
+#define DBLOCK_MASK_SIZE(blk_count) (((blk_count) + 7) / (sizeof(byte) * 8))
+#define INDIRECT_DBLOCK_INDEX_COUNT (DATA_BLOCK_SIZE / sizeof(dblock_index_t) - 1)
+
+// ----------------------- UTILITY FUNCTION ----------------------- //
+
+static fs_snapshot_t *find_snapshot(filesystem_t *fs, const char *name)
+{
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return NULL;
+    for (size_t i = 0; i < ext->snapshot_count; ++i)
+        if (strcmp(ext->snapshots[i].name, name) == 0) return &ext->snapshots[i];
+    return NULL;
+}
+
+// marks the inodes on the free list of an inode table
+static byte *free_inode_mask(inode_t *inodes, size_t inode_count, inode_index_t available_inode)
+{
+    byte *mask = calloc((inode_count + 7) / 8, sizeof(byte));
+    if (!mask) return NULL;
+    for (inode_index_t iter = available_inode; iter != 0; iter = inodes[iter].next_free_inode)
+        mask[iter / 8] |= 1 << (iter % 8);
+    return mask;
+}
+
+static int inode_is_free(byte *mask, size_t n)
+{
+    return (mask[n / 8] >> (n % 8)) & 1;
+}
+
+// releases the data of every inode in use in an inode table
+static fs_retcode_t release_inode_table(filesystem_t *fs, inode_t *inodes, inode_index_t available_inode)
+{
+    byte *free_mask = free_inode_mask(inodes, fs->inode_count, available_inode);
+    if (!free_mask) return SYSTEM_ERROR;
+    fs_retcode_t ret = SUCCESS;
+    for (size_t i = 0; i < fs->inode_count && ret == SUCCESS; ++i)
+        if (!inode_is_free(free_mask, i)) ret = inode_release_data(fs, &inodes[i]);
+    free(free_mask);
+    return ret;
+}
+
+// makes `dst` a copy of the inode table `src` that shares the data of every inode in use
+static fs_retcode_t share_inode_table(filesystem_t *fs, inode_t *dst, inode_t *src, inode_index_t available_inode)
+{
+    byte *free_mask = free_inode_mask(src, fs->inode_count, available_inode);
+    if (!free_mask) return SYSTEM_ERROR;
+    memcpy(dst, src, fs->inode_count * sizeof(inode_t));
+    fs_retcode_t ret = SUCCESS;
+    size_t i = 0;
+    for (; i < fs->inode_count && ret == SUCCESS; ++i)
+    {
+        if (inode_is_free(free_mask, i)) continue;
+        dst[i].internal.file_size = 0;
+        ret = inode_share_data(fs, &dst[i], &src[i]);
+    }
+    // undo the inodes shared before the failure
+    if (ret != SUCCESS)
+        for (size_t j = 0; j + 1 < i; ++j)
+            if (!inode_is_free(free_mask, j)) inode_release_data(fs, &dst[j]);
+    free(free_mask);
+    return ret;
+}
+
+// counts a reference on a map entry. the payload of a cluster is referenced through its
+// header, so it is counted the first time the header is reached
+static void count_map_entry(filesystem_t *fs, inode_t *inode, dblock_index_t entry, uint32_t *counts)
+{
+    if (counts[entry]++ || !(inode->internal.file_perms & INODE_COMPRESSED)) return;
+    cluster_header_t header;
+    size_t payload = read_cluster_header(fs, entry, &header);
+    for (size_t i = 0; i < payload; ++i) ++counts[header.payload[i]];
+}
+
+// counts the references an inode holds on each dblock, the same way `ref_dblock` does.
+// an index dblock that was already reached through another inode is shared, so it and
+// everything behind it were counted then
+static void count_dblock_refs(filesystem_t *fs, inode_t *inode, uint32_t *counts)
+{
+    size_t blocks = calculate_map_entries(inode, inode->internal.file_size);
+    for (size_t b = 0; b < blocks && b < INODE_DIRECT_BLOCK_COUNT; ++b)
+        count_map_entry(fs, inode, inode->internal.direct_data[b], counts);
+
+    size_t live_index = calculate_map_index_dblock_amount(blocks);
+    dblock_index_t index_dblock = inode->internal.indirect_dblock;
+    for (size_t position = 0; position < live_index; ++position)
+    {
+        if (counts[index_dblock]++) break;
+        dblock_index_t *entries = cast_dblock_ptr(fs->dblocks + index_dblock * DATA_BLOCK_SIZE);
+        size_t first_block = INODE_DIRECT_BLOCK_COUNT + position * INDIRECT_DBLOCK_INDEX_COUNT;
+        for (size_t i = 0; i < INDIRECT_DBLOCK_INDEX_COUNT && first_block + i < blocks; ++i)
+            count_map_entry(fs, inode, entries[i], counts);
+        index_dblock = entries[INDIRECT_DBLOCK_INDEX_COUNT];
+    }
+}
+
+// whether two inodes have the same attributes and point at the same data. a packed tail
+// is never shared, so the tails are compared by content
+static int same_inode(filesystem_t *fs, inode_t *a, inode_t *b)
+{
+    if (a->internal.file_type != b->internal.file_type) return 0;
+    if ((a->internal.file_perms & ~INODE_TAIL_OFFSET_MASK) != (b->internal.file_perms & ~INODE_TAIL_OFFSET_MASK)) return 0;
+    if (memcmp(a->internal.file_name, b->internal.file_name, MAX_FILE_NAME_LEN) != 0) return 0;
+    size_t file_size = a->internal.file_size;
+    if (file_size != b->internal.file_size) return 0;
+    size_t blocks = calculate_map_entries(a, file_size);
+    if (a->internal.file_perms & INODE_TAIL_PACKED)
+    {
+        byte *tail_a = fs->dblocks + a->internal.direct_data[blocks - 1] * DATA_BLOCK_SIZE + INODE_TAIL_OFFSET(a->internal.file_perms);
+        byte *tail_b = fs->dblocks + b->internal.direct_data[blocks - 1] * DATA_BLOCK_SIZE + INODE_TAIL_OFFSET(b->internal.file_perms);
+        if (memcmp(tail_a, tail_b, file_size % DATA_BLOCK_SIZE) != 0) return 0;
+        --blocks;
+    }
+    for (size_t i = 0; i < blocks && i < INODE_DIRECT_BLOCK_COUNT; ++i)
+        if (a->internal.direct_data[i] != b->internal.direct_data[i]) return 0;
+    if (calculate_map_index_dblock_amount(blocks) > 0 && a->internal.indirect_dblock != b->internal.indirect_dblock)
+        return 0;
+    return 1;
+}
+
+static void print_inode_change(char change, inode_t *inode, size_t index)
+{
+    char filename[MAX_FILE_NAME_LEN + 1] = { 0 };
+    memcpy(filename, inode->internal.file_name, MAX_FILE_NAME_LEN);
+    printf("%c %s (inode %lu)\n", change, filename, index);
+}
+
+// ----------------------- CORE FUNCTION ----------------------- //
+
+fs_retcode_t fs_snapshot_create(filesystem_t *fs, const char *name)
+{
+    if (!fs || !name) return INVALID_INPUT;
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > MAX_FILE_NAME_LEN || find_snapshot(fs, name)) return INVALID_INPUT;
+
+    fs_ext_t *ext = fs_ext(fs);
+    if (!ext) return SYSTEM_ERROR;
+    fs_snapshot_t *snapshots = realloc(ext->snapshots, (ext->snapshot_count + 1) * sizeof(fs_snapshot_t));
+    if (!snapshots) return SYSTEM_ERROR;
+    ext->snapshots = snapshots;
+
+    inode_t *inodes = malloc(fs->inode_count * sizeof(inode_t));
+    if (!inodes) return SYSTEM_ERROR;
+    fs_retcode_t ret = share_inode_table(fs, inodes, fs->inodes, fs->available_inode);
+    if (ret != SUCCESS)
+    {
+        free(inodes);
+        return ret;
+    }
+
+    fs_snapshot_t *snapshot = &ext->snapshots[ext->snapshot_count++];
+    memset(snapshot->name, 0, sizeof(snapshot->name));
+    memcpy(snapshot->name, name, name_len);
+    snapshot->available_inode = fs->available_inode;
+    snapshot->inodes = inodes;
+    return SUCCESS;
+}
+
+fs_retcode_t fs_snapshot_delete(filesystem_t *fs, const char *name)
+{
+    if (!fs || !name) return INVALID_INPUT;
+    fs_snapshot_t *snapshot = find_snapshot(fs, name);
+    if (!snapshot) return NOT_FOUND;
+
+    fs_retcode_t ret = release_inode_table(fs, snapshot->inodes, snapshot->available_inode);
+    if (ret != SUCCESS) return ret;
+    free(snapshot->inodes);
+
+    // keep the snapshots in the order they were taken
+    fs_ext_t *ext = fs_ext(fs);
+    size_t index = snapshot - ext->snapshots;
+    memmove(snapshot, snapshot + 1, (ext->snapshot_count - index - 1) * sizeof(fs_snapshot_t));
+    --ext->snapshot_count;
+    return SUCCESS;
+}
+
+fs_retcode_t fs_snapshot_rollback(filesystem_t *fs, const char *name)
+{
+    if (!fs || !name) return INVALID_INPUT;
+    fs_snapshot_t *snapshot = find_snapshot(fs, name);
+    if (!snapshot) return NOT_FOUND;
+
+    // share the snapshot into a table of its own first, so the live file system is left as
+    // it is if that fails
+    byte *live_free = free_inode_mask(fs->inodes, fs->inode_count, fs->available_inode);
+    inode_t *inodes = malloc(fs->inode_count * sizeof(inode_t));
+    fs_retcode_t ret = (live_free && inodes) ? share_inode_table(fs, inodes, snapshot->inodes, snapshot->available_inode) : SYSTEM_ERROR;
+    if (ret != SUCCESS)
+    {
+        free(live_free);
+        free(inodes);
+        return ret;
+    }
+
+    // the live data is dropped. releasing never claims a dblock and the shared table holds
+    // its own references, so at worst a file whose release runs out of memory is leaked
+    for (size_t i = 0; i < fs->inode_count; ++i)
+        if (!inode_is_free(live_free, i)) inode_release_data(fs, &fs->inodes[i]);
+    free(live_free);
+
+    // the table is copied in place since the working directory of a terminal points into it
+    memcpy(fs->inodes, inodes, fs->inode_count * sizeof(inode_t));
+    free(inodes);
+    fs->available_inode = snapshot->available_inode;
+    dentry_invalidate_all(fs);
+    fs_ext_t *ext = fs_ext(fs);
+    free(ext->dir_slots); // rebuilt as the directories are added to
+    ext->dir_slots = NULL;
+    if (ext->path_cache) ext->path_cache->dir = NULL;
+    // the totals are counted afresh from the restored tree, or dropped if they cannot be
+    if (ext->dir_totals && dir_totals_enable(fs) != SUCCESS) dir_totals_disable(fs);
+    return SUCCESS;
+}
+
+fs_retcode_t fs_snapshot_diff(filesystem_t *fs, const char *name)
+{
+    if (!fs || !name) return INVALID_INPUT;
+    fs_snapshot_t *snapshot = find_snapshot(fs, name);
+    if (!snapshot) return NOT_FOUND;
+
+    byte *old_free = free_inode_mask(snapshot->inodes, fs->inode_count, snapshot->available_inode);
+    byte *new_free = free_inode_mask(fs->inodes, fs->inode_count, fs->available_inode);
+    if (!old_free || !new_free)
+    {
+        free(old_free);
+        free(new_free);
+        return SYSTEM_ERROR;
+    }
+
+    for (size_t i = 0; i < fs->inode_count; ++i)
+    {
+        int was_used = !inode_is_free(old_free, i);
+        int is_used = !inode_is_free(new_free, i);
+        if (was_used && !is_used) print_inode_change('-', &snapshot->inodes[i], i);
+        else if (!was_used && is_used) print_inode_change('+', &fs->inodes[i], i);
+        else if (was_used && !same_inode(fs, &snapshot->inodes[i], &fs->inodes[i]))
+            print_inode_change('M', &fs->inodes[i], i);
+    }
+
+    free(old_free);
+    free(new_free);
+    return SUCCESS;
+}
+
+fs_retcode_t fs_snapshot_save(filesystem_t *fs, const char *name, FILE *file)
+{
+    if (!fs || !name || !file) return INVALID_INPUT;
+    fs_snapshot_t *snapshot = find_snapshot(fs, name);
+    if (!snapshot) return NOT_FOUND;
+
+    byte *free_mask = free_inode_mask(snapshot->inodes, fs->inode_count, snapshot->available_inode);
+    uint32_t *counts = calloc(fs->dblock_count, sizeof(uint32_t));
+    size_t block_bitmask_size = DBLOCK_MASK_SIZE(fs->dblock_count);
+    byte *dblock_bitmask = malloc(block_bitmask_size * sizeof(byte));
+    if (!free_mask || !counts || !dblock_bitmask)
+    {
+        free(free_mask);
+        free(counts);
+        free(dblock_bitmask);
+        return SYSTEM_ERROR;
+    }
+
+    // the dblocks in use are the ones the snapshot can reach, not the ones claimed right now
+    for (size_t i = 0; i < fs->inode_count; ++i)
+        if (!inode_is_free(free_mask, i)) count_dblock_refs(fs, &snapshot->inodes[i], counts);
+    memset(dblock_bitmask, 0xFF, block_bitmask_size);
+    for (size_t i = 0; i < fs->dblock_count; ++i)
+    {
+        if (!counts[i]) continue;
+        dblock_bitmask[i / 8] &= ~(1 << (7 - i % 8));
+        --counts[i]; // the reference table stores the references past the first
+    }
+
+    // save the snapshot through a view of the file system that shares its dblocks. the view
+    // shares the state of the live file system too, so the sections are written from its own
+    fs_ext_t view_ext = { 0 };
+    view_ext.free_dblock_count = FREE_DBLOCK_COUNT_UNKNOWN;
+    view_ext.dblock_refs = counts;
+    view_ext.dblock_crcs = fs_ext(fs)->dblock_crcs;
+    filesystem_t view;
+    view.available_inode = snapshot->available_inode;
+    view.inodes = snapshot->inodes;
+    view.inode_count = fs->inode_count;
+    view.dblock_bitmask = dblock_bitmask;
+    view.dblocks = fs->dblocks;
+    view.dblock_count = fs->dblock_count;
+    fs_retcode_t ret = save_filesystem(file, &view);
+    if (ret == SUCCESS) save_optional_sections(file, &view, &view_ext);
+
+    free(free_mask);
+    free(counts);
+    free(dblock_bitmask);
+    return ret;
+}
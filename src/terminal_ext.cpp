@@ -0,0 +1,808 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <memory>
+
+// the terminal with the commands of the features added on top of the base file system.
+// the base terminal is compiled in with its main renamed, so its commands are used as
+// they are, and the ones that change with the added features are redefined here.
+#define main base_terminal_main
+#include "terminal.cpp"
+#undef main
+
+extern "C"
+{
+    #include "fs_ext.h"
+}
+
+// ------------------------ TERMINAL COMMANDS ------------------------------ //
+
+// parses an optional thread count argument, printing why it is not one
+static bool parse_threads(const std::vector<std::string_view>& args, std::size_t index, size_t& threads)
+{
+    threads = 1;
+    if (args.size() <= index) return true;
+    try
+    {
+        threads = std::stoul(std::string{ args[index] });
+    }
+    catch (std::logic_error&)
+    {
+        puts("Argument is not an unsigned integer type.");
+        return false;
+    }
+    return true;
+}
+
+struct load_fs_ext_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("load"sv) != 0) return false;
+
+        if (args.size() != 2)
+        {
+            puts("Incorrect number of arguments for load.");
+            return true;
+        }
+
+        std::string file_name{ args[1] };
+        FILE *file = fopen(file_name.data(), "r");
+        if (!file)
+        {
+            printf("File with name %s does not exist.\n", file_name.data());
+            return true;
+        }
+        
+        filesystem_t copy;
+        fs_retcode_t ret = load_filesystem_ext(file, &copy);
+        if (ret != SUCCESS) 
+        {
+            REPORT_RETCODE_EXT(ret);
+            return true;
+        }
+        
+        free_filesystem(&fs_env::instance().get());
+        fs_env::instance().get() = copy;
+        new_terminal(&fs_env::instance().get(), &terminal_env::instance().get());
+        fclose(file);
+        return true;
+    }   
+};
+
+const char * const load_fs_ext_command::help_messages[help_message_len] = {
+    "load path_to_fs_binary",
+    "\tLoads a file system from a binary file."
+};
+
+struct save_fs_ext_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("save"sv) != 0) return false;
+
+        if (args.size() != 2)
+        {
+            puts("Incorrect number of arguments for save.");
+            return true;
+        }
+
+        std::string file_name{ args[1] };
+        FILE *file = fopen(file_name.data(), "w");
+        if (!file)
+        {
+            printf("Unexpected error occurred when opening file %s\n", file_name.data());
+            return true;
+        }
+        
+        save_filesystem_ext(file, &fs_env::instance().get());
+        fclose(file);
+        return true;
+    }  
+};
+
+const char * const save_fs_ext_command::help_messages[help_message_len] = {
+    "save path_to_new_fs_binary",
+    "\tSaves a file system to a binary file."
+};
+
+struct display_fs_ext_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("fs"sv) != 0) return false;
+
+        if (args.size() != 1)
+        {
+            puts("Incorrect number of arguments for display.");
+            return true;
+        }
+
+        display_filesystem_ext(&fs_env::instance().get(), DISPLAY_ALL);
+        return true;
+    }
+};
+
+const char * const display_fs_ext_command::help_messages[help_message_len] = {
+    "fs",
+    "\tDisplays all file system information."
+};
+
+struct available_ext_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("available"sv) != 0) return false;
+
+        display_filesystem_ext(&fs_env::instance().get(), DISPLAY_FS_FORMAT);
+        return true;
+    } 
+};
+
+const char * const available_ext_command::help_messages[help_message_len] = {
+    "available",
+    "\tDisplays the number of available inodes and dblocks in the file system."
+};
+
+struct clone_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("clone"sv) != 0) return false;
+
+        if (args.size() != 3)
+        {
+            puts("Incorrect number of arguments for clone.");
+            return true;
+        }
+
+        std::string source{ args[1] };
+        std::string destination{ args[2] };
+
+        fs_clone_file(&terminal_env::instance().get(), source.data(), destination.data());
+        return true;
+    }
+};
+
+const char * const clone_command::help_messages[help_message_len] = {
+    "clone path_to_file path_to_new_file",
+    "\tCreates `path_to_new_file` sharing the data of `path_to_file`. Data blocks are copied when either file is written."
+};
+
+struct snapshot_command
+{
+    static constexpr std::size_t help_message_len = 6;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("snapshot"sv) != 0) return false;
+
+        if (args.size() < 3 || (args[1] == "save"sv) != (args.size() == 4) || args.size() > 4)
+        {
+            puts("Incorrect number of arguments for snapshot.");
+            return true;
+        }
+
+        filesystem_t *fs = &fs_env::instance().get();
+        std::string name{ args[2] };
+        fs_retcode_t ret;
+        if (args[1] == "create"sv) ret = fs_snapshot_create(fs, name.data());
+        else if (args[1] == "delete"sv) ret = fs_snapshot_delete(fs, name.data());
+        else if (args[1] == "diff"sv) ret = fs_snapshot_diff(fs, name.data());
+        else if (args[1] == "rollback"sv)
+        {
+            ret = fs_snapshot_rollback(fs, name.data());
+            if (ret == SUCCESS) new_terminal(fs, &terminal_env::instance().get());
+        }
+        else if (args[1] == "save"sv)
+        {
+            std::string file_name{ args[3] };
+            FILE *file = fopen(file_name.data(), "w");
+            if (!file)
+            {
+                printf("Unexpected error occurred when opening file %s\n", file_name.data());
+                return true;
+            }
+            ret = fs_snapshot_save(fs, name.data(), file);
+            fclose(file);
+        }
+        else
+        {
+            printf("Unknown snapshot operation %s.\n", std::string{ args[1] }.data());
+            return true;
+        }
+
+        if (ret != SUCCESS) REPORT_RETCODE_EXT(ret);
+        return true;
+    }
+};
+
+const char * const snapshot_command::help_messages[help_message_len] = {
+    "snapshot create|delete|rollback|diff name",
+    "\tCreates or deletes the snapshot `name`, restores the file system to it, or prints what changed since.",
+    "\tRolling back moves the working directory to the root.",
+    "snapshot save name path_to_new_fs_binary",
+    "\tSaves the snapshot `name` to a binary file that can be loaded like any other.",
+    "\tThe current snapshots are listed by `available`."
+};
+
+struct compress_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("compress"sv) != 0) return false;
+
+        if (args.size() != 3 || (args[2] != "on"sv && args[2] != "off"sv))
+        {
+            puts("Incorrect number of arguments for compress.");
+            return true;
+        }
+
+        std::string filename{ args[1] };
+        fs_compress_file(&terminal_env::instance().get(), filename.data(), args[2] == "on"sv);
+        return true;
+    }
+};
+
+const char * const compress_command::help_messages[help_message_len] = {
+    "compress path_to_file on|off",
+    "\tStores the data file at `path_to_file` in compressed clusters, or plainly again."
+};
+
+struct dedup_command
+{
+    static constexpr std::size_t help_message_len = 3;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("dedup"sv) != 0) return false;
+
+        if (args.size() > 2 || (args.size() == 2 && args[1] != "off"sv))
+        {
+            puts("Incorrect number of arguments for dedup.");
+            return true;
+        }
+
+        filesystem_t *fs = &fs_env::instance().get();
+        if (args.size() == 2)
+        {
+            dedup_disable(fs);
+            return true;
+        }
+
+        size_t saved;
+        fs_retcode_t ret = fs_dedup(fs, &saved);
+        if (ret != SUCCESS) REPORT_RETCODE_EXT(ret);
+        else printf("Released %lu dblocks (%lu bytes).\n", saved, saved * DATA_BLOCK_SIZE);
+        return true;
+    }
+};
+
+const char * const dedup_command::help_messages[help_message_len] = {
+    "dedup [off]",
+    "\tShares identical data blocks between files and keeps doing so for new writes.",
+    "\t`dedup off` stops sharing new writes. The blocks saved so far are listed by `available`."
+};
+
+struct checksum_command
+{
+    static constexpr std::size_t help_message_len = 4;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("checksum"sv) != 0) return false;
+
+        bool scrub = args.size() >= 2 && args[1] == "scrub"sv;
+        if (args.size() < 2 || (!scrub && args.size() != 2) || args.size() > 3)
+        {
+            puts("Incorrect number of arguments for checksum.");
+            return true;
+        }
+
+        filesystem_t *fs = &fs_env::instance().get();
+        if (!scrub)
+        {
+            if (args[1] == "off"sv) checksum_disable(fs);
+            else if (args[1] == "on"sv || args[1] == "verify"sv)
+            {
+                fs_retcode_t ret = checksum_enable(fs, args[1] == "verify"sv);
+                if (ret != SUCCESS) REPORT_RETCODE_EXT(ret);
+            }
+            else puts("Incorrect arguments for checksum.");
+            return true;
+        }
+
+        size_t threads;
+        if (!parse_threads(args, 2, threads)) return true;
+        dblock_index_t *bad;
+        size_t bad_count;
+        fs_retcode_t ret = fs_scrub(fs, threads, &bad, &bad_count);
+        if (ret != SUCCESS)
+        {
+            REPORT_RETCODE_EXT(ret);
+            return true;
+        }
+        for (size_t i = 0; i < bad_count; ++i) printf("Checksum mismatch in dblock %u\n", bad[i]);
+        printf("%lu bad dblocks.\n", bad_count);
+        free(bad);
+        return true;
+    }
+};
+
+const char * const checksum_command::help_messages[help_message_len] = {
+    "checksum on|verify|off|scrub [threads]",
+    "\tKeeps a CRC32C of every data block up to date as blocks are written.",
+    "\t`verify` also checks every block a read returns data from.",
+    "\t`scrub` checks every claimed block, split between `threads` threads, and lists the bad ones."
+};
+
+struct tailpack_command
+{
+    static constexpr std::size_t help_message_len = 3;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("tailpack"sv) != 0) return false;
+
+        if (args.size() != 2 || (args[1] != "on"sv && args[1] != "off"sv))
+        {
+            puts("Incorrect number of arguments for tailpack.");
+            return true;
+        }
+
+        filesystem_t *fs = &fs_env::instance().get();
+        if (args[1] == "off"sv)
+        {
+            tail_packing_disable(fs);
+            return true;
+        }
+        fs_retcode_t ret = tail_packing_enable(fs);
+        if (ret != SUCCESS) REPORT_RETCODE_EXT(ret);
+        return true;
+    }
+};
+
+const char * const tailpack_command::help_messages[help_message_len] = {
+    "tailpack on|off",
+    "\tPacks the last partial block of small data files into blocks shared with other tails",
+    "\tas the files are written. `available` lists the packed tails."
+};
+
+struct log_command
+{
+    static constexpr std::size_t help_message_len = 4;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("log"sv) != 0) return false;
+
+        if (args.size() != 2 || (args[1] != "on"sv && args[1] != "off"sv && args[1] != "clean"sv))
+        {
+            puts("Incorrect number of arguments for log.");
+            return true;
+        }
+
+        filesystem_t *fs = &fs_env::instance().get();
+        if (args[1] == "off"sv)
+        {
+            log_disable(fs);
+            return true;
+        }
+        if (args[1] == "on"sv)
+        {
+            fs_retcode_t ret = log_enable(fs);
+            if (ret != SUCCESS) REPORT_RETCODE_EXT(ret);
+            return true;
+        }
+        size_t cleaned;
+        fs_retcode_t ret = fs_log_clean(fs, &cleaned);
+        if (ret != SUCCESS) REPORT_RETCODE_EXT(ret);
+        else printf("Emptied %lu segments.\n", cleaned);
+        return true;
+    }
+};
+
+const char * const log_command::help_messages[help_message_len] = {
+    "log on|off|clean",
+    "\tWrites new and changed data blocks in order into segments of the log instead of in place.",
+    "\tSegments that are at most half live are cleaned as they run low, or right away with `clean`.",
+    "\t`available` lists the free segments."
+};
+
+struct index_command
+{
+    static constexpr std::size_t help_message_len = 4;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("index"sv) != 0) return false;
+
+        if (args.size() != 3 || (args[2] != "on"sv && args[2] != "ordered"sv && args[2] != "off"sv))
+        {
+            puts("Incorrect number of arguments for index.");
+            return true;
+        }
+
+        std::string dirname{ args[1] };
+        int indexed = args[2] == "on"sv ? FS_INDEX_HASHED : args[2] == "ordered"sv ? FS_INDEX_ORDERED : FS_INDEX_NONE;
+        fs_index_directory(&terminal_env::instance().get(), dirname.data(), indexed);
+        return true;
+    }
+};
+
+const char * const index_command::help_messages[help_message_len] = {
+    "index path_to_directory on|ordered|off",
+    "\tKeeps a hashed index of the entries of the directory at `path_to_directory`, so",
+    "\tlooking up a name does not scan the whole directory, or drops it again. An ordered",
+    "\tindex is a tree keyed by name, which also makes `ls` list the entries sorted."
+};
+
+struct stats_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("stats"sv) != 0) return false;
+
+        if (args.size() != 1)
+        {
+            puts("Incorrect number of arguments for stats.");
+            return true;
+        }
+
+        const fs_ext_t *ext = fs_ext(&fs_env::instance().get());
+        const dentry_cache_t *dentries = ext ? ext->dentries : nullptr;
+        std::size_t hits = dentries ? dentries->hits : 0;
+        std::size_t misses = dentries ? dentries->misses : 0;
+        double hit_rate = hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0;
+        printf("dentry cache: %lu of %d entries, %lu hits, %lu misses, %.1f%% hit rate\n",
+            dentries ? dentries->count : 0, DENTRY_CACHE_CAPACITY, hits, misses, hit_rate);
+        return true;
+    }
+};
+
+const char * const stats_command::help_messages[help_message_len] = {
+    "stats",
+    "\tDisplays how often path lookups were answered by the dentry cache."
+};
+
+struct tree_ext_command
+{
+    static constexpr std::size_t help_message_len = 4;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("tree"sv) != 0) return false;
+
+        if (args.size() > 3)
+        {
+            puts("Incorrect number of arguments for tree.");
+            return true;
+        }
+
+        size_t threads;
+        if (!parse_threads(args, 2, threads)) return true;
+        if (args.size() == 1) tree(&terminal_env::instance().get(), std::string{ "." }.data());
+        else fs_tree(&terminal_env::instance().get(), std::string{ args[1] }.data(), threads);
+
+        return true;
+    }
+};
+
+const char * const tree_ext_command::help_messages[help_message_len] = {
+    "tree path [threads]",
+    "\tIf the file at path is a directory, display the tree representation starting from the directory.",
+    "\tIf the file at path is a data file, display the tree representation starting from the file.",
+    "\tThe directories are read by `threads` threads, 1 by default."
+};
+
+struct du_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("du"sv) != 0) return false;
+
+        if (args.size() < 2 || args.size() > 3)
+        {
+            puts("Incorrect number of arguments for du.");
+            return true;
+        }
+
+        size_t threads;
+        if (!parse_threads(args, 2, threads)) return true;
+        std::string path{ args[1] };
+        size_t bytes;
+        if (fs_du(&terminal_env::instance().get(), path.data(), threads, &bytes) == 0)
+            printf("%lu\t%s\n", bytes, path.data());
+
+        return true;
+    }
+};
+
+const char * const du_command::help_messages[help_message_len] = {
+    "du path [threads]",
+    "\tDisplays the total size of the data files under path, read by `threads` threads."
+};
+
+struct find_command
+{
+    static constexpr std::size_t help_message_len = 6;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("find"sv) != 0) return false;
+
+        if (args.size() < 2 || args.size() % 2 != 0)
+        {
+            puts("Incorrect number of arguments for find.");
+            return true;
+        }
+
+        fs_find_query_t query{ NULL, 0, 0, 0, -1 };
+        std::string name;
+        size_t threads = 1;
+        for (std::size_t i = 2; i < args.size(); i += 2)
+        {
+            std::string value{ args[i + 1] };
+            try
+            {
+                if (args[i] == "-name"sv)
+                {
+                    name = value;
+                    query.name = name.c_str();
+                }
+                else if (args[i] == "-type"sv && (value == "f" || value == "d")) query.type = value[0];
+                else if (args[i] == "-size"sv)
+                {
+                    query.size_op = (value[0] == '+' || value[0] == '-') ? value[0] : '=';
+                    query.size = std::stoul(query.size_op == '=' ? value : value.substr(1));
+                }
+                else if (args[i] == "-maxdepth"sv) query.max_depth = std::stol(value);
+                else if (args[i] == "-threads"sv) threads = std::stoul(value);
+                else
+                {
+                    printf("Unknown find option %s %s\n", std::string{ args[i] }.data(), value.data());
+                    return true;
+                }
+            }
+            catch (std::logic_error&)
+            {
+                puts("Argument is not an unsigned integer type.");
+                return true;
+            }
+        }
+        fs_find(&terminal_env::instance().get(), std::string{ args[1] }.data(), &query, threads);
+
+        return true;
+    }
+};
+
+const char * const find_command::help_messages[help_message_len] = {
+    "find path [-name glob] [-type f|d] [-size [+|-]N] [-maxdepth N] [-threads N]",
+    "\tDisplays the path of every entry under path that passes all of the given tests:",
+    "\t`-name` matches the entry name against a glob, `-type` its type,",
+    "\t`-size` its size in bytes, above, below or equal to N.",
+    "\t`-maxdepth` only looks N levels below path, and the directories below are not read.",
+    "\tThe directories are read by `threads` threads, 1 by default."
+};
+
+struct totals_command
+{
+    static constexpr std::size_t help_message_len = 3;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("totals"sv) != 0) return false;
+
+        if (args.size() != 2 || (args[1] != "on"sv && args[1] != "off"sv))
+        {
+            puts("Incorrect number of arguments for totals.");
+            return true;
+        }
+
+        filesystem_t *fs = &fs_env::instance().get();
+        if (args[1] == "off"sv)
+        {
+            dir_totals_disable(fs);
+            return true;
+        }
+        fs_retcode_t ret = dir_totals_enable(fs);
+        if (ret != SUCCESS) REPORT_RETCODE_EXT(ret);
+        return true;
+    }
+};
+
+const char * const totals_command::help_messages[help_message_len] = {
+    "totals on|off",
+    "\tKeeps the size of the data files under every directory up to date as the tree changes,",
+    "\tso `du` answers without reading the tree."
+};
+
+struct link_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("link"sv) != 0) return false;
+
+        if (args.size() != 3)
+        {
+            puts("Incorrect number of arguments for link.");
+            return true;
+        }
+
+        std::string source{ args[1] };
+        std::string destination{ args[2] };
+
+        fs_link(&terminal_env::instance().get(), source.data(), destination.data());
+        return true;
+    }
+};
+
+const char * const link_command::help_messages[help_message_len] = {
+    "link path_to_file path_to_new_name",
+    "\tGives the file at `path_to_file` a second name. The data is freed once every name is removed."
+};
+
+struct mv_command
+{
+    static constexpr std::size_t help_message_len = 2;
+    static const char* const help_messages[help_message_len];
+
+    static bool exec(const std::vector<std::string_view>& args)
+    {
+        using namespace std::string_view_literals;
+        if (args[0].compare("mv"sv) != 0) return false;
+
+        if (args.size() != 3)
+        {
+            puts("Incorrect number of arguments for mv.");
+            return true;
+        }
+
+        std::string source{ args[1] };
+        std::string destination{ args[2] };
+
+        fs_rename(&terminal_env::instance().get(), source.data(), destination.data());
+        return true;
+    }
+};
+
+const char * const mv_command::help_messages[help_message_len] = {
+    "mv path path_to_new_name",
+    "\tMoves a file or directory without copying its data, replacing a file or empty directory at `path_to_new_name`."
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        printf("Invalid number of arguments\n");
+        return 1;
+    }
+
+    if (argc == 1)
+    {
+        stdin_interpreter<
+            load_fs_ext_command, 
+            save_fs_ext_command, 
+            new_fs_command,
+            display_fs_ext_command,
+            available_ext_command,
+            stats_command,
+            ls_command,
+            tree_ext_command,
+            du_command,
+            find_command,
+            new_file_command,
+            new_directory_command,
+            remove_file_command,
+            clone_command,
+            link_command,
+            mv_command,
+            snapshot_command,
+            compress_command,
+            index_command,
+            dedup_command,
+            checksum_command,
+            tailpack_command,
+            log_command,
+            totals_command,
+            remove_dir_command,
+            cd_command,
+            write_command,
+            cat_command,
+            dump_command,
+            patch_command
+        >{}.start();
+    }
+    else
+    {
+        source_interpreter<
+            load_fs_ext_command, 
+            save_fs_ext_command, 
+            new_fs_command,
+            display_fs_ext_command,
+            available_ext_command,
+            stats_command,
+            ls_command,
+            tree_ext_command,
+            du_command,
+            find_command,
+            new_file_command,
+            new_directory_command,
+            remove_file_command,
+            clone_command,
+            link_command,
+            mv_command,
+            snapshot_command,
+            compress_command,
+            index_command,
+            dedup_command,
+            checksum_command,
+            tailpack_command,
+            log_command,
+            totals_command,
+            remove_dir_command,
+            cd_command,
+            cat_command,
+            dump_command,
+            patch_command
+        >{ argv[1] }.start();
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -6,11 +6,15 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+#include <string>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 extern "C"
 {
     #include "filesys.h"
+    #include "fs_ext.h"
     #include "debug.h"
 }
 
@@ -22,6 +26,64 @@ extern "C"
 
 void compare_fs_files(char *output_buf, size_t output_size, char *expected_buf, size_t expected_size);
 
+// the helpers below are inline so that a test binary only links the file system code the
+// tests it runs call
+
+// the data of an inode, read back in one call
+inline std::vector<char> read_all(filesystem_t *fs, inode_t *inode)
+{
+    std::vector<char> data(inode->internal.file_size);
+    size_t bytes_read = 0;
+    if (!data.empty()) inode_read_data(fs, inode, 0, data.data(), data.size(), &bytes_read);
+    data.resize(bytes_read);
+    return data;
+}
+
+// every entry of an open directory, read `batch` at a time
+inline std::vector<fs_dirent_t> read_all(fs_dir_t dir, size_t batch)
+{
+    std::vector<fs_dirent_t> result;
+    std::vector<fs_dirent_t> entries(batch);
+    size_t count;
+    while ((count = fs_readdir(dir, entries.data(), batch)))
+        result.insert(result.end(), entries.begin(), entries.begin() + count);
+    return result;
+}
+
+// the contents of the file at `path`, read through a file handle
+inline std::string read_file(terminal_context_t *context, const char *path)
+{
+    fs_file_t file = fs_open(context, PATH(path));
+    EXPECT_NE( file, nullptr ) << path;
+    if (!file) return "";
+    std::string data;
+    char buffer[1024];
+    size_t count;
+    while ((count = fs_read(file, buffer, sizeof(buffer))) > 0) data.append(buffer, count);
+    fs_close(file);
+    return data;
+}
+
+// what fs_walk visits under the inode it starts from
+struct walk_count
+{
+    inode_index_t root;
+    size_t bytes;
+    size_t descendants;
+};
+
+// an fs_walk callback adding each visited entry to the walk_count in `arg`
+inline void count_visit(const fs_walk_entry_t *visited, void *arg)
+{
+    auto *count = static_cast<walk_count*>(arg);
+    if (visited->depth == 0)
+        count->root = visited->entry->inode;
+    else
+        ++count->descendants;
+    if (visited->entry->type == DATA_FILE)
+        count->bytes += visited->entry->size;
+}
+
 template<typename Test>
 struct stdout_logger_lock
 {
@@ -0,0 +1,85 @@
+#include "test_util.hpp"
+
+#include <string>
+
+using DentryCacheSuite = fs_internal_test;
+
+TEST_F(DentryCacheSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8);
+    inode_index_t child;
+    EXPECT_EQ( dentry_lookup(NULL, 0, "a", &child), 0 );
+    EXPECT_EQ( dentry_lookup(&fs, 0, NULL, &child), 0 );
+    EXPECT_EQ( dentry_lookup(&fs, 0, "a", NULL), 0 );
+    dentry_insert(NULL, 0, "a", 1);
+    dentry_invalidate(NULL, 0, "a");
+    // a name longer than an entry can hold is never cached
+    dentry_insert(&fs, 0, "a_very_long_file_name", 1);
+    EXPECT_EQ( dentry_lookup(&fs, 0, "a_very_long_file_name", &child), 0 );
+    free_filesystem(&fs);
+}
+
+TEST_F(DentryCacheSuite, LookupAndInvalidate)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 8);
+    inode_index_t child = 0;
+    EXPECT_EQ( dentry_lookup(&fs, 0, "a", &child), 0 );
+    dentry_insert(&fs, 0, "a", 1);
+    dentry_insert(&fs, 1, "a", 2);
+    dentry_insert(&fs, 1, "fourteen_chars", 3);
+    dentry_insert(&fs, 1, "..", 0);
+    ASSERT_EQ( dentry_lookup(&fs, 0, "a", &child), 1 );
+    EXPECT_EQ( child, 1 );
+    ASSERT_EQ( dentry_lookup(&fs, 1, "a", &child), 1 );
+    EXPECT_EQ( child, 2 );
+    ASSERT_EQ( dentry_lookup(&fs, 1, "fourteen_chars", &child), 1 );
+    EXPECT_EQ( child, 3 );
+    EXPECT_EQ( dentry_lookup(&fs, 1, "fourteen_chars2", &child), 0 );
+    EXPECT_EQ( fs_ext(&fs)->dentries->hits, (size_t) 3 );
+    EXPECT_EQ( fs_ext(&fs)->dentries->misses, (size_t) 1 );
+
+    dentry_invalidate(&fs, 0, "a");
+    EXPECT_EQ( dentry_lookup(&fs, 0, "a", &child), 0 );
+    EXPECT_EQ( dentry_lookup(&fs, 1, "a", &child), 1 );
+
+    // entries in the directory and the entry pointing at it go
+    dentry_insert(&fs, 0, "a", 1);
+    dentry_invalidate_dir(&fs, 1);
+    EXPECT_EQ( dentry_lookup(&fs, 0, "a", &child), 0 );
+    EXPECT_EQ( dentry_lookup(&fs, 1, "a", &child), 0 );
+    EXPECT_EQ( dentry_lookup(&fs, 1, "..", &child), 0 );
+    EXPECT_EQ( fs_ext(&fs)->dentries->count, (size_t) 0 );
+
+    dentry_insert(&fs, 2, "b", 3);
+    size_t hits = fs_ext(&fs)->dentries->hits;
+    dentry_invalidate_all(&fs);
+    EXPECT_EQ( dentry_lookup(&fs, 2, "b", &child), 0 );
+    EXPECT_EQ( fs_ext(&fs)->dentries->hits, hits );
+    free_filesystem(&fs);
+}
+
+// a full cache evicts the entry used least recently
+TEST_F(DentryCacheSuite, Eviction)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 8);
+    inode_index_t child;
+    for (size_t i = 0; i < DENTRY_CACHE_CAPACITY; ++i)
+        dentry_insert(&fs, (inode_index_t) (i % 7), ("n" + std::to_string(i)).c_str(), (inode_index_t) i);
+    EXPECT_EQ( fs_ext(&fs)->dentries->count, (size_t) DENTRY_CACHE_CAPACITY );
+    // touch the oldest entry so the second oldest is evicted instead
+    ASSERT_EQ( dentry_lookup(&fs, 0, "n0", &child), 1 );
+    dentry_insert(&fs, 1, "extra", 1);
+    EXPECT_EQ( fs_ext(&fs)->dentries->count, (size_t) DENTRY_CACHE_CAPACITY );
+    EXPECT_EQ( dentry_lookup(&fs, 0, "n0", &child), 1 );
+    EXPECT_EQ( dentry_lookup(&fs, 1, "n1", &child), 0 );
+    EXPECT_EQ( dentry_lookup(&fs, 1, "extra", &child), 1 );
+    for (size_t i = 2; i < DENTRY_CACHE_CAPACITY; ++i)
+    {
+        ASSERT_EQ( dentry_lookup(&fs, (inode_index_t) (i % 7), ("n" + std::to_string(i)).c_str(), &child), 1 ) << i;
+        EXPECT_EQ( child, (inode_index_t) i );
+    }
+    free_filesystem(&fs);
+}
@@ -0,0 +1,134 @@
+#include "test_util.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using DirTotalsSuite = fs_internal_test;
+
+// the totals kept so far are the ones counted afresh from the tree
+static void expect_counted(filesystem_t *fs)
+{
+    std::vector<dir_total_t> kept(fs_ext(fs)->dir_totals, fs_ext(fs)->dir_totals + fs->inode_count);
+    ASSERT_EQ( dir_totals_enable(fs), SUCCESS );
+    for (size_t i = 0; i < fs->inode_count; ++i)
+    {
+        const dir_total_t &counted = fs_ext(fs)->dir_totals[i];
+        if (i != 0 && counted.parent == DIR_TOTAL_NONE) continue;
+        EXPECT_EQ( kept[i].parent, counted.parent ) << i;
+        EXPECT_EQ( kept[i].bytes, counted.bytes ) << i;
+        EXPECT_EQ( kept[i].descendants, counted.descendants ) << i;
+    }
+}
+
+TEST_F(DirTotalsSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8);
+    EXPECT_EQ( dir_totals_enable(NULL), INVALID_INPUT );
+    dir_totals_disable(NULL);
+    dir_totals_update(&fs, &fs.inodes[0]);
+    dir_totals_link(&fs, 0, 1);
+    dir_totals_unlink(&fs, 0, 1);
+    EXPECT_EQ( fs_ext(&fs)->dir_totals, nullptr );
+    free_filesystem(&fs);
+}
+
+// the totals of the directories of an image agree with walking them, and `du` reads them
+TEST_F(DirTotalsSuite, Image)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( dir_totals_enable(&fs), SUCCESS );
+    for (const char *path : { ".", "a", "a/b", "a/b/c", "a/d", "a/d/text" })
+    {
+        walk_count walked{ 0, 0, 0 };
+        ASSERT_EQ( fs_walk(&context, PATH(path), 1, count_visit, &walked), 0 );
+        const dir_total_t &kept = fs_ext(&fs)->dir_totals[walked.root];
+        if (fs.inodes[walked.root].internal.file_type == DIRECTORY)
+        {
+            EXPECT_EQ( kept.bytes, walked.bytes ) << path;
+        }
+        EXPECT_EQ( kept.descendants, walked.descendants ) << path;
+        size_t bytes;
+        ASSERT_EQ( fs_du(&context, PATH(path), 1, &bytes), 0 );
+        EXPECT_EQ( bytes, walked.bytes ) << path;
+    }
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// files and directories are added, written, shrunk, cloned and removed at random, with the
+// totals checked against a fresh count at every step
+TEST_F(DirTotalsSuite, Changes)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 128, 1024);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( dir_totals_enable(&fs), SUCCESS );
+    std::mt19937 rng{ 48 };
+    std::vector<std::string> directories{ "." }, files;
+    for (size_t i = 0; i < 300; ++i)
+    {
+        std::string directory = directories[rng() % directories.size()];
+        std::string path = directory + "/n" + std::to_string(i);
+        switch (rng() % 7)
+        {
+        case 0:
+            if (new_directory(&context, path.data()) == 0) directories.push_back(path);
+            break;
+        case 1:
+            if (new_file(&context, path.data(), FS_READ) == 0) files.push_back(path);
+            break;
+        case 2:
+        case 3:
+            if (!files.empty())
+            {
+                fs_file_t file = fs_open(&context, files[rng() % files.size()].data());
+                ASSERT_NE( file, nullptr );
+                std::string data(rng() % 200, 'w');
+                fs_write(file, data.data(), data.size());
+                fs_close(file);
+            }
+            break;
+        case 4:
+            if (!files.empty())
+            {
+                fs_dirent_t entry;
+                std::string file = files[rng() % files.size()];
+                size_t slash = file.rfind('/');
+                std::string name = file.substr(slash + 1);
+                ASSERT_EQ( fs_readdir_prefix(&context, file.substr(0, slash).data(), name.data(), &entry, 1), 1 );
+                inode_t *inode = &fs.inodes[entry.inode];
+                ASSERT_EQ( inode_shrink_data(&fs, inode, inode->internal.file_size / 2), SUCCESS );
+            }
+            break;
+        case 5:
+            if (!files.empty() && fs_clone_file(&context, files[rng() % files.size()].data(), path.data()) == 0)
+                files.push_back(path);
+            break;
+        case 6:
+            if (!files.empty())
+            {
+                size_t victim = rng() % files.size();
+                ASSERT_EQ( remove_file(&context, files[victim].data()), 0 );
+                files.erase(files.begin() + victim);
+            }
+            else if (directories.size() > 1)
+            {
+                {   // begin stdout logging
+                    stdout_logger_lock lk{ this };
+                    if (remove_directory(&context, directories.back().data()) == 0) directories.pop_back();
+                }   // end stdout logging
+            }
+            break;
+        }
+        expect_counted(&fs);
+    }
+    walk_count walked{ 0, 0, 0 };
+    ASSERT_EQ( fs_walk(&context, PATH("."), 1, count_visit, &walked), 0 );
+    EXPECT_EQ( fs_ext(&fs)->dir_totals[0].bytes, walked.bytes );
+    EXPECT_EQ( fs_ext(&fs)->dir_totals[0].descendants, walked.descendants );
+    free_filesystem(&fs);
+}
@@ -0,0 +1,215 @@
+#include "test_util.hpp"
+
+#include <random>
+#include <vector>
+
+extern "C"
+{
+    #include "utility.h"
+}
+
+using DedupSuite = fs_internal_test;
+
+// `count` blocks, each filled with one of `kinds` byte values
+static std::vector<char> pattern_blocks(std::mt19937 &rng, size_t count, size_t kinds)
+{
+    std::vector<char> data;
+    for (size_t i = 0; i < count; ++i) data.insert(data.end(), DATA_BLOCK_SIZE, (char) ('a' + rng() % kinds));
+    return data;
+}
+
+TEST_F(DedupSuite, Checksum)
+{
+    EXPECT_EQ( crc32c(0, "123456789", 9), 0xE3069283u );
+    EXPECT_EQ( crc32c(crc32c(0, "1234", 4), "56789", 5), 0xE3069283u );
+}
+
+// identical blocks written with deduplication on are stored once
+TEST_F(DedupSuite, InlineWrite)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 64);
+    ASSERT_EQ( dedup_enable(&fs), SUCCESS );
+    inode_t *file = &fs.inodes[1];
+    file->internal.file_type = DATA_FILE;
+    std::vector<char> data(10 * DATA_BLOCK_SIZE, 'z');
+
+    // one data block and one index dblock instead of ten and one
+    size_t available = available_dblocks(&fs);
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available - 2 );
+    EXPECT_EQ( fs_ext(&fs)->dedup->saved, (size_t) 9 );
+    EXPECT_EQ( read_all(&fs, file), data );
+
+    // writing into one of the shared blocks gives it its own copy
+    char patch[] = "patched";
+    ASSERT_EQ( inode_modify_data(&fs, file, 200, patch, std::size(patch) - 1), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available - 3 );
+    memcpy(data.data() + 200, patch, std::size(patch) - 1);
+    EXPECT_EQ( read_all(&fs, file), data );
+
+    // and overwriting it with the shared content again gives the copy back
+    std::vector<char> block(DATA_BLOCK_SIZE, 'z');
+    ASSERT_EQ( inode_modify_data(&fs, file, 192, block.data(), block.size()), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available - 2 );
+
+    ASSERT_EQ( inode_release_data(&fs, file), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
+
+// dblock 0 is a dblock like any other once the root directory has moved off it
+TEST_F(DedupSuite, ReuseDblockZero)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 64);
+    inode_t *root = &fs.inodes[0];
+    std::vector<char> entries = read_all(&fs, root);
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+    ASSERT_EQ( inode_modify_data(&fs, root, 0, entries.data(), entries.size()), SUCCESS );
+    ASSERT_EQ( fs_snapshot_delete(&fs, "before"), SUCCESS );
+    ASSERT_EQ( dedup_enable(&fs), SUCCESS );
+
+    inode_t *file = &fs.inodes[1];
+    file->internal.file_type = DATA_FILE;
+    std::vector<char> a(DATA_BLOCK_SIZE, 'A');
+    ASSERT_EQ( inode_write_data(&fs, file, a.data(), a.size()), SUCCESS );
+    ASSERT_EQ( file->internal.direct_data[0], (dblock_index_t) 0 );
+
+    // new content without a twin is written in place
+    std::vector<char> b(DATA_BLOCK_SIZE, 'B');
+    ASSERT_EQ( inode_modify_data(&fs, file, 0, b.data(), b.size()), SUCCESS );
+    EXPECT_EQ( read_all(&fs, file), b );
+
+    // and dblock 0 is found as the twin of the same content
+    inode_t *twin = &fs.inodes[2];
+    twin->internal.file_type = DATA_FILE;
+    size_t available = available_dblocks(&fs);
+    ASSERT_EQ( inode_write_data(&fs, twin, b.data(), b.size()), SUCCESS );
+    EXPECT_EQ( twin->internal.direct_data[0], (dblock_index_t) 0 );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( fs_ext(&fs)->dedup->saved, (size_t) 1 );
+    EXPECT_EQ( read_all(&fs, root), entries );
+    free_filesystem(&fs);
+}
+
+// the offline pass shares the blocks of files written before deduplication was on
+TEST_F(DedupSuite, OfflinePass)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 128);
+    std::mt19937 rng{ 32 };
+    std::vector<char> data = pattern_blocks(rng, 30, 3);
+    data.insert(data.end(), 10, 'q'); // a partial last block is never shared
+    size_t available = available_dblocks(&fs);
+    for (inode_index_t i = 1; i <= 2; ++i)
+    {
+        inode_index_t index;
+        ASSERT_EQ( claim_available_inode(&fs, &index), SUCCESS );
+        fs.inodes[index].internal.file_type = DATA_FILE;
+        fs.inodes[index].internal.file_size = 0;
+        ASSERT_EQ( inode_write_data(&fs, &fs.inodes[index], data.data(), data.size()), SUCCESS );
+    }
+    size_t before = available_dblocks(&fs);
+
+    // both files keep their index dblocks and partial last block, the rest comes down to
+    // one dblock per pattern
+    size_t saved;
+    ASSERT_EQ( fs_dedup(&fs, &saved), SUCCESS );
+    EXPECT_EQ( saved, (size_t) 57 );
+    EXPECT_EQ( available_dblocks(&fs), before + saved );
+    ASSERT_EQ( fs_dedup(&fs, &saved), SUCCESS );
+    EXPECT_EQ( saved, (size_t) 0 );
+    EXPECT_EQ( read_all(&fs, &fs.inodes[1]), data );
+    EXPECT_EQ( read_all(&fs, &fs.inodes[2]), data );
+
+    ASSERT_EQ( inode_release_data(&fs, &fs.inodes[1]), SUCCESS );
+    ASSERT_EQ( inode_release_data(&fs, &fs.inodes[2]), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
+
+// random appends, overwrites, shrinks, clones and offline passes over repetitive data,
+// checked against plain copies of the data
+TEST_F(DedupSuite, RandomOperations)
+{
+    constexpr size_t file_count = 6;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 1, 1024);
+    ASSERT_EQ( dedup_enable(&fs), SUCCESS );
+    std::vector<std::vector<char>> expected(file_count);
+    std::mt19937 rng{ 2032 };
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        inode_index_t index;
+        ASSERT_EQ( claim_available_inode(&fs, &index), SUCCESS );
+        ASSERT_EQ( index, i + 1 );
+        fs.inodes[index].internal.file_type = DATA_FILE;
+        fs.inodes[index].internal.file_size = 0;
+    }
+
+    for (int step = 0; step < 2000; ++step)
+    {
+        size_t f = rng() % file_count;
+        inode_t *inode = &fs.inodes[f + 1];
+        std::vector<char> &data = expected[f];
+        switch (rng() % 5)
+        {
+        case 0: {
+            std::vector<char> chunk = pattern_blocks(rng, rng() % 8, 4);
+            chunk.resize(chunk.size() + rng() % DATA_BLOCK_SIZE, 'a');
+            if (inode_write_data(&fs, inode, chunk.data(), chunk.size()) == SUCCESS)
+                data.insert(data.end(), chunk.begin(), chunk.end());
+            break;
+        }
+        case 1: {
+            size_t offset = data.empty() ? 0 : rng() % data.size();
+            if (rng() % 2) offset -= offset % DATA_BLOCK_SIZE;
+            std::vector<char> chunk = pattern_blocks(rng, rng() % 4, 4);
+            if (inode_modify_data(&fs, inode, offset, chunk.data(), chunk.size()) == SUCCESS)
+            {
+                if (offset + chunk.size() > data.size()) data.resize(offset + chunk.size());
+                std::copy(chunk.begin(), chunk.end(), data.begin() + offset);
+            }
+            break;
+        }
+        case 2: {
+            size_t new_size = data.empty() ? 0 : rng() % (data.size() + 1);
+            ASSERT_EQ( inode_shrink_data(&fs, inode, new_size), SUCCESS );
+            data.resize(new_size);
+            break;
+        }
+        case 3: {
+            size_t src = rng() % file_count;
+            if (src == f) break;
+            ASSERT_EQ( inode_release_data(&fs, inode), SUCCESS );
+            ASSERT_EQ( inode_share_data(&fs, inode, &fs.inodes[src + 1]), SUCCESS );
+            data = expected[src];
+            break;
+        }
+        case 4: {
+            size_t saved;
+            ASSERT_EQ( fs_dedup(&fs, &saved), SUCCESS );
+            break;
+        }
+        }
+        for (size_t i = 0; i < file_count; ++i)
+            ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] ) << "file " << i << " at step " << step;
+    }
+
+    // the shared blocks survive a save and load
+    ASSERT_EQ( save_filesystem_ext(output_file, &fs), SUCCESS );
+    free_filesystem(&fs);
+    rewind(output_file);
+    ASSERT_EQ( load_filesystem_ext(output_file, &fs), SUCCESS );
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] );
+
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( inode_release_data(&fs, &fs.inodes[i + 1]), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 1023 );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
@@ -0,0 +1,168 @@
+#include "test_util.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using IndexDirectorySuite = fs_internal_test;
+
+static std::string file_name(size_t i)
+{
+    return "f" + std::to_string(i);
+}
+
+// the inode a path resolves to through fs_open, or -1 if it cannot be opened
+static long open_inode(IndexDirectorySuite *test, terminal_context_t *context, const std::string &path)
+{
+    std::string copy = path;
+    fs_file_t file;
+    {   // begin stdout logging, misses report an error
+        stdout_logger_lock lk{ test };
+        file = fs_open(context, copy.data());
+    }   // end stdout logging
+    if (!file) return -1;
+    long index = file->inode - context->fs->inodes;
+    fs_close(file);
+    return index;
+}
+
+TEST_F(IndexDirectorySuite, InvalidInput)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    int ret0, ret1, ret2, ret3;
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        ret0 = fs_index_directory(NULL, PATH("a"), 1);
+        ret1 = fs_index_directory(&context, NULL, 1);
+        ret2 = fs_index_directory(&context, PATH("a/z"), 1);
+        ret3 = fs_index_directory(&context, PATH("book2.txt"), 1);
+    }   // end stdout logging
+    EXPECT_EQ( ret0, 0 );
+    EXPECT_EQ( ret1, 0 );
+    EXPECT_EQ( ret2, -1 );
+    EXPECT_EQ( ret3, -1 );
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// an indexed directory resolves the same paths as before, and dropping the index gives
+// back its inode and dblocks
+TEST_F(IndexDirectorySuite, ExistingDirectories)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    size_t inodes = available_inodes(&fs);
+    size_t dblocks = available_dblocks(&fs);
+    long book = open_inode(this, &context, "a/b/c/./.././../../book2.txt");
+    ASSERT_NE( book, -1 );
+
+    ASSERT_EQ( fs_index_directory(&context, PATH("."), 1), 0 );
+    ASSERT_EQ( fs_index_directory(&context, PATH("a"), 1), 0 );
+    ASSERT_EQ( fs_index_directory(&context, PATH("a/b"), 1), 0 );
+    EXPECT_EQ( available_inodes(&fs), inodes - 3 );
+    EXPECT_EQ( open_inode(this, &context, "a/b/c/./.././../../book2.txt"), book );
+    EXPECT_EQ( open_inode(this, &context, "a/nothing"), -1 );
+
+    ASSERT_EQ( fs_index_directory(&context, PATH("a"), 0), 0 );
+    ASSERT_EQ( fs_index_directory(&context, PATH("a/b"), 0), 0 );
+    ASSERT_EQ( fs_index_directory(&context, PATH("."), 0), 0 );
+    EXPECT_EQ( available_inodes(&fs), inodes );
+    EXPECT_EQ( available_dblocks(&fs), dblocks );
+    EXPECT_EQ( open_inode(this, &context, "a/b/c/./.././../../book2.txt"), book );
+    free_filesystem(&fs);
+}
+
+// random creates and removes in a large directory, checked against the entries it should
+// have, before and after the index is saved and loaded
+static void random_operations(IndexDirectorySuite *test, FILE *output_file, int kind, unsigned seed)
+{
+    constexpr size_t name_count = 600;
+    filesystem_t fs;
+    new_filesystem(&fs, name_count + 8, 2048);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("big")), 0 );
+    size_t dblocks = available_dblocks(&fs);
+    ASSERT_EQ( fs_index_directory(&context, PATH("big"), kind), 0 );
+    std::vector<long> expected(name_count, -1);
+    std::mt19937 rng{ seed };
+
+    for (int step = 0; step < 4000; ++step)
+    {
+        size_t i = rng() % name_count;
+        std::string path = "big/" + file_name(i);
+        if (expected[i] == -1)
+        {
+            ASSERT_EQ( new_file(&context, path.data(), FS_READ), 0 ) << "step " << step;
+            expected[i] = open_inode(test, &context, path);
+            ASSERT_NE( expected[i], -1 );
+        }
+        else
+        {
+            ASSERT_EQ( remove_file(&context, path.data()), 0 ) << "step " << step;
+            expected[i] = -1;
+        }
+        size_t probe = rng() % name_count;
+        ASSERT_EQ( open_inode(test, &context, "big/" + file_name(probe)), expected[probe] ) << "step " << step;
+    }
+    for (size_t i = 0; i < name_count; ++i)
+        ASSERT_EQ( open_inode(test, &context, "big/" + file_name(i)), expected[i] ) << file_name(i);
+
+    ASSERT_EQ( save_filesystem(output_file, &fs), SUCCESS );
+    free_filesystem(&fs);
+    rewind(output_file);
+    ASSERT_EQ( load_filesystem(output_file, &fs), SUCCESS );
+    context = { &fs, &fs.inodes[0] };
+    for (size_t i = 0; i < name_count; ++i)
+        ASSERT_EQ( open_inode(test, &context, "big/" + file_name(i)), expected[i] ) << file_name(i);
+
+    // an emptied directory shrinks back, and is removed together with its index
+    for (size_t i = 0; i < name_count; ++i)
+    {
+        if (expected[i] == -1) continue;
+        std::string path = "big/" + file_name(i);
+        ASSERT_EQ( remove_file(&context, path.data()), 0 );
+    }
+    ASSERT_EQ( fs_index_directory(&context, PATH("big"), FS_INDEX_NONE), 0 );
+    EXPECT_EQ( available_dblocks(&fs), dblocks );
+    ASSERT_EQ( fs_index_directory(&context, PATH("big"), kind), 0 );
+    ASSERT_EQ( remove_directory(&context, PATH("big")), 0 );
+    EXPECT_EQ( available_inodes(&fs), name_count + 7 );
+    free_filesystem(&fs);
+}
+
+TEST_F(IndexDirectorySuite, RandomOperations)
+{
+    random_operations(this, output_file, FS_INDEX_HASHED, 2036);
+}
+
+TEST_F(IndexDirectorySuite, OrderedRandomOperations)
+{
+    random_operations(this, output_file, FS_INDEX_ORDERED, 2041);
+}
+
+// changing the kind of index replaces it, keeping one index inode
+TEST_F(IndexDirectorySuite, ChangeKind)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    size_t inodes = available_inodes(&fs);
+    long book = open_inode(this, &context, "a/../book2.txt");
+    ASSERT_NE( book, -1 );
+
+    ASSERT_EQ( fs_index_directory(&context, PATH("."), FS_INDEX_HASHED), 0 );
+    ASSERT_EQ( fs_index_directory(&context, PATH("."), FS_INDEX_ORDERED), 0 );
+    EXPECT_EQ( available_inodes(&fs), inodes - 1 );
+    EXPECT_EQ( open_inode(this, &context, "a/../book2.txt"), book );
+    EXPECT_EQ( open_inode(this, &context, "book3.txt"), -1 );
+    ASSERT_EQ( fs_index_directory(&context, PATH("."), FS_INDEX_ORDERED), 0 );
+    ASSERT_EQ( fs_index_directory(&context, PATH("."), FS_INDEX_HASHED), 0 );
+    EXPECT_EQ( available_inodes(&fs), inodes - 1 );
+    EXPECT_EQ( open_inode(this, &context, "a/../book2.txt"), book );
+    ASSERT_EQ( fs_index_directory(&context, PATH("."), FS_INDEX_NONE), 0 );
+    EXPECT_EQ( available_inodes(&fs), inodes );
+    free_filesystem(&fs);
+}
@@ -0,0 +1,221 @@
+#include "test_util.hpp"
+
+#include <string>
+#include <vector>
+
+using LinkSuite = fs_internal_test;
+
+TEST_F(LinkSuite, InvalidInput)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    int ret0, ret1, ret2;
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        ret0 = fs_link(NULL, PATH("a/d/text"), PATH("a/t"));
+        ret1 = fs_link(&context, NULL, PATH("a/t"));
+        ret2 = fs_link(&context, PATH("a/d/text"), NULL);
+    }   // end stdout logging
+    EXPECT_EQ( ret0, 0 );
+    EXPECT_EQ( ret1, 0 );
+    EXPECT_EQ( ret2, 0 );
+    check_stdout(OUTPUT "Empty.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// directories cannot be linked
+TEST_F(LinkSuite, InvalidPath)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( fs_link(&context, PATH("a/b"), PATH("a/t")), -1 );
+    }   // end stdout logging
+    check_stdout(OUTPUT "FileNotFound.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// the new name has to be free
+TEST_F(LinkSuite, NameTaken)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( fs_link(&context, PATH("a/d/text"), PATH("a/b")), -1 );
+    }   // end stdout logging
+    check_stdout(OUTPUT "FileExist.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// both names refer to one inode, and its data is released with the last name
+TEST_F(LinkSuite, SharedData)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 16, 128);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("pub")), 0 );
+    size_t inodes = available_inodes(&fs);
+    size_t dblocks = available_dblocks(&fs);
+    ASSERT_EQ( new_file(&context, PATH("draft"), FS_READ), 0 );
+    std::string data(300, 'd');
+    fs_file_t file = fs_open(&context, PATH("draft"));
+    ASSERT_EQ( fs_write(file, data.data(), data.size()), data.size() );
+    fs_close(file);
+
+    // the link is one directory entry, with no inode or data block of its own
+    size_t linked_inodes = available_inodes(&fs);
+    size_t linked_dblocks = available_dblocks(&fs);
+    ASSERT_EQ( fs_link(&context, PATH("draft"), PATH("pub/final")), 0 );
+    EXPECT_EQ( available_inodes(&fs), linked_inodes );
+    EXPECT_EQ( available_dblocks(&fs), linked_dblocks );
+    EXPECT_EQ( read_file(&context, "pub/final"), data );
+
+    std::string edit = "edited";
+    file = fs_open(&context, PATH("pub/final"));
+    ASSERT_EQ( fs_write(file, edit.data(), edit.size()), edit.size() );
+    fs_close(file);
+    data.replace(0, edit.size(), edit);
+    EXPECT_EQ( read_file(&context, "draft"), data );
+
+    ASSERT_EQ( remove_file(&context, PATH("draft")), 0 );
+    EXPECT_EQ( read_file(&context, "pub/final"), data );
+    ASSERT_EQ( remove_file(&context, PATH("pub/final")), 0 );
+    EXPECT_EQ( available_inodes(&fs), inodes );
+    EXPECT_EQ( available_dblocks(&fs), dblocks );
+    free_filesystem(&fs);
+}
+
+TEST_F(LinkSuite, MaxLinks)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 64);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("d")), 0 );
+    ASSERT_EQ( new_file(&context, PATH("f"), FS_READ), 0 );
+    for (size_t i = 1; i < INODE_MAX_LINKS; ++i)
+    {
+        std::string path = "d/l" + std::to_string(i);
+        ASSERT_EQ( fs_link(&context, PATH("f"), path.data()), 0 ) << i;
+    }
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( fs_link(&context, PATH("f"), PATH("d/over")), -1 );
+    }   // end stdout logging
+    for (size_t i = 1; i < INODE_MAX_LINKS; ++i)
+    {
+        std::string path = "d/l" + std::to_string(i);
+        ASSERT_EQ( remove_file(&context, path.data()), 0 ) << i;
+    }
+    ASSERT_EQ( remove_file(&context, PATH("f")), 0 );
+    EXPECT_EQ( available_inodes(&fs), (size_t) 6 );
+    free_filesystem(&fs);
+}
+
+// a linked file counts as an entry under each name and its bytes once, even once the name
+// it was counted under is removed
+TEST_F(LinkSuite, DirTotals)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 16, 128);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( dir_totals_enable(&fs), SUCCESS );
+    ASSERT_EQ( new_directory(&context, PATH("a")), 0 );
+    ASSERT_EQ( new_directory(&context, PATH("b")), 0 );
+    ASSERT_EQ( new_file(&context, PATH("a/f"), FS_READ), 0 );
+    ASSERT_EQ( fs_link(&context, PATH("a/f"), PATH("b/g")), 0 );
+    std::string data(100, 'x');
+    fs_file_t file = fs_open(&context, PATH("b/g"));
+    ASSERT_EQ( fs_write(file, data.data(), data.size()), data.size() );
+    fs_close(file);
+
+    size_t bytes;
+    ASSERT_EQ( fs_du(&context, PATH("."), 1, &bytes), 0 );
+    EXPECT_EQ( bytes, 2 * data.size() );
+    EXPECT_EQ( fs_ext(&fs)->dir_totals[0].descendants, (size_t) 4 );
+
+    ASSERT_EQ( remove_file(&context, PATH("a/f")), 0 );
+    ASSERT_EQ( fs_du(&context, PATH("."), 1, &bytes), 0 );
+    EXPECT_EQ( bytes, data.size() );
+    ASSERT_EQ( fs_du(&context, PATH("b"), 1, &bytes), 0 );
+    EXPECT_EQ( bytes, data.size() );
+    for (const char *path : { ".", "a", "b" })
+    {
+        walk_count walked{ 0, 0, 0 };
+        ASSERT_EQ( fs_walk(&context, PATH(path), 1, count_visit, &walked), 0 );
+        fs_dirent_t entry;
+        inode_index_t index = 0;
+        if (std::string{ path } != ".")
+        {
+            ASSERT_EQ( fs_readdir_prefix(&context, PATH("."), PATH(path), &entry, 1), 1 );
+            index = entry.inode;
+        }
+        EXPECT_EQ( fs_ext(&fs)->dir_totals[index].descendants, walked.descendants ) << path;
+    }
+    free_filesystem(&fs);
+}
+
+TEST_F(LinkSuite, DuTotalsAgree)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 16, 128);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("a")), 0 );
+    ASSERT_EQ( new_directory(&context, PATH("b")), 0 );
+    ASSERT_EQ( new_directory(&context, PATH("b/c")), 0 );
+    ASSERT_EQ( new_file(&context, PATH("a/f"), FS_READ), 0 );
+    ASSERT_EQ( fs_link(&context, PATH("a/f"), PATH("b/c/g")), 0 );
+    ASSERT_EQ( fs_link(&context, PATH("a/f"), PATH("a/h")), 0 );
+    ASSERT_EQ( dir_totals_enable(&fs), SUCCESS );
+
+    auto compare = [&](size_t expected)
+    {
+        for (const char *path : { ".", "a", "b", "b/c" })
+        {
+            size_t counted, walked;
+            ASSERT_EQ( fs_du(&context, PATH(path), 1, &counted), 0 );
+            dir_total_t *totals = fs_ext(&fs)->dir_totals;
+            fs_ext(&fs)->dir_totals = nullptr;
+            ASSERT_EQ( fs_du(&context, PATH(path), 1, &walked), 0 );
+            fs_ext(&fs)->dir_totals = totals;
+            EXPECT_EQ( counted, walked ) << path;
+        }
+        size_t bytes;
+        ASSERT_EQ( fs_du(&context, PATH("."), 1, &bytes), 0 );
+        EXPECT_EQ( bytes, expected );
+    };
+
+    std::string data(150, 'x');
+    fs_file_t file = fs_open(&context, PATH("b/c/g"));
+    ASSERT_EQ( fs_write(file, data.data(), data.size()), data.size() );
+    fs_close(file);
+    compare(3 * data.size());
+
+    ASSERT_EQ( dir_totals_enable(&fs), SUCCESS );
+    compare(3 * data.size());
+
+    ASSERT_EQ( remove_file(&context, PATH("a/f")), 0 );
+    compare(2 * data.size());
+    ASSERT_EQ( remove_file(&context, PATH("b/c/g")), 0 );
+    file = fs_open(&context, PATH("a/h"));
+    ASSERT_EQ( fs_write(file, data.data(), 10), (size_t) 10 );
+    fs_close(file);
+    compare(data.size());
+    ASSERT_EQ( fs_link(&context, PATH("a/h"), PATH("b/i")), 0 );
+    compare(2 * data.size());
+    ASSERT_EQ( fs_rename(&context, PATH("a/h"), PATH("b/c/h")), 0 );
+    compare(2 * data.size());
+    file = fs_open(&context, PATH("b/i"));
+    ASSERT_EQ( fs_write(file, data.data(), data.size()), data.size() );
+    ASSERT_EQ( fs_write(file, data.data(), data.size()), data.size() );
+    fs_close(file);
+    compare(4 * data.size());
+    free_filesystem(&fs);
+}
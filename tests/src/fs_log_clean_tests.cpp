@@ -0,0 +1,329 @@
+#include "test_util.hpp"
+
+#include <random>
+#include <vector>
+
+using LogSuite = fs_internal_test;
+
+static inode_t *claim_file(filesystem_t *fs)
+{
+    inode_index_t index;
+    EXPECT_EQ( claim_available_inode(fs, &index), SUCCESS );
+    inode_t *inode = &fs->inodes[index];
+    inode->internal.file_type = DATA_FILE;
+    inode->internal.file_perms = FS_READ;
+    inode->internal.file_size = 0;
+    return inode;
+}
+
+static std::vector<char> pattern(size_t n, int seed)
+{
+    std::vector<char> data(n);
+    for (size_t i = 0; i < n; ++i) data[i] = (char) (i * 31 + seed);
+    return data;
+}
+
+// the segment counts match the bitmask
+static void expect_live_counts(filesystem_t *fs)
+{
+    fs_log_t *log = fs_ext(fs)->log;
+    size_t free_segments = 0;
+    for (size_t segment = 0; segment < log->segment_count; ++segment)
+    {
+        size_t live = 0;
+        for (size_t i = segment * LOG_SEGMENT_DBLOCKS; i < (segment + 1) * LOG_SEGMENT_DBLOCKS && i < fs->dblock_count; ++i)
+            if (!((fs->dblock_bitmask[i / 8] >> (7 - i % 8)) & 1)) ++live;
+        EXPECT_EQ( log->live[segment], live ) << "segment " << segment;
+        if (live == 0) ++free_segments;
+    }
+    EXPECT_EQ( log->free_segments, free_segments );
+}
+
+TEST_F(LogSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8);
+    size_t cleaned;
+    EXPECT_EQ( log_enable(NULL), INVALID_INPUT );
+    EXPECT_EQ( fs_log_clean(&fs, &cleaned), INVALID_INPUT );
+    ASSERT_EQ( log_enable(&fs), SUCCESS );
+    EXPECT_EQ( fs_log_clean(NULL, &cleaned), INVALID_INPUT );
+    EXPECT_EQ( fs_log_clean(&fs, NULL), INVALID_INPUT );
+    log_disable(&fs);
+    EXPECT_EQ( fs_ext(&fs)->log, nullptr );
+    free_filesystem(&fs);
+}
+
+// new dblocks come in order from a free segment instead of from the holes left behind
+TEST_F(LogSuite, SequentialClaims)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8 * LOG_SEGMENT_DBLOCKS);
+    inode_t *hole = claim_file(&fs);
+    inode_t *kept = claim_file(&fs);
+    std::vector<char> data = pattern(20 * DATA_BLOCK_SIZE, 1);
+    ASSERT_EQ( inode_write_data(&fs, hole, data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_write_data(&fs, kept, data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_release_data(&fs, hole), SUCCESS );
+
+    ASSERT_EQ( log_enable(&fs), SUCCESS );
+    expect_live_counts(&fs);
+    inode_t *file = claim_file(&fs);
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), 4 * DATA_BLOCK_SIZE), SUCCESS );
+    EXPECT_EQ( file->internal.direct_data[0], (dblock_index_t) LOG_SEGMENT_DBLOCKS );
+    for (size_t i = 1; i < INODE_DIRECT_BLOCK_COUNT; ++i)
+        EXPECT_EQ( file->internal.direct_data[i], file->internal.direct_data[i - 1] + 1 );
+    EXPECT_EQ( read_all(&fs, kept), data );
+    expect_live_counts(&fs);
+    free_filesystem(&fs);
+}
+
+// a write copies the data block to the head of the log and releases the old one, unless a
+// clone still refers to it
+TEST_F(LogSuite, Overwrite)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8 * LOG_SEGMENT_DBLOCKS);
+    ASSERT_EQ( log_enable(&fs), SUCCESS );
+    inode_t *file = claim_file(&fs);
+    std::vector<char> data = pattern(10 * DATA_BLOCK_SIZE, 2);
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    size_t available = available_dblocks(&fs);
+
+    dblock_index_t before = file->internal.direct_data[1];
+    char patch[] = "patched";
+    ASSERT_EQ( inode_modify_data(&fs, file, DATA_BLOCK_SIZE + 3, patch, std::size(patch) - 1), SUCCESS );
+    memcpy(data.data() + DATA_BLOCK_SIZE + 3, patch, std::size(patch) - 1);
+    EXPECT_NE( file->internal.direct_data[1], before );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( read_all(&fs, file), data );
+
+    inode_t *clone = claim_file(&fs);
+    ASSERT_EQ( inode_share_data(&fs, clone, file), SUCCESS );
+    std::vector<char> old = data;
+    ASSERT_EQ( inode_modify_data(&fs, file, 0, patch, std::size(patch) - 1), SUCCESS );
+    memcpy(data.data(), patch, std::size(patch) - 1);
+    EXPECT_EQ( read_all(&fs, file), data );
+    EXPECT_EQ( read_all(&fs, clone), old );
+    EXPECT_EQ( available_dblocks(&fs), available - 1 );
+    expect_live_counts(&fs);
+    free_filesystem(&fs);
+}
+
+// cleaning empties the half empty segments and moves the dblocks every map refers to,
+// including those of clones, compressed files and snapshots
+TEST_F(LogSuite, Clean)
+{
+    constexpr size_t file_count = 8;
+    filesystem_t fs;
+    new_filesystem(&fs, 2 * file_count + 1, 16 * LOG_SEGMENT_DBLOCKS);
+    ASSERT_EQ( checksum_enable(&fs, 1), SUCCESS );
+    ASSERT_EQ( log_enable(&fs), SUCCESS );
+    std::vector<inode_t *> files;
+    std::vector<std::vector<char>> expected(file_count);
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        files.push_back(claim_file(&fs));
+        if (i == 3)
+        {
+            ASSERT_EQ( inode_set_compressed(&fs, files.back(), 1), SUCCESS );
+        }
+    }
+    // interleave the appends so every segment holds blocks of every file
+    for (int round = 0; round < 40; ++round)
+    {
+        for (size_t i = 0; i < file_count; ++i)
+        {
+            std::vector<char> chunk = pattern(50 + i * 7, round + (int) i);
+            ASSERT_EQ( inode_write_data(&fs, files[i], chunk.data(), chunk.size()), SUCCESS );
+            expected[i].insert(expected[i].end(), chunk.begin(), chunk.end());
+        }
+    }
+    inode_t *clone = claim_file(&fs);
+    ASSERT_EQ( inode_share_data(&fs, clone, files[1]), SUCCESS );
+    ASSERT_EQ( fs_snapshot_create(&fs, "snap"), SUCCESS );
+    for (size_t i = 4; i < file_count; ++i) ASSERT_EQ( inode_release_data(&fs, files[i]), SUCCESS );
+    for (size_t i = 4; i < file_count; ++i) expected[i].clear();
+    ASSERT_EQ( fs_snapshot_delete(&fs, "snap"), SUCCESS );
+    ASSERT_EQ( fs_snapshot_create(&fs, "snap"), SUCCESS );
+
+    size_t available = available_dblocks(&fs);
+    size_t free_segments = fs_ext(&fs)->log->free_segments;
+    size_t cleaned;
+    ASSERT_EQ( fs_log_clean(&fs, &cleaned), SUCCESS );
+    EXPECT_GT( cleaned, (size_t) 0 );
+    EXPECT_GT( fs_ext(&fs)->log->free_segments, free_segments );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    expect_live_counts(&fs);
+
+    for (size_t i = 0; i < file_count; ++i) EXPECT_EQ( read_all(&fs, files[i]), expected[i] ) << "file " << i;
+    EXPECT_EQ( read_all(&fs, clone), expected[1] );
+    for (size_t i = 0; i < file_count; ++i)
+        EXPECT_EQ( read_all(&fs, &fs_ext(&fs)->snapshots[0].inodes[files[i] - fs.inodes]), expected[i] ) << "snapshot file " << i;
+    dblock_index_t *bad;
+    size_t bad_count;
+    ASSERT_EQ( fs_scrub(&fs, 2, &bad, &bad_count), SUCCESS );
+    EXPECT_EQ( bad_count, (size_t) 0 );
+
+    // the mode is not saved, the moved dblocks are
+    ASSERT_EQ( save_filesystem_ext(output_file, &fs), SUCCESS );
+    free_filesystem(&fs);
+    rewind(output_file);
+    ASSERT_EQ( load_filesystem_ext(output_file, &fs), SUCCESS );
+    EXPECT_EQ( fs_ext(&fs)->log, nullptr );
+    EXPECT_EQ( read_all(&fs, &fs.inodes[1]), expected[0] );
+    EXPECT_EQ( read_all(&fs, &fs.inodes[4]), expected[3] );
+    free_filesystem(&fs);
+}
+
+// rewriting the root directory releases dblock 0, which the log later hands out again.
+// files past the direct blocks then get it as an index or data dblock, cleaner or not
+TEST_F(LogSuite, ReuseDblockZero)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 4 * LOG_SEGMENT_DBLOCKS);
+    ASSERT_EQ( log_enable(&fs), SUCCESS );
+    inode_t *root = &fs.inodes[0];
+    std::vector<char> entries = read_all(&fs, root);
+    ASSERT_EQ( inode_modify_data(&fs, root, 0, entries.data(), entries.size()), SUCCESS );
+    EXPECT_NE( root->internal.direct_data[0], (dblock_index_t) 0 );
+
+    inode_t *kept = claim_file(&fs);
+    inode_t *file = claim_file(&fs);
+    std::vector<char> kept_data;
+    int reused = 0;
+    for (int round = 0; round < 100; ++round)
+    {
+        std::vector<char> chunk = pattern(DATA_BLOCK_SIZE / 2, round);
+        ASSERT_EQ( inode_write_data(&fs, kept, chunk.data(), chunk.size()), SUCCESS );
+        kept_data.insert(kept_data.end(), chunk.begin(), chunk.end());
+        std::vector<char> data = pattern(6 * DATA_BLOCK_SIZE, round);
+        ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS ) << round;
+        ASSERT_EQ( read_all(&fs, file), data ) << round;
+        for (size_t i = 0; i < INODE_DIRECT_BLOCK_COUNT; ++i)
+            reused |= file->internal.direct_data[i] == 0;
+        reused |= file->internal.indirect_dblock == 0;
+        ASSERT_EQ( inode_release_data(&fs, file), SUCCESS );
+        if (round % 10 == 9)
+        {
+            size_t cleaned;
+            ASSERT_EQ( fs_log_clean(&fs, &cleaned), SUCCESS );
+        }
+    }
+    EXPECT_TRUE( reused );
+    EXPECT_GT( fs_ext(&fs)->log->cleaned, (size_t) 0 );
+    EXPECT_EQ( read_all(&fs, kept), kept_data );
+    EXPECT_EQ( read_all(&fs, root), entries );
+    expect_live_counts(&fs);
+    free_filesystem(&fs);
+}
+
+// a file whose first index dblock is dblock 0 keeps a good checksum there when the
+// cleaner moves the index dblock it links to
+TEST_F(LogSuite, CleanAfterIndexZero)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 4 * LOG_SEGMENT_DBLOCKS);
+    ASSERT_EQ( checksum_enable(&fs, 1), SUCCESS );
+    inode_t *file = claim_file(&fs);
+    inode_t *filler = claim_file(&fs);
+    inode_t *hole = claim_file(&fs);
+    std::vector<char> expected = pattern(INODE_DIRECT_BLOCK_COUNT * DATA_BLOCK_SIZE, 1);
+    ASSERT_EQ( inode_write_data(&fs, file, expected.data(), expected.size()), SUCCESS );
+    std::vector<char> fill = pattern(LOG_SEGMENT_DBLOCKS * DATA_BLOCK_SIZE, 2);
+    ASSERT_EQ( inode_write_data(&fs, filler, fill.data(), fill.size()), SUCCESS );
+
+    // copying the root directory away from dblock 0 frees it for the first index dblock
+    inode_t *root = &fs.inodes[0];
+    std::vector<char> entries = read_all(&fs, root);
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+    ASSERT_EQ( inode_modify_data(&fs, root, 0, entries.data(), entries.size()), SUCCESS );
+    ASSERT_EQ( fs_snapshot_delete(&fs, "before"), SUCCESS );
+    for (int block = 0; block < 32; ++block)
+    {
+        std::vector<char> chunk = pattern(DATA_BLOCK_SIZE, block);
+        ASSERT_EQ( inode_write_data(&fs, file, chunk.data(), chunk.size()), SUCCESS );
+        expected.insert(expected.end(), chunk.begin(), chunk.end());
+        ASSERT_EQ( inode_write_data(&fs, hole, chunk.data(), chunk.size()), SUCCESS );
+        ASSERT_EQ( inode_write_data(&fs, hole, chunk.data(), chunk.size()), SUCCESS );
+    }
+    ASSERT_EQ( inode_release_data(&fs, hole), SUCCESS );
+    ASSERT_EQ( file->internal.indirect_dblock, (dblock_index_t) 0 );
+
+    // the segment of dblock 0 is full, the one of the second index dblock is not
+    ASSERT_EQ( log_enable(&fs), SUCCESS );
+    size_t cleaned;
+    ASSERT_EQ( fs_log_clean(&fs, &cleaned), SUCCESS );
+    EXPECT_GT( cleaned, (size_t) 0 );
+    EXPECT_EQ( read_all(&fs, file), expected );
+    dblock_index_t *bad;
+    size_t bad_count;
+    ASSERT_EQ( fs_scrub(&fs, 2, &bad, &bad_count), SUCCESS );
+    EXPECT_EQ( bad_count, (size_t) 0 );
+    free_filesystem(&fs);
+}
+
+// random appends, overwrites, shrinks and clones in a file system small enough that the
+// cleaner runs on its own, checked against plain copies of the data
+TEST_F(LogSuite, RandomOperations)
+{
+    constexpr size_t file_count = 6;
+    constexpr size_t dblock_total = 6 * LOG_SEGMENT_DBLOCKS;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 1, dblock_total);
+    ASSERT_EQ( log_enable(&fs), SUCCESS );
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    std::vector<std::vector<char>> expected(file_count);
+    std::mt19937 rng{ 2035 };
+    for (size_t i = 0; i < file_count; ++i) claim_file(&fs);
+
+    for (int step = 0; step < 3000; ++step)
+    {
+        size_t f = rng() % file_count;
+        inode_t *inode = &fs.inodes[f + 1];
+        std::vector<char> &data = expected[f];
+        switch (rng() % 4)
+        {
+        case 0: {
+            std::vector<char> chunk = pattern(rng() % 600, step);
+            if (inode_write_data(&fs, inode, chunk.data(), chunk.size()) == SUCCESS)
+                data.insert(data.end(), chunk.begin(), chunk.end());
+            break;
+        }
+        case 1: {
+            size_t offset = data.empty() ? 0 : rng() % data.size();
+            std::vector<char> chunk(rng() % 200, (char) rng());
+            if (inode_modify_data(&fs, inode, offset, chunk.data(), chunk.size()) == SUCCESS)
+            {
+                if (offset + chunk.size() > data.size()) data.resize(offset + chunk.size());
+                std::copy(chunk.begin(), chunk.end(), data.begin() + offset);
+            }
+            break;
+        }
+        case 2: {
+            size_t new_size = data.empty() ? 0 : rng() % (data.size() + 1);
+            ASSERT_EQ( inode_shrink_data(&fs, inode, new_size), SUCCESS );
+            data.resize(new_size);
+            break;
+        }
+        case 3: {
+            size_t src = rng() % file_count;
+            if (src == f) break;
+            ASSERT_EQ( inode_release_data(&fs, inode), SUCCESS );
+            if (inode_share_data(&fs, inode, &fs.inodes[src + 1]) == SUCCESS) data = expected[src];
+            else data.clear();
+            break;
+        }
+        }
+        for (size_t i = 0; i < file_count; ++i)
+            ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] ) << "file " << i << " at step " << step;
+    }
+    EXPECT_GT( fs_ext(&fs)->log->cleaned, (size_t) 0 );
+    expect_live_counts(&fs);
+
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( inode_release_data(&fs, &fs.inodes[i + 1]), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), dblock_total - 1 );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
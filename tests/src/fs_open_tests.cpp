@@ -208,4 +208,82 @@ TEST_F(FSOpenSuite, SuccessfulOpenTraversal2)
 
     check_stdout(OUTPUT "Empty.txt");
     free_filesystem(&fs);
-}
\ No newline at end of file
+}
+// names match whole, up to their full 14 bytes, with and without a directory index
+TEST_F(FSOpenSuite, NameLengths)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 64);
+    terminal_context_t context = { &fs, &fs.inodes[0] };
+    ASSERT_EQ(new_directory(&context, PATH("d")), 0);
+    ASSERT_EQ(new_file(&context, PATH("d/abcdefghijklmn"), FS_READ), 0);
+    ASSERT_EQ(new_file(&context, PATH("d/abc"), FS_READ), 0);
+    ASSERT_EQ(new_file(&context, PATH("d/abcd"), FS_READ), 0);
+
+    for (int indexed = 0; indexed < 2; indexed++)
+    {
+        if (indexed)
+        {
+            ASSERT_EQ(fs_index_directory(&context, PATH("d"), 1), 0);
+        }
+        fs_file_t full, three, four, longer, shorter, dot;
+        { // begin logging stdout, the misses report an error
+            stdout_logger_lock lk{ this };
+            full = fs_open(&context, PATH("d/abcdefghijklmn"));
+            three = fs_open(&context, PATH("d/./abc"));
+            four = fs_open(&context, PATH("d/abcd"));
+            longer = fs_open(&context, PATH("d/abcdefghijklmno"));
+            shorter = fs_open(&context, PATH("d/ab"));
+            dot = fs_open(&context, PATH("d/../d/./abcd"));
+        } // stop logging stdout
+        ASSERT_NE(full, nullptr);
+        ASSERT_NE(three, nullptr);
+        ASSERT_NE(four, nullptr);
+        EXPECT_EQ(longer, nullptr);
+        EXPECT_EQ(shorter, nullptr);
+        ASSERT_NE(dot, nullptr);
+        EXPECT_NE(full->inode, three->inode);
+        EXPECT_NE(three->inode, four->inode);
+        EXPECT_EQ(dot->inode, four->inode);
+        fs_close(full);
+        fs_close(three);
+        fs_close(four);
+        fs_close(dot);
+    }
+    free_filesystem(&fs);
+}
+
+// repeated and trailing slashes are skipped and "." stays in the directory, even in one
+// without a "." entry, while walking through a data file fails
+TEST_F(FSOpenSuite, PathSpelling)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 64);
+    terminal_context_t context = { &fs, &fs.inodes[0] };
+    ASSERT_EQ(new_directory(&context, PATH("a")), 0);
+    ASSERT_EQ(new_directory(&context, PATH("a//b/")), 0);
+    ASSERT_EQ(new_file(&context, PATH("./a/b/f"), FS_READ), 0);
+
+    for (const char *path : { "a/b/f", "a//b///f", "./a/./b/f", "//a/b/../b/f", "a/b/f/" })
+    {
+        fs_file_t file = fs_open(&context, PATH(path));
+        ASSERT_NE(file, nullptr) << path;
+        EXPECT_EQ(file->inode, &fs.inodes[3]) << path;
+        fs_close(file);
+    }
+    fs_file_t file0, file1;
+    int ret0, ret1;
+    { // begin logging stdout, every call fails
+        stdout_logger_lock lk{ this };
+        file0 = fs_open(&context, PATH("a/b/f/."));
+        file1 = fs_open(&context, PATH("a/b/f/../f"));
+        ret0 = new_file(&context, PATH(""), FS_READ);
+        ret1 = new_file(&context, PATH("//"), FS_READ);
+    } // stop logging stdout
+    EXPECT_EQ(file0, nullptr);
+    EXPECT_EQ(file1, nullptr);
+    EXPECT_EQ(ret0, -1);
+    EXPECT_EQ(ret1, -1);
+    EXPECT_EQ(available_inodes(&fs), (size_t) 4);
+    free_filesystem(&fs);
+}
@@ -0,0 +1,139 @@
+#include "test_util.hpp"
+
+using FSPWriteSuite = fs_internal_test;
+
+TEST_F(FSPWriteSuite, InvalidInput)
+{
+    size_t output_ret;
+    {
+        stdout_logger_lock lk{ this };
+        output_ret = fs_pwrite(NULL, NULL, 0, 0);
+    }
+    ASSERT_EQ( output_ret, 0 );
+    check_stdout(OUTPUT "Empty.txt");
+}
+
+// same as SimpleWrite1 but the handler offset must be left alone
+TEST_F(FSPWriteSuite, SimpleWrite1)
+{
+    constexpr size_t buffer_size = 47;
+    constexpr size_t offset = 22;
+    constexpr size_t handle_offset = 5;
+    constexpr size_t inode_index = 2;
+    constexpr size_t expected_file_size = 189;
+
+    filesystem_t fs;
+    load_fs(INPUT "medium_text.bin", fs);
+
+    inode_t *inode = &fs.inodes[inode_index];
+    struct fs_file file {
+        &fs,
+        inode,
+        handle_offset
+    };
+    char buffer[buffer_size] = { 0 };
+    memset(buffer, 0x30, buffer_size);
+    size_t output_ret;
+
+    {
+        stdout_logger_lock lk{ this };
+        output_ret = fs_pwrite(&file, buffer, buffer_size, offset);
+    }
+
+    ASSERT_EQ(output_ret, buffer_size) << "Return value does not match the expected.";
+    ASSERT_EQ(inode->internal.file_size, expected_file_size) << "File size is not correct.";
+    ASSERT_EQ(file.offset, handle_offset) << "File offset should not be modified by fs_pwrite.";
+
+    check_stdout(OUTPUT "Empty.txt");
+    check_fs(OUTPUT "SimpleWrite1.bin", fs);
+    free_filesystem(&fs);
+}
+
+// writing at the end of file appends, like WriteFromEOF0
+TEST_F(FSPWriteSuite, WriteFromEOF0)
+{
+    constexpr size_t buffer_size = 32;
+    constexpr size_t offset = 614;
+    constexpr size_t inode_index = 1;
+
+    filesystem_t fs;
+    load_fs(INPUT "medium_text.bin", fs);
+
+    inode_t *inode = &fs.inodes[inode_index];
+    struct fs_file file {
+        &fs,
+        inode,
+        0
+    };
+    char buffer[buffer_size] = { 0 };
+    memset(buffer, 0x41, buffer_size);
+    size_t output_ret;
+
+    {
+        stdout_logger_lock lk{ this };
+        output_ret = fs_pwrite(&file, buffer, buffer_size, offset);
+    }
+
+    ASSERT_EQ(output_ret, buffer_size) << "Return value does not match the expected.";
+    ASSERT_EQ(inode->internal.file_size, offset + buffer_size) << "File size is not correct.";
+    ASSERT_EQ(file.offset, 0) << "File offset should not be modified by fs_pwrite.";
+
+    check_stdout(OUTPUT "Empty.txt");
+    check_fs(OUTPUT "WriteFromEOF0.bin", fs);
+    free_filesystem(&fs);
+}
+
+// writing past the end of file would leave a hole, which is not supported
+TEST_F(FSPWriteSuite, PastEOF)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium_text.bin", fs);
+
+    struct fs_file file {
+        &fs,
+        &fs.inodes[1],
+        0
+    };
+    char buffer[8] = { 0 };
+    size_t output_ret;
+
+    {
+        stdout_logger_lock lk{ this };
+        output_ret = fs_pwrite(&file, buffer, std::size(buffer), 10000);
+    }
+
+    ASSERT_EQ(output_ret, 0);
+    check_fs(INPUT "medium_text.bin", fs);
+    free_filesystem(&fs);
+}
+
+// positional reads leave the handler offset alone
+TEST_F(FSPWriteSuite, PRead)
+{
+    constexpr size_t handle_offset = 17;
+
+    filesystem_t fs;
+    load_fs(INPUT "medium_text.bin", fs);
+
+    struct fs_file file {
+        &fs,
+        &fs.inodes[1],
+        handle_offset
+    };
+    char buffer[80] = { 0 };
+    size_t output_size;
+
+    {
+        stdout_logger_lock lk{ this };
+        output_size = fs_pread(&file, buffer, std::size(buffer), 0);
+    }
+
+    ASSERT_EQ(output_size, std::size(buffer)) << "Bytes read does not match the expected.";
+    const char *expected = "Hi. My name is $@#%^$@. It is a pleasure to meet you, but unfortunately, I canno";
+    EXPECT_EQ( memcmp(buffer, expected, std::size(buffer)), 0 );
+    ASSERT_EQ(file.offset, handle_offset) << "File offset should not be modified by fs_pread.";
+
+    check_stdout(OUTPUT "Empty.txt");
+    check_fs(INPUT "medium_text.bin", fs);
+    free_filesystem(&fs);
+}
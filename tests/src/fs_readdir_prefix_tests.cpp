@@ -0,0 +1,94 @@
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using ReaddirPrefixSuite = fs_internal_test;
+
+static std::vector<std::string> names(const std::vector<fs_dirent_t> &entries, int count)
+{
+    std::vector<std::string> result;
+    for (int i = 0; i < count && i < (int) entries.size(); ++i) result.push_back(entries[i].name);
+    return result;
+}
+
+TEST_F(ReaddirPrefixSuite, InvalidInput)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    fs_dirent_t entries[4];
+    int ret0, ret1, ret2, ret3;
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        ret0 = fs_readdir_prefix(NULL, PATH("a"), PATH(""), entries, 4);
+        ret1 = fs_readdir_prefix(&context, NULL, PATH(""), entries, 4);
+        ret2 = fs_readdir_prefix(&context, PATH("a"), NULL, entries, 4);
+        ret3 = fs_readdir_prefix(&context, PATH("a/z"), PATH(""), entries, 4);
+    }   // end stdout logging
+    EXPECT_EQ( ret0, 0 );
+    EXPECT_EQ( ret1, 0 );
+    EXPECT_EQ( ret2, 0 );
+    EXPECT_EQ( ret3, -1 );
+    check_stdout(OUTPUT "DirectoryNotFound.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// every kind of directory gives the same entries in name order, and a short buffer gets the
+// first of them
+TEST_F(ReaddirPrefixSuite, Prefixes)
+{
+    constexpr size_t file_count = 300;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 16, 1024);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("d")), 0 );
+    std::vector<std::string> all{ ".", ".." };
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        // created out of order, and every third removed again to leave tombstones
+        std::string name = "f" + std::to_string((i * 7) % file_count);
+        std::string path = "d/" + name;
+        ASSERT_EQ( new_file(&context, path.data(), FS_READ), 0 );
+        if (i % 3 == 0)
+        {
+            ASSERT_EQ( remove_file(&context, path.data()), 0 );
+        }
+        else all.push_back(name);
+    }
+    std::sort(all.begin(), all.end());
+
+    for (int kind : { FS_INDEX_NONE, FS_INDEX_ORDERED, FS_INDEX_HASHED })
+    {
+        ASSERT_EQ( fs_index_directory(&context, PATH("d"), kind), 0 );
+        for (std::string prefix : { "", "f", "f1", "f29", "f299", ".", "g", "f123456789012345" })
+        {
+            std::vector<std::string> expected;
+            for (const std::string &name : all)
+                if (name.compare(0, prefix.size(), prefix) == 0) expected.push_back(name);
+
+            std::vector<fs_dirent_t> entries(all.size());
+            int found = fs_readdir_prefix(&context, PATH("d"), prefix.data(), entries.data(), entries.size());
+            ASSERT_EQ( found, (int) expected.size() ) << "kind " << kind << " prefix " << prefix;
+            EXPECT_EQ( names(entries, found), expected ) << "kind " << kind << " prefix " << prefix;
+            for (int i = 0; i < found; ++i)
+            {
+                if (entries[i].name[0] == '.') continue;
+                std::string path = "d/" + std::string{ entries[i].name };
+                fs_file_t file = fs_open(&context, path.data());
+                ASSERT_NE( file, nullptr ) << path;
+                EXPECT_EQ( entries[i].inode, file->inode - fs.inodes ) << path;
+                fs_close(file);
+            }
+
+            std::vector<fs_dirent_t> first(3);
+            found = fs_readdir_prefix(&context, PATH("d"), prefix.data(), first.data(), first.size());
+            ASSERT_EQ( found, (int) expected.size() );
+            expected.resize(std::min<size_t>(expected.size(), first.size()));
+            EXPECT_EQ( names(first, found), expected ) << "kind " << kind << " prefix " << prefix;
+        }
+    }
+    free_filesystem(&fs);
+}
@@ -0,0 +1,103 @@
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using ReaddirSuite = fs_internal_test;
+
+TEST_F(ReaddirSuite, InvalidInput)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    fs_dirent_t entries[4];
+    fs_dir_t dir0, dir1, dir2, dir3;
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        dir0 = fs_opendir(NULL, PATH("a"));
+        dir1 = fs_opendir(&context, NULL);
+        dir2 = fs_opendir(&context, PATH("a/z"));
+        dir3 = fs_opendir(&context, PATH("book2.txt"));
+    }   // end stdout logging
+    EXPECT_EQ( dir0, nullptr );
+    EXPECT_EQ( dir1, nullptr );
+    EXPECT_EQ( dir2, nullptr );
+    EXPECT_EQ( dir3, nullptr );
+    EXPECT_EQ( fs_readdir(NULL, entries, 4), 0 );
+    fs_closedir(NULL);
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// the entries are those `list` prints, with the type and size of their inodes, however
+// many are read at a time
+TEST_F(ReaddirSuite, Entries)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    fs_dirent_t sorted[64];
+    int total = fs_readdir_prefix(&context, PATH("."), PATH(""), sorted, 64);
+    ASSERT_GT( total, 2 );
+    ASSERT_LE( total, 64 );
+
+    for (size_t batch : { 1, 3, 64 })
+    {
+        fs_dir_t dir = fs_opendir(&context, PATH("."));
+        ASSERT_NE( dir, nullptr );
+        std::vector<fs_dirent_t> entries = read_all(dir, batch);
+        EXPECT_EQ( fs_readdir(dir, sorted, 64), 0 );
+        fs_closedir(dir);
+        ASSERT_EQ( entries.size(), (size_t) total ) << batch;
+        EXPECT_STREQ( entries[0].name, "." );
+        std::sort(entries.begin(), entries.end(), [](const fs_dirent_t &a, const fs_dirent_t &b) {
+            return strcmp(a.name, b.name) < 0;
+        });
+        for (int i = 0; i < total; ++i)
+        {
+            EXPECT_STREQ( entries[i].name, sorted[i].name );
+            EXPECT_EQ( entries[i].inode, sorted[i].inode );
+            EXPECT_EQ( entries[i].type, fs.inodes[entries[i].inode].internal.file_type );
+            EXPECT_EQ( entries[i].size, fs.inodes[entries[i].inode].internal.file_size );
+        }
+    }
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// removed entries are skipped, and an ordered directory is read in name order
+TEST_F(ReaddirSuite, Tombstones)
+{
+    constexpr size_t file_count = 100;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 16, 512);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("d")), 0 );
+    std::vector<std::string> expected{ ".", ".." };
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        std::string path = "d/f" + std::to_string(i);
+        ASSERT_EQ( new_file(&context, path.data(), FS_READ), 0 );
+        if (i % 4 == 0)
+        {
+            ASSERT_EQ( remove_file(&context, path.data()), 0 );
+        }
+        else expected.push_back("f" + std::to_string(i));
+    }
+    for (int kind : { FS_INDEX_NONE, FS_INDEX_ORDERED })
+    {
+        ASSERT_EQ( fs_index_directory(&context, PATH("d"), kind), 0 );
+        fs_dir_t dir = fs_opendir(&context, PATH("d"));
+        ASSERT_NE( dir, nullptr );
+        std::vector<std::string> names;
+        for (const fs_dirent_t &entry : read_all(dir, 7)) names.push_back(entry.name);
+        fs_closedir(dir);
+        if (kind == FS_INDEX_ORDERED)
+        {
+            std::sort(expected.begin(), expected.end());
+        }
+        EXPECT_EQ( names, expected ) << kind;
+    }
+    free_filesystem(&fs);
+}
@@ -0,0 +1,259 @@
+#include "test_util.hpp"
+
+#include <string>
+#include <vector>
+
+using RenameSuite = fs_internal_test;
+
+static void write_file(terminal_context_t *context, const char *path, std::string data)
+{
+    ASSERT_EQ( new_file(context, PATH(path), FS_READ), 0 ) << path;
+    fs_file_t file = fs_open(context, PATH(path));
+    ASSERT_NE( file, nullptr ) << path;
+    ASSERT_EQ( fs_write(file, data.data(), data.size()), data.size() ) << path;
+    fs_close(file);
+}
+
+// the inode behind `name` in the directory at `path`, or -1 if there is none
+static int entry_inode(terminal_context_t *context, const char *path, const char *name)
+{
+    fs_dirent_t entry;
+    if (fs_readdir_prefix(context, PATH(path), PATH(name), &entry, 1) < 1 || std::string{ entry.name } != name)
+        return -1;
+    return entry.inode;
+}
+
+TEST_F(RenameSuite, InvalidInput)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    int ret0, ret1, ret2;
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        ret0 = fs_rename(NULL, PATH("a/d/text"), PATH("a/t"));
+        ret1 = fs_rename(&context, NULL, PATH("a/t"));
+        ret2 = fs_rename(&context, PATH("a/d/text"), NULL);
+    }   // end stdout logging
+    EXPECT_EQ( ret0, 0 );
+    EXPECT_EQ( ret1, 0 );
+    EXPECT_EQ( ret2, 0 );
+    check_stdout(OUTPUT "Empty.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+TEST_F(RenameSuite, InvalidPath)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( fs_rename(&context, PATH("a/missing"), PATH("a/t")), -1 );
+    }   // end stdout logging
+    check_stdout(OUTPUT "FileNotFound.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// a directory cannot be moved under itself
+TEST_F(RenameSuite, IntoItself)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( fs_rename(&context, PATH("a"), PATH("a/b/c/a")), -1 );
+        EXPECT_EQ( fs_rename(&context, PATH("a/b"), PATH("a/b/b")), -1 );
+    }   // end stdout logging
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// a file only replaces a file, and a directory only an empty directory
+TEST_F(RenameSuite, InvalidTarget)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( fs_rename(&context, PATH("a/d/text"), PATH("a/b")), -1 );
+    }   // end stdout logging
+    check_stdout(OUTPUT "InvalidFileType.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+TEST_F(RenameSuite, TargetNotEmpty)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( fs_rename(&context, PATH("a/b/c"), PATH("a/d")), -1 );
+    }   // end stdout logging
+    check_stdout(OUTPUT "DirectoryNotEmpty.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// moving a file claims nothing and keeps its inode and data
+TEST_F(RenameSuite, MoveFile)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 16, 256);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("pub")), 0 );
+    std::string data(5000, 'm');
+    write_file(&context, "draft", data);
+    int inode = entry_inode(&context, ".", "draft");
+    size_t inodes = available_inodes(&fs);
+    size_t dblocks = available_dblocks(&fs);
+
+    ASSERT_EQ( fs_rename(&context, PATH("draft"), PATH("pub/final")), 0 );
+    EXPECT_EQ( entry_inode(&context, ".", "draft"), -1 );
+    EXPECT_EQ( entry_inode(&context, "pub", "final"), inode );
+    EXPECT_EQ( available_inodes(&fs), inodes );
+    EXPECT_EQ( available_dblocks(&fs), dblocks );
+    EXPECT_EQ( read_file(&context, "pub/final"), data );
+    EXPECT_STREQ( fs.inodes[inode].internal.file_name, "final" );
+
+    // within one directory only the name changes
+    ASSERT_EQ( fs_rename(&context, PATH("pub/final"), PATH("pub/v2")), 0 );
+    EXPECT_EQ( entry_inode(&context, "pub", "v2"), inode );
+    EXPECT_EQ( read_file(&context, "pub/v2"), data );
+    free_filesystem(&fs);
+}
+
+// a moved directory keeps its contents, and its ".." leads to the new parent
+TEST_F(RenameSuite, MoveDirectory)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 16, 256);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("x")), 0 );
+    ASSERT_EQ( new_directory(&context, PATH("x/y")), 0 );
+    ASSERT_EQ( new_directory(&context, PATH("w")), 0 );
+    write_file(&context, "x/y/f", "contents");
+    ASSERT_EQ( change_directory(&context, PATH("x/y")), 0 );
+    EXPECT_STREQ( working_directory_path(&context), "root/x/y" );
+
+    ASSERT_EQ( fs_rename(&context, PATH("../y"), PATH("../../w/z")), 0 );
+    EXPECT_STREQ( working_directory_path(&context), "root/w/z" );
+    EXPECT_EQ( read_file(&context, "f"), "contents" );
+    ASSERT_EQ( change_directory(&context, PATH("..")), 0 );
+    EXPECT_EQ( context.working_directory - fs.inodes, entry_inode(&context, "..", "w") );
+    EXPECT_EQ( entry_inode(&context, "../x", "y"), -1 );
+    EXPECT_EQ( read_file(&context, "z/f"), "contents" );
+
+    // the emptied directory can be removed, and the moved one once emptied
+    ASSERT_EQ( remove_directory(&context, PATH("../x")), 0 );
+    ASSERT_EQ( remove_file(&context, PATH("z/f")), 0 );
+    ASSERT_EQ( remove_directory(&context, PATH("z")), 0 );
+    free_filesystem(&fs);
+}
+
+// an existing file is replaced in one step, releasing its data
+TEST_F(RenameSuite, Replace)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 16, 256);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    std::string data(300, 'n');
+    write_file(&context, "old", std::string(2000, 'o'));
+    size_t inodes = available_inodes(&fs);
+    size_t dblocks = available_dblocks(&fs);
+    write_file(&context, "new", data);
+    int inode = entry_inode(&context, ".", "new");
+
+    ASSERT_EQ( fs_rename(&context, PATH("new"), PATH("old")), 0 );
+    EXPECT_EQ( entry_inode(&context, ".", "old"), inode );
+    EXPECT_EQ( entry_inode(&context, ".", "new"), -1 );
+    EXPECT_EQ( read_file(&context, "old"), data );
+    EXPECT_EQ( available_inodes(&fs), inodes );
+    EXPECT_LT( available_dblocks(&fs) - dblocks, (size_t) 2000 / DATA_BLOCK_SIZE );
+    EXPECT_GT( available_dblocks(&fs), dblocks );
+
+    // an empty directory is replaced by a directory
+    ASSERT_EQ( new_directory(&context, PATH("d")), 0 );
+    ASSERT_EQ( new_directory(&context, PATH("e")), 0 );
+    write_file(&context, "d/f", data);
+    ASSERT_EQ( fs_rename(&context, PATH("d"), PATH("e")), 0 );
+    EXPECT_EQ( entry_inode(&context, ".", "d"), -1 );
+    EXPECT_EQ( read_file(&context, "e/f"), data );
+
+    // a linked file keeps its data under its other name
+    ASSERT_EQ( fs_link(&context, PATH("old"), PATH("e/g")), 0 );
+    write_file(&context, "other", "x");
+    ASSERT_EQ( fs_rename(&context, PATH("other"), PATH("old")), 0 );
+    EXPECT_EQ( read_file(&context, "e/g"), data );
+    EXPECT_EQ( read_file(&context, "old"), "x" );
+
+    // renaming onto another name of the same file changes nothing
+    ASSERT_EQ( fs_link(&context, PATH("e/g"), PATH("h")), 0 );
+    ASSERT_EQ( fs_rename(&context, PATH("h"), PATH("e/g")), 0 );
+    EXPECT_EQ( read_file(&context, "h"), data );
+    free_filesystem(&fs);
+}
+
+// names keep pointing at the right inodes in indexed directories
+TEST_F(RenameSuite, Indexed)
+{
+    for (int kind : { FS_INDEX_HASHED, FS_INDEX_ORDERED })
+    {
+        filesystem_t fs;
+        new_filesystem(&fs, 128, 1024);
+        terminal_context_t context{ &fs, &fs.inodes[0] };
+        ASSERT_EQ( new_directory(&context, PATH("d")), 0 );
+        ASSERT_EQ( fs_index_directory(&context, PATH("d"), kind), 0 );
+        for (int i = 0; i < 40; ++i)
+        {
+            write_file(&context, ("d/f" + std::to_string(i)).data(), std::to_string(i));
+        }
+        int moved = entry_inode(&context, "d", "f3");
+        ASSERT_EQ( fs_rename(&context, PATH("d/f3"), PATH("d/f7")), 0 );
+        ASSERT_EQ( fs_rename(&context, PATH("d/f9"), PATH("d/g9")), 0 );
+        EXPECT_EQ( entry_inode(&context, "d", "f7"), moved ) << kind;
+        EXPECT_EQ( entry_inode(&context, "d", "f3"), -1 ) << kind;
+        EXPECT_EQ( read_file(&context, "d/f7"), "3" ) << kind;
+        EXPECT_EQ( read_file(&context, "d/g9"), "9" ) << kind;
+        free_filesystem(&fs);
+    }
+}
+
+// files and directories moved between directories move their totals with them
+TEST_F(RenameSuite, DirTotals)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 32, 256);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( dir_totals_enable(&fs), SUCCESS );
+    ASSERT_EQ( new_directory(&context, PATH("a")), 0 );
+    ASSERT_EQ( new_directory(&context, PATH("a/s")), 0 );
+    ASSERT_EQ( new_directory(&context, PATH("b")), 0 );
+    write_file(&context, "a/s/f", std::string(100, 'f'));
+    write_file(&context, "a/g", std::string(50, 'g'));
+    write_file(&context, "b/g", std::string(20, 'r'));
+
+    ASSERT_EQ( fs_rename(&context, PATH("a/s"), PATH("b/s")), 0 );
+    ASSERT_EQ( fs_rename(&context, PATH("a/g"), PATH("b/g")), 0 );
+    std::vector<dir_total_t> kept(fs_ext(&fs)->dir_totals, fs_ext(&fs)->dir_totals + fs.inode_count);
+    ASSERT_EQ( dir_totals_enable(&fs), SUCCESS );
+    for (size_t i = 0; i < fs.inode_count; ++i)
+    {
+        if (i != 0 && fs_ext(&fs)->dir_totals[i].parent == DIR_TOTAL_NONE) continue;
+        EXPECT_EQ( kept[i].parent, fs_ext(&fs)->dir_totals[i].parent ) << i;
+        EXPECT_EQ( kept[i].bytes, fs_ext(&fs)->dir_totals[i].bytes ) << i;
+        EXPECT_EQ( kept[i].descendants, fs_ext(&fs)->dir_totals[i].descendants ) << i;
+    }
+    size_t bytes;
+    ASSERT_EQ( fs_du(&context, PATH("a"), 1, &bytes), 0 );
+    EXPECT_EQ( bytes, (size_t) 0 );
+    ASSERT_EQ( fs_du(&context, PATH("b"), 1, &bytes), 0 );
+    EXPECT_EQ( bytes, (size_t) 150 );
+    free_filesystem(&fs);
+}
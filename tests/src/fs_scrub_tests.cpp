@@ -0,0 +1,161 @@
+#include "test_util.hpp"
+
+#include <random>
+#include <vector>
+
+using ScrubSuite = fs_internal_test;
+
+static std::vector<dblock_index_t> scrub(filesystem_t *fs, size_t threads)
+{
+    dblock_index_t *bad;
+    size_t bad_count;
+    EXPECT_EQ( fs_scrub(fs, threads, &bad, &bad_count), SUCCESS );
+    std::vector<dblock_index_t> result(bad, bad + bad_count);
+    free(bad);
+    return result;
+}
+
+TEST_F(ScrubSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8);
+    dblock_index_t *bad;
+    size_t bad_count;
+    EXPECT_EQ( fs_scrub(&fs, 1, &bad, &bad_count), INVALID_INPUT );
+    ASSERT_EQ( checksum_enable(&fs, 0), SUCCESS );
+    EXPECT_EQ( fs_scrub(NULL, 1, &bad, &bad_count), INVALID_INPUT );
+    EXPECT_EQ( fs_scrub(&fs, 1, NULL, &bad_count), INVALID_INPUT );
+    EXPECT_EQ( fs_scrub(&fs, 1, &bad, NULL), INVALID_INPUT );
+    free_filesystem(&fs);
+}
+
+// a flipped byte is found by the scrub, and by a read once reads are verified
+TEST_F(ScrubSuite, Corruption)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 256);
+    ASSERT_EQ( checksum_enable(&fs, 0), SUCCESS );
+    inode_t *file = &fs.inodes[1];
+    file->internal.file_type = DATA_FILE;
+    std::vector<char> data(40 * DATA_BLOCK_SIZE);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = (char) (i * 7);
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    char patch[] = "patched";
+    ASSERT_EQ( inode_modify_data(&fs, file, 1000, patch, std::size(patch) - 1), SUCCESS );
+    memcpy(data.data() + 1000, patch, std::size(patch) - 1);
+    EXPECT_TRUE( scrub(&fs, 4).empty() );
+
+    dblock_index_t victim = file->internal.direct_data[2];
+    fs.dblocks[victim * DATA_BLOCK_SIZE + 5] ^= 1;
+    EXPECT_EQ( scrub(&fs, 4), std::vector<dblock_index_t>{ victim } );
+    EXPECT_EQ( scrub(&fs, 1), std::vector<dblock_index_t>{ victim } );
+
+    char buffer[DATA_BLOCK_SIZE];
+    size_t bytes_read;
+    EXPECT_EQ( inode_read_data(&fs, file, 2 * DATA_BLOCK_SIZE, buffer, std::size(buffer), &bytes_read), SUCCESS );
+    ASSERT_EQ( checksum_enable(&fs, 1), SUCCESS );
+    EXPECT_EQ( inode_read_data(&fs, file, 2 * DATA_BLOCK_SIZE, buffer, std::size(buffer), &bytes_read), CHECKSUM_MISMATCH );
+    EXPECT_EQ( inode_read_data(&fs, file, 3 * DATA_BLOCK_SIZE, buffer, std::size(buffer), &bytes_read), SUCCESS );
+
+    // rewriting the block makes it good again
+    fs.dblocks[victim * DATA_BLOCK_SIZE + 5] ^= 1;
+    ASSERT_EQ( inode_modify_data(&fs, file, 2 * DATA_BLOCK_SIZE, data.data() + 2 * DATA_BLOCK_SIZE, DATA_BLOCK_SIZE), SUCCESS );
+    EXPECT_TRUE( scrub(&fs, 3).empty() );
+    EXPECT_EQ( read_all(&fs, file), data );
+    free_filesystem(&fs);
+}
+
+// the checksums are saved with the image and still match after loading it
+TEST_F(ScrubSuite, SaveLoad)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 64);
+    ASSERT_EQ( checksum_enable(&fs, 1), SUCCESS );
+    fs.inodes[1].internal.file_type = DATA_FILE;
+    std::vector<char> data(500, 'c');
+    ASSERT_EQ( inode_write_data(&fs, &fs.inodes[1], data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( save_filesystem_ext(output_file, &fs), SUCCESS );
+    free_filesystem(&fs);
+
+    rewind(output_file);
+    ASSERT_EQ( load_filesystem_ext(output_file, &fs), SUCCESS );
+    ASSERT_NE( fs_ext(&fs)->dblock_crcs, nullptr );
+    EXPECT_FALSE( fs_ext(&fs)->verify_reads );
+    EXPECT_TRUE( scrub(&fs, 2).empty() );
+    EXPECT_EQ( read_all(&fs, &fs.inodes[1]), data );
+    free_filesystem(&fs);
+}
+
+// random appends, overwrites, shrinks and clones of plain, compressed and deduplicated
+// files never leave a claimed dblock out of date
+TEST_F(ScrubSuite, RandomOperations)
+{
+    constexpr size_t file_count = 6;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 1, 1024);
+    ASSERT_EQ( checksum_enable(&fs, 1), SUCCESS );
+    ASSERT_EQ( dedup_enable(&fs), SUCCESS );
+    std::vector<std::vector<char>> expected(file_count);
+    std::mt19937 rng{ 2033 };
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        inode_index_t index;
+        ASSERT_EQ( claim_available_inode(&fs, &index), SUCCESS );
+        fs.inodes[index].internal.file_type = DATA_FILE;
+        fs.inodes[index].internal.file_size = 0;
+        if (i % 2)
+        {
+            ASSERT_EQ( inode_set_compressed(&fs, &fs.inodes[index], 1), SUCCESS );
+        }
+    }
+
+    for (int step = 0; step < 2000; ++step)
+    {
+        size_t f = rng() % file_count;
+        inode_t *inode = &fs.inodes[f + 1];
+        std::vector<char> &data = expected[f];
+        switch (rng() % 4)
+        {
+        case 0: {
+            std::vector<char> chunk(rng() % 600);
+            for (char &c : chunk) c = (char) ('a' + rng() % 3);
+            if (inode_write_data(&fs, inode, chunk.data(), chunk.size()) == SUCCESS)
+                data.insert(data.end(), chunk.begin(), chunk.end());
+            break;
+        }
+        case 1: {
+            size_t offset = data.empty() ? 0 : rng() % data.size();
+            std::vector<char> chunk(rng() % 200, (char) rng());
+            if (inode_modify_data(&fs, inode, offset, chunk.data(), chunk.size()) == SUCCESS)
+            {
+                if (offset + chunk.size() > data.size()) data.resize(offset + chunk.size());
+                std::copy(chunk.begin(), chunk.end(), data.begin() + offset);
+            }
+            break;
+        }
+        case 2: {
+            size_t new_size = data.empty() ? 0 : rng() % (data.size() + 1);
+            ASSERT_EQ( inode_shrink_data(&fs, inode, new_size), SUCCESS );
+            data.resize(new_size);
+            break;
+        }
+        case 3: {
+            size_t src = rng() % file_count;
+            if (src == f) break;
+            ASSERT_EQ( inode_release_data(&fs, inode), SUCCESS );
+            ASSERT_EQ( inode_share_data(&fs, inode, &fs.inodes[src + 1]), SUCCESS );
+            data = expected[src];
+            break;
+        }
+        }
+        if (step % 100 == 0)
+        {
+            ASSERT_TRUE( scrub(&fs, 4).empty() ) << "at step " << step;
+        }
+    }
+
+    ASSERT_TRUE( scrub(&fs, 4).empty() );
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] );
+    free_filesystem(&fs);
+}
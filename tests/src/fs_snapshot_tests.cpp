@@ -0,0 +1,257 @@
+#include "test_util.hpp"
+
+#include <vector>
+
+using SnapshotSuite = fs_internal_test;
+
+TEST_F(SnapshotSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8);
+    EXPECT_EQ( fs_snapshot_create(NULL, "a"), INVALID_INPUT );
+    EXPECT_EQ( fs_snapshot_create(&fs, NULL), INVALID_INPUT );
+    EXPECT_EQ( fs_snapshot_create(&fs, ""), INVALID_INPUT );
+    EXPECT_EQ( fs_snapshot_create(&fs, "a_name_too_long"), INVALID_INPUT );
+    EXPECT_EQ( fs_snapshot_create(&fs, "a"), SUCCESS );
+    EXPECT_EQ( fs_snapshot_create(&fs, "a"), INVALID_INPUT );
+
+    EXPECT_EQ( fs_snapshot_delete(&fs, "b"), NOT_FOUND );
+    EXPECT_EQ( fs_snapshot_rollback(&fs, "b"), NOT_FOUND );
+    EXPECT_EQ( fs_snapshot_diff(&fs, "b"), NOT_FOUND );
+    EXPECT_EQ( fs_snapshot_save(&fs, "b", output_file), NOT_FOUND );
+    EXPECT_EQ( fs_snapshot_save(&fs, "a", NULL), INVALID_INPUT );
+    free_filesystem(&fs);
+}
+
+// taking a snapshot claims no dblocks, and the first write after it copies what it touches
+TEST_F(SnapshotSuite, CopyOnWrite)
+{
+    filesystem_t fs;
+    load_fs(INPUT "large.bin", fs);
+    inode_t *large_file = &fs.inodes[5];
+    std::vector<char> before = read_all(&fs, large_file);
+
+    size_t available = available_dblocks(&fs);
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+
+    // the write lands in the first index dblock, so it and one data block are copied
+    char patch[] = "patched";
+    ASSERT_EQ( inode_modify_data(&fs, large_file, 500, patch, std::size(patch) - 1), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available - 2 );
+    ASSERT_EQ( inode_modify_data(&fs, large_file, 502, patch, std::size(patch) - 1), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available - 2 );
+
+    // deleting the snapshot gives back the dblocks only it referred to
+    ASSERT_EQ( fs_snapshot_delete(&fs, "before"), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    EXPECT_NE( read_all(&fs, large_file), before );
+    free_filesystem(&fs);
+}
+
+TEST_F(SnapshotSuite, Rollback)
+{
+    filesystem_t fs;
+    load_fs(INPUT "large.bin", fs);
+    std::vector<std::vector<char>> before;
+    for (size_t i = 0; i < 7; ++i) before.push_back(read_all(&fs, &fs.inodes[i]));
+    size_t available = available_dblocks(&fs);
+    inode_index_t available_inode = fs.available_inode;
+
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+    std::vector<char> data(100, 'z');
+    ASSERT_EQ( inode_modify_data(&fs, &fs.inodes[5], 1000, data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_write_data(&fs, &fs.inodes[6], data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_shrink_data(&fs, &fs.inodes[2], 10), SUCCESS );
+    ASSERT_EQ( inode_release_data(&fs, &fs.inodes[4]), SUCCESS );
+    ASSERT_EQ( release_inode(&fs, &fs.inodes[4]), SUCCESS );
+
+    // rolling back twice gives the same file system as the snapshot
+    for (int round = 0; round < 2; ++round)
+    {
+        ASSERT_EQ( fs_snapshot_rollback(&fs, "before"), SUCCESS );
+        EXPECT_EQ( fs.available_inode, available_inode );
+        for (size_t i = 0; i < 7; ++i) EXPECT_EQ( read_all(&fs, &fs.inodes[i]), before[i] ) << "inode " << i;
+        ASSERT_EQ( inode_modify_data(&fs, &fs.inodes[5], 0, data.data(), data.size()), SUCCESS );
+    }
+
+    ASSERT_EQ( fs_snapshot_delete(&fs, "before"), SUCCESS );
+    ASSERT_EQ( inode_shrink_data(&fs, &fs.inodes[5], 2048), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
+
+// a rollback that cannot copy the packed tails of the snapshot leaves the file system as it was
+TEST_F(SnapshotSuite, RollbackFailure)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 16);
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    std::vector<inode_t *> files;
+    for (int i = 0; i < 3; ++i)
+    {
+        inode_index_t index;
+        ASSERT_EQ( claim_available_inode(&fs, &index), SUCCESS );
+        files.push_back(&fs.inodes[index]);
+        files.back()->internal.file_type = DATA_FILE;
+        files.back()->internal.file_perms = FS_READ;
+        files.back()->internal.file_size = 0;
+        std::vector<char> data(20, (char) ('a' + i));
+        ASSERT_EQ( inode_write_data(&fs, files.back(), data.data(), data.size()), SUCCESS );
+    }
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+
+    // every dblock left goes to a file the snapshot does not have
+    inode_index_t index;
+    ASSERT_EQ( claim_available_inode(&fs, &index), SUCCESS );
+    inode_t *big = &fs.inodes[index];
+    big->internal.file_type = DATA_FILE;
+    big->internal.file_perms = FS_READ;
+    big->internal.file_size = 0;
+    std::vector<char> data((INODE_DIRECT_BLOCK_COUNT + 8) * DATA_BLOCK_SIZE, 'z');
+    ASSERT_EQ( inode_write_data(&fs, big, data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( available_dblocks(&fs), (size_t) 0 );
+    inode_index_t available_inode = fs.available_inode;
+    std::vector<inode_t> inodes(fs.inodes, fs.inodes + fs.inode_count);
+
+    EXPECT_EQ( fs_snapshot_rollback(&fs, "before"), INSUFFICIENT_DBLOCKS );
+    EXPECT_EQ( fs.available_inode, available_inode );
+    EXPECT_EQ( memcmp(inodes.data(), fs.inodes, inodes.size() * sizeof(inode_t)), 0 );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 0 );
+    EXPECT_EQ( read_all(&fs, big), data );
+    for (int i = 0; i < 3; ++i) EXPECT_EQ( read_all(&fs, files[i]), std::vector<char>(20, (char) ('a' + i)) );
+
+    // with room for the tails the same rollback goes through
+    ASSERT_EQ( inode_release_data(&fs, big), SUCCESS );
+    ASSERT_EQ( fs_snapshot_rollback(&fs, "before"), SUCCESS );
+    EXPECT_EQ( fs.inodes[index].internal.file_size, (size_t) 0 );
+    for (int i = 0; i < 3; ++i) EXPECT_EQ( read_all(&fs, files[i]), std::vector<char>(20, (char) ('a' + i)) );
+    free_filesystem(&fs);
+}
+
+// directory totals are counted again from the restored tree
+TEST_F(SnapshotSuite, RollbackTotals)
+{
+    filesystem_t fs;
+    load_fs(INPUT "large.bin", fs);
+    ASSERT_EQ( dir_totals_enable(&fs), SUCCESS );
+    std::vector<dir_total_t> before(fs_ext(&fs)->dir_totals, fs_ext(&fs)->dir_totals + fs.inode_count);
+
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+    std::vector<char> data(100, 'z');
+    ASSERT_EQ( inode_write_data(&fs, &fs.inodes[6], data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_shrink_data(&fs, &fs.inodes[5], 10), SUCCESS );
+    EXPECT_NE( fs_ext(&fs)->dir_totals[0].bytes, before[0].bytes );
+
+    ASSERT_EQ( fs_snapshot_rollback(&fs, "before"), SUCCESS );
+    ASSERT_NE( fs_ext(&fs)->dir_totals, nullptr );
+    for (size_t i = 0; i < fs.inode_count; ++i)
+    {
+        EXPECT_EQ( fs_ext(&fs)->dir_totals[i].bytes, before[i].bytes ) << "inode " << i;
+        EXPECT_EQ( fs_ext(&fs)->dir_totals[i].descendants, before[i].descendants ) << "inode " << i;
+        EXPECT_EQ( fs_ext(&fs)->dir_totals[i].parent, before[i].parent ) << "inode " << i;
+    }
+    free_filesystem(&fs);
+}
+
+// copying the root directory on write lets its first dblock go with the snapshot, after
+// which dblock 0 is claimed again like any other, here as an index dblock
+TEST_F(SnapshotSuite, ReuseDblockZero)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 64);
+    inode_index_t index;
+    ASSERT_EQ( claim_available_inode(&fs, &index), SUCCESS );
+    inode_t *file = &fs.inodes[index];
+    file->internal.file_type = DATA_FILE;
+    file->internal.file_perms = FS_READ;
+    file->internal.file_size = 0;
+    std::vector<char> data(INODE_DIRECT_BLOCK_COUNT * DATA_BLOCK_SIZE, 'd');
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+    inode_t *root = &fs.inodes[0];
+    std::vector<char> entries = read_all(&fs, root);
+    ASSERT_EQ( inode_modify_data(&fs, root, 0, entries.data(), entries.size()), SUCCESS );
+    EXPECT_NE( root->internal.direct_data[0], (dblock_index_t) 0 );
+    ASSERT_EQ( fs_snapshot_delete(&fs, "before"), SUCCESS );
+
+    std::vector<char> more(DATA_BLOCK_SIZE, 'm');
+    ASSERT_EQ( inode_write_data(&fs, file, more.data(), more.size()), SUCCESS );
+    EXPECT_EQ( file->internal.indirect_dblock, (dblock_index_t) 0 );
+    data.insert(data.end(), more.begin(), more.end());
+    EXPECT_EQ( read_all(&fs, file), data );
+    EXPECT_EQ( read_all(&fs, root), entries );
+
+    ASSERT_EQ( inode_release_data(&fs, file), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 63 );
+    free_filesystem(&fs);
+}
+
+TEST_F(SnapshotSuite, Diff)
+{
+    filesystem_t fs;
+    load_fs(INPUT "large.bin", fs);
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+
+    char patch[] = "patched";
+    ASSERT_EQ( inode_modify_data(&fs, &fs.inodes[5], 1500, patch, std::size(patch) - 1), SUCCESS );
+    inode_index_t new_index;
+    ASSERT_EQ( claim_available_inode(&fs, &new_index), SUCCESS );
+    ASSERT_EQ( inode_release_data(&fs, &fs.inodes[4]), SUCCESS );
+    ASSERT_EQ( release_inode(&fs, &fs.inodes[4]), SUCCESS );
+    inode_t *new_inode = &fs.inodes[new_index];
+    memset(new_inode, 0, sizeof(inode_t));
+    strcpy(new_inode->internal.file_name, "new.txt");
+
+    fs_retcode_t ret;
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        ret = fs_snapshot_diff(&fs, "before");
+    }   // end stdout logging
+
+    EXPECT_EQ( ret, SUCCESS );
+    check_stdout(OUTPUT "SnapshotDiff.txt");
+    free_filesystem(&fs);
+}
+
+// a saved snapshot loads as a file system holding the data from when it was taken
+TEST_F(SnapshotSuite, Save)
+{
+    filesystem_t fs;
+    load_fs(INPUT "large.bin", fs);
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+    std::vector<std::vector<char>> before;
+    for (size_t i = 0; i < 7; ++i) before.push_back(read_all(&fs, &fs.inodes[i]));
+    size_t available = available_dblocks(&fs);
+
+    std::vector<char> data(500, 'z');
+    ASSERT_EQ( inode_modify_data(&fs, &fs.inodes[5], 100, data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_release_data(&fs, &fs.inodes[1]), SUCCESS );
+    ASSERT_EQ( fs_snapshot_save(&fs, "before", output_file), SUCCESS );
+
+    // the live file system, snapshot included, also survives a save and load
+    FILE *live_file = tmpfile();
+    ASSERT_NE( live_file, nullptr );
+    ASSERT_EQ( save_filesystem_ext(live_file, &fs), SUCCESS );
+    std::vector<char> after = read_all(&fs, &fs.inodes[5]);
+    free_filesystem(&fs);
+
+    rewind(output_file);
+    ASSERT_EQ( load_filesystem_ext(output_file, &fs), SUCCESS );
+    EXPECT_EQ( fs_ext(&fs)->snapshot_count, (size_t) 0 );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    for (size_t i = 0; i < 7; ++i) EXPECT_EQ( read_all(&fs, &fs.inodes[i]), before[i] ) << "inode " << i;
+    free_filesystem(&fs);
+
+    rewind(live_file);
+    ASSERT_EQ( load_filesystem_ext(live_file, &fs), SUCCESS );
+    fclose(live_file);
+    ASSERT_EQ( fs_ext(&fs)->snapshot_count, (size_t) 1 );
+    EXPECT_EQ( read_all(&fs, &fs.inodes[5]), after );
+    ASSERT_EQ( fs_snapshot_rollback(&fs, "before"), SUCCESS );
+    for (size_t i = 0; i < 7; ++i) EXPECT_EQ( read_all(&fs, &fs.inodes[i]), before[i] ) << "inode " << i;
+    free_filesystem(&fs);
+}
@@ -0,0 +1,202 @@
+#include "test_util.hpp"
+
+#include <fnmatch.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+using WalkSuite = fs_internal_test;
+
+struct visit_record
+{
+    std::string path;
+    std::string name;
+    size_t depth;
+    file_type_t type;
+    size_t size;
+};
+
+static void record_visit(const fs_walk_entry_t *visited, void *arg)
+{
+    auto *records = static_cast<std::vector<visit_record>*>(arg);
+    records->push_back({ visited->path, visited->entry->name, visited->depth, visited->entry->type,
+                         visited->entry->size });
+}
+
+TEST_F(WalkSuite, InvalidInput)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    std::vector<visit_record> records;
+    size_t bytes;
+    int ret0, ret1, ret2, ret3, ret4;
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        ret0 = fs_walk(NULL, PATH("a"), 1, record_visit, &records);
+        ret1 = fs_walk(&context, NULL, 1, record_visit, &records);
+        ret2 = fs_walk(&context, PATH("a"), 1, NULL, &records);
+        ret3 = fs_du(&context, PATH("a"), 1, NULL);
+        ret4 = fs_walk(&context, PATH("a/z"), 1, record_visit, &records);
+    }   // end stdout logging
+    EXPECT_EQ( ret0, 0 );
+    EXPECT_EQ( ret1, 0 );
+    EXPECT_EQ( ret2, 0 );
+    EXPECT_EQ( ret3, 0 );
+    EXPECT_EQ( ret4, -1 );
+    EXPECT_TRUE( records.empty() );
+    EXPECT_EQ( fs_du(&context, PATH("book2.txt"), 2, &bytes), 0 );
+    EXPECT_EQ( bytes, 0 );  // the files of medium.bin are empty
+    check_stdout(OUTPUT "DirectoryNotFound.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// a random tree is visited in the same order whatever the number of threads, each
+// directory before its entries
+TEST_F(WalkSuite, Threads)
+{
+    constexpr size_t entry_count = 1500;
+    filesystem_t fs;
+    new_filesystem(&fs, entry_count + 16, 8192);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    ASSERT_EQ( new_directory(&context, PATH("t")), 0 );
+    std::vector<std::string> directories{ "t" };
+    std::mt19937 rng{ 2045 };
+    size_t total = 0;
+    for (size_t i = 0; i < entry_count; ++i)
+    {
+        std::string path = directories[rng() % directories.size()] + "/e" + std::to_string(i);
+        if (rng() % 3 == 0)
+        {
+            ASSERT_EQ( new_directory(&context, path.data()), 0 );
+            directories.push_back(path);
+        }
+        else
+        {
+            ASSERT_EQ( new_file(&context, path.data(), FS_WRITE), 0 );
+            fs_file_t file = fs_open(&context, path.data());
+            ASSERT_NE( file, nullptr );
+            std::string data(i % 97, 'x');
+            ASSERT_EQ( fs_write(file, data.data(), data.size()), data.size() );
+            fs_close(file);
+            total += data.size();
+        }
+    }
+
+    std::vector<visit_record> expected;
+    ASSERT_EQ( fs_walk(&context, PATH("t"), 1, record_visit, &expected), 0 );
+    ASSERT_EQ( expected.size(), entry_count + 1 );
+    EXPECT_EQ( expected[0].path, "t" );
+    EXPECT_EQ( expected[0].depth, 0 );
+    for (size_t i = 1; i < expected.size(); ++i)
+    {
+        const visit_record &parent = expected[i - 1];
+        // the entry after a directory is in it, or in one of the directories above it
+        EXPECT_LE( expected[i].depth, parent.depth + 1 );
+        EXPECT_EQ( expected[i].path.substr(expected[i].path.rfind('/') + 1), expected[i].name );
+    }
+    for (size_t threads : { 2, 4, 8 })
+    {
+        std::vector<visit_record> records;
+        ASSERT_EQ( fs_walk(&context, PATH("t"), threads, record_visit, &records), 0 );
+        ASSERT_EQ( records.size(), expected.size() ) << threads;
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            EXPECT_EQ( records[i].path, expected[i].path ) << threads;
+            EXPECT_EQ( records[i].depth, expected[i].depth ) << threads;
+        }
+        size_t bytes;
+        ASSERT_EQ( fs_du(&context, PATH("t"), threads, &bytes), 0 );
+        EXPECT_EQ( bytes, total ) << threads;
+    }
+    free_filesystem(&fs);
+}
+
+TEST_F(WalkSuite, Find)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    fs_find_query_t c{ "c", 0, 0, 0, -1 };
+    fs_find_query_t text{ "te?t", 'f', 0, 0, -1 };
+    fs_find_query_t books{ "book*", 0, 0, 0, -1 };
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( fs_find(&context, PATH("."), &c, 3), 0 );
+        EXPECT_EQ( fs_find(&context, PATH("a/"), &text, 1), 0 );
+        EXPECT_EQ( fs_find(&context, PATH("a"), &books, 2), 0 );
+        EXPECT_EQ( fs_find(&context, PATH("."), NULL, 2), 0 );
+    }   // end stdout logging
+    check_stdout(OUTPUT "Find.txt");
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// every combination of predicates finds what filtering the whole walk finds, in the same
+// order, streamed or across threads
+TEST_F(WalkSuite, FindPredicates)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 256, 2048);
+    terminal_context_t context{ &fs, &fs.inodes[0] };
+    std::mt19937 rng{ 2047 };
+    std::vector<std::string> directories{ "t" };
+    ASSERT_EQ( new_directory(&context, PATH("t")), 0 );
+    for (size_t i = 0; i < 200; ++i)
+    {
+        std::string path = directories[rng() % directories.size()] + "/" + (i % 2 ? "x" : "y") + std::to_string(i);
+        if (rng() % 4 == 0)
+        {
+            ASSERT_EQ( new_directory(&context, path.data()), 0 );
+            directories.push_back(path);
+            continue;
+        }
+        ASSERT_EQ( new_file(&context, path.data(), FS_WRITE), 0 );
+        fs_file_t file = fs_open(&context, path.data());
+        std::string data(i % 50, 'z');
+        ASSERT_EQ( fs_write(file, data.data(), data.size()), data.size() );
+        fs_close(file);
+    }
+    std::vector<visit_record> all;
+    ASSERT_EQ( fs_walk(&context, PATH("t"), 1, record_visit, &all), 0 );
+
+    for (const char *name : { (const char*) NULL, "x*", "*1?", "[xy]2*" })
+    for (char type : { '\0', 'f', 'd' })
+    for (char size_op : { '\0', '+', '-', '=' })
+    for (long max_depth : { -1L, 0L, 1L, 2L })
+    {
+        fs_find_query_t query{ name, type, size_op, 20, max_depth };
+        std::string expected;
+        for (const visit_record &record : all)
+        {
+            size_t size = record.size;
+            bool directory = record.type == DIRECTORY;
+            if (max_depth >= 0 && record.depth > (size_t) max_depth) continue;
+            if (type == 'f' && directory) continue;
+            if (type == 'd' && !directory) continue;
+            if (size_op == '+' && size <= 20) continue;
+            if (size_op == '-' && size >= 20) continue;
+            if (size_op == '=' && size != 20) continue;
+            if (name && fnmatch(name, record.name.data(), 0) != 0) continue;
+            expected += record.path + "\n";
+        }
+        for (size_t threads : { 1, 3 })
+        {
+            // only what this run appends is compared
+            fseek(stdout_file, 0, SEEK_END);
+            long start = ftell(stdout_file);
+            {   // begin stdout logging
+                stdout_logger_lock lk{ this };
+                ASSERT_EQ( fs_find(&context, PATH("t"), &query, threads), 0 );
+            }   // end stdout logging
+            fseek(stdout_file, 0, SEEK_END);
+            std::string output(ftell(stdout_file) - start, '\0');
+            fseek(stdout_file, start, SEEK_SET);
+            ASSERT_EQ( fread(output.data(), 1, output.size(), stdout_file), output.size() );
+            EXPECT_EQ( output, expected ) << (name ? name : "*") << " " << type << size_op << max_depth << " " << threads;
+        }
+    }
+    free_filesystem(&fs);
+}
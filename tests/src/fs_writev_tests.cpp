@@ -0,0 +1,83 @@
+#include "test_util.hpp"
+
+using FSWriteVSuite = fs_internal_test;
+
+TEST_F(FSWriteVSuite, InvalidInput)
+{
+    size_t output_ret;
+    {
+        stdout_logger_lock lk{ this };
+        output_ret = fs_writev(NULL, NULL, 0);
+    }
+    ASSERT_EQ( output_ret, 0 );
+    check_stdout(OUTPUT "Empty.txt");
+}
+
+// same result as SimpleWrite0 with the buffer split in two
+TEST_F(FSWriteVSuite, SimpleWrite0)
+{
+    constexpr size_t offset = 0;
+    constexpr size_t expected_ret = 80;
+    constexpr size_t inode_index = 1;
+
+    filesystem_t fs;
+    load_fs(INPUT "medium_text.bin", fs);
+
+    inode_t *inode = &fs.inodes[inode_index];
+    struct fs_file file {
+        &fs,
+        inode,
+        offset
+    };
+    char header[16], payload[64];
+    memset(header, 0x24, std::size(header));
+    memset(payload, 0x24, std::size(payload));
+    fs_iovec_t iov[] = { { header, std::size(header) }, { payload, std::size(payload) } };
+    size_t output_ret;
+
+    {
+        stdout_logger_lock lk{ this };
+        output_ret = fs_writev(&file, iov, std::size(iov));
+    }
+
+    ASSERT_EQ(output_ret, expected_ret) << "Return value does not match the expected.";
+    ASSERT_EQ(file.offset, offset + expected_ret) << "New file offset is incorrect.";
+
+    check_stdout(OUTPUT "Empty.txt");
+    check_fs(OUTPUT "SimpleWrite0.bin", fs);
+    free_filesystem(&fs);
+}
+
+TEST_F(FSWriteVSuite, ReadV)
+{
+    constexpr size_t offset = 0;
+    constexpr size_t inode_index = 1;
+
+    filesystem_t fs;
+    load_fs(INPUT "medium_text.bin", fs);
+
+    inode_t *inode = &fs.inodes[inode_index];
+    struct fs_file file {
+        &fs,
+        inode,
+        offset
+    };
+    char first[4] = { 0 }, second[76] = { 0 };
+    fs_iovec_t iov[] = { { first, std::size(first) }, { second, std::size(second) } };
+    size_t output_size;
+
+    {
+        stdout_logger_lock lk{ this };
+        output_size = fs_readv(&file, iov, std::size(iov));
+    }
+
+    ASSERT_EQ(output_size, 80) << "Bytes read does not match the expected.";
+    const char *expected = "Hi. My name is $@#%^$@. It is a pleasure to meet you, but unfortunately, I canno";
+    EXPECT_EQ( memcmp(first, expected, std::size(first)), 0 );
+    EXPECT_EQ( memcmp(second, expected + std::size(first), std::size(second)), 0 );
+    ASSERT_EQ(file.offset, offset + output_size) << "New file offset is incorrect.";
+
+    check_stdout(OUTPUT "Empty.txt");
+    check_fs(INPUT "medium_text.bin", fs);
+    free_filesystem(&fs);
+}
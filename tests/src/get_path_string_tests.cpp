@@ -1,5 +1,7 @@
 #include "test_util.hpp"
 
+#include <string>
+
 using PathStringSuite = fs_internal_test;
 
 TEST_F(PathStringSuite, InvalidInput)
@@ -55,4 +57,78 @@ TEST_F(PathStringSuite, PathString2)
 
     free(output_path_string);
     free_filesystem(&fs);
-}
\ No newline at end of file
+}
+// the cached path follows change_directory, and a failed change leaves it alone
+TEST_F(PathStringSuite, ChangeDirectory)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    terminal_context_t ctx { &fs, &fs.inodes[0] };
+    EXPECT_STREQ( working_directory_path(&ctx), "root" );
+    ASSERT_EQ( change_directory(&ctx, PATH("a/b/c")), 0 );
+    EXPECT_STREQ( working_directory_path(&ctx), "root/a/b/c" );
+    ASSERT_EQ( change_directory(&ctx, PATH("./..//../d/")), 0 );
+    EXPECT_STREQ( working_directory_path(&ctx), "root/a/d" );
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        EXPECT_EQ( change_directory(&ctx, PATH("../b/nothing")), -1 );
+    }   // end stdout logging
+    EXPECT_STREQ( working_directory_path(&ctx), "root/a/d" );
+    ASSERT_EQ( change_directory(&ctx, PATH("../..")), 0 );
+    EXPECT_STREQ( working_directory_path(&ctx), "root" );
+
+    // a working directory set directly is noticed
+    ctx.working_directory = &fs.inodes[3];
+    EXPECT_STREQ( working_directory_path(&ctx), "root/a/b/c" );
+    free_filesystem(&fs);
+}
+
+// paths are not limited in depth
+TEST_F(PathStringSuite, DeepPath)
+{
+    constexpr size_t depth = 400;
+    filesystem_t fs;
+    new_filesystem(&fs, depth + 8, 4 * depth + 64);
+    terminal_context_t ctx;
+    new_terminal(&fs, &ctx);
+    std::string expected = working_directory_path(&ctx);
+    for (size_t i = 0; i < depth; ++i)
+    {
+        std::string name = "d" + std::to_string(i);
+        ASSERT_EQ( new_directory(&ctx, name.data()), 0 ) << i;
+        ASSERT_EQ( change_directory(&ctx, name.data()), 0 ) << i;
+        expected += "/" + name;
+    }
+    EXPECT_EQ( working_directory_path(&ctx), expected );
+    // rebuilt from the tree once another directory was asked for
+    inode_t *deepest = ctx.working_directory;
+    ctx.working_directory = &fs.inodes[0];
+    EXPECT_EQ( working_directory_path(&ctx), expected.substr(0, expected.find('/')) );
+    ctx.working_directory = deepest;
+    char *path = get_path_string(&ctx);
+    EXPECT_EQ( path, expected );
+    free(path);
+    free_filesystem(&fs);
+}
+
+// removing a directory drops the cached path, since its inode can be reused
+TEST_F(PathStringSuite, RemovedDirectory)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 16, 64);
+    terminal_context_t ctx, other;
+    new_terminal(&fs, &ctx);
+    new_terminal(&fs, &other);
+    ASSERT_EQ( new_directory(&ctx, PATH("x")), 0 );
+    ASSERT_EQ( new_directory(&ctx, PATH("x/y")), 0 );
+    ASSERT_EQ( change_directory(&ctx, PATH("x/y")), 0 );
+    std::string root = working_directory_path(&other);
+    EXPECT_EQ( working_directory_path(&ctx), root + "/x/y" );
+
+    // the working directory of one terminal removed and reused by another
+    ASSERT_EQ( remove_directory(&other, PATH("x/y")), 0 );
+    ASSERT_EQ( new_directory(&other, PATH("z")), 0 );
+    ASSERT_STREQ( ctx.working_directory->internal.file_name, "z" );
+    EXPECT_EQ( working_directory_path(&ctx), root + "/z" );
+    free_filesystem(&fs);
+}
@@ -0,0 +1,131 @@
+#include "test_util.hpp"
+
+#include <vector>
+
+using BlockIterSuite = fs_internal_test;
+
+static inode_t *claim_file(filesystem_t *fs)
+{
+    inode_index_t index;
+    EXPECT_EQ( claim_available_inode(fs, &index), SUCCESS );
+    inode_t *inode = &fs->inodes[index];
+    inode->internal.file_type = DATA_FILE;
+    inode->internal.file_perms = FS_READ;
+    inode->internal.file_size = 0;
+    return inode;
+}
+
+static std::vector<char> pattern(size_t n, int seed)
+{
+    std::vector<char> data(n);
+    for (size_t i = 0; i < n; ++i) data[i] = (char) (i * 31 + seed);
+    return data;
+}
+
+// the data a walk from `offset` hands out, checking the length of every block
+static std::vector<char> walk(filesystem_t *fs, inode_t *inode, size_t offset)
+{
+    inode_block_iter_t iter;
+    inode_block_iter_init(&iter, fs, inode, offset);
+    std::vector<char> data;
+    const byte *block;
+    size_t len;
+    while (true)
+    {
+        EXPECT_EQ( inode_block_iter_next(&iter, &block, &len), SUCCESS );
+        if (len == 0) break;
+        size_t left = inode->internal.file_size - (offset - offset % DATA_BLOCK_SIZE) - data.size();
+        EXPECT_EQ( len, left < DATA_BLOCK_SIZE ? left : DATA_BLOCK_SIZE );
+        data.insert(data.end(), block, block + len);
+    }
+    return data;
+}
+
+TEST_F(BlockIterSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8);
+    inode_t *file = claim_file(&fs);
+    inode_block_iter_t iter;
+    const byte *block;
+    size_t len;
+    inode_block_iter_init(&iter, &fs, file, 0);
+    EXPECT_EQ( inode_block_iter_next(NULL, &block, &len), INVALID_INPUT );
+    EXPECT_EQ( inode_block_iter_next(&iter, NULL, &len), INVALID_INPUT );
+    EXPECT_EQ( inode_block_iter_next(&iter, &block, NULL), INVALID_INPUT );
+    inode_block_iter_init(&iter, NULL, file, 0);
+    EXPECT_EQ( inode_block_iter_next(&iter, &block, &len), INVALID_INPUT );
+    inode_block_iter_init(&iter, &fs, file, 0);
+    EXPECT_EQ( inode_block_iter_next(&iter, &block, &len), SUCCESS );
+    EXPECT_EQ( len, (size_t) 0 );
+    free_filesystem(&fs);
+}
+
+// a walk over several index dblocks hands out the data in order, from the start or from
+// the block holding an offset
+TEST_F(BlockIterSuite, IndexChain)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 256);
+    inode_t *file = claim_file(&fs);
+    std::vector<char> data = pattern(100 * DATA_BLOCK_SIZE + 10, 1);
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    EXPECT_EQ( walk(&fs, file, 0), data );
+    for (size_t block : { 2, 4, 18, 19, 50, 100 })
+    {
+        size_t offset = block * DATA_BLOCK_SIZE + 5;
+        EXPECT_EQ( walk(&fs, file, offset), std::vector<char>(data.begin() + block * DATA_BLOCK_SIZE, data.end()) ) << "block " << block;
+    }
+    EXPECT_EQ( walk(&fs, file, data.size() + DATA_BLOCK_SIZE), std::vector<char>() );
+    free_filesystem(&fs);
+}
+
+// the last block of a tail packed file starts inside a shared dblock, and compressed files
+// are handed out decompressed
+TEST_F(BlockIterSuite, Layouts)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 256);
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    inode_t *first = claim_file(&fs);
+    inode_t *packed = claim_file(&fs);
+    std::vector<char> small = pattern(20, 2);
+    std::vector<char> data = pattern(3 * DATA_BLOCK_SIZE + 20, 3);
+    ASSERT_EQ( inode_write_data(&fs, first, small.data(), small.size()), SUCCESS );
+    ASSERT_EQ( inode_write_data(&fs, packed, data.data(), data.size()), SUCCESS );
+    ASSERT_NE( inode_file_perms(packed) & INODE_TAIL_PACKED, 0 );
+    ASSERT_NE( INODE_TAIL_OFFSET(inode_file_perms(packed)), 0 );
+    EXPECT_EQ( walk(&fs, first, 0), small );
+    EXPECT_EQ( walk(&fs, packed, 0), data );
+
+    inode_t *compressed = claim_file(&fs);
+    ASSERT_EQ( inode_set_compressed(&fs, compressed, 1), SUCCESS );
+    std::vector<char> text(30 * DATA_BLOCK_SIZE + 7, 'a');
+    for (size_t i = 0; i < text.size(); i += 13) text[i] = (char) ('b' + i % 5);
+    ASSERT_EQ( inode_write_data(&fs, compressed, text.data(), text.size()), SUCCESS );
+    EXPECT_EQ( walk(&fs, compressed, 0), text );
+    EXPECT_EQ( walk(&fs, compressed, 9 * DATA_BLOCK_SIZE), std::vector<char>(text.begin() + 9 * DATA_BLOCK_SIZE, text.end()) );
+    free_filesystem(&fs);
+}
+
+// verified reads stop at a damaged block
+TEST_F(BlockIterSuite, ChecksumMismatch)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 64);
+    ASSERT_EQ( checksum_enable(&fs, 1), SUCCESS );
+    inode_t *file = claim_file(&fs);
+    std::vector<char> data = pattern(8 * DATA_BLOCK_SIZE, 4);
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    dblock_index_t damaged = file->internal.direct_data[2];
+    fs.dblocks[damaged * DATA_BLOCK_SIZE] ^= 1;
+
+    inode_block_iter_t iter;
+    const byte *block;
+    size_t len;
+    inode_block_iter_init(&iter, &fs, file, 0);
+    EXPECT_EQ( inode_block_iter_next(&iter, &block, &len), SUCCESS );
+    EXPECT_EQ( inode_block_iter_next(&iter, &block, &len), SUCCESS );
+    EXPECT_EQ( inode_block_iter_next(&iter, &block, &len), CHECKSUM_MISMATCH );
+    free_filesystem(&fs);
+}
@@ -0,0 +1,158 @@
+#include "test_util.hpp"
+
+#include <random>
+#include <vector>
+
+using INodeSetCompressedSuite = fs_internal_test;
+
+static std::vector<char> text(size_t n)
+{
+    static const char words[] = "the quick brown fox jumps over the lazy dog. ";
+    std::vector<char> data(n);
+    for (size_t i = 0; i < n; ++i) data[i] = words[i % (std::size(words) - 1)];
+    return data;
+}
+
+TEST_F(INodeSetCompressedSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8);
+    EXPECT_EQ( inode_set_compressed(NULL, &fs.inodes[1], 1), INVALID_INPUT );
+    EXPECT_EQ( inode_set_compressed(&fs, NULL, 1), INVALID_INPUT );
+    EXPECT_EQ( inode_set_compressed(&fs, &fs.inodes[0], 1), INVALID_FILE_TYPE );
+    free_filesystem(&fs);
+}
+
+// compressing a text file gives back dblocks and leaves the data as it was
+TEST_F(INodeSetCompressedSuite, RoundTrip)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 256);
+    inode_t *file = &fs.inodes[1];
+    file->internal.file_type = DATA_FILE;
+    std::vector<char> data = text(5000);
+    size_t available = available_dblocks(&fs);
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    size_t plain_available = available_dblocks(&fs);
+
+    ASSERT_EQ( inode_set_compressed(&fs, file, 1), SUCCESS );
+    EXPECT_TRUE( inode_file_perms(file) & INODE_COMPRESSED );
+    EXPECT_GT( available_dblocks(&fs), plain_available );
+    EXPECT_EQ( read_all(&fs, file), data );
+
+    // a read in the middle of a cluster
+    char buffer[10];
+    size_t bytes_read;
+    ASSERT_EQ( inode_read_data(&fs, file, 1234, buffer, std::size(buffer), &bytes_read), SUCCESS );
+    EXPECT_EQ( bytes_read, std::size(buffer) );
+    EXPECT_EQ( memcmp(buffer, data.data() + 1234, std::size(buffer)), 0 );
+
+    ASSERT_EQ( inode_set_compressed(&fs, file, 0), SUCCESS );
+    EXPECT_FALSE( inode_file_perms(file) & INODE_COMPRESSED );
+    EXPECT_EQ( available_dblocks(&fs), plain_available );
+    EXPECT_EQ( read_all(&fs, file), data );
+
+    ASSERT_EQ( inode_release_data(&fs, file), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    free_filesystem(&fs);
+}
+
+// a conversion that does not fit leaves the file unchanged
+TEST_F(INodeSetCompressedSuite, InsufficientBlock)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 64);
+    inode_t *file = &fs.inodes[1];
+    file->internal.file_type = DATA_FILE;
+    std::vector<char> data = text(2000);
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+
+    char filler[DATA_BLOCK_SIZE] = { 0 };
+    while (available_dblocks(&fs) > 2)
+        ASSERT_EQ( inode_write_data(&fs, &fs.inodes[2], filler, std::size(filler)), SUCCESS );
+
+    EXPECT_EQ( inode_set_compressed(&fs, file, 1), INSUFFICIENT_DBLOCKS );
+    EXPECT_FALSE( inode_file_perms(file) & INODE_COMPRESSED );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 2 );
+    EXPECT_EQ( read_all(&fs, file), data );
+    free_filesystem(&fs);
+}
+
+// random appends, overwrites, shrinks and clones of compressed files checked against plain
+// copies of the data
+TEST_F(INodeSetCompressedSuite, RandomOperations)
+{
+    constexpr size_t file_count = 6;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 1, 2048);
+    std::vector<std::vector<char>> expected(file_count);
+    std::mt19937 rng{ 2031 };
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        fs.inodes[i + 1].internal.file_type = DATA_FILE;
+        ASSERT_EQ( inode_set_compressed(&fs, &fs.inodes[i + 1], 1), SUCCESS );
+    }
+
+    for (int step = 0; step < 2000; ++step)
+    {
+        size_t f = rng() % file_count;
+        inode_t *inode = &fs.inodes[f + 1];
+        std::vector<char> &data = expected[f];
+        switch (rng() % 5)
+        {
+        case 0: {
+            std::vector<char> chunk = text(rng() % 1500);
+            if (inode_write_data(&fs, inode, chunk.data(), chunk.size()) == SUCCESS)
+                data.insert(data.end(), chunk.begin(), chunk.end());
+            break;
+        }
+        case 1: {
+            size_t offset = data.empty() ? 0 : rng() % data.size();
+            std::vector<char> chunk(rng() % 200);
+            for (char &c : chunk) c = (char) rng();
+            if (inode_modify_data(&fs, inode, offset, chunk.data(), chunk.size()) == SUCCESS)
+            {
+                if (offset + chunk.size() > data.size()) data.resize(offset + chunk.size());
+                std::copy(chunk.begin(), chunk.end(), data.begin() + offset);
+            }
+            break;
+        }
+        case 2: {
+            size_t new_size = data.empty() ? 0 : rng() % (data.size() + 1);
+            ASSERT_EQ( inode_shrink_data(&fs, inode, new_size), SUCCESS );
+            data.resize(new_size);
+            break;
+        }
+        case 3: {
+            size_t src = rng() % file_count;
+            if (src == f) break;
+            ASSERT_EQ( inode_release_data(&fs, inode), SUCCESS );
+            ASSERT_EQ( inode_share_data(&fs, inode, &fs.inodes[src + 1]), SUCCESS );
+            data = expected[src];
+            break;
+        }
+        case 4: {
+            fs_retcode_t ret = inode_set_compressed(&fs, inode, rng() % 2);
+            ASSERT_TRUE( ret == SUCCESS || ret == INSUFFICIENT_DBLOCKS );
+            break;
+        }
+        }
+        for (size_t i = 0; i < file_count; ++i)
+            ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] ) << "file " << i << " at step " << step;
+    }
+
+    // the clusters survive a save and load
+    ASSERT_EQ( save_filesystem_ext(output_file, &fs), SUCCESS );
+    free_filesystem(&fs);
+    rewind(output_file);
+    ASSERT_EQ( load_filesystem_ext(output_file, &fs), SUCCESS );
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] );
+
+    // releasing every file gives back every dblock exactly once
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( inode_release_data(&fs, &fs.inodes[i + 1]), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 2047 );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
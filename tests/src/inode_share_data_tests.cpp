@@ -0,0 +1,150 @@
+#include "test_util.hpp"
+
+#include <random>
+#include <vector>
+
+using INodeShareDataSuite = fs_internal_test;
+
+TEST_F(INodeShareDataSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 3, 8);
+    EXPECT_EQ( inode_share_data(NULL, &fs.inodes[1], &fs.inodes[2]), INVALID_INPUT );
+    EXPECT_EQ( inode_share_data(&fs, NULL, &fs.inodes[2]), INVALID_INPUT );
+    EXPECT_EQ( inode_share_data(&fs, &fs.inodes[1], NULL), INVALID_INPUT );
+    EXPECT_EQ( inode_share_data(&fs, &fs.inodes[1], &fs.inodes[1]), INVALID_INPUT );
+
+    // the destination has to be empty
+    char data[10] = { 0 };
+    EXPECT_EQ( inode_write_data(&fs, &fs.inodes[1], data, std::size(data)), SUCCESS );
+    EXPECT_EQ( inode_share_data(&fs, &fs.inodes[1], &fs.inodes[2]), INVALID_INPUT );
+    free_filesystem(&fs);
+}
+
+// sharing claims no dblocks and a write to the clone leaves the source untouched
+TEST_F(INodeShareDataSuite, CopyOnWrite)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 128);
+    inode_t *source = &fs.inodes[1];
+    inode_t *clone = &fs.inodes[2];
+
+    std::vector<char> data(3000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = (char) ('a' + i % 26);
+    ASSERT_EQ( inode_write_data(&fs, source, data.data(), data.size()), SUCCESS );
+
+    size_t available = available_dblocks(&fs);
+    ASSERT_EQ( inode_share_data(&fs, clone, source), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( read_all(&fs, clone), data );
+
+    // the write lands in the second index dblock, so the path to it and the data block are copied
+    char patch[] = "PATCHED";
+    ASSERT_EQ( inode_modify_data(&fs, clone, 1500, patch, std::size(patch) - 1), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available - 3 );
+
+    std::vector<char> patched = data;
+    memcpy(patched.data() + 1500, patch, std::size(patch) - 1);
+    EXPECT_EQ( read_all(&fs, clone), patched );
+    EXPECT_EQ( read_all(&fs, source), data );
+
+    // once both are gone every dblock is available again
+    EXPECT_EQ( inode_release_data(&fs, source), SUCCESS );
+    EXPECT_EQ( read_all(&fs, clone), patched );
+    EXPECT_EQ( inode_release_data(&fs, clone), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 127 );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
+
+// a write that cannot copy the shared dblocks it touches leaves both files unchanged
+TEST_F(INodeShareDataSuite, InsufficientBlock)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 64);
+    inode_t *source = &fs.inodes[1];
+    inode_t *clone = &fs.inodes[2];
+    std::vector<char> data(3000, 'x');
+    ASSERT_EQ( inode_write_data(&fs, source, data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_share_data(&fs, clone, source), SUCCESS );
+
+    // use up all but two dblocks. the modify needs three
+    char filler[DATA_BLOCK_SIZE] = { 0 };
+    while (available_dblocks(&fs) > 2)
+        ASSERT_EQ( inode_write_data(&fs, &fs.inodes[3], filler, std::size(filler)), SUCCESS );
+    ASSERT_EQ( available_dblocks(&fs), (size_t) 2 );
+
+    char patch[] = "PATCHED";
+    EXPECT_EQ( inode_modify_data(&fs, clone, 1500, patch, std::size(patch) - 1), INSUFFICIENT_DBLOCKS );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 2 );
+    EXPECT_EQ( read_all(&fs, clone), data );
+    EXPECT_EQ( read_all(&fs, source), data );
+    free_filesystem(&fs);
+}
+
+// random appends, overwrites, shrinks and clones checked against plain copies of the data
+TEST_F(INodeShareDataSuite, RandomOperations)
+{
+    constexpr size_t file_count = 6;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 1, 2048);
+    std::vector<std::vector<char>> expected(file_count);
+    std::mt19937 rng{ 2024 };
+
+    for (int step = 0; step < 2000; ++step)
+    {
+        size_t f = rng() % file_count;
+        inode_t *inode = &fs.inodes[f + 1];
+        std::vector<char> &data = expected[f];
+        switch (rng() % 4)
+        {
+        case 0: {
+            std::vector<char> chunk(rng() % 400, (char) ('A' + step % 26));
+            if (inode_write_data(&fs, inode, chunk.data(), chunk.size()) == SUCCESS)
+                data.insert(data.end(), chunk.begin(), chunk.end());
+            break;
+        }
+        case 1: {
+            size_t offset = data.empty() ? 0 : rng() % data.size();
+            std::vector<char> chunk(rng() % 200, (char) ('a' + step % 26));
+            if (inode_modify_data(&fs, inode, offset, chunk.data(), chunk.size()) == SUCCESS)
+            {
+                if (offset + chunk.size() > data.size()) data.resize(offset + chunk.size());
+                std::copy(chunk.begin(), chunk.end(), data.begin() + offset);
+            }
+            break;
+        }
+        case 2: {
+            size_t new_size = data.empty() ? 0 : rng() % (data.size() + 1);
+            ASSERT_EQ( inode_shrink_data(&fs, inode, new_size), SUCCESS );
+            data.resize(new_size);
+            break;
+        }
+        case 3: {
+            size_t src = rng() % file_count;
+            if (src == f) break;
+            ASSERT_EQ( inode_release_data(&fs, inode), SUCCESS );
+            ASSERT_EQ( inode_share_data(&fs, inode, &fs.inodes[src + 1]), SUCCESS );
+            data = expected[src];
+            break;
+        }
+        }
+        for (size_t i = 0; i < file_count; ++i)
+            ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] ) << "file " << i << " at step " << step;
+    }
+
+    // the shared dblocks survive a save and load
+    ASSERT_EQ( save_filesystem_ext(output_file, &fs), SUCCESS );
+    free_filesystem(&fs);
+    rewind(output_file);
+    ASSERT_EQ( load_filesystem_ext(output_file, &fs), SUCCESS );
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] );
+
+    // releasing every file gives back every dblock exactly once
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( inode_release_data(&fs, &fs.inodes[i + 1]), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 2047 );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
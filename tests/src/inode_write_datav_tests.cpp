@@ -0,0 +1,98 @@
+#include "test_util.hpp"
+
+using INodeWriteDataVSuite = fs_internal_test;
+
+TEST_F(INodeWriteDataVSuite, InvalidInput)
+{
+    EXPECT_EQ( inode_write_datav(NULL, NULL, NULL, 0), INVALID_INPUT );
+
+    filesystem_t fs;
+    new_filesystem(&fs, 1, 1);
+    EXPECT_EQ( inode_write_datav(&fs, NULL, NULL, 0), INVALID_INPUT );
+    EXPECT_EQ( inode_write_datav(&fs, &fs.inodes[0], NULL, 1), INVALID_INPUT );
+
+    fs_iovec_t iov[] = { { NULL, 4 } };
+    EXPECT_EQ( inode_write_datav(&fs, &fs.inodes[0], iov, std::size(iov)), INVALID_INPUT );
+
+    free_filesystem(&fs);
+}
+
+// the whole vector must fit or nothing is written
+TEST_F(INodeWriteDataVSuite, InsufficientBlock0)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium_near_full_dblock.bin", fs);
+
+    inode_t *root = &fs.inodes[0];
+    char header[16] = { 0 };
+    char payload[128] = { 0 };
+    fs_iovec_t iov[] = { { header, std::size(header) }, { payload, std::size(payload) } };
+    EXPECT_EQ( inode_write_datav(&fs, root, iov, std::size(iov)), INSUFFICIENT_DBLOCKS );
+
+    check_fs(INPUT "medium_near_full_dblock.bin", fs);
+    free_filesystem(&fs);
+}
+
+// split the WriteIndirect1 buffer unevenly across several iovecs
+TEST_F(INodeWriteDataVSuite, WriteIndirect1)
+{
+    filesystem_t fs;
+    load_fs(INPUT "large.bin", fs);
+
+    inode_t *large_file = &fs.inodes[5];
+    char header[13], middle[500], tail[511];
+    memset(header, 0x20, std::size(header));
+    memset(middle, 0x20, std::size(middle));
+    memset(tail, 0x20, std::size(tail));
+    fs_iovec_t iov[] = {
+        { header, std::size(header) },
+        { NULL, 0 },
+        { middle, std::size(middle) },
+        { tail, std::size(tail) }
+    };
+    EXPECT_EQ( inode_write_datav(&fs, large_file, iov, std::size(iov)), SUCCESS );
+
+    check_fs(OUTPUT "WriteIndirect1.bin", fs);
+    free_filesystem(&fs);
+}
+
+TEST_F(INodeWriteDataVSuite, WriteDirectIndirect)
+{
+    filesystem_t fs;
+    load_fs(INPUT "large.bin", fs);
+
+    inode_t *sys_file = &fs.inodes[4];
+    char first[64], second[960];
+    memset(first, 0x20, std::size(first));
+    memset(second, 0x20, std::size(second));
+    fs_iovec_t iov[] = { { first, std::size(first) }, { second, std::size(second) } };
+    EXPECT_EQ( inode_write_datav(&fs, sys_file, iov, std::size(iov)), SUCCESS );
+
+    check_fs(OUTPUT "WriteDirectIndirect.bin", fs);
+    free_filesystem(&fs);
+}
+
+// reading back into several buffers returns the data in order
+TEST_F(INodeWriteDataVSuite, ReadBack)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium_text.bin", fs);
+
+    inode_t *inode = &fs.inodes[1];
+    char contiguous[300] = { 0 };
+    size_t contiguous_read;
+    ASSERT_EQ( inode_read_data(&fs, inode, 5, contiguous, std::size(contiguous), &contiguous_read), SUCCESS );
+
+    char a[7] = { 0 }, b[64] = { 0 }, c[229] = { 0 };
+    fs_iovec_t iov[] = { { a, std::size(a) }, { b, std::size(b) }, { c, std::size(c) } };
+    size_t vector_read;
+    ASSERT_EQ( inode_read_datav(&fs, inode, 5, iov, std::size(iov), &vector_read), SUCCESS );
+
+    ASSERT_EQ( vector_read, contiguous_read );
+    EXPECT_EQ( memcmp(a, contiguous, std::size(a)), 0 );
+    EXPECT_EQ( memcmp(b, contiguous + std::size(a), std::size(b)), 0 );
+    EXPECT_EQ( memcmp(c, contiguous + std::size(a) + std::size(b), std::size(c)), 0 );
+
+    check_fs(INPUT "medium_text.bin", fs);
+    free_filesystem(&fs);
+}
@@ -128,3 +128,32 @@ TEST_F(ListSuite, List1)
     check_fs(INPUT "medium.bin", fs);
     free_filesystem(&fs);
 }
+
+// a directory with an ordered index is listed in name order
+TEST_F(ListSuite, ListOrdered)
+{
+    constexpr int expected_ret = 0;
+
+    filesystem_t fs;
+    new_filesystem(&fs, 16, 64);
+    terminal_context_t ctx { &fs, &fs.inodes[0] };
+    ASSERT_EQ(new_directory(&ctx, PATH("d")), 0);
+    ASSERT_EQ(new_file(&ctx, PATH("d/zeta"), FS_READ), 0);
+    ASSERT_EQ(new_directory(&ctx, PATH("d/mid")), 0);
+    ASSERT_EQ(new_file(&ctx, PATH("d/alpha"), (permission_t) (FS_READ | FS_WRITE)), 0);
+    ASSERT_EQ(fs_index_directory(&ctx, PATH("d"), FS_INDEX_ORDERED), 0);
+    ASSERT_EQ(new_file(&ctx, PATH("d/beta"), FS_EXECUTE), 0);
+    ASSERT_EQ(remove_file(&ctx, PATH("d/zeta")), 0);
+    ASSERT_EQ(new_file(&ctx, PATH("d/Zeta"), FS_READ), 0);
+    int ret;
+
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        ret = list(&ctx, PATH("d"));
+    }   // end stdout logging
+
+    ASSERT_EQ(ret, expected_ret) << "Incorrect return value";
+
+    check_stdout(OUTPUT "ListOrdered.txt");
+    free_filesystem(&fs);
+}
@@ -187,4 +187,37 @@ TEST_F(NewFileSuite, NewFile1)
     check_stdout(OUTPUT "Empty.txt");
     check_fs(OUTPUT "NewFile1.bin", fs);
     free_filesystem(&fs);
-}
\ No newline at end of file
+}
+// new files go to the tombstones left by removed ones, whether the directory remembers
+// them or has to find them again, and are appended once there are none
+TEST_F(NewFileSuite, ReuseTombstones)
+{
+    constexpr size_t file_count = 40;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 8, 256);
+    terminal_context_t ctx { &fs, &fs.inodes[0] };
+    ASSERT_EQ(new_directory(&ctx, PATH("d")), 0);
+    inode_t *dir = &fs.inodes[1];
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ(new_file(&ctx, PATH("d/f" + std::to_string(i)), FS_READ), 0);
+    size_t full_size = dir->internal.file_size;
+
+    // more removes than the directory keeps hints for
+    for (size_t i = 1; i < file_count - 1; i += 3)
+        ASSERT_EQ(remove_file(&ctx, PATH("d/f" + std::to_string(i))), 0);
+    EXPECT_EQ(dir->internal.file_size, full_size);
+    for (size_t i = 1; i < file_count - 1; i += 3)
+        ASSERT_EQ(new_file(&ctx, PATH("d/g" + std::to_string(i)), FS_READ), 0);
+    EXPECT_EQ(dir->internal.file_size, full_size);
+
+    ASSERT_EQ(new_file(&ctx, PATH("d/last"), FS_READ), 0);
+    EXPECT_EQ(dir->internal.file_size, full_size + 16);
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        std::string name = (i % 3 == 1 && i < file_count - 1 ? "d/g" : "d/f") + std::to_string(i);
+        fs_file_t file = fs_open(&ctx, PATH(name));
+        ASSERT_NE(file, nullptr) << name;
+        fs_close(file);
+    }
+    free_filesystem(&fs);
+}
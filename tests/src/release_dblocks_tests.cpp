@@ -0,0 +1,53 @@
+#include "test_util.hpp"
+
+using ReleaseDBlocksSuite = fs_internal_test;
+
+TEST_F(ReleaseDBlocksSuite, InvalidInput)
+{
+    dblock_index_t indices[] = { 1 };
+    ASSERT_EQ(release_dblocks(NULL, indices, std::size(indices)), INVALID_INPUT);
+
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+    ASSERT_EQ(release_dblocks(&fs, NULL, 1), INVALID_INPUT);
+    ASSERT_EQ(release_dblocks(&fs, NULL, 0), SUCCESS);
+
+    // out of range releases nothing
+    dblock_index_t out_of_range[] = { 4, (dblock_index_t) fs.dblock_count };
+    ASSERT_EQ(release_dblocks(&fs, out_of_range, std::size(out_of_range)), INVALID_INPUT);
+    check_fs(INPUT "medium.bin", fs);
+    free_filesystem(&fs);
+}
+
+// same result as ComplexReleaseDBlock0 with one bulk call
+TEST_F(ReleaseDBlocksSuite, ComplexReleaseDBlock0)
+{
+    dblock_index_t dblocks_to_release[] = { 
+        27, 10, 23, 13, 30, 2
+    };
+
+    filesystem_t fs;
+    load_fs(INPUT "empty_random_inode_fragmented.bin", fs);
+
+    size_t available_before = available_dblocks(&fs);
+    ASSERT_EQ(release_dblocks(&fs, dblocks_to_release, std::size(dblocks_to_release)), SUCCESS);
+    ASSERT_EQ(available_dblocks(&fs), available_before + std::size(dblocks_to_release));
+
+    check_fs(OUTPUT "ComplexReleaseDBlock0.bin", fs);
+    free_filesystem(&fs);
+}
+
+// releasing the same or an already available dblock does not inflate the count
+TEST_F(ReleaseDBlocksSuite, AlreadyAvailable)
+{
+    filesystem_t fs;
+    load_fs(INPUT "medium.bin", fs);
+
+    dblock_index_t dblocks_to_release[] = { 4, 4 };
+    size_t available_before = available_dblocks(&fs);
+    ASSERT_EQ(release_dblocks(&fs, dblocks_to_release, std::size(dblocks_to_release)), SUCCESS);
+    ASSERT_EQ(available_dblocks(&fs), available_before + 1);
+
+    check_fs(OUTPUT "SimpleReleaseDBlock0.bin", fs);
+    free_filesystem(&fs);
+}
@@ -205,4 +205,41 @@ TEST_F(RemoveDirectorySuite, RemoveDir1)
     check_stdout(OUTPUT "Empty.txt");
     check_fs(OUTPUT "RemoveDir1.bin", fs);
     free_filesystem(&fs);
-}
\ No newline at end of file
+}
+// a path resolved before the directory on it is removed does not resolve to the removed
+// directory afterwards, even if its inode is reused
+TEST_F(RemoveDirectorySuite, RemoveCachedPath)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 32);
+    terminal_context_t ctx { &fs, &fs.inodes[0] };
+
+    ASSERT_EQ(new_directory(&ctx, PATH("a")), 0);
+    ASSERT_EQ(new_directory(&ctx, PATH("a/b")), 0);
+    ASSERT_EQ(change_directory(&ctx, PATH("a/b")), 0);
+    ASSERT_EQ(change_directory(&ctx, PATH("../..")), 0);
+    inode_t *b = &fs.inodes[2];
+
+    ASSERT_EQ(remove_directory(&ctx, PATH("a/b")), 0);
+    int ret;
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        ret = change_directory(&ctx, PATH("a/b"));
+    }   // end stdout logging
+    ASSERT_EQ(ret, -1);
+    check_stdout(OUTPUT "DirectoryNotFound.txt");
+
+    // the inode of b comes back as a file in the root
+    ASSERT_EQ(new_file(&ctx, PATH("c"), FS_READ), 0);
+    fs_file_t file = fs_open(&ctx, PATH("c"));
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(file->inode, b);
+    fs_close(file);
+    {   // begin stdout logging
+        stdout_logger_lock lk{ this };
+        file = fs_open(&ctx, PATH("a/b/.."));
+    }   // end stdout logging
+    EXPECT_EQ(file, nullptr);
+    EXPECT_GT(fs_ext(&fs)->dentries->hits, (size_t) 0);
+    free_filesystem(&fs);
+}
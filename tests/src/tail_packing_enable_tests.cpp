@@ -0,0 +1,257 @@
+#include "test_util.hpp"
+
+#include <random>
+#include <vector>
+
+using TailPackingSuite = fs_internal_test;
+
+static inode_t *claim_file(filesystem_t *fs)
+{
+    inode_index_t index;
+    EXPECT_EQ( claim_available_inode(fs, &index), SUCCESS );
+    inode_t *inode = &fs->inodes[index];
+    inode->internal.file_type = DATA_FILE;
+    inode->internal.file_perms = FS_READ;
+    inode->internal.file_size = 0;
+    return inode;
+}
+
+TEST_F(TailPackingSuite, InvalidInput)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 4, 8);
+    dblock_index_t dblock;
+    size_t offset;
+    EXPECT_EQ( tail_packing_enable(NULL), INVALID_INPUT );
+    EXPECT_EQ( tail_claim(&fs, 10, &dblock, &offset), INVALID_INPUT );
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    EXPECT_EQ( tail_claim(&fs, 0, &dblock, &offset), INVALID_INPUT );
+    EXPECT_EQ( tail_claim(&fs, DATA_BLOCK_SIZE, &dblock, &offset), INVALID_INPUT );
+    free_filesystem(&fs);
+}
+
+// the tails of small files share dblocks, and the files read back as written
+TEST_F(TailPackingSuite, SmallFiles)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 64);
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    size_t available = available_dblocks(&fs);
+    std::vector<inode_t *> files;
+    std::vector<std::vector<char>> expected;
+    for (int i = 0; i < 6; ++i)
+    {
+        files.push_back(claim_file(&fs));
+        expected.emplace_back(20, (char) ('a' + i));
+        ASSERT_EQ( inode_write_data(&fs, files.back(), expected.back().data(), 20), SUCCESS );
+        EXPECT_TRUE( inode_file_perms(files.back()) & INODE_TAIL_PACKED );
+        EXPECT_EQ( INODE_PERMISSIONS(inode_file_perms(files.back())), FS_READ );
+    }
+
+    // three 20 byte tails fit in a dblock
+    EXPECT_EQ( available_dblocks(&fs), available - 2 );
+    EXPECT_EQ( fs_ext(&fs)->tails->tails, (size_t) 6 );
+    EXPECT_EQ( fs_ext(&fs)->tails->dblocks, (size_t) 2 );
+    for (size_t i = 0; i < files.size(); ++i) EXPECT_EQ( read_all(&fs, files[i]), expected[i] );
+
+    char middle[5];
+    size_t bytes_read;
+    ASSERT_EQ( inode_read_data(&fs, files[4], 8, middle, std::size(middle), &bytes_read), SUCCESS );
+    EXPECT_EQ( bytes_read, std::size(middle) );
+    EXPECT_EQ( memcmp(middle, "eeeee", std::size(middle)), 0 );
+
+    for (inode_t *file : files) ASSERT_EQ( inode_release_data(&fs, file), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( fs_ext(&fs)->tails->tails, (size_t) 0 );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
+
+// appends, overwrites and shrinks move the tail out of its tail dblock and back
+TEST_F(TailPackingSuite, AppendModifyShrink)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 64);
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    size_t available = available_dblocks(&fs);
+    inode_t *neighbour = claim_file(&fs);
+    std::vector<char> other(30, 'n');
+    ASSERT_EQ( inode_write_data(&fs, neighbour, other.data(), other.size()), SUCCESS );
+    inode_t *file = claim_file(&fs);
+    std::vector<char> data(30, 'x');
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available - 1 );
+
+    // 130 bytes: two full blocks and a 2 byte tail next to the neighbour's
+    std::vector<char> more(100, 'y');
+    ASSERT_EQ( inode_write_data(&fs, file, more.data(), more.size()), SUCCESS );
+    data.insert(data.end(), more.begin(), more.end());
+    EXPECT_TRUE( inode_file_perms(file) & INODE_TAIL_PACKED );
+    EXPECT_EQ( available_dblocks(&fs), available - 3 );
+    EXPECT_EQ( read_all(&fs, file), data );
+
+    char patch[] = "patched";
+    ASSERT_EQ( inode_modify_data(&fs, file, 125, patch, std::size(patch) - 1), SUCCESS );
+    memcpy(data.data() + 125, patch, 5);
+    data.insert(data.end(), patch + 5, patch + std::size(patch) - 1);
+    EXPECT_EQ( read_all(&fs, file), data );
+    EXPECT_EQ( available_dblocks(&fs), available - 3 );
+
+    // shrinking inside the tail keeps it packed, past it packs the new last block
+    ASSERT_EQ( inode_shrink_data(&fs, file, 129), SUCCESS );
+    data.resize(129);
+    EXPECT_TRUE( inode_file_perms(file) & INODE_TAIL_PACKED );
+    EXPECT_EQ( read_all(&fs, file), data );
+    ASSERT_EQ( inode_shrink_data(&fs, file, 40), SUCCESS );
+    data.resize(40);
+    EXPECT_TRUE( inode_file_perms(file) & INODE_TAIL_PACKED );
+    EXPECT_EQ( available_dblocks(&fs), available - 2 );
+    EXPECT_EQ( read_all(&fs, file), data );
+    ASSERT_EQ( inode_shrink_data(&fs, file, 0), SUCCESS );
+    EXPECT_FALSE( inode_file_perms(file) & INODE_TAIL_PACKED );
+    EXPECT_EQ( read_all(&fs, neighbour), other );
+
+    ASSERT_EQ( inode_release_data(&fs, neighbour), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    free_filesystem(&fs);
+}
+
+// clones and snapshots get tails of their own, and the pool is rebuilt when an image is loaded
+TEST_F(TailPackingSuite, ShareAndReload)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 64);
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    size_t available = available_dblocks(&fs);
+    inode_t *file = claim_file(&fs);
+    std::vector<char> data(100, 'a');
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+
+    inode_t *clone = claim_file(&fs);
+    ASSERT_EQ( inode_share_data(&fs, clone, file), SUCCESS );
+    EXPECT_TRUE( inode_file_perms(clone) & INODE_TAIL_PACKED );
+    EXPECT_NE( clone->internal.direct_data[1], file->internal.direct_data[1] );
+    char patch = 'b';
+    ASSERT_EQ( inode_modify_data(&fs, clone, 90, &patch, 1), SUCCESS );
+    EXPECT_EQ( read_all(&fs, file), data );
+    data[90] = 'b';
+    EXPECT_EQ( read_all(&fs, clone), data );
+
+    ASSERT_EQ( fs_snapshot_create(&fs, "snap"), SUCCESS );
+    EXPECT_EQ( fs_ext(&fs)->tails->tails, (size_t) 4 );
+    ASSERT_EQ( save_filesystem_ext(output_file, &fs), SUCCESS );
+    free_filesystem(&fs);
+
+    rewind(output_file);
+    ASSERT_EQ( load_filesystem_ext(output_file, &fs), SUCCESS );
+    ASSERT_NE( fs_ext(&fs)->tails, nullptr );
+    EXPECT_EQ( fs_ext(&fs)->tails->tails, (size_t) 4 );
+    // 36 byte tails, one per tail dblock
+    EXPECT_EQ( fs_ext(&fs)->tails->dblocks, (size_t) 4 );
+    EXPECT_EQ( read_all(&fs, &fs.inodes[2]), data );
+
+    ASSERT_EQ( fs_snapshot_delete(&fs, "snap"), SUCCESS );
+    ASSERT_EQ( inode_release_data(&fs, &fs.inodes[1]), SUCCESS );
+    ASSERT_EQ( inode_release_data(&fs, &fs.inodes[2]), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), available );
+    EXPECT_EQ( shared_dblocks(&fs), (size_t) 0 );
+    free_filesystem(&fs);
+}
+
+// a tail dblock that lands on dblock 0 takes more tails like any other
+TEST_F(TailPackingSuite, ReuseDblockZero)
+{
+    filesystem_t fs;
+    new_filesystem(&fs, 8, 64);
+    inode_t *root = &fs.inodes[0];
+    std::vector<char> entries = read_all(&fs, root);
+    ASSERT_EQ( fs_snapshot_create(&fs, "before"), SUCCESS );
+    ASSERT_EQ( inode_modify_data(&fs, root, 0, entries.data(), entries.size()), SUCCESS );
+    ASSERT_EQ( fs_snapshot_delete(&fs, "before"), SUCCESS );
+
+    // the file is packed once dblock 0 is free again, so its tail dblock is claimed there
+    inode_t *holder = claim_file(&fs);
+    inode_t *file = claim_file(&fs);
+    std::vector<char> data(20, 'a');
+    ASSERT_EQ( inode_write_data(&fs, holder, data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    ASSERT_EQ( inode_release_data(&fs, holder), SUCCESS );
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    ASSERT_EQ( inode_write_data(&fs, file, data.data(), data.size()), SUCCESS );
+    ASSERT_TRUE( inode_file_perms(file) & INODE_TAIL_PACKED );
+    ASSERT_EQ( file->internal.direct_data[0], (dblock_index_t) 0 );
+
+    std::vector<char> other(20, 'b');
+    inode_t *next = claim_file(&fs);
+    ASSERT_EQ( inode_write_data(&fs, next, other.data(), other.size()), SUCCESS );
+    EXPECT_EQ( next->internal.direct_data[0], (dblock_index_t) 0 );
+    EXPECT_EQ( fs_ext(&fs)->tails->dblocks, (size_t) 1 );
+    data.insert(data.end(), data.begin(), data.end());
+    EXPECT_EQ( read_all(&fs, file), data );
+    EXPECT_EQ( read_all(&fs, next), other );
+    free_filesystem(&fs);
+}
+
+// random appends, overwrites, shrinks and clones of small files checked against plain
+// copies of the data
+TEST_F(TailPackingSuite, RandomOperations)
+{
+    constexpr size_t file_count = 8;
+    filesystem_t fs;
+    new_filesystem(&fs, file_count + 1, 256);
+    ASSERT_EQ( tail_packing_enable(&fs), SUCCESS );
+    std::vector<std::vector<char>> expected(file_count);
+    std::mt19937 rng{ 2034 };
+    for (size_t i = 0; i < file_count; ++i) claim_file(&fs);
+
+    for (int step = 0; step < 3000; ++step)
+    {
+        size_t f = rng() % file_count;
+        inode_t *inode = &fs.inodes[f + 1];
+        std::vector<char> &data = expected[f];
+        switch (rng() % 4)
+        {
+        case 0: {
+            std::vector<char> chunk(rng() % 80);
+            for (char &c : chunk) c = (char) rng();
+            if (data.size() + chunk.size() > 300) break;
+            if (inode_write_data(&fs, inode, chunk.data(), chunk.size()) == SUCCESS)
+                data.insert(data.end(), chunk.begin(), chunk.end());
+            break;
+        }
+        case 1: {
+            size_t offset = data.empty() ? 0 : rng() % data.size();
+            std::vector<char> chunk(rng() % 40, (char) rng());
+            if (inode_modify_data(&fs, inode, offset, chunk.data(), chunk.size()) == SUCCESS)
+            {
+                if (offset + chunk.size() > data.size()) data.resize(offset + chunk.size());
+                std::copy(chunk.begin(), chunk.end(), data.begin() + offset);
+            }
+            break;
+        }
+        case 2: {
+            size_t new_size = data.empty() ? 0 : rng() % (data.size() + 1);
+            ASSERT_EQ( inode_shrink_data(&fs, inode, new_size), SUCCESS );
+            data.resize(new_size);
+            break;
+        }
+        case 3: {
+            size_t src = rng() % file_count;
+            if (src == f) break;
+            ASSERT_EQ( inode_release_data(&fs, inode), SUCCESS );
+            if (inode_share_data(&fs, inode, &fs.inodes[src + 1]) == SUCCESS) data = expected[src];
+            else data.clear();
+            break;
+        }
+        }
+        for (size_t i = 0; i < file_count; ++i)
+            ASSERT_EQ( read_all(&fs, &fs.inodes[i + 1]), expected[i] ) << "file " << i << " at step " << step;
+    }
+
+    for (size_t i = 0; i < file_count; ++i)
+        ASSERT_EQ( inode_release_data(&fs, &fs.inodes[i + 1]), SUCCESS );
+    EXPECT_EQ( available_dblocks(&fs), (size_t) 255 );
+    EXPECT_EQ( fs_ext(&fs)->tails->tails, (size_t) 0 );
+    EXPECT_EQ( fs_ext(&fs)->tails->dblocks, (size_t) 0 );
+    free_filesystem(&fs);
+}
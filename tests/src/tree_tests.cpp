@@ -1,5 +1,7 @@
 #include "test_util.hpp"
 
+#include <string>
+
 using TreeSuite = fs_internal_test;
 
 TEST_F(TreeSuite, InvalidInput)
@@ -153,4 +155,41 @@ TEST_F(TreeSuite, Tree2)
     check_stdout(OUTPUT "Tree2.txt");
     check_fs(INPUT "medium.bin", fs);
     free_filesystem(&fs); 
-}
\ No newline at end of file
+}
+// the output of `tree` for a chain of directories thousands of levels deep, each holding
+// a file before the next directory, whatever the number of threads
+TEST_F(TreeSuite, DeepTree)
+{
+    constexpr size_t depth = 3000;
+    filesystem_t fs;
+    new_filesystem(&fs, 2 * depth + 8, 2 * depth + 64);
+    terminal_context_t ctx { &fs, &fs.inodes[0] };
+    std::string path = "d0";
+    std::string expected = "d0\n";
+    ASSERT_EQ( new_directory(&ctx, path.data()), 0 );
+    for (size_t i = 1; i < depth; ++i)
+    {
+        std::string file = path + "/f" + std::to_string(i - 1);
+        ASSERT_EQ( new_file(&ctx, file.data(), FS_READ), 0 ) << i;
+        path += "/d" + std::to_string(i);
+        ASSERT_EQ( new_directory(&ctx, path.data()), 0 ) << i;
+        std::string indent(3 * i, ' ');
+        expected += indent + "f" + std::to_string(i - 1) + "\n" + indent + "d" + std::to_string(i) + "\n";
+    }
+
+    for (size_t threads : { 1, 4 })
+    {
+        {   // begin stdout logging
+            stdout_logger_lock lk{ this };
+            ASSERT_EQ( fs_tree(&ctx, PATH("d0"), threads), 0 );
+        }   // end stdout logging
+        fseek(stdout_file, 0, SEEK_END);
+        std::string output(ftell(stdout_file), '\0');
+        fseek(stdout_file, 0, SEEK_SET);
+        ASSERT_EQ( fread(output.data(), 1, output.size(), stdout_file), output.size() );
+        EXPECT_TRUE( output == expected ) << threads;
+        ASSERT_EQ( ftruncate(fileno(stdout_file), 0), 0 );
+        rewind(stdout_file);
+    }
+    free_filesystem(&fs);
+}